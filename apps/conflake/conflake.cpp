@@ -2,18 +2,25 @@
 #include <fmt/format.h>
 
 #include <pol_codegen.h>
+#include <pol_incremental.h>
 #include <pol_llvm.h>
+#include <pom_cache.h>
 #include <pom_lexer.h>
 #include <pom_parser.h>
+#include <pom_partialeval.h>
 #include <pom_semantic.h>
 
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <thread>
 
 #include <argparse.hpp>
 
-void print(std::ostream& ost, const std::vector<pom::lexer::Token>& tokens) {
-    for (auto& tok : tokens) {
-        ost << tok << "\n";
+void print(std::ostream& ost, const pom::lexer::Tokens& tokens) {
+    for (auto& tok : tokens.m_tokens) {
+        ost << tokens.decode(tok) << "\n";
     }
 }
 
@@ -23,56 +30,288 @@ void print(std::ostream& ost, const pom::parser::TopLevel& top_level) {
     }
 }
 
-int main(int argc, char** argv) {
-    argparse::ArgumentParser app{"App description"};
+// Runs each top level unit through all phases before reading the next one. Units are not
+// partially evaluated, that needs the whole program.
+int stream(std::istream& ist,
+           const pom::parser::Options& options,
+           const pol::codegen::Options& cg_options) {
+    pom::lexer::Lexer lexer(ist);
+    pom::ast::AstArena arena;
+    pom::parser::Parser parser(lexer, arena, options);
+    pom::semantic::Analyzer analyzer;
+    pol::codegen::Session session(cg_options);
 
-    app.add_argument("-f", "--file");
+    while (true) {
+        auto unit = parser.next();
+        if (!unit) {
+            std::cout << "Parser error: " << unit.error().m_desc << std::endl;
+            return -1;
+        }
+        if (!*unit) {
+            break;
+        }
+        std::cout << "-- Parser --------" << std::endl;
+        pom::parser::print(std::cout, **unit);
+        if (options.m_hash_cons) {
+            std::cout << pom::parser::sharing(**unit) << std::endl;
+        }
 
-    try {
-        app.parse_args(argc, argv);
-    } catch (const std::runtime_error& err) {
-        std::cout << err.what() << std::endl;
-        std::cout << app;
-        return 1;
+        auto sematic_res = analyzer.analyze(**unit);
+        if (!sematic_res) {
+            std::cout << "Semantic error: " << sematic_res.error().m_desc << std::endl;
+            return -1;
+        }
+        std::cout << "-- Semantic ------" << std::endl;
+        pom::semantic::print(std::cout, *sematic_res) << std::endl;
+
+        std::cout << "-- Code Gen ------" << std::endl;
+        // A generic def adds nothing, its first users add its instances.
+        for (auto& sem_unit : *sematic_res) {
+            auto added = session.add(sem_unit);
+            if (!added) {
+                std::cout << "Error: " << added.error().m_desc << std::endl;
+                return -1;
+            }
+        }
+        std::cout << "------------------" << std::endl << std::endl;
+
+        // The unit is lowered, its nodes can go.
+        arena.reset();
     }
 
-    pol::initLlvm();
+    auto res = session.evaluate();
+    if (!res) {
+        std::cout << "Error: " << res.error().m_desc << std::endl;
+    } else {
+        std::cout << "====================" << std::endl;
+        std::cout << "Evaluated: " << *res << std::endl;
+        std::cout << "====================" << std::endl;
+    }
+    return 0;
+}
+
+void print(std::ostream& ost, const char* what, const std::vector<pom::Symbol>& names) {
+    ost << what << ":";
+    for (auto& name : names) {
+        ost << " " << name;
+    }
+    ost << std::endl;
+}
+
+// Compiles the file again each time it changes, redoing only the units that changed.
+int watch(const std::filesystem::path& path) {
+    pol::incremental::Compiler compiler;
+    std::filesystem::file_time_type modified;
+    while (true) {
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(path, ec);
+        if (ec || time == modified) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
+        }
+        modified = time;
 
-    auto path = std::filesystem::u8path(app.get<std::string>("--file"));
+        auto source = pom::Source::map(path);
+        if (!source) {
+            std::cout << "Lexer error: " << source.error().m_desc << std::endl;
+            continue;
+        }
+        auto report = compiler.update(*source);
+        if (!report) {
+            std::cout << report.error().m_desc << std::endl;
+            continue;
+        }
+        std::cout << "-- Update --------" << std::endl;
+        print(std::cout, "Reused", report->m_reused);
+        print(std::cout, "Analyzed", report->m_analyzed);
+        print(std::cout, "Compiled", report->m_compiled);
+        print(std::cout, "Removed", report->m_removed);
+        std::cout << "------------------" << std::endl;
 
-    //auto path = std::filesystem::u8path("/home/ignacio/workspace/conflake/examples/testX.txt");
+        auto res = compiler.evaluate();
+        if (!res) {
+            std::cout << "Error: " << res.error().m_desc << std::endl;
+        } else {
+            std::cout << "Evaluated: " << *res << std::endl << std::endl;
+        }
+    }
+}
 
-    auto tokens = pom::lexer::lex(path);
+// Runs the phases before code generation, printing each.
+tl::expected<pom::semantic::TopLevel, std::string> compile(
+    std::shared_ptr<const pom::Source> source,
+    pom::ast::AstArena& arena,
+    const pom::parser::Options& options) {
+    auto tokens = pom::lexer::lex(source);
     if (!tokens) {
-        std::cout << "Lexer error: " << tokens.error().m_desc << std::endl;
-        return -1;
+        return tl::make_unexpected("Lexer error: " + tokens.error().m_desc);
     }
 
     std::cout << "-- Lexer --------" << std::endl;
     print(std::cout, *tokens);
     std::cout << "-----------------" << std::endl << std::endl;
 
-    auto top_level = pom::parser::parse(*tokens);
+    auto top_level = pom::parser::parse(*tokens, arena, options);
     if (!top_level) {
-        std::cout << "Parser error: " << top_level.error().m_desc << std::endl;
-        return -1;
+        return tl::make_unexpected("Parser error: " + top_level.error().m_desc);
     }
     std::cout << "-- Parser --------" << std::endl;
     print(std::cout, *top_level);
+    if (options.m_hash_cons) {
+        std::cout << pom::parser::sharing(*top_level) << std::endl;
+    }
     std::cout << "------------------" << std::endl << std::endl;
 
     auto sematic_res = pom::semantic::analyze(*top_level);
     if (!sematic_res) {
-        std::cout << "Semantic error: " << sematic_res.error().m_desc << std::endl;
+        return tl::make_unexpected("Semantic error: " + sematic_res.error().m_desc);
+    }
+    return std::move(*sematic_res);
+}
+
+int main(int argc, char** argv) {
+    argparse::ArgumentParser app{"App description"};
+
+    app.add_argument("-f", "--file").help("file to compile, stdin if missing or -");
+    app.add_argument("--stream")
+        .help("compile one top level unit at a time")
+        .default_value(false)
+        .implicit_value(true);
+    app.add_argument("--hash-cons")
+        .help("share structurally equal subtrees in the parser")
+        .default_value(false)
+        .implicit_value(true);
+    app.add_argument("--watch")
+        .help("compile the file again whenever it changes, reusing the units that did not")
+        .default_value(false)
+        .implicit_value(true);
+    app.add_argument("--no-partial-eval")
+        .help("leave constant code to run time, as --stream and stdin always do")
+        .default_value(false)
+        .implicit_value(true);
+    app.add_argument("--fuel")
+        .help("rows the partial evaluator may run for one call with constant arguments")
+        .default_value(size_t(100000))
+        .scan<'u', size_t>();
+    app.add_argument("--memoize")
+        .help("keep the values of recursive pure functions of integers and booleans in tables")
+        .default_value(false)
+        .implicit_value(true);
+    app.add_argument("--memo-slots")
+        .help("entries of each memo table")
+        .default_value(uint32_t(4096))
+        .scan<'u', uint32_t>();
+    app.add_argument("--huge-pages")
+        .help("back the arena lists are allocated in with huge pages")
+        .default_value(false)
+        .implicit_value(true);
+    app.add_argument("--cache-dir")
+        .help("reuse the analyzed program cached in this directory, skipping lexing, parsing and "
+              "semantic analysis when the file is unchanged");
+
+    try {
+        app.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        std::cout << app;
+        return 1;
+    }
+
+    pol::initLlvm();
+
+    pom::parser::Options options;
+    options.m_hash_cons = app.get<bool>("--hash-cons");
+
+    pol::codegen::Options cg_options;
+    cg_options.m_print_ir   = true;
+    cg_options.m_memoize    = app.get<bool>("--memoize");
+    cg_options.m_memo_slots = app.get<uint32_t>("--memo-slots");
+    cg_options.m_huge_pages = app.get<bool>("--huge-pages");
+
+    // The cache holds a whole analyzed file, streamed units are analyzed as they come.
+    auto file = app.present<std::string>("--file");
+    auto cache_dir = app.present<std::string>("--cache-dir");
+    if (cache_dir && (!file || *file == "-" || app.get<bool>("--stream"))) {
+        std::cout << "--cache-dir needs a file and cannot be used with --stream" << std::endl;
+        return 1;
+    }
+    if (!file || *file == "-") {
+        return stream(std::cin, options, cg_options);
+    }
+
+    auto path = std::filesystem::u8path(*file);
+    if (app.get<bool>("--stream")) {
+        std::ifstream ist(path);
+        if (!ist) {
+            std::cout << "Could not open: " << *file << std::endl;
+            return -1;
+        }
+        return stream(ist, options, cg_options);
+    }
+    if (app.get<bool>("--watch")) {
+        return watch(path);
+    }
+
+    auto source = pom::Source::map(path);
+    if (!source) {
+        std::cout << "Lexer error: " << source.error().m_desc << std::endl;
         return -1;
     }
 
+    pom::ast::AstArena arena;
+    std::optional<pom::semantic::TopLevel> sematic_res;
+
+    std::filesystem::path cache_path;
+    if (cache_dir) {
+        cache_path = pom::cache::cachePath(std::filesystem::u8path(*cache_dir), **source);
+        auto cached = pom::cache::load(cache_path, **source, arena);
+        if (cached) {
+            std::cout << "-- Cache ---------" << std::endl;
+            std::cout << "Loaded " << cache_path.string() << std::endl;
+            std::cout << "------------------" << std::endl << std::endl;
+            sematic_res = std::move(*cached);
+        }
+    }
+
+    if (!sematic_res) {
+        auto compiled = compile(*source, arena, options);
+        if (!compiled) {
+            std::cout << compiled.error() << std::endl;
+            return -1;
+        }
+        sematic_res = std::move(*compiled);
+        if (cache_dir) {
+            auto saved = pom::cache::save(cache_path, **source, *sematic_res);
+            if (!saved) {
+                std::cout << "Cache error: " << saved.error().m_desc << std::endl;
+            }
+        }
+    }
+
     std::cout << "-- Semantic ------" << std::endl;
     pom::semantic::print(std::cout, *sematic_res);
     std::cout << "------------------" << std::endl << std::endl;
 
+    size_t scalarized_lists = 0;
+    if (!app.get<bool>("--no-partial-eval")) {
+        pom::partialeval::Options pe_options;
+        pe_options.m_fuel = app.get<size_t>("--fuel");
+        auto evaluated    = pom::partialeval::evaluate(*sematic_res, arena, pe_options);
+        std::cout << "-- Partial Eval --" << std::endl;
+        pom::semantic::print(std::cout, evaluated.m_top_level);
+        std::cout << fmt::format(
+                         "{0} rows folded, {1} calls evaluated, {2} specializations, {3} lists "
+                         "scalarized",
+                         evaluated.m_folded_rows, evaluated.m_evaluated_calls,
+                         evaluated.m_specializations, evaluated.m_scalarized_lists)
+                  << std::endl;
+        scalarized_lists = evaluated.m_scalarized_lists;
+        std::cout << "------------------" << std::endl << std::endl;
+        sematic_res = std::move(evaluated.m_top_level);
+    }
+
     std::cout << "-- Code Gen ------" << std::endl;
-    auto err = pol::codegen::codegen(*sematic_res, true);
+    auto err = pol::codegen::codegen(*sematic_res, cg_options);
     std::cout << "------------------" << std::endl << std::endl;
 
     if (!err) {
@@ -80,6 +319,13 @@ int main(int argc, char** argv) {
     } else {
         std::cout << "====================" << std::endl;
         std::cout << "Evaluated: " << *err << std::endl;
+        std::cout << fmt::format("Heap allocations removed: {0} ({1} scalarized, {2} on the stack)",
+                                 scalarized_lists + err->m_stack_lists, scalarized_lists,
+                                 err->m_stack_lists)
+                  << std::endl;
+        std::cout << fmt::format("Arena: {0} lists, {1} bytes", err->m_arena_lists,
+                                 err->m_arena_bytes)
+                  << std::endl;
         std::cout << "====================" << std::endl;
     }
     return 0;
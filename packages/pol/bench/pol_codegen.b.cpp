@@ -0,0 +1,112 @@
+#include <pol_codegen.h>
+#include <pol_llvm.h>
+#include <pom_lexer.h>
+#include <pom_parser.h>
+#include <pom_semantic.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/format.h>
+
+#include <string>
+
+namespace {
+
+/// Defs whose bodies are chains of arithmetic, comparisons, ifs and calls to the def before, so
+/// nearly every node is an operator or a call. Nothing runs, the calls would take forever.
+std::string operatorHeavyProgram(size_t defs, size_t terms)
+{
+    std::string text = "def f0(real a, real b) a * b\n";
+    for (size_t i = 1; i < defs; i++) {
+        text += fmt::format("def f{0}(real a, real b) a", i);
+        for (size_t t = 0; t < terms; t++) {
+            text += t % 2 ? fmt::format(" + f{0}(a * b, b - a) * a", i - 1)
+                          : " - if(or(a < b, and(b > 1.5, a > b)), a * b + b, a - b * 2.0)";
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+}  // namespace
+
+TEST_CASE("Compiling operator heavy programs", "[!benchmark][codegen]")
+{
+    using namespace pom;
+    pol::initLlvm();
+
+    auto tokens = lexer::lex(Source::fromString(operatorHeavyProgram(100, 200)));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          top_level = parser::parse(*tokens, arena);
+    REQUIRE(top_level);
+    auto analyzed = semantic::analyze(*top_level);
+    REQUIRE(analyzed);
+    REQUIRE(pol::codegen::codegen(*analyzed, false));
+
+    BENCHMARK("analyze 100 defs of 200 operator terms")
+    {
+        return semantic::analyze(*top_level)->size();
+    };
+
+    BENCHMARK("analyze and generate code for 100 defs of 200 operator terms")
+    {
+        auto analyzed = semantic::analyze(*top_level);
+        return pol::codegen::codegen(*analyzed, false).has_value();
+    };
+}
+
+TEST_CASE("Running self tail calls", "[!benchmark][codegen]")
+{
+    using namespace pom;
+    pol::initLlvm();
+
+    // A billion calls deep without the loop, far beyond any stack.
+    auto tokens = lexer::lex(Source::fromString(
+        "def count(integer n, integer acc) : integer if(n < 1i, acc, count(n - 1i, acc + 1i))\n"
+        "count(1000000000i, 0i)\n"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+
+    pol::codegen::Session session(false);
+    for (auto& unit : *analyzed) {
+        REQUIRE(session.add(unit));
+    }
+    REQUIRE(*session.evaluate() == pol::codegen::Result{int64_t(1000000000)});
+
+    BENCHMARK("count to 10^9 by self tail calls")
+    {
+        return session.evaluate().has_value();
+    };
+}
+
+TEST_CASE("Running list allocation", "[!benchmark][codegen]")
+{
+    using namespace pom;
+    pol::initLlvm();
+
+    // Ten million returned lists, each evaluation frees them at once.
+    auto tokens = lexer::lex(Source::fromString(
+        "def third(list<real> x) x[2]\n"
+        "def mk(real a) [a a + 1.0 a + 2.0 a + 3.0]\n"
+        "def sum(real a, integer n) : real if(n < 1i, a, sum(third(mk(a)) - 1.0, n - 1i))\n"
+        "sum(0.0, 10000000i)\n"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+
+    pol::codegen::Session session(false);
+    for (auto& unit : *analyzed) {
+        REQUIRE(session.add(unit));
+    }
+    REQUIRE(session.evaluate()->m_arena_lists == 10000000);
+
+    BENCHMARK("allocate 10^7 lists of 4 reals")
+    {
+        return session.evaluate().has_value();
+    };
+}
@@ -2,224 +2,145 @@
 #include <fmt/format.h>
 #include <pol_basicoperators.h>
 #include <pom_basictypes.h>
-#include <map>
-#include <sstream>
 
 namespace pol {
 
 namespace basicoperators {
 
-std::string make_key(const pom::ops::OpKey& op, std::vector<pom::TypeCSP> operands)
-{
-    std::ostringstream oss;
-    if (std::holds_alternative<char>(op)) {
-        oss << "op" << std::get<char>(op) << "__";
-    } else if (std::holds_alternative<std::string>(op)) {
-        oss << std::get<std::string>(op) << "__";
-    }
-    for (auto& operand : operands) {
-        oss << operand->mangled();
-    }
-    return oss.str();
-}
+namespace {
 
-class OpTable
+tl::expected<llvm::Value*, Err> buildIf(llvm::IRBuilderBase*               builder,
+                                        const std::vector<ValueGenerator>& vs)
 {
-   public:
-    OpTable();
-
-    tl::expected<llvm::Value*, Err> generate(llvm::IRBuilderBase*               builder,
-                                             const pom::ops::OpInfo&            op_info,
-                                             const std::vector<ValueGenerator>& operands) const;
-
-   private:
-    llvm::Value* plus_int(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateAdd(vs[0], vs[1], "addtmp");
-    }
-
-    llvm::Value* minus_int(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateSub(vs[0], vs[1], "subtmp");
-    }
-
-    llvm::Value* multiply_int(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateMul(vs[0], vs[1], "multmp");
-    }
-
-    llvm::Value* plus_real(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateFAdd(vs[0], vs[1], "addtmp");
-    }
-
-    llvm::Value* minus_real(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateFSub(vs[0], vs[1], "subtmp");
-    }
-
-    llvm::Value* multiply_real(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateFMul(vs[0], vs[1], "multmp");
-    }
-
-    llvm::Value* lt_real(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateFCmpULT(vs[0], vs[1], "lttmp");
-    }
-
-    llvm::Value* gt_real(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateFCmpUGT(vs[0], vs[1], "gttmp");
-    }
-
-    llvm::Value* lt_int(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateICmpULT(vs[0], vs[1], "lttmp");
-    }
-
-    llvm::Value* gt_int(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateICmpUGT(vs[0], vs[1], "gttmp");
-    }
-
-    llvm::Value* or_bool(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateOr(vs[0], vs[1], "ortmp");
-    }
-
-    llvm::Value* and_bool(llvm::IRBuilderBase* builder, const std::vector<llvm::Value*>& vs)
-    {
-        return builder->CreateAnd(vs[0], vs[1], "andtmp");
+    auto bv = vs[0](builder);
+    if (!bv) {
+        return bv;
     }
+    auto blocks = beginIf(builder, *bv);
 
-    tl::expected<llvm::Value*, Err> if_real(llvm::IRBuilderBase*               builder,
-                                            const std::vector<ValueGenerator>& vs)
-    {
-        return if_generic(builder, vs, llvm::Type::getDoubleTy(builder->getContext()));
+    auto lv = vs[1](builder);
+    if (!lv) {
+        return lv;
     }
+    beginElse(builder, blocks, *lv);
 
-    tl::expected<llvm::Value*, Err> if_int(llvm::IRBuilderBase*               builder,
-                                           const std::vector<ValueGenerator>& vs)
-    {
-        return if_generic(builder, vs, llvm::Type::getInt64Ty(builder->getContext()));
+    auto rv = vs[2](builder);
+    if (!rv) {
+        return rv;
     }
+    return endIf(builder, blocks, *rv);
+}
 
-    tl::expected<llvm::Value*, Err> if_generic(llvm::IRBuilderBase*               builder,
-                                               const std::vector<ValueGenerator>& vs,
-                                               llvm::Type*                        ty)
-    {
-        auto& ctx = builder->getContext();
-        auto  bv  = vs[0](builder);
-        if (!bv) {
-            return bv;
-        }
-        auto cmp = builder->CreateICmpEQ(*bv, llvm::ConstantInt::getTrue(ctx));
-        auto fn  = builder->GetInsertBlock()->getParent();
-
-        llvm::BasicBlock* then_bb  = llvm::BasicBlock::Create(ctx, "then", fn);
-        llvm::BasicBlock* else_bb  = llvm::BasicBlock::Create(ctx, "else");
-        llvm::BasicBlock* merge_bb = llvm::BasicBlock::Create(ctx, "ifcont");
-        builder->CreateCondBr(cmp, then_bb, else_bb);
-
-        builder->SetInsertPoint(then_bb);
-
-        auto lv = vs[1](builder);
-        if (!lv) {
-            return lv;
-        }
-
-        builder->CreateBr(merge_bb);
-
-        then_bb = builder->GetInsertBlock();
-
-        fn->getBasicBlockList().push_back(else_bb);
-        builder->SetInsertPoint(else_bb);
+/// Operators taking the values of their operands.
+llvm::Value* buildValueOp(llvm::IRBuilderBase*             builder,
+                          pom::ops::BuiltinOp              op,
+                          const std::vector<llvm::Value*>& vs)
+{
+    using Op = pom::ops::BuiltinOp;
+    switch (op) {
+        case Op::k_add_real:
+            return builder->CreateFAdd(vs[0], vs[1], "addtmp");
+        case Op::k_add_integer:
+            return builder->CreateAdd(vs[0], vs[1], "addtmp");
+        case Op::k_sub_real:
+            return builder->CreateFSub(vs[0], vs[1], "subtmp");
+        case Op::k_sub_integer:
+            return builder->CreateSub(vs[0], vs[1], "subtmp");
+        case Op::k_mul_real:
+            return builder->CreateFMul(vs[0], vs[1], "multmp");
+        case Op::k_mul_integer:
+            return builder->CreateMul(vs[0], vs[1], "multmp");
+        case Op::k_lt_integer:
+            return builder->CreateICmpULT(vs[0], vs[1], "lttmp");
+        case Op::k_gt_integer:
+            return builder->CreateICmpUGT(vs[0], vs[1], "gttmp");
+        case Op::k_lt_real:
+            return builder->CreateFCmpULT(vs[0], vs[1], "lttmp");
+        case Op::k_gt_real:
+            return builder->CreateFCmpUGT(vs[0], vs[1], "gttmp");
+        case Op::k_or:
+            return builder->CreateOr(vs[0], vs[1], "ortmp");
+        case Op::k_and:
+            return builder->CreateAnd(vs[0], vs[1], "andtmp");
+        case Op::k_none:
+        case Op::k_if_real:
+        case Op::k_if_integer:
+            break;
+    }
+    return nullptr;
+}
 
-        auto rv = vs[2](builder);
-        if (!rv) {
-            return rv;
-        }
+}  // namespace
 
-        builder->CreateBr(merge_bb);
-        else_bb = builder->GetInsertBlock();
+IfBlocks beginIf(llvm::IRBuilderBase* builder, llvm::Value* cond)
+{
+    auto& ctx = builder->getContext();
+    auto  cmp = builder->CreateICmpEQ(cond, llvm::ConstantInt::getTrue(ctx));
+    auto  fn  = builder->GetInsertBlock()->getParent();
+
+    IfBlocks blocks;
+    blocks.m_then  = llvm::BasicBlock::Create(ctx, "then", fn);
+    blocks.m_else  = llvm::BasicBlock::Create(ctx, "else");
+    blocks.m_merge = llvm::BasicBlock::Create(ctx, "ifcont");
+    builder->CreateCondBr(cmp, blocks.m_then, blocks.m_else);
+
+    builder->SetInsertPoint(blocks.m_then);
+    return blocks;
+}
 
-        fn->getBasicBlockList().push_back(merge_bb);
-        builder->SetInsertPoint(merge_bb);
-        llvm::PHINode* phi = builder->CreatePHI(ty, 2, "iftmp");
+void beginElse(llvm::IRBuilderBase* builder, IfBlocks& blocks, llvm::Value* then_value)
+{
+    builder->CreateBr(blocks.m_merge);
+    blocks.m_then_value = then_value;
+    blocks.m_then_end   = builder->GetInsertBlock();
 
-        phi->addIncoming(*lv, then_bb);
-        phi->addIncoming(*rv, else_bb);
-        return phi;
-    }
+    auto fn = blocks.m_then_end->getParent();
+    fn->getBasicBlockList().push_back(blocks.m_else);
+    builder->SetInsertPoint(blocks.m_else);
+}
 
-    using BinaryOpBuilder =
-        std::function<llvm::Value*(llvm::IRBuilderBase*, const std::vector<llvm::Value*>&)>;
-    using AdvBinaryOpBuilder = std::function<tl::expected<llvm::Value*, Err>(
-        llvm::IRBuilderBase*, const std::vector<ValueGenerator>&)>;
+llvm::Value* endIf(llvm::IRBuilderBase* builder, const IfBlocks& blocks, llvm::Value* else_value)
+{
+    builder->CreateBr(blocks.m_merge);
+    auto else_end = builder->GetInsertBlock();
 
-    std::map<std::string, BinaryOpBuilder>    m_ops;
-    std::map<std::string, AdvBinaryOpBuilder> m_adv_ops;
-};
+    auto fn = else_end->getParent();
+    fn->getBasicBlockList().push_back(blocks.m_merge);
+    builder->SetInsertPoint(blocks.m_merge);
+    llvm::PHINode* phi = builder->CreatePHI(blocks.m_then_value->getType(), 2, "iftmp");
 
-OpTable::OpTable()
-{
-    auto real    = pom::types::real();
-    auto boolean = pom::types::boolean();
-    auto integer = pom::types::integer();
-
-    using namespace std::placeholders;
-    m_ops[make_key('+', {real, real})] = std::bind(&OpTable::plus_real, this, _1, _2);
-    m_ops[make_key('-', {real, real})] = std::bind(&OpTable::minus_real, this, _1, _2);
-    m_ops[make_key('*', {real, real})] = std::bind(&OpTable::multiply_real, this, _1, _2);
-    m_ops[make_key('<', {real, real})] = std::bind(&OpTable::lt_real, this, _1, _2);
-    m_ops[make_key('>', {real, real})] = std::bind(&OpTable::gt_real, this, _1, _2);
-
-    m_ops[make_key('+', {integer, integer})] = std::bind(&OpTable::plus_int, this, _1, _2);
-    m_ops[make_key('-', {integer, integer})] = std::bind(&OpTable::minus_int, this, _1, _2);
-    m_ops[make_key('*', {integer, integer})] = std::bind(&OpTable::multiply_int, this, _1, _2);
-    m_ops[make_key('+', {integer, integer})] = std::bind(&OpTable::plus_int, this, _1, _2);
-    m_ops[make_key('-', {integer, integer})] = std::bind(&OpTable::minus_int, this, _1, _2);
-    m_ops[make_key('<', {integer, integer})] = std::bind(&OpTable::lt_int, this, _1, _2);
-    m_ops[make_key('>', {integer, integer})] = std::bind(&OpTable::gt_int, this, _1, _2);
-
-    m_ops[make_key("or", {boolean, boolean})]  = std::bind(&OpTable::or_bool, this, _1, _2);
-    m_ops[make_key("and", {boolean, boolean})] = std::bind(&OpTable::and_bool, this, _1, _2);
-
-    m_adv_ops[make_key("if", {boolean, real, real})] = std::bind(&OpTable::if_real, this, _1, _2);
-    m_adv_ops[make_key("if", {boolean, integer, integer})] =
-        std::bind(&OpTable::if_int, this, _1, _2);
+    phi->addIncoming(blocks.m_then_value, blocks.m_then_end);
+    phi->addIncoming(else_value, else_end);
+    return phi;
 }
 
-tl::expected<llvm::Value*, Err> OpTable::generate(llvm::IRBuilderBase*               builder,
-                                                  const pom::ops::OpInfo&            op_info,
-                                                  const std::vector<ValueGenerator>& operands) const
+tl::expected<llvm::Value*, Err> buildBinOp(llvm::IRBuilderBase*               builder,
+                                           pom::ops::BuiltinOp                op,
+                                           const std::vector<ValueGenerator>& operands)
 {
-    auto key = make_key(op_info.m_op, op_info.m_args);
-    auto fo  = m_ops.find(key);
-    if (fo == m_ops.end()) {
-        // try advanced
-        auto fo_adv = m_adv_ops.find(key);
-        if (fo_adv == m_adv_ops.end()) {
-            return tl::make_unexpected(Err{fmt::format("invalid binary operator {0}", key)});
-        }
-        return fo_adv->second(builder, operands);
+    using Op = pom::ops::BuiltinOp;
+    switch (op) {
+        case Op::k_if_real:
+        case Op::k_if_integer:
+            return buildIf(builder, operands);
+        default:
+            break;
     }
 
     auto values = execute(operands, builder);
     if (!values) {
         return tl::make_unexpected(values.error());
     }
-
-    return fo->second(builder, *values);
+    auto value = buildValueOp(builder, op, *values);
+    if (!value) {
+        return tl::make_unexpected(Err{fmt::format("invalid binary operator {0}", int(op))});
+    }
+    return value;
 }
 
-tl::expected<llvm::Value*, Err> buildBinOp(llvm::IRBuilderBase*               builder,
-                                           const pom::ops::OpInfo&            op_info,
-                                           const std::vector<ValueGenerator>& operands)
+bool generatesOperands(pom::ops::BuiltinOp op)
 {
-    static const OpTable ops;
-    return ops.generate(builder, op_info, operands);
+    return op == pom::ops::BuiltinOp::k_if_real || op == pom::ops::BuiltinOp::k_if_integer;
 }
 
 tl::expected<std::vector<llvm::Value*>, Err> execute(const std::vector<ValueGenerator>& operands,
@@ -22,9 +22,35 @@ struct Err
 using ValueGenerator = std::function<tl::expected<llvm::Value*, Err>(llvm::IRBuilderBase*)>;
 
 tl::expected<llvm::Value*, Err> buildBinOp(llvm::IRBuilderBase*               builder,
-                                           const pom::ops::OpInfo&            op_info,
+                                           pom::ops::BuiltinOp                op,
                                            const std::vector<ValueGenerator>& operands);
 
+/// Blocks of an if lowered a step at a time, by callers generating the arms themselves.
+struct IfBlocks
+{
+    llvm::BasicBlock* m_then;
+    llvm::BasicBlock* m_else;
+    llvm::BasicBlock* m_merge;
+
+    /// Value of the then arm, from the block it ended in, null until the arm is closed.
+    llvm::Value*      m_then_value = nullptr;
+    llvm::BasicBlock* m_then_end   = nullptr;
+};
+
+/// Branches on cond, leaving the builder in the then block.
+IfBlocks beginIf(llvm::IRBuilderBase* builder, llvm::Value* cond);
+
+/// Closes the then arm with its value, leaving the builder in the else block.
+void beginElse(llvm::IRBuilderBase* builder, IfBlocks& blocks, llvm::Value* then_value);
+
+/// Closes the else arm with its value, leaving the builder in the merge block. Returns the value
+/// of the if.
+llvm::Value* endIf(llvm::IRBuilderBase* builder, const IfBlocks& blocks, llvm::Value* else_value);
+
+/// True if the operator calls the generators of its operands itself, in blocks it creates, like
+/// the arms of an if. Other operators only need the values.
+bool generatesOperands(pom::ops::BuiltinOp op);
+
 tl::expected<std::vector<llvm::Value*>, Err> execute(const std::vector<ValueGenerator>& operands,
                                                      llvm::IRBuilderBase*               builder);
 
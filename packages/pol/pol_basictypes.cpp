@@ -1,5 +1,8 @@
 
 #include <pol_basictypes.h>
+#include <pom_basictypes.h>
+#include <pom_functiontype.h>
+#include <pom_listtype.h>
 
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/LLVMContext.h"
@@ -10,11 +13,6 @@ namespace pol {
 
 namespace basictypes {
 
-inline bool starts_with(std::string_view s, std::string_view prefix)
-{
-    return std::equal(prefix.begin(), prefix.end(), s.begin());
-}
-
 inline tl::expected<std::vector<llvm::Type*>, Err> convertTemplateArgs(llvm::LLVMContext* context,
                                                                        const pom::Type&   type)
 {
@@ -32,19 +30,19 @@ inline tl::expected<std::vector<llvm::Type*>, Err> convertTemplateArgs(llvm::LLV
 
 tl::expected<llvm::Type*, Err> getType(llvm::LLVMContext* context, const pom::Type& type)
 {
-    if (type.mangled() == "real") {
+    if (type == *pom::types::real()) {
         return llvm::Type::getDoubleTy(*context);
-    } else if (type.mangled() == "integer") {
+    } else if (type == *pom::types::integer()) {
         return llvm::Type::getInt64Ty(*context);
-    } else if (type.mangled() == "boolean") {
+    } else if (type == *pom::types::boolean()) {
         return llvm::Type::getInt1Ty(*context);
-    } else if (starts_with(type.mangled(), "__list_")) {
+    } else if (dynamic_cast<const pom::types::List*>(&type)) {
         auto llvm_templ_args = convertTemplateArgs(context, type);
         if (!llvm_templ_args) {
             return tl::make_unexpected(llvm_templ_args.error());
         }
         return llvm::PointerType::get((*llvm_templ_args)[0], 0);
-    } else if (starts_with(type.mangled(), "__function__")) {
+    } else if (dynamic_cast<const pom::types::Function*>(&type)) {
         auto function_type = getFunctionType(context, type);
         if (!function_type) {
             return tl::make_unexpected(function_type.error());
@@ -7,10 +7,17 @@
 #include <pol_basictypes.h>
 #include <pol_jit.h>
 #include <pol_llvm.h>
+#include <pol_runtime.h>
 #include <pom_basictypes.h>
+#include <pom_effects.h>
+#include <pom_escape.h>
 #include <pom_listtype.h>
 #include <pom_ops.h>
+#include <pom_partialeval.h>
+#include <algorithm>
 #include <iostream>
+#include <optional>
+#include <unordered_map>
 
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
@@ -25,6 +32,8 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_os_ostream.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
@@ -35,19 +44,35 @@ namespace pol {
 
 namespace codegen {
 
+/// Lowers one top level unit at a time, each into its own module. Functions of earlier units are
+/// declared in the current module as they get referenced.
+/// Memo tables only hold values stored in the current evaluation, the one numbered here.
+constexpr const char* k_memo_epoch = "conflake.memo.epoch";
+
 struct Program
 {
-    Program()
+    Program() : m_context(std::make_unique<llvm::LLVMContext>())
     {
-        // Open a new context and module.
-        auto a_context       = std::make_unique<llvm::LLVMContext>();
-        auto a_module        = std::make_unique<llvm::Module>("my cool jit", *a_context);
-        m_thread_safe_module = std::make_unique<llvm::orc::ThreadSafeModule>(std::move(a_module),
-                                                                             std::move(a_context));
-
-        // Create a new builder for the module.
+        // Create a new builder for the modules.
         m_builder = std::make_unique<llvm::IRBuilder<>>(context());
 
+        m_jit = Jit::Create();
+        assert(m_jit);
+
+        auto defined = m_jit->defineAbsolute(k_memo_epoch, &m_memo_epoch);
+        assert(defined);
+        defined = m_jit->defineAbsolute(runtime::k_allocate,
+                                        reinterpret_cast<const void*>(&runtime::allocate));
+        assert(defined);
+        (void)defined;
+    }
+
+    void newModule()
+    {
+        m_module = std::make_unique<llvm::Module>("my cool jit", context());
+        m_module->setDataLayout(m_jit->getDataLayout());
+        m_functions.clear();
+
         m_fpm = std::make_unique<llvm::legacy::FunctionPassManager>(get_module());
         // Do simple "peephole" optimizations and bit-twiddling optzns.
         m_fpm->add(llvm::createInstructionCombiningPass());
@@ -58,21 +83,53 @@ struct Program
         // Simplify the control flow graph (deleting unreachable blocks, etc).
         m_fpm->add(llvm::createCFGSimplificationPass());
         m_fpm->doInitialization();
+    }
 
-        m_jit = Jit::Create();
-        assert(m_jit);
-        get_module()->setDataLayout(m_jit->getDataLayout());
+    llvm::Module* get_module() { return m_module.get(); }
+
+    llvm::Function* function(pom::Symbol name);
+
+    /// Name the current definition of name has in the JIT.
+    std::string symbol(pom::Symbol name) const
+    {
+        auto fo = m_versions.find(name);
+        if (fo == m_versions.end() || fo->second <= 1) {
+            return std::string(name.str());
+        }
+        return fmt::format("{0}#{1}", name, fo->second);
     }
 
-    llvm::Module* get_module() { return m_thread_safe_module->getModuleUnlocked(); }
+    llvm::LLVMContext& context() { return *m_context.getContext(); }
+
+    llvm::orc::ThreadSafeContext                              m_context;
+    std::unique_ptr<llvm::Module>                             m_module;
+    std::unique_ptr<llvm::IRBuilder<>>                        m_builder;
+    std::unordered_map<pom::Symbol, llvm::Value*>             m_named_values;
+    std::unordered_map<pom::Symbol, llvm::Function*>          m_functions;
+    std::unordered_map<pom::Symbol, pom::semantic::Signature> m_prototypes;
+    std::unique_ptr<llvm::legacy::FunctionPassManager>        m_fpm;
+    std::unique_ptr<Jit>                                      m_jit;
+
+    /// Effects of the units added, they give the attributes of the functions and their
+    /// declarations.
+    pom::effects::Analyzer m_effects;
+
+    /// What the units added do with the lists they are given, for the lists of their callers.
+    pom::escape::Analyzer m_escapes;
 
-    llvm::LLVMContext& context() { return get_module()->getContext(); }
+    /// Lists allocated in the frame of their function rather than on the heap.
+    size_t m_stack_lists = 0;
 
-    std::unique_ptr<llvm::orc::ThreadSafeModule>       m_thread_safe_module;
-    std::unique_ptr<llvm::IRBuilder<>>                 m_builder;
-    std::map<std::string, llvm::Value*>                m_named_values;
-    std::unique_ptr<llvm::legacy::FunctionPassManager> m_fpm;
-    std::unique_ptr<Jit>                               m_jit;
+    /// Number of the current evaluation, slots of memo tables start in evaluation 0.
+    uint64_t m_memo_epoch = 1;
+
+    /// Holds the module of each function. The one of the anonymous expression is replaced by the
+    /// next one.
+    std::unordered_map<pom::Symbol, llvm::orc::ResourceTrackerSP> m_trackers;
+
+    /// Definitions of each function so far. A redefinition is added under a name of its own, the
+    /// callers compiled before keep calling the definition they saw.
+    std::unordered_map<pom::Symbol, uint32_t> m_versions;
 };
 
 template <class E>
@@ -86,10 +143,6 @@ struct DecValue
     llvm::Value* m_value;
 };
 
-tl::expected<DecValue, Err> codegen(Program&                      program,
-                                    const pom::semantic::Context& context,
-                                    const pom::ast::Expr&         v);
-
 tl::expected<DecValue, Err> literalValue(Program& program, const pom::literals::Boolean& v)
 {
     return DecValue{(v.m_val ? llvm::ConstantInt::getTrue(program.context())
@@ -106,83 +159,254 @@ tl::expected<DecValue, Err> literalValue(Program& program, const pom::literals::
     return DecValue{llvm::ConstantInt::get(program.context(), llvm::APInt(64, v.m_val, true))};
 }
 
-tl::expected<DecValue, Err> codegen(Program& program,
-                                    const pom::semantic::Context&,
-                                    const pom::ast::Literal& v,
-                                    pom::ast::ExprId)
+/// Lowers the rows of a function in one forward scan, children come before their parents so
+/// their values are there when a row is reached. Operands an operator generates itself, like the
+/// arms of an if, are regions of rows the scan skips and goes back to when it reaches the
+/// operator.
+class RowEmitter
 {
-    return std::visit([&](auto& e) { return literalValue(program, e); }, v);
+   public:
+    RowEmitter(Program& program, const pom::semantic::Function& function)
+        : m_program(program),
+          m_function(function),
+          m_flat(function.m_flat),
+          m_values(m_flat.size()),
+          m_builtins(function.m_builtins),
+          m_subtree_begin(m_flat.size()),
+          m_region_end(m_flat.size()),
+          m_local_lists(program.m_escapes.localLists(function))
+    {
+    }
+
+    /// Marks the regions of the operands builtin operators generate.
+    tl::expected<void, Err> prepare();
+
+    /// When function calls itself in tail position, puts its body in a loop whose header takes
+    /// the arguments, the tail calls jump back to it.
+    void loopSelfTailCalls(llvm::Function* function);
+
+    /// Lowers rows [first, last], returns the value of the last.
+    tl::expected<DecValue, Err> emitRange(uint32_t first, uint32_t last);
+
+   private:
+    /// An if whose arms are being lowered, after which the scan resumes past its row in the range
+    /// [m_first, m_last] it is in.
+    struct PendingIf
+    {
+        uint32_t                 m_row;
+        uint32_t                 m_first;
+        uint32_t                 m_last;
+        basicoperators::IfBlocks m_blocks;
+    };
+
+    tl::expected<DecValue, Err> emitRow(uint32_t row);
+
+    tl::expected<DecValue, Err> emitVar(uint32_t row);
+
+    tl::expected<DecValue, Err> emitList(uint32_t row);
+
+    tl::expected<DecValue, Err> emitBuiltin(uint32_t row);
+
+    tl::expected<DecValue, Err> emitCall(uint32_t row);
+
+    tl::expected<DecValue, Err> emitSelfTailCall(uint32_t row);
+
+    Program&                                m_program;
+    const pom::semantic::Function&          m_function;
+    const pom::ast::FlatExprs&              m_flat;
+    std::vector<llvm::Value*>               m_values;
+    const std::vector<pom::ops::BuiltinOp>& m_builtins;
+
+    /// First row of the subtree of a row.
+    std::vector<uint32_t> m_subtree_begin;
+
+    /// Last row of the region starting at a row, 0 where none starts.
+    std::vector<uint32_t> m_region_end;
+
+    /// List rows whose lists die with the frame.
+    std::vector<bool> m_local_lists;
+
+    /// Rows jumping back to m_loop with new values of m_loop_args.
+    std::vector<bool>           m_self_tail_calls;
+    llvm::BasicBlock*           m_loop = nullptr;
+    std::vector<llvm::PHINode*> m_loop_args;
+};
+
+tl::expected<void, Err> RowEmitter::prepare()
+{
+    using Kind = pom::ast::ExprKind;
+    for (uint32_t row = 0; row < m_flat.size(); row++) {
+        auto children = m_flat.children(row);
+
+        m_subtree_begin[row] = row;
+        for (auto child : children) {
+            m_subtree_begin[row] = std::min(m_subtree_begin[row], m_subtree_begin[child]);
+        }
+
+        auto builtin = m_builtins[row];
+        if (builtin == pom::ops::BuiltinOp::k_none) {
+            if (m_flat.m_kinds[row] == Kind::k_binary) {
+                return tl::make_unexpected(pom_should_have_caught(Err{"unresolved operator"}));
+            }
+            continue;
+        }
+        // The first operand always runs first, in the current block, so it stays in the scan.
+        // The parser keeps the rows of the other arguments of a call to themselves, so each is
+        // the run of rows of its subtree.
+        if (basicoperators::generatesOperands(builtin)) {
+            for (size_t i = 1; i < children.size(); i++) {
+                m_region_end[m_subtree_begin[children[i]]] = children[i];
+            }
+        }
+    }
+    return {};
+}
+
+void RowEmitter::loopSelfTailCalls(llvm::Function* function)
+{
+    m_self_tail_calls = m_function.selfTailCalls();
+    if (std::find(m_self_tail_calls.begin(), m_self_tail_calls.end(), true) ==
+        m_self_tail_calls.end()) {
+        return;
+    }
+
+    auto& builder = *m_program.m_builder;
+    auto  entry   = builder.GetInsertBlock();
+    m_loop        = llvm::BasicBlock::Create(m_program.context(), "tailrecurse", function);
+    builder.CreateBr(m_loop);
+    builder.SetInsertPoint(m_loop);
+
+    unsigned idx = 0;
+    for (auto& arg : function->args()) {
+        auto phi = builder.CreatePHI(arg.getType(), 2, arg.getName() + ".tr");
+        phi->addIncoming(&arg, entry);
+        m_loop_args.push_back(phi);
+        m_program.m_named_values[m_function.m_sig.m_args[idx++].second] = phi;
+    }
+}
+
+tl::expected<DecValue, Err> RowEmitter::emitRange(uint32_t first, uint32_t last)
+{
+    // The arms of an if are scanned in place of its row rather than lowered by a recursive call,
+    // so nesting costs a pending if each and no stack.
+    auto&                  builder = *m_program.m_builder;
+    std::vector<PendingIf> pending;
+    uint32_t               row = first;
+    while (1) {
+        if (row > last) {
+            if (pending.empty()) {
+                return DecValue{m_values[last]};
+            }
+            auto& top  = pending.back();
+            auto  arms = m_flat.children(top.m_row);
+            if (!top.m_blocks.m_then_value) {
+                basicoperators::beginElse(&builder, top.m_blocks, m_values[last]);
+                last  = arms[2];
+                first = row = m_subtree_begin[last];
+                continue;
+            }
+            m_values[top.m_row] = basicoperators::endIf(&builder, top.m_blocks, m_values[last]);
+            row                 = top.m_row + 1;
+            first               = top.m_first;
+            last                = top.m_last;
+            pending.pop_back();
+            continue;
+        }
+        if (row != first && m_region_end[row]) {
+            row = m_region_end[row] + 1;
+            continue;
+        }
+        if (basicoperators::generatesOperands(m_builtins[row])) {
+            auto arms = m_flat.children(row);
+            if (arms.size() != 3) {
+                return tl::make_unexpected(Err{"codegen got bad code"});
+            }
+            auto blocks = basicoperators::beginIf(&builder, m_values[arms[0]]);
+            pending.push_back(PendingIf{row, first, last, blocks});
+            last  = arms[1];
+            first = row = m_subtree_begin[last];
+            continue;
+        }
+        auto value = emitRow(row);
+        if (!value) {
+            return value;
+        }
+        m_values[row] = value->m_value;
+        row++;
+    }
+}
+
+tl::expected<DecValue, Err> RowEmitter::emitRow(uint32_t row)
+{
+    using Kind = pom::ast::ExprKind;
+    switch (m_flat.m_kinds[row]) {
+        case Kind::k_literal:
+            return std::visit([&](auto& e) { return literalValue(m_program, e); },
+                              m_flat.m_literals[row]);
+        case Kind::k_var:
+        case Kind::k_subscript:
+            return emitVar(row);
+        case Kind::k_list:
+            return emitList(row);
+        case Kind::k_binary:
+            return emitBuiltin(row);
+        case Kind::k_call:
+            if (m_builtins[row] != pom::ops::BuiltinOp::k_none) {
+                return emitBuiltin(row);
+            }
+            return m_loop && m_self_tail_calls[row] ? emitSelfTailCall(row) : emitCall(row);
+    }
+    return tl::make_unexpected(Err{"codegen got bad code"});
 }
 
-tl::expected<DecValue, Err> codegen(Program&                      program,
-                                    const pom::semantic::Context& context,
-                                    const pom::ast::Var&          var,
-                                    pom::ast::ExprId)
+tl::expected<DecValue, Err> RowEmitter::emitVar(uint32_t row)
 {
+    auto name = m_flat.m_names[row];
+
     // check in global functions
-    llvm::Function* function = program.get_module()->getFunction(var.m_name);
+    llvm::Function* function = m_program.function(name);
     if (function) {
         return DecValue{function};
     }
 
     // Look this variable up in the function.
-    auto v = program.m_named_values.find(var.m_name);
-    if (v == program.m_named_values.end() || !v->second) {
-        return tl::make_unexpected(
-            Err{fmt::format("Unknown variable name (old): {0}", var.m_name)});
+    auto v = m_program.m_named_values.find(name);
+    if (v == m_program.m_named_values.end() || !v->second) {
+        return tl::make_unexpected(Err{fmt::format("Unknown variable name (old): {0}", name)});
     }
-    auto fo = context.m_variables.find(var.m_name);
-    if (fo == context.m_variables.end()) {
-        return tl::make_unexpected(Err{fmt::format("Unknown variable name: {0}", var.m_name)});
+    if (!m_function.m_context.variableType(name)) {
+        return tl::make_unexpected(Err{fmt::format("Unknown variable name: {0}", name)});
     }
 
-    if (var.m_subscript) {
-        auto sty = fo->second->subscriptedType(*var.m_subscript);
-        if (!sty) {
-            return tl::make_unexpected(Err{"codegen got bad code"});
-        }
-        auto ty = basictypes::getType(&program.context(), *sty);
+    if (m_flat.m_kinds[row] == pom::ast::ExprKind::k_subscript) {
+        // The type of the row is the one of the item.
+        auto ty = basictypes::getType(&m_program.context(), *m_function.m_types[row]);
         if (!ty) {
             return tl::make_unexpected(Err{ty.error().m_desc});
         }
-        auto index =
-            llvm::ConstantInt::get(program.context(), llvm::APInt(64, *var.m_subscript, true));
+        auto subscript = std::get<pom::literals::Integer>(m_flat.m_literals[row]).m_val;
+        auto index = llvm::ConstantInt::get(m_program.context(), llvm::APInt(64, subscript, true));
 
-        auto gep = program.m_builder->CreateInBoundsGEP(*ty, v->second, index);
+        auto gep = m_program.m_builder->CreateInBoundsGEP(*ty, v->second, index);
 
-        auto load = program.m_builder->CreateLoad(*ty, gep);
+        auto load = m_program.m_builder->CreateLoad(*ty, gep);
         return DecValue{load};
     }
 
     return DecValue{v->second};
 }
 
-tl::expected<DecValue, Err> codegen(Program&                      program,
-                                    const pom::semantic::Context& context,
-                                    const pom::ast::ListExpr&     li,
-                                    pom::ast::ExprId)
-{
-    pom::TypeCSP          item_ty;
-    std::vector<DecValue> generated;
-    for (auto& exp : li.m_expressions) {
-        auto lie = codegen(program, context, *exp);
-        if (!lie) {
-            return lie;
-        }
-        generated.push_back(std::move(*lie));
-        if (!item_ty) {
-            auto ty = context.expressionType(exp->m_id);
-            if (!ty) {
-                return tl::make_unexpected(Err{ty.error().m_desc});
-            }
-            item_ty = *ty;
-        }
+tl::expected<DecValue, Err> RowEmitter::emitList(uint32_t row)
+{
+    auto children = m_flat.children(row);
+    if (children.empty()) {
+        return tl::make_unexpected(Err{"codegen got bad code"});
     }
-    assert(item_ty);
+    auto& item_ty = m_function.m_types[children[0]];
 
-    auto int_ptr = llvm::IntegerType::get(program.context(), 64);
+    auto int_ptr = llvm::IntegerType::get(m_program.context(), 64);
 
-    auto llvm_type = basictypes::getType(&program.context(), *item_ty);
+    auto llvm_type = basictypes::getType(&m_program.context(), *item_ty);
     if (!llvm_type) {
         return tl::make_unexpected(Err{llvm_type.error().m_desc});
     }
@@ -193,113 +417,79 @@ tl::expected<DecValue, Err> codegen(Program&                      program,
     }
 
     llvm::Value* alloc_sz =
-        llvm::ConstantInt::get(program.context(), llvm::APInt(64, llvm_type_size, false));
+        llvm::ConstantInt::get(m_program.context(), llvm::APInt(64, llvm_type_size, false));
 
     llvm::Value* array_sz =
-        llvm::ConstantInt::get(program.context(), llvm::APInt(64, generated.size(), false));
-
-    auto allocated = pol::createMalloc(program.m_builder.get(), int_ptr, *llvm_type, alloc_sz,
-                                       array_sz, nullptr, "a");
+        llvm::ConstantInt::get(m_program.context(), llvm::APInt(64, children.size(), false));
+
+    llvm::Value* allocated = nullptr;
+    if (m_local_lists[row]) {
+        // In the entry block, so that it is allocated once per call whichever branch makes it.
+        auto&             entry = m_program.m_builder->GetInsertBlock()->getParent()->front();
+        llvm::IRBuilder<> builder(&entry, entry.begin());
+        allocated = builder.CreateAlloca(*llvm_type, array_sz, "a");
+        m_program.m_stack_lists++;
+    } else {
+        // In the arena of the evaluation, freed when it ends.
+        auto module = m_program.get_module();
+        auto alloc  = module->getFunction(runtime::k_allocate);
+        if (!alloc) {
+            alloc = llvm::Function::Create(
+                llvm::FunctionType::get(llvm::Type::getInt8PtrTy(m_program.context()), {int_ptr},
+                                        false),
+                llvm::Function::ExternalLinkage, runtime::k_allocate, module);
+            alloc->setReturnDoesNotAlias();
+            alloc->addFnAttr(llvm::Attribute::NoUnwind);
+            alloc->addFnAttr(llvm::Attribute::WillReturn);
+        }
+        allocated = pol::createMalloc(m_program.m_builder.get(), int_ptr, *llvm_type, alloc_sz,
+                                      array_sz, alloc, "a");
+    }
 
-    for (auto i = 0ull; i < generated.size(); i++) {
-        auto index = llvm::ConstantInt::get(program.context(), llvm::APInt(32, int(i), true));
+    for (auto i = 0ull; i < children.size(); i++) {
+        auto index = llvm::ConstantInt::get(m_program.context(), llvm::APInt(32, int(i), true));
 
-        auto gep = program.m_builder->CreateGEP(*llvm_type, allocated, index);
-        program.m_builder->CreateStore(generated[i].m_value, gep);
+        auto gep = m_program.m_builder->CreateGEP(*llvm_type, allocated, index);
+        m_program.m_builder->CreateStore(m_values[children[i]], gep);
     }
 
     return DecValue{allocated};
 }
 
-tl::expected<DecValue, Err> codegen(Program&                      program,
-                                    const pom::semantic::Context& context,
-                                    const pom::ast::BinaryExpr&   e,
-                                    pom::ast::ExprId)
+tl::expected<DecValue, Err> RowEmitter::emitBuiltin(uint32_t row)
 {
-    using BErr  = pol::basicoperators::Err;
-    auto lv_gen = [&](llvm::IRBuilderBase*) -> tl::expected<llvm::Value*, BErr> {
-        auto v = codegen(program, context, *e.m_lhs);
-        if (!v) {
-            return tl::make_unexpected(BErr{v.error().m_desc});
-        }
-        return v->m_value;
-    };
-    auto rv_gen = [&](llvm::IRBuilderBase*) -> tl::expected<llvm::Value*, BErr> {
-        auto v = codegen(program, context, *e.m_rhs);
-        if (!v) {
-            return tl::make_unexpected(BErr{v.error().m_desc});
-        }
-        return v->m_value;
-    };
-
-    auto lv_ty = context.expressionType(e.m_lhs->m_id);
-    auto rv_ty = context.expressionType(e.m_rhs->m_id);
-    if (!lv_ty) {
-        return tl::make_unexpected(Err{lv_ty.error().m_desc});
-    }
-    if (!rv_ty) {
-        return tl::make_unexpected(Err{rv_ty.error().m_desc});
-    }
+    using BErr = pol::basicoperators::Err;
 
-    auto op_info = pom::ops::getBuiltin(e.m_op, {*lv_ty, *rv_ty});
-    if (!op_info) {
-        assert(0);
-        return tl::make_unexpected(pom_should_have_caught(op_info.error()));
+    // Operators generating their operands are lowered by the scan, the others take values.
+    std::vector<basicoperators::ValueGenerator> arg_gen;
+    for (auto child : m_flat.children(row)) {
+        arg_gen.push_back([this, child](llvm::IRBuilderBase*) -> tl::expected<llvm::Value*, BErr> {
+            return m_values[child];
+        });
     }
 
-    auto bop = basicoperators::buildBinOp(program.m_builder.get(), *op_info, {lv_gen, rv_gen});
-    if (!bop) {
-        return tl::make_unexpected(pom_should_have_caught(bop.error()));
+    auto op = basicoperators::buildBinOp(m_program.m_builder.get(), m_builtins[row], arg_gen);
+    if (!op) {
+        return tl::make_unexpected(pom_should_have_caught(op.error()));
     }
-    return DecValue{*bop};
+    return DecValue{*op};
 }
 
-tl::expected<DecValue, Err> codegen(Program&                      program,
-                                    const pom::semantic::Context& context,
-                                    const pom::ast::Call&         c,
-                                    pom::ast::ExprId)
+tl::expected<DecValue, Err> RowEmitter::emitCall(uint32_t row)
 {
-    using BErr = pol::basicoperators::Err;
-
-    std::vector<basicoperators::ValueGenerator> arg_gen;
-    std::vector<pom::TypeCSP>                   arg_types;
-    for (unsigned i = 0, e = c.m_args.size(); i != e; ++i) {
-        auto generator = [&program, &context, &c,
-                          i](llvm::IRBuilderBase*) -> tl::expected<llvm::Value*, BErr> {
-            auto aa = codegen(program, context, *c.m_args[i]);
-            if (!aa) {
-                return tl::make_unexpected(BErr{aa.error().m_desc});
-            }
-            return aa->m_value;
-        };
-        arg_gen.push_back(generator);
-
-        auto a_type = context.expressionType(c.m_args[i]->m_id);
-        if (!a_type) {
-            return tl::make_unexpected(Err{a_type.error().m_desc});
-        }
-        arg_types.push_back(*a_type);
-    }
-
-    auto builtin = pom::ops::getBuiltin(c.m_function, arg_types);
-    if (builtin) {
-        auto op = basicoperators::buildBinOp(program.m_builder.get(), *builtin, arg_gen);
-        if (!op) {
-            return tl::make_unexpected(Err{op.error().m_desc});
-        }
-        return DecValue{*op};
-    }
+    auto name     = m_flat.m_names[row];
+    auto children = m_flat.children(row);
 
     llvm::Value*        function_value = nullptr;
     llvm::FunctionType* function_type  = nullptr;
 
     {
-        llvm::Function* function = program.get_module()->getFunction(c.m_function);
+        llvm::Function* function = m_program.function(name);
         if (function) {
-            if (function->arg_size() != c.m_args.size()) {
+            if (function->arg_size() != children.size()) {
                 return tl::make_unexpected(
                     Err{fmt::format("Incorrect # arguments passed {0} vs {1}", function->arg_size(),
-                                    c.m_args.size())});
+                                    children.size())});
             }
             function_value = function;
             function_type  = function->getFunctionType();
@@ -307,37 +497,79 @@ tl::expected<DecValue, Err> codegen(Program&                      program,
     }
 
     if (!function_value) {
-        auto v = program.m_named_values.find(c.m_function);
-        if (v == program.m_named_values.end()) {
+        auto v = m_program.m_named_values.find(name);
+        if (v == m_program.m_named_values.end()) {
             return tl::make_unexpected(Err{"Unknown function referenced (old)"});
         }
 
-        auto cv = context.m_variables.find(c.m_function);
-        if (cv == context.m_variables.end()) {
+        auto cv = m_function.m_context.variableType(name);
+        if (!cv) {
             return tl::make_unexpected(Err{"Unknown function referenced"});
         }
 
         function_value = v->second;
-        auto fty       = basictypes::getFunctionType(&program.context(), *cv->second);
+        auto fty       = basictypes::getFunctionType(&m_program.context(), **cv);
         if (!fty) {
             return tl::make_unexpected(Err{fty.error().m_desc});
         }
         function_type = *fty;
     }
 
-    auto args = pol::basicoperators::execute(arg_gen, program.m_builder.get());
-    if (!args) {
-        return tl::make_unexpected(Err{args.error().m_desc});
+    std::vector<llvm::Value*> args;
+    for (auto child : children) {
+        args.push_back(m_values[child]);
     }
 
-    return DecValue{program.m_builder->CreateCall(function_type, function_value, *args, "calltmp")};
+    return DecValue{m_program.m_builder->CreateCall(function_type, function_value, args, "calltmp")};
+}
+
+tl::expected<DecValue, Err> RowEmitter::emitSelfTailCall(uint32_t row)
+{
+    auto& builder  = *m_program.m_builder;
+    auto  children = m_flat.children(row);
+    if (children.size() != m_loop_args.size()) {
+        return tl::make_unexpected(Err{fmt::format("Incorrect # arguments passed {0} vs {1}",
+                                                   m_loop_args.size(), children.size())});
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+        m_loop_args[i]->addIncoming(m_values[children[i]], builder.GetInsertBlock());
+    }
+    builder.CreateBr(m_loop);
+
+    // What follows the jump is never reached, its value only has to fit the merges and the
+    // return it flows into. Simplifying the CFG drops them.
+    auto function = builder.GetInsertBlock()->getParent();
+    builder.SetInsertPoint(
+        llvm::BasicBlock::Create(m_program.context(), "aftertailcall", function));
+    auto ty = basictypes::getType(&m_program.context(), *m_function.m_types[row]);
+    if (!ty) {
+        return tl::make_unexpected(Err{ty.error().m_desc});
+    }
+    return DecValue{llvm::UndefValue::get(*ty)};
 }
 
-tl::expected<DecValue, Err> codegen(Program&                      program,
-                                    const pom::semantic::Context& context,
-                                    const pom::ast::Expr&         v)
+/// Attributes that let LLVM share, hoist and drop calls of f.
+void addAttributes(llvm::Function* f, const pom::effects::Effects& effects)
 {
-    return std::visit([&](auto&& w) { return codegen(program, context, w, v.m_id); }, v.m_val);
+    if (effects.m_pure && effects.m_reads_lists) {
+        f->setOnlyReadsMemory();
+        f->setOnlyAccessesArgMemory();
+    } else if (effects.m_pure) {
+        f->setDoesNotAccessMemory();
+    }
+    if (effects.m_closed) {
+        f->setDoesNotThrow();
+        f->setDoesNotFreeMemory();
+        if (!effects.m_recursive) {
+            f->setDoesNotRecurse();
+        }
+    }
+    if (effects.m_terminates) {
+        f->setWillReturn();
+    }
+    if (effects.m_fresh_result) {
+        f->addRetAttr(llvm::Attribute::NoAlias);
+    }
 }
 
 tl::expected<llvm::Function*, Err> codegen(Program& program, const pom::semantic::Signature& s)
@@ -360,95 +592,328 @@ tl::expected<llvm::Function*, Err> codegen(Program& program, const pom::semantic
 
     llvm::FunctionType* func_type = llvm::FunctionType::get(*ret_type, llvm_args, false);
 
-    llvm::Function* f = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage, s.m_name,
+    llvm::Function* f = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
+                                               program.symbol(s.m_name),
                                                program.get_module());
+    program.m_functions[s.m_name] = f;
+    if (auto effects = program.m_effects.find(s.m_name)) {
+        addAttributes(f, *effects);
+    }
 
     // Set names for all arguments.
     unsigned idx = 0;
     for (auto& arg : f->args()) {
-        arg.setName(s.m_args[idx++].second);
+        arg.setName(llvm::StringRef(s.m_args[idx++].second.str()));
     }
 
     return f;
 }
 
-tl::expected<llvm::Function*, Err> codegen(Program& program, const pom::semantic::Function& f)
+llvm::Function* Program::function(pom::Symbol name)
 {
-    // First, check for an existing function from a previous 'extern' declaration.
-    llvm::Function* function = program.get_module()->getFunction(f.m_sig.m_name);
+    auto fo = m_functions.find(name);
+    if (fo != m_functions.end()) {
+        return fo->second;
+    }
 
-    if (!function) {
-        auto funcorerr = codegen(program, f.m_sig);
-        if (!funcorerr) {
-            return tl::make_unexpected(funcorerr.error());
-        }
-        function = *funcorerr;
+    // Functions of earlier units get declared in this module on first use.
+    auto proto = m_prototypes.find(name);
+    if (proto == m_prototypes.end()) {
+        return nullptr;
+    }
+    auto declared = codegen(*this, proto->second);
+    return declared ? *declared : nullptr;
+}
+
+/// Checks the code generated for function, so it never reaches the backend broken.
+tl::expected<void, Err> verify(const llvm::Function& function)
+{
+    std::string              problems;
+    llvm::raw_string_ostream ost(problems);
+    if (llvm::verifyFunction(function, &ost)) {
+        return tl::make_unexpected(Err{fmt::format("Invalid code generated for {0}: {1}",
+                                                   function.getName().str(), ost.str())});
     }
+    return {};
+}
 
+/// Lowers the rows of f into the body of function.
+tl::expected<void, Err> codegenBody(Program&                        program,
+                                    const pom::semantic::Function& f,
+                                    llvm::Function*                 function)
+{
     // Create a new basic block to start insertion into.
     llvm::BasicBlock* bb = llvm::BasicBlock::Create(program.context(), "entry", function);
     program.m_builder->SetInsertPoint(bb);
 
     // Record the function arguments in the NamedValues map.
     program.m_named_values.clear();
+    unsigned idx = 0;
     for (auto& arg : function->args()) {
-        program.m_named_values[std::string(arg.getName())] = &arg;
+        arg.setName(llvm::StringRef(f.m_sig.m_args[idx].second.str()));
+        program.m_named_values[f.m_sig.m_args[idx++].second] = &arg;
     }
 
-    auto retVal = codegen(program, f.m_context, *f.m_code);
+    RowEmitter emitter(program, f);
+    auto       retVal = emitter.prepare().and_then([&] {
+        emitter.loopSelfTailCalls(function);
+        return emitter.emitRange(0, f.m_flat.size() - 1);
+    });
     if (!retVal) {
-        function->eraseFromParent();
         return tl::make_unexpected(retVal.error());
     }
     // Finish off the function.
     program.m_builder->CreateRet(retVal->m_value);
 
     // Validate the generated code, checking for consistency.
-    verifyFunction(*function);
+    auto verified = verify(*function);
+    if (!verified) {
+        return verified;
+    }
 
     program.m_fpm->run(*function);
+    return {};
+}
 
-    return function;
+/// Makes function look its arguments up in a table of slots entries before calling body, which
+/// computes the value. A slot holds the evaluation it was stored in, the arguments and the value,
+/// a miss overwrites it.
+tl::expected<void, Err> codegenMemo(Program&        program,
+                                    llvm::Function* function,
+                                    llvm::Function* body,
+                                    uint32_t        slots)
+{
+    auto& ctx     = program.context();
+    auto& builder = *program.m_builder;
+    auto  i64     = llvm::Type::getInt64Ty(ctx);
+
+    std::vector<llvm::Type*> fields(function->arg_size() + 1, i64);
+    fields.push_back(function->getReturnType());
+    auto slot_type  = llvm::StructType::get(ctx, fields);
+    auto table_type = llvm::ArrayType::get(slot_type, slots);
+    auto table      = new llvm::GlobalVariable(
+        *program.get_module(), table_type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantAggregateZero::get(table_type), function->getName() + ".memo");
+    auto epoch_var = program.get_module()->getOrInsertGlobal(k_memo_epoch, i64);
+
+    auto entry_bb = llvm::BasicBlock::Create(ctx, "entry", function);
+    auto hit_bb   = llvm::BasicBlock::Create(ctx, "hit", function);
+    auto miss_bb  = llvm::BasicBlock::Create(ctx, "miss", function);
+    builder.SetInsertPoint(entry_bb);
+
+    // FNV-1a over the arguments, with the high bits folded into the ones the mask keeps.
+    std::vector<llvm::Value*> args, keys;
+    llvm::Value*              hash = builder.getInt64(0xcbf29ce484222325);
+    for (auto& arg : function->args()) {
+        args.push_back(&arg);
+        keys.push_back(builder.CreateZExtOrBitCast(&arg, i64));
+        hash = builder.CreateMul(builder.CreateXor(hash, keys.back()),
+                                 builder.getInt64(0x100000001b3));
+    }
+    hash       = builder.CreateXor(hash, builder.CreateLShr(hash, 32));
+    auto index = builder.CreateAnd(hash, builder.getInt64(slots - 1));
+    auto slot  = builder.CreateInBoundsGEP(table_type, table, {builder.getInt64(0), index});
+    auto field = [&](unsigned i) { return builder.CreateStructGEP(slot_type, slot, i); };
+
+    auto         epoch = builder.CreateLoad(i64, epoch_var, "epoch");
+    llvm::Value* hit   = builder.CreateICmpEQ(builder.CreateLoad(i64, field(0)), epoch);
+    for (unsigned i = 0; i < keys.size(); i++) {
+        hit = builder.CreateAnd(
+            hit, builder.CreateICmpEQ(builder.CreateLoad(i64, field(i + 1)), keys[i]));
+    }
+    builder.CreateCondBr(hit, hit_bb, miss_bb);
+
+    builder.SetInsertPoint(hit_bb);
+    builder.CreateRet(builder.CreateLoad(function->getReturnType(), field(keys.size() + 1)));
+
+    // The call may have stored other arguments in the slot, it is overwritten whole.
+    builder.SetInsertPoint(miss_bb);
+    auto value = builder.CreateCall(body, args, "calltmp");
+    builder.CreateStore(epoch, field(0));
+    for (unsigned i = 0; i < keys.size(); i++) {
+        builder.CreateStore(keys[i], field(i + 1));
+    }
+    builder.CreateStore(value, field(keys.size() + 1));
+    builder.CreateRet(value);
+
+    return verify(*function);
 }
 
-tl::expected<Result, Err> codegen(const pom::semantic::TopLevel& top_level, bool print_ir)
+/// Lowers f, behind a memo table of memo_slots entries when not 0.
+tl::expected<llvm::Function*, Err> codegen(Program&                        program,
+                                           const pom::semantic::Function& f,
+                                           uint32_t                        memo_slots = 0)
 {
-    Program program;
+    // Declared from its own signature, the prototype of an earlier definition of the name may
+    // have other types and an extern of the name has nothing to add.
+    auto funcorerr = codegen(program, f.m_sig);
+    if (!funcorerr) {
+        return tl::make_unexpected(funcorerr.error());
+    }
+    auto function = *funcorerr;
+
+    // Recursive calls still resolve to function, so they go through the table too.
+    auto body = function;
+    if (memo_slots) {
+        body = llvm::Function::Create(function->getFunctionType(),
+                                      llvm::Function::InternalLinkage,
+                                      function->getName() + ".uncached", program.get_module());
+    }
 
-    std::string  lastfn;
-    pom::TypeCSP tp;
-    for (auto& tpu : top_level) {
-        auto fn_or_err = std::visit([&program](auto&& v) { return codegen(program, v); }, tpu);
-        if (!fn_or_err) {
-            return tl::make_unexpected(fn_or_err.error());
+    auto generated = codegenBody(program, f, body);
+    if (generated && memo_slots) {
+        generated = codegenMemo(program, function, body, memo_slots);
+    }
+    if (!generated) {
+        if (body != function) {
+            body->eraseFromParent();
         }
-        if ((*fn_or_err)->arg_empty()) {
-            lastfn  = (*fn_or_err)->getName().str();
-            auto fn = std::get_if<pom::semantic::Function>(&tpu);
-            assert(fn);
-            tp = fn->type()->returnType();
+        function->eraseFromParent();
+        program.m_functions.erase(f.m_sig.m_name);
+        return tl::make_unexpected(generated.error());
+    }
+    return function;
+}
+
+/// Slots of the memo table of fn, 0 for none. Only recursive pure functions of integers and
+/// booleans get one, the others either compute their value once or have no key to store it under.
+uint32_t memoSlots(const pom::semantic::Function& fn,
+                   const pom::effects::Effects&   effects,
+                   const Options&                 options)
+{
+    auto is_key = [](auto& arg) {
+        return *arg.first == *pom::types::integer() || *arg.first == *pom::types::boolean();
+    };
+    if (!options.m_memoize || !effects.m_pure || !effects.m_recursive || fn.m_sig.m_args.empty() ||
+        !std::all_of(fn.m_sig.m_args.begin(), fn.m_sig.m_args.end(), is_key)) {
+        return 0;
+    }
+    return uint32_t(llvm::PowerOf2Ceil(std::max(options.m_memo_slots, 1u)));
+}
+
+Session::Session(bool print_ir) : Session(Options{print_ir}) {}
+
+Session::Session(const Options& options)
+    : m_program(std::make_unique<Program>()), m_options(options)
+{
+}
+
+Session::~Session() = default;
+
+tl::expected<void, Err> Session::add(const pom::semantic::TopLevelUnit& unit)
+{
+    static const pom::Symbol anon_name("__anon_expr");
+
+    auto& program = *m_program;
+    program.newModule();
+
+    auto effects = program.m_effects.analyze(unit);
+    program.m_escapes.analyze(unit);
+    auto fn    = std::get_if<pom::semantic::Function>(&unit);
+    auto name  = fn ? fn->m_sig.m_name : std::get<pom::semantic::Signature>(unit).m_name;
+    auto slots = fn ? memoSlots(*fn, effects, m_options) : 0;
+    if (fn && name != anon_name) {
+        program.m_versions[name]++;
+    }
+    if (slots) {
+        program.m_effects.markImpure(name);
+    }
+    auto fn_or_err = fn ? codegen(program, *fn, slots)
+                        : codegen(program, std::get<pom::semantic::Signature>(unit));
+    if (!fn_or_err) {
+        if (fn && name != anon_name) {
+            program.m_versions[name]--;
         }
+        return tl::make_unexpected(fn_or_err.error());
     }
 
-    if (lastfn.empty()) {
-        return Result();
+    if (!fn) {
+        // Externs are only declared, in the modules that use them.
+        auto& sig = std::get<pom::semantic::Signature>(unit);
+        program.m_prototypes.insert_or_assign(sig.m_name, sig);
+        return {};
+    }
+    program.m_prototypes.insert_or_assign(fn->m_sig.m_name, fn->m_sig);
+    if ((*fn_or_err)->arg_empty() && !pom::partialeval::isClone(fn->m_sig.m_name)) {
+        m_entry      = fn->m_sig.m_name;
+        m_entry_type = fn->type()->returnType();
     }
 
-    if (print_ir) {
+    if (m_options.m_print_ir && m_options.m_ir_stream) {
+        llvm::raw_os_ostream os(*m_options.m_ir_stream);
+        program.get_module()->print(os, nullptr);
+    } else if (m_options.m_print_ir) {
         program.get_module()->print(llvm::outs(), nullptr);
     }
 
-    auto error = program.m_jit->addModule(std::move(*program.m_thread_safe_module));
-    if(!error) {
+    // Only the last anonymous expression can be evaluated, the module of the one before goes.
+    // The module of a redefined function stays for its callers, under the default tracker.
+    auto& tracker = program.m_trackers[fn->m_sig.m_name];
+    if (tracker && fn->m_sig.m_name == anon_name) {
+        if (auto error = tracker->remove()) {
+            return tl::make_unexpected(Err{llvm::toString(std::move(error))});
+        }
+    }
+    tracker = program.m_jit->getMainJITDylib().createResourceTracker();
+
+    program.m_fpm.reset();
+    auto error = program.m_jit->addModule(
+        llvm::orc::ThreadSafeModule(std::move(program.m_module), program.m_context), tracker);
+    if (!error) {
         return tl::make_unexpected(Err{error.error().m_desc});
     }
+    return {};
+}
 
-    auto symbol = program.m_jit->lookup(lastfn);
-    if (!symbol) {
-        return tl::make_unexpected(Err{fmt::format("Could not find symbol: {0}", lastfn)});
+tl::expected<void, Err> Session::remove(pom::Symbol name)
+{
+    auto& program = *m_program;
+    program.m_prototypes.erase(name);
+    program.m_effects.forget(name);
+    program.m_escapes.forget(name);
+    if (m_entry == name) {
+        m_entry = pom::Symbol();
+    }
+    auto fo = program.m_trackers.find(name);
+    if (fo == program.m_trackers.end()) {
+        return {};
     }
+    auto tracker = std::move(fo->second);
+    program.m_trackers.erase(fo);
+    if (auto error = tracker->remove()) {
+        return tl::make_unexpected(Err{llvm::toString(std::move(error))});
+    }
+    return {};
+}
+
+tl::expected<Result, Err> Session::evaluate() { return evaluate(m_entry, m_entry_type); }
+
+tl::expected<Result, Err> Session::evaluate(const pom::semantic::Function& entry)
+{
+    return evaluate(entry.m_sig.m_name, entry.m_sig.m_return_type);
+}
 
+tl::expected<Result, Err> Session::evaluate(pom::Symbol entry, const pom::TypeCSP& tp)
+{
     Result res;
+    res.m_stack_lists = m_program->m_stack_lists;
+    if (entry.empty()) {
+        return res;
+    }
+
+    auto symbol = m_program->m_jit->lookup(m_program->symbol(entry));
+    if (!symbol) {
+        return tl::make_unexpected(Err{fmt::format("Could not find symbol: {0}", entry)});
+    }
+
+    // Memo tables start empty, what was stored before may depend on functions since redefined.
+    m_program->m_memo_epoch++;
+
+    // The lists of the evaluation are dropped with its arena, the value is no list.
+    auto& arena  = runtime::threadArena();
+    auto  before = arena.stats();
+    arena.setHugePages(m_options.m_huge_pages);
+
     if (*tp == *pom::types::real()) {
         double (*fp)() = (double (*)())(symbol->getAddress());
         res.m_ev       = fp();
@@ -461,9 +926,29 @@ tl::expected<Result, Err> codegen(const pom::semantic::TopLevel& top_level, bool
         res.m_ev        = bool(r == 0 ? false : true);
     }
 
+    arena.reset();
+    res.m_arena_lists = arena.stats().m_allocations - before.m_allocations;
+    res.m_arena_bytes = arena.stats().m_bytes - before.m_bytes;
     return res;
 }
 
+tl::expected<Result, Err> codegen(const pom::semantic::TopLevel& top_level, bool print_ir)
+{
+    return codegen(top_level, Options{print_ir});
+}
+
+tl::expected<Result, Err> codegen(const pom::semantic::TopLevel& top_level, const Options& options)
+{
+    Session session(options);
+    for (auto& tpu : top_level) {
+        auto added = session.add(tpu);
+        if (!added) {
+            return tl::make_unexpected(added.error());
+        }
+    }
+    return session.evaluate();
+}
+
 template <class>
 inline constexpr bool always_false_v = false;
 
@@ -17,11 +17,69 @@ struct Result
 {
     std::variant<std::monostate, double, int64_t, bool> m_ev;
 
+    /// Lists of the units added that are allocated on the stack instead of the heap, as they do
+    /// not outlive the call making them.
+    size_t m_stack_lists = 0;
+
+    /// Lists the evaluation allocated in the arena it frees when it ends, and their bytes.
+    size_t m_arena_lists = 0;
+    size_t m_arena_bytes = 0;
+
     bool operator==(const Result& other) const { return m_ev == other.m_ev; }
 };
 
+struct Options
+{
+    /// Prints the IR of each unit added, to m_ir_stream or else standard output.
+    bool          m_print_ir  = false;
+    std::ostream* m_ir_stream = nullptr;
+
+    /// Recursive pure functions of integers and booleans keep the values of their calls in a
+    /// table of m_memo_slots entries, rounded up to a power of two. The tables are emptied for
+    /// each evaluation.
+    bool     m_memoize    = false;
+    uint32_t m_memo_slots = 4096;
+
+    /// Backs the arena lists are allocated in with huge pages, where the system has them.
+    bool m_huge_pages = false;
+};
+
+struct Program;
+
+/// Lowers and jits a program one top level unit at a time. Each unit gets its own module, so the
+/// semantic unit can be dropped as soon as add() returns.
+class Session
+{
+   public:
+    explicit Session(bool print_ir);
+    explicit Session(const Options& options);
+    ~Session();
+
+    tl::expected<void, Err> add(const pom::semantic::TopLevelUnit& unit);
+
+    /// Drops the machine code and the declaration of a unit, so it can be added again. Code
+    /// calling it must be added again too before it runs.
+    tl::expected<void, Err> remove(pom::Symbol name);
+
+    /// Runs the last function without arguments added so far.
+    tl::expected<Result, Err> evaluate();
+
+    /// Runs entry, a function without arguments added before.
+    tl::expected<Result, Err> evaluate(const pom::semantic::Function& entry);
+
+   private:
+    tl::expected<Result, Err> evaluate(pom::Symbol entry, const pom::TypeCSP& type);
+
+    std::unique_ptr<Program> m_program;
+    Options                  m_options;
+    pom::Symbol              m_entry;
+    pom::TypeCSP             m_entry_type;
+};
+
 tl::expected<Result, Err> codegen(const pom::semantic::TopLevel& tl, bool print_ir);
 
+tl::expected<Result, Err> codegen(const pom::semantic::TopLevel& tl, const Options& options);
+
 std::ostream& operator<<(std::ostream& os, const Result& value);
 
 }  // namespace codegen
@@ -0,0 +1,243 @@
+
+#include <pol_incremental.h>
+
+#include <fmt/format.h>
+
+#include <unordered_set>
+
+namespace pol {
+
+namespace incremental {
+
+namespace {
+
+const pom::Symbol& anonName()
+{
+    static const pom::Symbol name("__anon_expr");
+    return name;
+}
+
+pom::Symbol unitName(const pom::parser::TopLevelUnit& unit)
+{
+    auto fn = std::get_if<pom::ast::Function>(&unit);
+    return fn ? fn->m_sig.m_name : std::get<pom::ast::Signature>(unit).m_name;
+}
+
+/// Globals a function refers to: its names that are not arguments. Its own name only when it
+/// cannot recurse, then it is an earlier unit of that name.
+std::vector<pom::Symbol> globalNames(const pom::ast::Function& fn)
+{
+    std::vector<pom::Symbol> names;
+    for (auto name : fn.m_flat.m_names) {
+        if (name.empty() || (name == fn.m_sig.m_name && fn.m_sig.m_ret_type)) {
+            continue;
+        }
+        auto is_arg = std::any_of(fn.m_sig.m_args.begin(), fn.m_sig.m_args.end(),
+                                  [&](auto& arg) { return arg.m_name == name; });
+        if (!is_arg && std::find(names.begin(), names.end(), name) == names.end()) {
+            names.push_back(name);
+        }
+    }
+    return names;
+}
+
+/// The content of a unit and the types it sees its globals with, what its analysis depends on.
+uint64_t unitKey(const pom::parser::TopLevelUnit&   unit,
+                 const std::vector<pom::Symbol>&    globals,
+                 const pom::semantic::Context&      context)
+{
+    auto key = pom::parser::contentHash(unit);
+    for (auto name : globals) {
+        auto ty = context.find(name);
+        for (auto value : {uint64_t(name.id()), uint64_t(uintptr_t(ty ? ty->get() : nullptr))}) {
+            key = (key ^ value) * 0x100000001b3ull;
+            key ^= key >> 31;
+        }
+    }
+    return key;
+}
+
+}  // namespace
+
+Compiler::Compiler(bool print_ir) : m_session(print_ir) {}
+
+Compiler::~Compiler() = default;
+
+tl::expected<Report, Err> Compiler::update(std::shared_ptr<const pom::Source> source)
+{
+    auto tokens = pom::lexer::lex(std::move(source));
+    if (!tokens) {
+        return tl::make_unexpected(Err{"Lexer error: " + tokens.error().m_desc});
+    }
+    m_tokens = std::move(*tokens);
+    return compile();
+}
+
+tl::expected<Report, Err> Compiler::update(const pom::lexer::Edit& edit)
+{
+    if (!m_tokens) {
+        return tl::make_unexpected(Err{"Nothing to edit"});
+    }
+    // In place, edits after this one are to the edited text whether it parses or not.
+    auto relexed = pom::lexer::relex(*m_tokens, edit);
+    if (!relexed) {
+        return tl::make_unexpected(Err{"Lexer error: " + relexed.error().m_desc});
+    }
+    return compile();
+}
+
+tl::expected<Report, Err> Compiler::compile()
+{
+    pom::ast::AstArena parsed;
+    auto               top_level = pom::parser::parse(*m_tokens, parsed);
+    if (!top_level) {
+        return tl::make_unexpected(Err{"Parser error: " + top_level.error().m_desc});
+    }
+
+    // Only the last anonymous expression can run, the ones before it are not lowered.
+    size_t last_anon = top_level->size();
+    for (size_t i = 0; i < top_level->size(); i++) {
+        if (unitName((*top_level)[i]) == anonName()) {
+            last_anon = i;
+        }
+    }
+
+    // Units analyzed again are copied out of the parse, each update keeps what it made.
+    auto arena = std::make_shared<pom::ast::AstArena>();
+
+    pom::semantic::Analyzer                 analyzer;
+    std::unordered_map<pom::Symbol, Unit>   units;
+    std::unordered_set<pom::Symbol>         compiled;
+    std::optional<Err>                      failed;
+    Report                                  report;
+    pom::Symbol                             entry_name;
+    for (size_t i = 0; i < top_level->size() && !failed; i++) {
+        auto& unit    = (*top_level)[i];
+        auto  name    = unitName(unit);
+        auto  fn      = std::get_if<pom::ast::Function>(&unit);
+        auto  globals = fn ? globalNames(*fn) : std::vector<pom::Symbol>();
+        auto  key     = unitKey(unit, globals, analyzer.globals());
+
+        // Anonymous expressions before the last one never run, they are only checked.
+        if (name == anonName() && i != last_anon) {
+            auto analyzed = analyzer.analyze(unit);
+            if (!analyzed) {
+                failed = Err{"Semantic error: " + analyzed.error().m_desc};
+            }
+            continue;
+        }
+
+        Unit entry;
+        auto old = m_units.find(name);
+        if (old != m_units.end()) {
+            entry = std::move(old->second);
+            m_units.erase(old);
+        }
+
+        bool reanalyze = entry.m_key != key || !entry.m_arena;
+        if (reanalyze) {
+            auto analyzed = analyzer.analyze(unit);
+            if (!analyzed) {
+                failed = Err{"Semantic error: " + analyzed.error().m_desc};
+                // Its code, if any, is stale now.
+                entry.m_key = 0;
+                units[name] = std::move(entry);
+                break;
+            }
+            // Instances would be units no name in the source refers to.
+            if (analyzed->size() != 1) {
+                failed = Err{fmt::format("{0}: generic functions are not supported by incremental "
+                                         "compilation",
+                                         name)};
+                entry.m_key = 0;
+                units[name] = std::move(entry);
+                break;
+            }
+            if (auto sem_fn = std::get_if<pom::semantic::Function>(&analyzed->front())) {
+                sem_fn->m_flat = pom::ast::copyFlat(sem_fn->m_flat, *arena);
+                sem_fn->m_code = pom::ast::expandFlat(sem_fn->m_flat, *arena);
+            }
+            entry.m_key   = key;
+            entry.m_unit  = std::move(analyzed->front());
+            entry.m_arena = arena;
+            report.m_analyzed.push_back(name);
+        } else {
+            analyzer.declare(entry.m_unit);
+        }
+
+        // Code calling code compiled again is compiled again, its calls went to the old one.
+        bool stale = std::any_of(globals.begin(), globals.end(),
+                                 [&](auto global) { return compiled.count(global) != 0; });
+        if (reanalyze || stale || !entry.m_compiled) {
+            if (entry.m_compiled) {
+                auto removed = m_session.remove(name);
+                if (!removed) {
+                    failed = Err{removed.error().m_desc};
+                }
+            }
+            entry.m_compiled = false;
+            if (!failed) {
+                auto added = m_session.add(entry.m_unit);
+                if (!added) {
+                    failed = Err{added.error().m_desc};
+                    entry.m_key = 0;
+                } else {
+                    entry.m_compiled = true;
+                    compiled.insert(name);
+                    report.m_compiled.push_back(name);
+                }
+            }
+        } else if (!reanalyze) {
+            report.m_reused.push_back(name);
+        }
+
+        auto sem_fn = std::get_if<pom::semantic::Function>(&entry.m_unit);
+        if (sem_fn && sem_fn->m_sig.m_args.empty()) {
+            entry_name = name;
+        }
+        units[name] = std::move(entry);
+    }
+
+    if (failed) {
+        // Units not reached keep their code, but it may call code compiled again: the next
+        // update analyzes and compiles them again.
+        for (auto& [name, unit] : m_units) {
+            unit.m_key = 0;
+        }
+        for (auto& [name, unit] : units) {
+            m_units[name] = std::move(unit);
+        }
+        m_entry = pom::Symbol();
+        return tl::make_unexpected(*failed);
+    }
+
+    for (auto& [name, unit] : m_units) {
+        if (unit.m_compiled) {
+            auto removed = m_session.remove(name);
+            if (!removed) {
+                return tl::make_unexpected(Err{removed.error().m_desc});
+            }
+        }
+        report.m_removed.push_back(name);
+    }
+    m_units = std::move(units);
+    m_entry = entry_name;
+    return report;
+}
+
+tl::expected<codegen::Result, Err> Compiler::evaluate()
+{
+    if (m_entry.empty()) {
+        return codegen::Result();
+    }
+    auto fo = m_units.find(m_entry);
+    auto res = m_session.evaluate(std::get<pom::semantic::Function>(fo->second.m_unit));
+    if (!res) {
+        return tl::make_unexpected(Err{res.error().m_desc});
+    }
+    return *res;
+}
+
+}  // namespace incremental
+
+}  // namespace pol
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <pol_codegen.h>
+#include <pom_astarena.h>
+#include <pom_lexer.h>
+#include <pom_parser.h>
+#include <pom_semantic.h>
+
+#include <memory>
+#include <optional>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace pol {
+
+namespace incremental {
+
+struct Err
+{
+    std::string m_desc;
+};
+
+/// What an update did with the units of the program, by name.
+struct Report
+{
+    /// Neither analyzed nor lowered again.
+    std::vector<pom::Symbol> m_reused;
+
+    /// Analyzed again, because they or the types of the globals they use changed.
+    std::vector<pom::Symbol> m_analyzed;
+
+    /// Lowered and jitted again, because they were analyzed again or code they call was.
+    std::vector<pom::Symbol> m_compiled;
+
+    /// Gone from the program, their code was dropped.
+    std::vector<pom::Symbol> m_removed;
+};
+
+/// Keeps a program compiled in a long lived Session across edits of its source. Each unit is
+/// keyed on its contentHash and the types of the globals it uses. On update, a unit whose key is
+/// unchanged keeps its semantic unit, and its machine code too unless code it calls was compiled
+/// again. Everything else is analyzed and compiled as usual.
+class Compiler
+{
+   public:
+    explicit Compiler(bool print_ir = false);
+    ~Compiler();
+
+    /// Brings the program to source.
+    tl::expected<Report, Err> update(std::shared_ptr<const pom::Source> source);
+
+    /// Brings the program to its source with edit applied, relexing only around the edit.
+    tl::expected<Report, Err> update(const pom::lexer::Edit& edit);
+
+    /// Runs the last function without arguments of the program.
+    tl::expected<codegen::Result, Err> evaluate();
+
+   private:
+    struct Unit
+    {
+        uint64_t                            m_key = 0;
+        pom::semantic::TopLevelUnit         m_unit;
+        std::shared_ptr<pom::ast::AstArena> m_arena;
+        bool                                m_compiled = false;
+    };
+
+    /// Brings the program to m_tokens.
+    tl::expected<Report, Err> compile();
+
+    codegen::Session                      m_session;
+    std::optional<pom::lexer::Tokens>     m_tokens;
+    std::unordered_map<pom::Symbol, Unit> m_units;
+    pom::Symbol                           m_entry;
+};
+
+}  // namespace incremental
+
+}  // namespace pol
@@ -54,7 +54,8 @@ tl::expected<void, Jit::Err> Jit::addModule(llvm::orc::ThreadSafeModule tsm, llv
     }
     auto error = m_compile_layer.add(resource_tracker, std::move(tsm));
     if(error) {
-        return tl::make_unexpected(Err{"Failed to add module"});
+        return tl::make_unexpected(
+            Err{fmt::format("Failed to add module: {0}", llvm::toString(std::move(error)))});
     }
     return {};
 }
@@ -68,4 +69,13 @@ tl::expected<llvm::JITEvaluatedSymbol, Jit::Err> Jit::lookup(llvm::StringRef nam
     return found.get();
 }
 
+tl::expected<void, Jit::Err> Jit::defineAbsolute(llvm::StringRef name, const void* address)
+{
+    auto symbol = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(address), llvm::JITSymbolFlags::Exported);
+    if (auto error = m_main_jd.define(llvm::orc::absoluteSymbols({{m_mangle(name.str()), symbol}}))) {
+        return tl::make_unexpected(Err{llvm::toString(std::move(error))});
+    }
+    return {};
+}
+
 }  // namespace pol
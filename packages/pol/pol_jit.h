@@ -43,6 +43,9 @@ class Jit
 
     tl::expected<llvm::JITEvaluatedSymbol, Err> lookup(llvm::StringRef name);
 
+    /// Makes name resolve to address, for data and functions of the host.
+    tl::expected<void, Err> defineAbsolute(llvm::StringRef name, const void* address);
+
    private:
     std::unique_ptr<llvm::orc::ExecutionSession> m_execution_session;
     llvm::DataLayout                             m_data_layout;
@@ -0,0 +1,102 @@
+
+#include <pol_runtime.h>
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace pol {
+
+namespace runtime {
+
+Arena::~Arena()
+{
+    for (auto& block : m_blocks) {
+        ::munmap(block.m_data, block.m_size);
+    }
+}
+
+char* Arena::map(size_t bytes)
+{
+    // The kernel only backs aligned huge pages, so a huge page more is mapped and trimmed.
+    auto extra = m_huge_pages ? k_huge_page : 0;
+    auto raw   = ::mmap(nullptr, bytes + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (raw == MAP_FAILED) {
+        // Lowered code has no way to handle it.
+        std::fprintf(stderr, "conflake: out of memory mapping %zu bytes\n", bytes);
+        std::abort();
+    }
+    auto data = static_cast<char*>(raw);
+    if (m_huge_pages) {
+        auto head = ((uintptr_t(raw) + k_huge_page - 1) & ~uintptr_t(k_huge_page - 1)) -
+                    uintptr_t(raw);
+        if (head) {
+            ::munmap(raw, head);
+        }
+        if (head != extra) {
+            ::munmap(data + head + bytes, extra - head);
+        }
+        data += head;
+#ifdef MADV_HUGEPAGE
+        ::madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    return data;
+}
+
+void* Arena::allocateSlow(size_t size)
+{
+    // Blocks are whole huge pages when backed by them.
+    auto page     = m_huge_pages ? k_huge_page : k_block_size;
+    auto standard = size + k_align <= k_block_size;
+    auto bytes    = (std::max(size + k_align, k_block_size) + page - 1) & ~(page - 1);
+    auto data     = map(bytes);
+    m_blocks.push_back(Block{data, bytes, standard});
+    m_stats.m_blocks++;
+
+    // Mappings are page aligned, so aligned for any item.
+    m_pos = data + size;
+    m_end = data + bytes;
+    count(size);
+    return data;
+}
+
+void Arena::reset()
+{
+    m_stats.m_peak_bytes = std::max(m_stats.m_peak_bytes, m_used);
+    m_stats.m_resets++;
+    m_used = 0;
+    m_pos  = nullptr;
+    m_end  = nullptr;
+
+    // One large list would otherwise stay mapped for good.
+    auto kept = std::find_if(m_blocks.begin(), m_blocks.end(),
+                             [](const Block& block) { return block.m_standard; });
+    for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+        if (it != kept) {
+            ::munmap(it->m_data, it->m_size);
+        }
+    }
+    if (kept == m_blocks.end()) {
+        m_blocks.clear();
+        return;
+    }
+    m_blocks = {*kept};
+    m_pos    = m_blocks[0].m_data;
+    m_end    = m_blocks[0].m_data + m_blocks[0].m_size;
+}
+
+Arena& threadArena()
+{
+    thread_local Arena arena;
+    return arena;
+}
+
+void* allocate(uint64_t size) { return threadArena().allocate(size); }
+
+}  // namespace runtime
+
+}  // namespace pol
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pol {
+
+namespace runtime {
+
+/// Name lowered code allocates lists with, the JIT resolves it to allocate().
+constexpr const char* k_allocate = "conflake.alloc";
+
+struct Stats
+{
+    /// Allocations and their bytes since the arena was made.
+    size_t m_allocations = 0;
+    size_t m_bytes       = 0;
+
+    /// Blocks mapped since the arena was made.
+    size_t m_blocks = 0;
+
+    /// Most bytes handed out in one evaluation.
+    size_t m_peak_bytes = 0;
+
+    /// Evaluations ended.
+    size_t m_resets = 0;
+};
+
+/// Bump allocates the lists of one evaluation in blocks, and frees them all at once when the
+/// evaluation ends. A block of the standard size is kept for the next one.
+class Arena
+{
+   public:
+    explicit Arena(bool huge_pages = false) : m_huge_pages(huge_pages) {}
+    ~Arena();
+
+    Arena(const Arena&)            = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size)
+    {
+        auto pos = (uintptr_t(m_pos) + k_align - 1) & ~uintptr_t(k_align - 1);
+        if (pos + size > uintptr_t(m_end)) {
+            return allocateSlow(size);
+        }
+        m_pos = reinterpret_cast<char*>(pos + size);
+        count(size);
+        return reinterpret_cast<void*>(pos);
+    }
+
+    /// Ends an evaluation, what it allocated is gone.
+    void reset();
+
+    /// Backs the blocks mapped from now on with huge pages, where the system has them.
+    void setHugePages(bool huge_pages) { m_huge_pages = huge_pages; }
+
+    const Stats& stats() const { return m_stats; }
+
+   private:
+    struct Block
+    {
+        char*  m_data;
+        size_t m_size;
+
+        /// Mapped for items that fit a standard block rather than for one larger item.
+        bool m_standard;
+    };
+
+    void* allocateSlow(size_t size);
+
+    /// Maps bytes, aligned to huge pages and advised to use them if m_huge_pages.
+    char* map(size_t bytes);
+
+    void count(size_t size)
+    {
+        m_used += size;
+        m_stats.m_allocations++;
+        m_stats.m_bytes += size;
+    }
+
+    static constexpr size_t k_align      = 16;
+    static constexpr size_t k_block_size = 1 << 20;
+    static constexpr size_t k_huge_page  = 2 << 20;
+
+    bool               m_huge_pages;
+    std::vector<Block> m_blocks;
+    char*              m_pos  = nullptr;
+    char*              m_end  = nullptr;
+    size_t             m_used = 0;
+    Stats              m_stats;
+};
+
+/// Arena of the calling thread, the one lowered code allocates in.
+Arena& threadArena();
+
+/// Allocates size bytes in the arena of the calling thread, for lowered code.
+void* allocate(uint64_t size);
+
+}  // namespace runtime
+
+}  // namespace pol
@@ -1,21 +1,28 @@
 
 #include <pol_codegen.h>
+#include <pol_incremental.h>
 #include <pol_llvm.h>
+#include <pol_runtime.h>
+#include <pom_cache.h>
 #include <pom_lexer.h>
 #include <pom_parser.h>
+#include <pom_partialeval.h>
 #include <pom_semantic.h>
 
 #include <catch2/catch_test_macros.hpp>
 
 #include <filesystem>
+#include <fstream>
+#include <sstream>
 
-TEST_CASE("Whole pipeline test", "[whole][jit]")
-{
-    using namespace pom::lexer;
-    using Res = pol::codegen::Result;
+namespace {
 
+using Res = pol::codegen::Result;
+
+std::vector<std::pair<std::filesystem::path, Res>> examples()
+{
     // clang-format off
-    std::vector<std::pair<std::filesystem::path, Res>> ppp = {
+    return {
         {
             CONFLAKE_EXAMPLES "/test1.cfl", Res{9.0}
         },
@@ -52,20 +59,487 @@ TEST_CASE("Whole pipeline test", "[whole][jit]")
         {
             CONFLAKE_EXAMPLES "/test_fun_as_arg.cfl", Res{8.0}
         },
+        {
+            CONFLAKE_EXAMPLES "/test_shared.cfl", Res{54.0}
+        },
     };
     // clang-format on
+}
 
+}  // namespace
+
+TEST_CASE("Whole pipeline test", "[whole][jit]")
+{
     pol::initLlvm();
-    for (auto& [path, expected_res] : ppp) {
-        auto tokens = pom::lexer::lex(path);
-        REQUIRE(tokens);
+    for (bool hash_cons : {false, true}) {
+        for (bool partial_eval : {false, true}) {
+            for (auto& [path, expected_res] : examples()) {
+                auto tokens = pom::lexer::lex(path);
+                REQUIRE(tokens);
 
-        auto top_level = pom::parser::parse(*tokens);
-        REQUIRE(top_level);
-        auto sematic_res = pom::semantic::analyze(*top_level);
-        REQUIRE(sematic_res);
-        auto codege_res = pol::codegen::codegen(*sematic_res, false);
+                pom::ast::AstArena   arena;
+                pom::parser::Options options;
+                options.m_hash_cons = hash_cons;
+                auto top_level      = pom::parser::parse(*tokens, arena, options);
+                REQUIRE(top_level);
+                auto sematic_res = pom::semantic::analyze(*top_level);
+                REQUIRE(sematic_res);
+                if (partial_eval) {
+                    *sematic_res = pom::partialeval::evaluate(*sematic_res, arena).m_top_level;
+                }
+                auto codege_res = pol::codegen::codegen(*sematic_res, false);
+                REQUIRE(codege_res);
+                REQUIRE(*codege_res == expected_res);
+            }
+        }
+    }
+}
+
+TEST_CASE("Partially evaluated pipeline test", "[whole][jit][partialeval]")
+{
+    pol::initLlvm();
+    auto tokens = pom::lexer::lex(pom::Source::fromString(
+        "def p(real x, integer n) : real if(n < 1i, 1.0, x * p(x, n - 1i))\n"
+        "def q(real y) p(y, 3i) + p(2.0, 2i)\n"
+        "q(1.5)"));
+    REQUIRE(tokens);
+    pom::ast::AstArena arena;
+    auto               sematic_res = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+    REQUIRE(sematic_res);
+
+    // Without fuel nothing is evaluated, the clones run.
+    for (size_t fuel : {size_t(0), size_t(100000)}) {
+        pom::partialeval::Options options;
+        options.m_fuel = fuel;
+        auto evaluated = pom::partialeval::evaluate(*sematic_res, arena, options);
+        REQUIRE(evaluated.m_specializations == 4);
+        REQUIRE(evaluated.m_evaluated_calls == (fuel ? 2 : 0));
+        auto codege_res = pol::codegen::codegen(evaluated.m_top_level, false);
+        REQUIRE(codege_res);
+        REQUIRE(*codege_res == Res{1.5 * 1.5 * 1.5 + 4.0});
+    }
+}
+
+TEST_CASE("Cached pipeline test", "[whole][jit][cache]")
+{
+    pol::initLlvm();
+    auto dir = std::filesystem::temp_directory_path() / "pol_cache_test";
+    std::filesystem::remove_all(dir);
+    for (auto& [path, expected_res] : examples()) {
+        auto source = pom::Source::map(path);
+        REQUIRE(source);
+        auto cache_path = pom::cache::cachePath(dir, **source);
+        {
+            auto               tokens = pom::lexer::lex(*source);
+            pom::ast::AstArena arena;
+            auto               top_level   = pom::parser::parse(*tokens, arena);
+            auto               sematic_res = pom::semantic::analyze(*top_level);
+            REQUIRE(sematic_res);
+            REQUIRE(pom::cache::save(cache_path, **source, *sematic_res));
+        }
+
+        // Generated from the cache alone.
+        pom::ast::AstArena arena;
+        auto               cached = pom::cache::load(cache_path, **source, arena);
+        REQUIRE(cached);
+        auto codege_res = pol::codegen::codegen(*cached, false);
+        REQUIRE(codege_res);
+        REQUIRE(*codege_res == expected_res);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Streaming pipeline test", "[whole][jit]")
+{
+    pol::initLlvm();
+    for (auto& [path, expected_res] : examples()) {
+        std::ifstream           ist(path);
+        pom::lexer::Lexer       lexer(ist);
+        pom::ast::AstArena      arena;
+        pom::parser::Parser     parser(lexer, arena);
+        pom::semantic::Analyzer analyzer;
+        pol::codegen::Session   session(false);
+        while (1) {
+            auto unit = parser.next();
+            REQUIRE(unit);
+            if (!*unit) {
+                break;
+            }
+            auto sematic_res = analyzer.analyze(**unit);
+            REQUIRE(sematic_res);
+            for (auto& sem_unit : *sematic_res) {
+                REQUIRE(session.add(sem_unit));
+            }
+            arena.reset();
+        }
+        auto codege_res = session.evaluate();
         REQUIRE(codege_res);
         REQUIRE(*codege_res == expected_res);
     }
+
+    // Each anonymous expression replaces the one before.
+    std::istringstream      ist("def sq(real x) x * x; sq(2.0); sq(3.0); 1.0 + sq(4.0)");
+    pom::lexer::Lexer       lexer(ist);
+    pom::ast::AstArena      arena;
+    pom::parser::Parser     parser(lexer, arena);
+    pom::semantic::Analyzer analyzer;
+    pol::codegen::Session   session(false);
+    while (auto unit = parser.next()) {
+        if (!*unit) {
+            break;
+        }
+        auto sematic_res = analyzer.analyze(**unit);
+        REQUIRE(sematic_res);
+        REQUIRE(sematic_res->size() == 1);
+        REQUIRE(session.add(sematic_res->front()));
+    }
+    auto res = session.evaluate();
+    REQUIRE(res);
+    REQUIRE(*res == Res{17.0});
+}
+
+TEST_CASE("Incremental pipeline test", "[whole][jit][incremental]")
+{
+    pol::initLlvm();
+    using Names = std::vector<pom::Symbol>;
+    auto anon   = pom::Symbol("__anon_expr");
+
+    pol::incremental::Compiler compiler;
+    auto                       update = [&](const char* text) {
+        return compiler.update(pom::Source::fromString(text));
+    };
+
+    auto report = update("def sq(real x) x * x\n"
+                         "def quad(real x) sq(x) * sq(x)\n"
+                         "def cube(real x) x * x * x\n"
+                         "cube(2.0) + quad(2.0)\n");
+    REQUIRE(report);
+    REQUIRE(report->m_reused.empty());
+    REQUIRE(report->m_compiled == Names{"sq", "quad", "cube", anon});
+    REQUIRE(*compiler.evaluate() == Res{24.0});
+
+    // Nothing changed.
+    report = update("def sq(real x) x * x\n"
+                    "def quad(real x) sq(x) * sq(x)\n"
+                    "def cube(real x) x * x * x\n"
+                    "cube(2.0) + quad(2.0)\n");
+    REQUIRE(report);
+    REQUIRE(report->m_reused == Names{"sq", "quad", "cube", anon});
+    REQUIRE(report->m_analyzed.empty());
+    REQUIRE(report->m_compiled.empty());
+    REQUIRE(*compiler.evaluate() == Res{24.0});
+
+    // The body of sq changed, its type did not: quad and the expression calling it are only
+    // compiled again.
+    report = update("def sq(real x) x * x + 1.0\n"
+                    "def quad(real x) sq(x) * sq(x)\n"
+                    "def cube(real x) x * x * x\n"
+                    "cube(2.0) + quad(2.0)\n");
+    REQUIRE(report);
+    REQUIRE(report->m_reused == Names{"cube"});
+    REQUIRE(report->m_analyzed == Names{"sq"});
+    REQUIRE(report->m_compiled == Names{"sq", "quad", anon});
+    REQUIRE(*compiler.evaluate() == Res{33.0});
+
+    // The type of sq changed, quad is analyzed again and fails. Units after it are analyzed again
+    // by the next update.
+    report = update("def sq(integer x) x * x\n"
+                    "def quad(real x) sq(x) * sq(x)\n"
+                    "def cube(real x) x * x * x\n"
+                    "cube(2.0) + quad(2.0)\n");
+    REQUIRE(!report);
+
+    report = update("def sq(integer x) x * x\n"
+                    "def quad(integer x) sq(x) * sq(x)\n"
+                    "def cube(real x) x * x * x\n"
+                    "quad(2i)\n");
+    REQUIRE(report);
+    REQUIRE(report->m_reused == Names{"sq"});
+    REQUIRE(report->m_analyzed == Names{"quad", "cube", anon});
+    REQUIRE(*compiler.evaluate() == Res{int64_t(16)});
+
+    report = update("def sq(integer x) x * x\n"
+                    "def quad(integer x) sq(x) * sq(x)\n"
+                    "quad(3i)\n");
+    REQUIRE(report);
+    REQUIRE(report->m_reused == Names{"sq", "quad"});
+    REQUIRE(report->m_analyzed == Names{anon});
+    REQUIRE(report->m_removed == Names{"cube"});
+    REQUIRE(*compiler.evaluate() == Res{int64_t(81)});
+
+    // Edits relex only around them.
+    report = compiler.update(pom::lexer::Edit{57, 0, " + 1i"});
+    REQUIRE(report);
+    REQUIRE(report->m_reused == Names{"sq"});
+    REQUIRE(report->m_compiled == Names{"quad", anon});
+    REQUIRE(*compiler.evaluate() == Res{int64_t(82)});
+}
+
+TEST_CASE("Memoized pipeline test", "[whole][jit][memo]")
+{
+    pol::initLlvm();
+    auto run = [](pol::codegen::Session& session, const std::string& text) {
+        pom::ast::AstArena arena;
+        auto               tokens = pom::lexer::lex(pom::Source::fromString(text));
+        REQUIRE(tokens);
+        auto analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+        REQUIRE(analyzed);
+        for (auto& unit : *analyzed) {
+            REQUIRE(session.add(unit));
+        }
+        return session.evaluate();
+    };
+    std::string fib = "def fib(integer x) : integer if(x < 2i, x, fib(x - 1i) + fib(x - 2i))\n";
+
+    // Without the table this would take longer than the test suite.
+    pol::codegen::Options options;
+    options.m_memoize = true;
+    pol::codegen::Session session(options);
+    REQUIRE(*run(session, fib + "fib(90i)") == Res{int64_t(2880067194370816120)});
+    REQUIRE(*session.evaluate() == Res{int64_t(2880067194370816120)});
+
+    // Colliding arguments evict each other, values stay right.
+    options.m_memo_slots = 3;
+    pol::codegen::Session small(options);
+    REQUIRE(*run(small, fib + "fib(25i)") == Res{int64_t(75025)});
+}
+
+TEST_CASE("Memory attributes test", "[jit]")
+{
+    pol::initLlvm();
+    auto ir = [](const std::string& text, const pol::codegen::Options& options) {
+        auto tokens = pom::lexer::lex(pom::Source::fromString(text));
+        REQUIRE(tokens);
+        pom::ast::AstArena arena;
+        auto               analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+        REQUIRE(analyzed);
+
+        std::ostringstream    out;
+        pol::codegen::Options printing = options;
+        printing.m_print_ir            = true;
+        printing.m_ir_stream           = &out;
+        pol::codegen::Session session(printing);
+        for (auto& unit : *analyzed) {
+            REQUIRE(session.add(unit));
+        }
+        return out.str();
+    };
+
+    // Attributes of the first definition or declaration of name, each module numbers its
+    // attribute groups anew.
+    auto attributes = [](const std::string& text, const std::string& kind, const char* name) {
+        std::istringstream lines(text);
+        std::string        line, group;
+        while (group.empty() && std::getline(lines, line)) {
+            if (line.rfind(kind + " ", 0) == 0 &&
+                line.find(std::string("@") + name + "(") != std::string::npos) {
+                group = line.substr(line.find(") #") + 2);
+                group = group.substr(0, group.find(' '));
+            }
+        }
+        while (std::getline(lines, line)) {
+            if (line.rfind("attributes " + group + " = ", 0) == 0) {
+                return line;
+            }
+        }
+        FAIL("no attributes for " << name);
+        return line;
+    };
+    auto has = [](const std::string& text, const char* attribute) {
+        return text.find(attribute) != std::string::npos;
+    };
+
+    auto text = ir("def scale(real a, real b) a * b\n"
+                   "def second(list<real> l) l[1]\n"
+                   "def scaled(list<real> l, real a) scale(second(l), a)\n"
+                   "def pair(real a) second([a a])\n",
+                   {});
+
+    // Only scalars are read: no memory is.
+    REQUIRE(has(attributes(text, "define", "scale"), "readnone"));
+    REQUIRE(!has(attributes(text, "define", "scale"), "argmemonly"));
+
+    // Items of the lists given are read, directly or by a callee.
+    for (auto name : {"second", "scaled"}) {
+        REQUIRE(has(attributes(text, "define", name), "readonly"));
+        REQUIRE(has(attributes(text, "define", name), "argmemonly"));
+        REQUIRE(!has(attributes(text, "define", name), "readnone"));
+    }
+
+    // Lists are allocated.
+    REQUIRE(!has(attributes(text, "define", "pair"), "readnone"));
+    REQUIRE(!has(attributes(text, "define", "pair"), "readonly"));
+
+    // Calls of a memoized function write its table, wherever it is declared.
+    pol::codegen::Options memoize;
+    memoize.m_memoize = true;
+    text = ir("def fib(integer x) : integer if(x < 2i, x, fib(x - 1i) + fib(x - 2i))\n"
+              "def twice(integer x) : integer fib(x) + fib(x)\n",
+              memoize);
+    REQUIRE(!has(attributes(text, "define", "fib"), "readnone"));
+    REQUIRE(!has(attributes(text, "declare", "fib"), "readnone"));
+    REQUIRE(has(attributes(text, "declare", "fib"), "nounwind"));
+
+    // So do calls of its callers.
+    REQUIRE(!has(attributes(text, "define", "twice"), "readnone"));
+}
+
+TEST_CASE("Redefinition pipeline test", "[whole][jit]")
+{
+    pol::initLlvm();
+
+    // Callers keep the definition they saw, the ones after it get the new one.
+    std::string defs = "def f(real a) a + 1.0\n"
+                       "def g(real b) f(b)\n"
+                       "def f(real a) a + 100.0\n"
+                       "def h(real c) f(c)\n";
+    for (auto [expr, expected] : {std::pair{"g(5.0)", 6.0}, std::pair{"g(5.0) + h(5.0)", 111.0}}) {
+        auto tokens = pom::lexer::lex(pom::Source::fromString(defs + expr));
+        REQUIRE(tokens);
+        pom::ast::AstArena arena;
+        auto analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+        REQUIRE(analyzed);
+        auto res = pol::codegen::codegen(*analyzed, false);
+        REQUIRE(res);
+        REQUIRE(*res == Res{expected});
+    }
+
+    // Analysis rejects a redefinition of another type. A session given one declares it from its
+    // own signature.
+    pom::ast::AstArena arena;
+    auto               analyze = [&](const char* text) {
+        auto tokens = pom::lexer::lex(pom::Source::fromString(text));
+        REQUIRE(tokens);
+        return pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+    };
+    auto retyped = analyze("def g(real a) a + 1.0\ndef g(real a) a < 1.0\n");
+    REQUIRE(!retyped);
+    REQUIRE(retyped.error().m_desc == "g redefined as (real,) -> boolean, it is (real,) -> real");
+
+    pol::codegen::Session session(false);
+    for (auto text : {"def g(real a) a + 1.0\n", "def g(real a) a < 1.0\ng(0.5)\n"}) {
+        auto analyzed = analyze(text);
+        REQUIRE(analyzed);
+        for (auto& unit : *analyzed) {
+            REQUIRE(session.add(unit));
+        }
+    }
+    REQUIRE(*session.evaluate() == Res{true});
+}
+
+TEST_CASE("Self tail call pipeline test", "[whole][jit]")
+{
+    pol::initLlvm();
+
+    // Calls would need gigabytes of stack, the loops need none.
+    auto tokens = pom::lexer::lex(pom::Source::fromString(
+        "def count(integer n, integer acc) : integer if(n < 1i, acc, count(n - 1i, acc + 1i))\n"
+        "def steps(integer n, integer acc) : integer\n"
+        "    if(n < 2i, acc, if(n > 100i, steps(n - 100i, acc + 1i), steps(n - 1i, acc + 1i)))\n"
+        "count(50000000i, 0i) + steps(50000000i, 0i)\n"));
+    REQUIRE(tokens);
+    pom::ast::AstArena arena;
+    auto               analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+    auto res = pol::codegen::codegen(*analyzed, false);
+    REQUIRE(res);
+    REQUIRE(*res == Res{int64_t(50500098)});
+}
+
+TEST_CASE("Generic pipeline test", "[whole][jit]")
+{
+    pol::initLlvm();
+
+    auto tokens = pom::lexer::lex(pom::Source::fromString(
+        "def sq<T>(T x) : T x * x\n"
+        "def pow<T>(T x, integer n) : T if(n < 1i, x, sq(pow(x, n - 1i)))\n"
+        "def second<T>(list<T> l) : T l[1]\n"
+        "def f(real a) pow(a, 2i) + second([a sq(a)])\n"
+        "def g(integer a) sq(a) + pow(a, 1i)\n"
+        "f(2.0) + if(g(3i) > 10i, 1.0, 0.0)\n"));
+    REQUIRE(tokens);
+    pom::ast::AstArena arena;
+    auto               analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+
+    // One function for each generic function and type arguments used.
+    REQUIRE(analyzed->size() == 8);
+    auto res = pol::codegen::codegen(*analyzed, false);
+    REQUIRE(res);
+    REQUIRE(*res == Res{21.0});
+}
+
+TEST_CASE("Stack list pipeline test", "[whole][jit]")
+{
+    pol::initLlvm();
+
+    // Lists given to self calls in tail position or returned stay on the heap.
+    auto tokens = pom::lexer::lex(pom::Source::fromString(
+        "def third(list<real> x) x[2]\n"
+        "def mk(real a) [a a + 1.0 a + 2.0]\n"
+        "def f(real a) third([a a a * 3.0]) + third(mk(a))\n"
+        "def tail(list<real> x, integer n) : real if(n < 1i, x[0], tail([x[1] x[0]], n - 1i))\n"
+        "f(2.0) + tail([1.0 2.0], 3i)\n"));
+    REQUIRE(tokens);
+    pom::ast::AstArena arena;
+    auto               analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+    auto res = pol::codegen::codegen(*analyzed, false);
+    REQUIRE(res);
+    REQUIRE(*res == Res{12.0});
+    REQUIRE(res->m_stack_lists == 2);
+}
+
+TEST_CASE("Arena pipeline test", "[whole][jit]")
+{
+    pol::initLlvm();
+
+    // Allocations are aligned, blocks to huge pages when backed by them. Large allocations get a
+    // block of their own, a reset keeps a standard one.
+    pol::runtime::Arena arena(true);
+    auto                small = arena.allocate(24);
+    auto                next  = arena.allocate(8);
+    REQUIRE(uintptr_t(small) % (2 << 20) == 0);
+    REQUIRE(uintptr_t(next) % 16 == 0);
+    REQUIRE(static_cast<char*>(next) == static_cast<char*>(small) + 32);
+    REQUIRE(uintptr_t(arena.allocate(8 << 20)) % (2 << 20) == 0);
+    REQUIRE(arena.stats().m_blocks == 2);
+    arena.reset();
+    REQUIRE(arena.allocate(24) == small);
+    REQUIRE(arena.stats().m_allocations == 4);
+    REQUIRE(arena.stats().m_peak_bytes == 24 + 8 + (8 << 20));
+
+    // A large first allocation is not kept.
+    pol::runtime::Arena large;
+    REQUIRE(large.allocate(8 << 20));
+    large.reset();
+    REQUIRE(large.allocate(24));
+    REQUIRE(large.stats().m_blocks == 2);
+    large.reset();
+    REQUIRE(large.allocate(24));
+    REQUIRE(large.stats().m_blocks == 2);
+
+    // Lists that outlive their function go to the arena, which each evaluation starts empty.
+    auto tokens = pom::lexer::lex(pom::Source::fromString(
+        "def third(list<real> x) x[2]\n"
+        "def mk(real a) [a a + 1.0 a + 2.0 a + 3.0]\n"
+        "def sum(real a, integer n) : real if(n < 1i, a, sum(third(mk(a)), n - 1i))\n"
+        "sum(0.0, 1000i)\n"));
+    REQUIRE(tokens);
+    pom::ast::AstArena ast_arena;
+    auto analyzed = pom::semantic::analyze(*pom::parser::parse(*tokens, ast_arena));
+    REQUIRE(analyzed);
+    pol::codegen::Session session(false);
+    for (auto& unit : *analyzed) {
+        REQUIRE(session.add(unit));
+    }
+    auto resets = pol::runtime::threadArena().stats().m_resets;
+    for (int run = 0; run < 2; run++) {
+        auto res = session.evaluate();
+        REQUIRE(res);
+        REQUIRE(*res == Res{2000.0});
+        REQUIRE(res->m_arena_lists == 1000);
+        REQUIRE(res->m_arena_bytes == 32000);
+    }
+    REQUIRE(pol::runtime::threadArena().stats().m_resets == resets + 2);
 }
@@ -0,0 +1,97 @@
+
+#include <pom_lexer.h>
+#include <pom_scan.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/format.h>
+
+#include <string>
+
+namespace {
+
+/// A machine generated looking program: long names, long numbers, comments and indentation.
+std::string generatedProgram(size_t approx_size)
+{
+    std::string text;
+    for (size_t i = 0; text.size() < approx_size; i++) {
+        text += fmt::format("# generated unit {0}, do not edit this comment by hand\n", i);
+        text += fmt::format("def generatedFunctionNumber{0}(real firstArgument, real secondArgument)\n",
+                            i);
+        text += fmt::format("        firstArgument * 12345.678901 + secondArgument * {0}.25 - "
+                            "firstArgument * secondArgument\n\n",
+                            i);
+    }
+    return text;
+}
+
+}  // namespace
+
+TEST_CASE("Lexer throughput", "[!benchmark][lexer]")
+{
+    using namespace pom;
+
+    auto source = Source::fromString(generatedProgram(8ull << 20));
+    auto best   = scan::detectIsa();
+
+    for (auto isa : {scan::Isa::k_scalar, scan::Isa::k_sse42, scan::Isa::k_avx2}) {
+        if (scan::setIsa(isa) != isa) {
+            continue;
+        }
+        BENCHMARK(fmt::format("lex 8 MiB ({0})", scan::toString(isa)))
+        {
+            return lexer::lex(source)->m_tokens.size();
+        };
+    }
+    scan::setIsa(best);
+}
+
+TEST_CASE("Scanner throughput", "[!benchmark][scan]")
+{
+    using namespace pom;
+
+    std::string spaces(1 << 20, ' ');
+    std::string comment(1 << 20, 'c');
+    auto        best = scan::detectIsa();
+
+    for (auto isa : {scan::Isa::k_scalar, scan::Isa::k_sse42, scan::Isa::k_avx2}) {
+        if (scan::setIsa(isa) != isa) {
+            continue;
+        }
+        BENCHMARK(fmt::format("skip 1 MiB of spaces ({0})", scan::toString(isa)))
+        {
+            return scan::skipSpace(spaces.data(), spaces.data() + spaces.size());
+        };
+        BENCHMARK(fmt::format("skip 1 MiB comment ({0})", scan::toString(isa)))
+        {
+            return scan::skipToEol(comment.data(), comment.data() + comment.size());
+        };
+    }
+    scan::setIsa(best);
+}
+
+TEST_CASE("Relexing an edit", "[!benchmark][lexer]")
+{
+    using namespace pom;
+
+    auto text   = generatedProgram(8ull << 20);
+    auto offset = uint32_t(text.find("generatedFunctionNumber", text.size() / 2));
+    auto tokens = lexer::lex(Source::fromString(text));
+    REQUIRE(tokens);
+
+    // Relexing edits the tokens in place, each run renames the identifier and back.
+    BENCHMARK("relex one identifier in 8 MiB twice")
+    {
+        auto renamed = lexer::relex(*tokens, lexer::Edit{offset, 9, "renamed"});
+        auto back    = lexer::relex(*tokens, lexer::Edit{offset, 7, "generated"});
+        return renamed->m_new_end + back->m_new_end;
+    };
+
+    BENCHMARK("lex edited 8 MiB from scratch")
+    {
+        auto edited = text;
+        edited.replace(offset, 9, "renamed");
+        return lexer::lex(Source::fromString(std::move(edited)))->m_tokens.size();
+    };
+}
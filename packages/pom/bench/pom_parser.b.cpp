@@ -0,0 +1,198 @@
+#include <pom_lexer.h>
+#include <pom_parser.h>
+#include <pom_partialeval.h>
+#include <pom_semantic.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/format.h>
+
+#include <fstream>
+#include <functional>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+/// Defs with calls, lists and operator chains, about 20 nodes each.
+std::string nodeHeavyProgram(size_t defs)
+{
+    std::string text;
+    for (size_t i = 0; i < defs; i++) {
+        text += fmt::format(
+            "def f{0}(real a, real b) a * b + g{0}(a, b - 1.5, [a b 2.0]) * {0}.5 - h(a * b, "
+            "b)\n",
+            i);
+    }
+    return text;
+}
+
+/// One def whose body is a chain of terms, as generated formulas are.
+std::string longChainProgram(size_t terms)
+{
+    std::string text = "def f(real a) a";
+    for (size_t i = 0; i < terms; i++) {
+        text += i % 2 ? " + 1.5" : " * a";
+    }
+    return text + "\n";
+}
+
+/// One def whose body is nested depth parens and calls deep.
+std::string deepNestingProgram(size_t depth)
+{
+    std::string text = "def f(real a) ";
+    for (size_t i = 0; i < depth; i++) {
+        text += i % 2 ? "(" : "g(a, ";
+    }
+    text += "a";
+    text.append(depth, ')');
+    return text + "\n";
+}
+
+/// One def whose body is depth ifs nested in their else arms, and a call of it the partial
+/// evaluator runs through all of them.
+std::string deepIfProgram(size_t depth)
+{
+    std::string text = "def f(integer n) : integer ";
+    for (size_t i = 0; i < depth; i++) {
+        text += fmt::format("if(n < {0}i, {0}i, ", i);
+    }
+    text += "n";
+    text.append(depth, ')');
+    return text + fmt::format("\nf({0}i)\n", depth);
+}
+
+/// Runs fn on a thread with a small stack, anything recursing per node would overflow it.
+void runWithStack(size_t stack_size, const std::function<void()>& fn)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+    pthread_t thread;
+    auto      run = [](void* arg) -> void* {
+        (*static_cast<const std::function<void()>*>(arg))();
+        return nullptr;
+    };
+    pthread_create(&thread, &attr, run, const_cast<std::function<void()>*>(&fn));
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+}
+
+size_t residentBytes()
+{
+    size_t        pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+}  // namespace
+
+TEST_CASE("Parser on a million nodes", "[!benchmark][parser]")
+{
+    using namespace pom;
+
+    auto tokens = lexer::lex(Source::fromString(nodeHeavyProgram(50000)));
+    REQUIRE(tokens);
+
+    {
+        auto          before = residentBytes();
+        ast::AstArena arena;
+        auto          top_level = parser::parse(*tokens, arena);
+        REQUIRE(top_level);
+        size_t nodes = 0;
+        for (auto& unit : *top_level) {
+            ast::visitExprTree(*std::get<ast::Function>(unit).m_code, [&](const ast::Expr&) {
+                nodes++;
+                return true;
+            });
+        }
+        fmt::print("{0} nodes, {1:.1f} MiB resident for the ast, {2:.1f} MiB in the arena\n",
+                   nodes, double(residentBytes() - before) / (1 << 20),
+                   double(arena.used()) / (1 << 20));
+    }
+
+    BENCHMARK("parse 1M nodes")
+    {
+        ast::AstArena arena;
+        return parser::parse(*tokens, arena)->size();
+    };
+}
+
+TEST_CASE("Parser on million term expressions", "[!benchmark][parser]")
+{
+    using namespace pom;
+
+    auto chain = lexer::lex(Source::fromString(longChainProgram(1000000)));
+    REQUIRE(chain);
+    auto nesting = lexer::lex(Source::fromString(deepNestingProgram(1000000)));
+    REQUIRE(nesting);
+
+    // Every phase on a 256 KiB stack. Assertions stay on the main thread.
+    for (auto tokens : {&*chain, &*nesting}) {
+        bool   parsed = false, equal = false;
+        size_t nodes = 0, rows = 0, printed = 0;
+        runWithStack(256 << 10, [&] {
+            ast::AstArena arena;
+            auto          top_level = parser::parse(*tokens, arena);
+            if (!(parsed = bool(top_level))) {
+                return;
+            }
+            auto& function = std::get<ast::Function>(top_level->front());
+            ast::visitExprTree(*function.m_code, [&](const ast::Expr&) { return ++nodes; });
+            rows  = function.m_flat.size();
+            equal = *top_level == *top_level;
+            std::ostringstream ost;
+            ost << function;
+            printed = ost.str().size();
+        });
+        REQUIRE(parsed);
+        REQUIRE(nodes == rows);
+        REQUIRE(equal);
+        fmt::print("{0} nodes, {1:.1f} MiB printed\n", nodes, double(printed) / (1 << 20));
+    }
+
+    bool analyzed = false;
+    runWithStack(256 << 10, [&] {
+        ast::AstArena arena;
+        analyzed = bool(semantic::analyze(*parser::parse(*chain, arena)));
+    });
+    REQUIRE(analyzed);
+
+    // The evaluator scans the arms of the ifs without recursing.
+    auto ifs = lexer::lex(Source::fromString(deepIfProgram(100000)));
+    REQUIRE(ifs);
+    size_t evaluated = 0;
+    runWithStack(256 << 10, [&] {
+        ast::AstArena arena;
+        auto          top_level = semantic::analyze(*parser::parse(*ifs, arena));
+        if (!top_level) {
+            return;
+        }
+        partialeval::Options options;
+        options.m_fuel = 1000000;
+        evaluated      = partialeval::evaluate(*top_level, arena, options).m_evaluated_calls;
+    });
+    REQUIRE(evaluated == 1);
+
+    // Each doubles the one before, times should too.
+    for (size_t terms : {250000, 500000, 1000000}) {
+        auto tokens = lexer::lex(Source::fromString(longChainProgram(terms)));
+        REQUIRE(tokens);
+        BENCHMARK(fmt::format("parse and analyze a {0} term chain", terms))
+        {
+            ast::AstArena arena;
+            auto          top_level = parser::parse(*tokens, arena);
+            return semantic::analyze(*top_level)->size();
+        };
+    }
+
+    BENCHMARK("parse 1M nested parens and calls")
+    {
+        ast::AstArena arena;
+        return parser::parse(*nesting, arena)->size();
+    };
+}
@@ -0,0 +1,90 @@
+#include <pom_lexer.h>
+#include <pom_parser.h>
+#include <pom_semantic.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/format.h>
+
+#include <string>
+
+namespace {
+
+/// Defs taking nested list and function types, whose bodies are chains of list literals and
+/// calls through function arguments, so analysis spends its time building and comparing types.
+std::string typeHeavyProgram(size_t defs, size_t terms)
+{
+    std::string text = "def k(list<real> xs, real a) a\n";
+    for (size_t i = 0; i < defs; i++) {
+        text += fmt::format(
+            "def g{0}(list<list<real>> xs, fun<real, list<real>, real> h, real a) a", i);
+        for (size_t t = 0; t < terms; t++) {
+            text += t % 2 ? " + h([a a a a a a a a], a)" : " * h([a 1.5 a 2.5], a)";
+        }
+        text += fmt::format("\ndef f{0}(real a) a", i);
+        for (size_t t = 0; t < terms; t++) {
+            text += fmt::format(" + g{0}([[a 1.0 2.0 a] [a a a a] [3.0 a 4.0 a]], k, a)", i);
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+/// Many small defs, each calling the one before.
+std::string manyDefsProgram(size_t defs)
+{
+    std::string text = "def f0(real a) a\n";
+    for (size_t i = 1; i < defs; i++) {
+        text += fmt::format("def f{0}(real a) f{1}(a) * 2.0 + a\n", i, i - 1);
+    }
+    return text;
+}
+
+}  // namespace
+
+TEST_CASE("Semantic analysis of type heavy programs", "[!benchmark][semantic]")
+{
+    using namespace pom;
+
+    auto tokens = lexer::lex(Source::fromString(typeHeavyProgram(100, 500)));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          top_level = parser::parse(*tokens, arena);
+    REQUIRE(top_level);
+    REQUIRE(semantic::analyze(*top_level));
+
+    // Made first: once a thread exists shared_ptr counts are atomic, the calling thread alone
+    // would otherwise be measured in a single threaded process.
+    ThreadPool pool(3);
+
+    ThreadPool inline_pool(0);
+    BENCHMARK("analyze 100k typed calls on the calling thread")
+    {
+        return semantic::analyze(*top_level, inline_pool)->size();
+    };
+
+    // The defs only depend on k and the g before them, most can be checked concurrently.
+    BENCHMARK("analyze 100k typed calls on 3 workers")
+    {
+        return semantic::analyze(*top_level, pool)->size();
+    };
+}
+
+TEST_CASE("Semantic analysis of many defs", "[!benchmark][semantic]")
+{
+    using namespace pom;
+
+    // Each doubles the one before, times should too.
+    for (size_t defs : {12500, 25000, 50000}) {
+        auto tokens = lexer::lex(Source::fromString(manyDefsProgram(defs)));
+        REQUIRE(tokens);
+        ast::AstArena arena;
+        auto          top_level = parser::parse(*tokens, arena);
+        REQUIRE(top_level);
+        BENCHMARK(fmt::format("analyze {0} defs", defs))
+        {
+            return semantic::analyze(*top_level)->size();
+        };
+    }
+}
@@ -10,57 +10,110 @@ namespace pom {
 
 namespace ast {
 
-struct ExprVisitor
-{
-    using VisitorFun = std::function<bool(const Expr&)>;
+namespace {
 
-    ExprVisitor(const VisitorFun& fun) : m_fun(fun) {}
+size_t childCount(const Expr& expr)
+{
+    return std::visit(
+        [](auto& v) -> size_t {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, BinaryExpr>) {
+                return 2;
+            } else if constexpr (std::is_same_v<T, Call>) {
+                return v.m_args.size();
+            } else if constexpr (std::is_same_v<T, ListExpr>) {
+                return v.m_expressions.size();
+            } else {
+                return 0;
+            }
+        },
+        expr.m_val);
+}
 
-    bool operator()(const Literal&) { return true; }
-    bool operator()(const Var&) { return true; }
-    bool operator()(const BinaryExpr& v)
-    {
-        if (!visitExprTree(*v.m_lhs, m_fun) || !visitExprTree(*v.m_rhs, m_fun)) {
-            return false;
-        }
-        return true;
-    }
-    bool operator()(const Call& v)
-    {
-        for (auto& e : v.m_args) {
-            if (!visitExprTree(*e, m_fun)) {
-                return false;
+ExprP child(const Expr& expr, size_t i)
+{
+    return std::visit(
+        [i](auto& v) -> ExprP {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, BinaryExpr>) {
+                return i == 0 ? v.m_lhs : v.m_rhs;
+            } else if constexpr (std::is_same_v<T, Call>) {
+                return v.m_args[i];
+            } else if constexpr (std::is_same_v<T, ListExpr>) {
+                return v.m_expressions[i];
+            } else {
+                return nullptr;
             }
-        }
-        return true;
+        },
+        expr.m_val);
+}
+
+/// Compares the nodes themselves, not their children.
+bool sameNode(const Expr& a, const Expr& b)
+{
+    if (a.m_val.index() != b.m_val.index()) {
+        return false;
     }
-    bool operator()(const ListExpr& v)
-    {
-        for (auto& e : v.m_expressions) {
-            if (!visitExprTree(*e, m_fun)) {
-                return false;
+    return std::visit(
+        [&](auto& v) {
+            using T  = std::decay_t<decltype(v)>;
+            auto& w  = std::get<T>(b.m_val);
+            if constexpr (std::is_same_v<T, Literal> || std::is_same_v<T, Var>) {
+                return v == w;
+            } else if constexpr (std::is_same_v<T, BinaryExpr>) {
+                return v.m_op == w.m_op;
+            } else if constexpr (std::is_same_v<T, Call>) {
+                return v.m_function == w.m_function && v.m_args.size() == w.m_args.size();
+            } else {
+                return v.m_expressions.size() == w.m_expressions.size();
             }
-        }
-        return true;
-    }
+        },
+        a.m_val);
+}
 
-    const VisitorFun& m_fun;
-};
+/// Something the Printer still has to write: a node, or text closing one.
+using PrintItem = std::variant<ExprP, const char*>;
+
+}  // namespace
 
 bool visitExprTree(const Expr& expr, const std::function<bool(const Expr&)>& visitor_fun)
 {
-    ExprVisitor expr_visitor(visitor_fun);
-    auto        stop = std::visit(expr_visitor, expr.m_val);
-    if (!stop) {
-        return false;
+    // Post-order with an explicit stack of nodes and the next child to visit.
+    std::vector<std::pair<ExprP, size_t>> stack = {{&expr, 0}};
+    while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        if (next < childCount(*node)) {
+            stack.emplace_back(child(*node, next++), 0);
+            continue;
+        }
+        if (!visitor_fun(*node)) {
+            return false;
+        }
+        stack.pop_back();
     }
-    return visitor_fun(expr);
+    return true;
 }
 
+/// Writes the nodes of a tree. Children are pushed on m_pending, so nesting costs no native
+/// stack.
 struct Printer
 {
     Printer(std::ostream& ost) : m_ost(ost) {}
 
+    void print(const Expr& expr)
+    {
+        m_pending.push_back(&expr);
+        while (!m_pending.empty()) {
+            auto item = m_pending.back();
+            m_pending.pop_back();
+            if (auto text = std::get_if<const char*>(&item)) {
+                m_ost << *text;
+            } else {
+                std::visit(*this, std::get<ExprP>(item)->m_val);
+            }
+        }
+    }
+
     void operator()(const Literal& v)
     {
         std::visit([&](auto& w) { m_ost << w; }, v);
@@ -75,28 +128,49 @@ struct Printer
     }
     void operator()(const BinaryExpr& v)
     {
-        m_ost << "(be: " << v.m_op << " " << *v.m_lhs << " " << *v.m_rhs << ")";
+        m_ost << "(be: " << v.m_op << " ";
+        m_pending.insert(m_pending.end(), {")", v.m_rhs, " ", v.m_lhs});
     }
     void operator()(const Call& v)
     {
         m_ost << "[call " << v.m_function << " <- ";
-        for (auto& a : v.m_args) {
-            m_ost << *a << ", ";
-        }
-        m_ost << "]";
+        pushItems(v.m_args);
     }
     void operator()(const ListExpr& v)
     {
         m_ost << "[";
-        for (auto& e : v.m_expressions) {
-            m_ost << *e << ", ";
+        pushItems(v.m_expressions);
+    }
+
+    /// Items followed by ", ", then "]".
+    void pushItems(const ArenaArray<ExprP>& items)
+    {
+        m_pending.push_back("]");
+        for (auto it = items.end(); it != items.begin();) {
+            m_pending.insert(m_pending.end(), {", ", *--it});
         }
-        m_ost << "]";
     }
 
-    std::ostream& m_ost;
+    std::ostream&          m_ost;
+    std::vector<PrintItem> m_pending;
 };
 
+bool Expr::operator==(const Expr& other) const
+{
+    std::vector<std::pair<ExprP, ExprP>> stack = {{this, &other}};
+    while (!stack.empty()) {
+        auto [a, b] = stack.back();
+        stack.pop_back();
+        if (!sameNode(*a, *b)) {
+            return false;
+        }
+        for (size_t i = 0, n = childCount(*a); i < n; i++) {
+            stack.emplace_back(child(*a, i), child(*b, i));
+        }
+    }
+    return true;
+}
+
 bool Var::operator==(const Var& other) const
 {
     return m_name == other.m_name && m_subscript == other.m_subscript;
@@ -135,7 +209,7 @@ bool Arg::operator==(const Arg& other) const
 bool Signature::operator==(const Signature& other) const
 {
     return ((!m_ret_type && !other.m_ret_type) || *m_ret_type == *other.m_ret_type) &&
-           m_name == other.m_name && m_args == other.m_args;
+           m_name == other.m_name && m_args == other.m_args && m_type_params == other.m_type_params;
 }
 
 bool Function::operator==(const Function& other) const
@@ -146,7 +220,7 @@ bool Function::operator==(const Function& other) const
 std::ostream& operator<<(std::ostream& ost, const Expr& e)
 {
     Printer p(ost);
-    std::visit(p, e.m_val);
+    p.print(e);
     return ost;
 }
 
@@ -162,7 +236,15 @@ std::ostream& operator<<(std::ostream& ost, const TypeDesc& ty)
 
 std::ostream& operator<<(std::ostream& ost, const Signature& sig)
 {
-    ost << sig.m_name << " <- ";
+    ost << sig.m_name;
+    if (!sig.m_type_params.empty()) {
+        ost << "<";
+        for (auto param : sig.m_type_params) {
+            ost << param << ",";
+        }
+        ost << ">";
+    }
+    ost << " <- ";
     for (auto& [arg_type, arg_name] : sig.m_args) {
         ost << arg_name << ":" << *arg_type << ",";
     }
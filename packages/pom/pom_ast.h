@@ -4,23 +4,48 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
 #include <pom_literals.h>
+#include <pom_symbol.h>
 
 namespace pom {
 
 namespace ast {
 
+/// A run of elements stored in an AstArena.
+template <class T>
+class ArenaArray
+{
+   public:
+    ArenaArray() = default;
+    ArenaArray(const T* data, size_t size) : m_data(data), m_size(size) {}
+
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+
+    size_t size() const { return m_size; }
+    bool   empty() const { return m_size == 0; }
+
+    const T& operator[](size_t i) const { return m_data[i]; }
+
+   private:
+    const T* m_data = nullptr;
+    size_t   m_size = 0;
+};
+
 struct Expr;
-using ExprP = std::shared_ptr<const Expr>;
+
+/// Nodes live in an AstArena, handles to them are plain pointers.
+using ExprP = const Expr*;
 
 using Literal = std::variant<literals::Boolean, literals::Integer, literals::Real>;
 
 struct Var
 {
-    std::string            m_name;
+    Symbol                 m_name;
     std::optional<int64_t> m_subscript;
 
     bool operator==(const Var& other) const;
@@ -37,56 +62,106 @@ struct BinaryExpr
 
 struct Call
 {
-    std::string        m_function;
-    std::vector<ExprP> m_args;
+    Symbol            m_function;
+    ArenaArray<ExprP> m_args;
 
     bool operator==(const Call& other) const;
 };
 
 struct ListExpr
 {
-    std::vector<ExprP> m_expressions;
+    ArenaArray<ExprP> m_expressions;
 
     bool operator==(const ListExpr& other) const;
 };
 
+struct TypeDesc;
+
+using TypeDescP = const TypeDesc*;
+
 struct TypeDesc
 {
-    std::string                                  m_name;
-    std::vector<std::shared_ptr<const TypeDesc>> m_template_args;
+    Symbol                m_name;
+    ArenaArray<TypeDescP> m_template_args;
 
     bool operator==(const TypeDesc& other) const;
 };
 
-using TypeDescCSP = std::shared_ptr<const TypeDesc>;
-
 struct Arg
 {
-    TypeDescCSP m_type;
-    std::string m_name;
+    TypeDescP m_type;
+    Symbol    m_name;
 
     bool operator==(const Arg& other) const;
 };
 
 struct Signature
 {
-    std::string      m_name;
+    Symbol           m_name;
     std::vector<Arg> m_args;
-    TypeDescCSP      m_ret_type;
+    TypeDescP        m_ret_type = nullptr;
+
+    /// Type parameters of a generic def, which its types may name.
+    std::vector<Symbol> m_type_params;
 
     bool operator==(const Signature& other) const;
 };
 
+using ExprId = int64_t;
+
+enum class ExprKind : uint8_t
+{
+    k_literal,
+    k_var,
+    k_subscript,
+    k_list,
+    k_binary,
+    k_call,
+};
+
+/// The expressions of a function in flat, post-order form, one row per ExprId starting at
+/// m_first. Children come before their parent, so a forward scan over the rows sees every child
+/// before the node using it, and the last row is the root. Columns live in the AstArena, or in
+/// memory it keeps alive.
+struct FlatExprs
+{
+    ExprId m_first = 0;
+
+    ArenaArray<ExprKind> m_kinds;
+
+    /// Children of row r are m_children[m_child_begin[r], m_child_begin[r + 1]), as rows.
+    ArenaArray<uint32_t> m_child_begin;
+    ArenaArray<uint32_t> m_children;
+
+    /// Operator of a binary expression.
+    ArenaArray<char> m_ops;
+
+    /// Name of a variable or of a called function.
+    ArenaArray<Symbol> m_names;
+
+    /// Value of a literal, or the index of a subscript as an Integer.
+    ArenaArray<Literal> m_literals;
+
+    uint32_t size() const { return uint32_t(m_kinds.size()); }
+
+    uint32_t row(ExprId id) const { return uint32_t(id - m_first); }
+
+    ArenaArray<uint32_t> children(uint32_t row) const
+    {
+        return ArenaArray<uint32_t>(m_children.begin() + m_child_begin[row],
+                                    m_child_begin[row + 1] - m_child_begin[row]);
+    }
+};
+
 struct Function
 {
     Signature m_sig;
-    ExprP     m_code;
+    ExprP     m_code = nullptr;
+    FlatExprs m_flat;
 
     bool operator==(const Function& other) const;
 };
 
-using ExprId = int64_t;
-
 struct Expr
 {
     explicit Expr(Literal val, int64_t id) : m_val(std::move(val)), m_id(id) {}
@@ -98,9 +173,14 @@ struct Expr
     std::variant<Literal, Var, ListExpr, BinaryExpr, Call> m_val;
     ExprId                                                 m_id;
 
-    bool operator==(const Expr& other) const { return m_val == other.m_val; }
+    /// Compares the trees, ids aside.
+    bool operator==(const Expr& other) const;
 };
 
+static_assert(std::is_trivially_destructible_v<Expr> && std::is_trivially_destructible_v<TypeDesc>,
+              "arena nodes are never destroyed");
+
+/// Calls visitor on the nodes in post-order. Stops and returns false as soon as visitor does.
 bool visitExprTree(const Expr& expr, const std::function<bool(const Expr&)>& visitor);
 
 std::ostream& operator<<(std::ostream& os, const TypeDesc& value);
@@ -0,0 +1,174 @@
+
+#include <pom_astarena.h>
+
+#include <cassert>
+#include <iterator>
+
+namespace pom {
+
+namespace ast {
+
+void* AstArena::allocateSlow(size_t size, size_t align)
+{
+    // Large runs get a block of their own.
+    auto block_size = std::max(k_block_size, size + align);
+    m_blocks.push_back(std::unique_ptr<char[]>(new char[block_size]));
+    m_pos = m_blocks.back().get();
+    m_end = m_pos + block_size;
+    return allocate(size, align);
+}
+
+void AstArena::adopt(AstArena&& other)
+{
+    if (m_blocks.empty() && m_kept.empty()) {
+        *this = std::move(other);
+    } else {
+        std::move(other.m_blocks.begin(), other.m_blocks.end(), std::back_inserter(m_blocks));
+        std::move(other.m_kept.begin(), other.m_kept.end(), std::back_inserter(m_kept));
+        m_used += other.m_used;
+    }
+    other.m_blocks.clear();
+    other.m_kept.clear();
+    other.m_pos  = nullptr;
+    other.m_end  = nullptr;
+    other.m_used = 0;
+}
+
+void AstArena::reset()
+{
+    if (m_blocks.size() > 1) {
+        m_blocks.resize(1);
+    }
+    m_kept.clear();
+    m_pos  = m_blocks.empty() ? nullptr : m_blocks.front().get();
+    m_end  = m_blocks.empty() ? nullptr : m_pos + k_block_size;
+    m_used = 0;
+}
+
+void FlatExprsBuilder::append(const Expr& expr)
+{
+    if (m_kinds.empty()) {
+        m_first = expr.m_id;
+        m_child_begin.push_back(0);
+    }
+    assert(expr.m_id == m_first + ExprId(m_kinds.size()));
+
+    auto row = [&](ExprP child) { return uint32_t(child->m_id - m_first); };
+
+    char     op = 0;
+    Symbol   name;
+    Literal  literal;
+    ExprKind kind = ExprKind::k_literal;
+    std::visit(
+        [&](auto& v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, Literal>) {
+                kind    = ExprKind::k_literal;
+                literal = v;
+            } else if constexpr (std::is_same_v<T, Var>) {
+                kind = v.m_subscript ? ExprKind::k_subscript : ExprKind::k_var;
+                name = v.m_name;
+                if (v.m_subscript) {
+                    literal = literals::Integer{*v.m_subscript};
+                }
+            } else if constexpr (std::is_same_v<T, ListExpr>) {
+                kind = ExprKind::k_list;
+                for (auto& e : v.m_expressions) {
+                    m_children.push_back(row(e));
+                }
+            } else if constexpr (std::is_same_v<T, BinaryExpr>) {
+                kind = ExprKind::k_binary;
+                op   = v.m_op;
+                m_children.push_back(row(v.m_lhs));
+                m_children.push_back(row(v.m_rhs));
+            } else if constexpr (std::is_same_v<T, Call>) {
+                kind = ExprKind::k_call;
+                name = v.m_function;
+                for (auto& e : v.m_args) {
+                    m_children.push_back(row(e));
+                }
+            }
+        },
+        expr.m_val);
+
+    m_kinds.push_back(kind);
+    m_child_begin.push_back(uint32_t(m_children.size()));
+    m_ops.push_back(op);
+    m_names.push_back(name);
+    m_literals.push_back(literal);
+}
+
+FlatExprs FlatExprsBuilder::finish(AstArena& arena)
+{
+    FlatExprs flat;
+    flat.m_first       = m_first;
+    flat.m_kinds       = arena.copy(m_kinds);
+    flat.m_child_begin = arena.copy(m_child_begin);
+    flat.m_children    = arena.copy(m_children);
+    flat.m_ops         = arena.copy(m_ops);
+    flat.m_names       = arena.copy(m_names);
+    flat.m_literals    = arena.copy(m_literals);
+
+    m_first = -1;
+    m_kinds.clear();
+    m_child_begin.clear();
+    m_children.clear();
+    m_ops.clear();
+    m_names.clear();
+    m_literals.clear();
+    return flat;
+}
+
+ExprP expandFlat(const FlatExprs& flat, AstArena& arena)
+{
+    std::vector<ExprP> nodes(flat.size());
+    std::vector<ExprP> children;
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        children.clear();
+        for (auto child : flat.children(row)) {
+            children.push_back(nodes[child]);
+        }
+        auto id = flat.m_first + ExprId(row);
+        switch (flat.m_kinds[row]) {
+            case ExprKind::k_literal:
+                nodes[row] = arena.make<Expr>(flat.m_literals[row], id);
+                break;
+            case ExprKind::k_var:
+                nodes[row] = arena.make<Expr>(Var{flat.m_names[row], std::nullopt}, id);
+                break;
+            case ExprKind::k_subscript:
+                nodes[row] = arena.make<Expr>(
+                    Var{flat.m_names[row], std::get<literals::Integer>(flat.m_literals[row]).m_val},
+                    id);
+                break;
+            case ExprKind::k_list:
+                nodes[row] = arena.make<Expr>(ListExpr{arena.copy(children)}, id);
+                break;
+            case ExprKind::k_binary:
+                nodes[row] = arena.make<Expr>(BinaryExpr{flat.m_ops[row], children[0], children[1]},
+                                              id);
+                break;
+            case ExprKind::k_call:
+                nodes[row] = arena.make<Expr>(Call{flat.m_names[row], arena.copy(children)}, id);
+                break;
+        }
+    }
+    return nodes.empty() ? nullptr : nodes.back();
+}
+
+FlatExprs copyFlat(const FlatExprs& flat, AstArena& arena)
+{
+    FlatExprs copy;
+    copy.m_first       = flat.m_first;
+    copy.m_kinds       = arena.copy(flat.m_kinds.begin(), flat.m_kinds.end());
+    copy.m_child_begin = arena.copy(flat.m_child_begin.begin(), flat.m_child_begin.end());
+    copy.m_children    = arena.copy(flat.m_children.begin(), flat.m_children.end());
+    copy.m_ops         = arena.copy(flat.m_ops.begin(), flat.m_ops.end());
+    copy.m_names       = arena.copy(flat.m_names.begin(), flat.m_names.end());
+    copy.m_literals    = arena.copy(flat.m_literals.begin(), flat.m_literals.end());
+    return copy;
+}
+
+}  // namespace ast
+
+}  // namespace pom
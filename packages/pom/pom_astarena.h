@@ -0,0 +1,120 @@
+#pragma once
+
+#include <pom_ast.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace pom {
+
+namespace ast {
+
+/// Owns the nodes of a compilation. Nodes are bump allocated in blocks and never destroyed one
+/// by one, so handles to them are trivially copyable and stay valid until the arena is reset or
+/// goes away.
+class AstArena
+{
+   public:
+    AstArena() = default;
+
+    AstArena(const AstArena&)            = delete;
+    AstArena& operator=(const AstArena&) = delete;
+    AstArena(AstArena&&)                 = default;
+    AstArena& operator=(AstArena&&)      = default;
+
+    template <class T, class... Args>
+    const T* make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>);
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <class T>
+    ArenaArray<T> copy(const T* first, const T* last)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (first == last) {
+            return {};
+        }
+        auto size = size_t(last - first);
+        auto data = static_cast<T*>(allocate(sizeof(T) * size, alignof(T)));
+        std::copy(first, last, data);
+        return ArenaArray<T>(data, size);
+    }
+
+    template <class T>
+    ArenaArray<T> copy(const std::vector<T>& elems)
+    {
+        return copy(elems.data(), elems.data() + elems.size());
+    }
+
+    /// Keeps owner alive as long as the nodes, for rows used in place from memory it holds.
+    void keep(std::shared_ptr<const void> owner) { m_kept.push_back(std::move(owner)); }
+
+    /// Takes over the nodes of other, which is left empty. Allocation carries on in the current
+    /// block.
+    void adopt(AstArena&& other);
+
+    /// Frees all nodes and lets go of what was kept, keeping the first block for the next ones.
+    void reset();
+
+    /// Bytes handed out since construction or the last reset.
+    size_t used() const { return m_used; }
+
+   private:
+    void* allocate(size_t size, size_t align)
+    {
+        auto pos = (uintptr_t(m_pos) + align - 1) & ~uintptr_t(align - 1);
+        if (pos + size > uintptr_t(m_end)) {
+            return allocateSlow(size, align);
+        }
+        m_pos = reinterpret_cast<char*>(pos + size);
+        m_used += size;
+        return reinterpret_cast<void*>(pos);
+    }
+
+    void* allocateSlow(size_t size, size_t align);
+
+    static constexpr size_t k_block_size = 64 << 10;
+
+    std::vector<std::unique_ptr<char[]>>     m_blocks;
+    std::vector<std::shared_ptr<const void>> m_kept;
+    char*                                    m_pos  = nullptr;
+    char*                                    m_end  = nullptr;
+    size_t                                   m_used = 0;
+};
+
+/// Collects the rows of a FlatExprs as the parser creates nodes, children first.
+class FlatExprsBuilder
+{
+   public:
+    /// Adds the row of a node, its children must have rows already.
+    void append(const Expr& expr);
+
+    /// Moves the rows collected so far into the arena and starts over.
+    FlatExprs finish(AstArena& arena);
+
+   private:
+    ExprId                m_first = -1;
+    std::vector<ExprKind> m_kinds;
+    std::vector<uint32_t> m_child_begin;
+    std::vector<uint32_t> m_children;
+    std::vector<char>     m_ops;
+    std::vector<Symbol>   m_names;
+    std::vector<Literal>  m_literals;
+};
+
+/// Rebuilds the nodes of a function from its rows, the inverse of FlatExprsBuilder. Rows used by
+/// several parents give shared nodes. Returns the root, the last row.
+ExprP expandFlat(const FlatExprs& flat, AstArena& arena);
+
+/// Copies the rows into arena, so they outlive the arena they were parsed into.
+FlatExprs copyFlat(const FlatExprs& flat, AstArena& arena);
+
+}  // namespace ast
+
+}  // namespace pom
@@ -7,31 +7,37 @@ namespace ast {
 
 namespace builder {
 
-ExprP integer(int64_t x)
+ExprP integer(AstArena& arena, int64_t x)
 {
     Literal lit = literals::Integer{x};
-    return std::make_shared<Expr>(std::move(lit), -1ll);
+    return arena.make<Expr>(std::move(lit), -1ll);
 }
 
-ExprP real(double x)
+ExprP real(AstArena& arena, double x)
 {
     Literal lit = literals::Real{x};
-    return std::make_shared<Expr>(std::move(lit), -1ll);
+    return arena.make<Expr>(std::move(lit), -1ll);
 }
 
-ExprP call(std::string name, std::vector<ExprP> args)
+ExprP call(AstArena& arena, Symbol name, const std::vector<ExprP>& args)
 {
-    return std::make_shared<Expr>(Call{name, args}, -1ll);
+    return arena.make<Expr>(Call{name, arena.copy(args)}, -1ll);
 }
 
-ExprP var(std::string name) { return std::make_shared<Expr>(Var{name, std::nullopt}, -1ll); }
+ExprP var(AstArena& arena, Symbol name)
+{
+    return arena.make<Expr>(Var{name, std::nullopt}, -1ll);
+}
 
-ExprP bin_op(char op, ExprP lhs, ExprP rhs)
+ExprP bin_op(AstArena& arena, char op, ExprP lhs, ExprP rhs)
 {
-    return std::make_shared<Expr>(BinaryExpr{op, lhs, rhs}, -1ll);
+    return arena.make<Expr>(BinaryExpr{op, lhs, rhs}, -1ll);
 }
 
-ExprP list(std::vector<ExprP> elems) { return std::make_shared<Expr>(ListExpr{elems}, -1ll); }
+ExprP list(AstArena& arena, const std::vector<ExprP>& elems)
+{
+    return arena.make<Expr>(ListExpr{arena.copy(elems)}, -1ll);
+}
 
 }  // namespace builder
 
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <pom_ast.h>
+#include <pom_astarena.h>
 
 namespace pom {
 
@@ -8,17 +8,17 @@ namespace ast {
 
 namespace builder {
 
-ExprP integer(int64_t x);
+ExprP integer(AstArena& arena, int64_t x);
 
-ExprP real(double x);
+ExprP real(AstArena& arena, double x);
 
-ExprP call(std::string name, std::vector<ExprP> builder);
+ExprP call(AstArena& arena, Symbol name, const std::vector<ExprP>& args);
 
-ExprP var(std::string name);
+ExprP var(AstArena& arena, Symbol name);
 
-ExprP bin_op(char op, ExprP lhs, ExprP rhs);
+ExprP bin_op(AstArena& arena, char op, ExprP lhs, ExprP rhs);
 
-ExprP list(std::vector<ExprP> elems);
+ExprP list(AstArena& arena, const std::vector<ExprP>& elems);
 
 }  // namespace builder
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <pom_type.h>
+#include <pom_typetable.h>
 #include <optional>
 #include <string>
 
@@ -13,7 +14,10 @@ class RealType : public Type
    public:
     std::string description() const { return "real"; }
 
-    std::string mangled() const { return "real"; }
+   private:
+    friend class pom::TypeTable;
+
+    RealType() : Type("real") {}
 };
 
 class IntegerType : public Type
@@ -21,7 +25,10 @@ class IntegerType : public Type
    public:
     std::string description() const { return "integer"; }
 
-    std::string mangled() const { return "integer"; }
+   private:
+    friend class pom::TypeTable;
+
+    IntegerType() : Type("integer") {}
 };
 
 class BooleanType : public Type
@@ -29,14 +36,17 @@ class BooleanType : public Type
    public:
     std::string description() const { return "boolean"; }
 
-    std::string mangled() const { return "boolean"; }
+   private:
+    friend class pom::TypeTable;
+
+    BooleanType() : Type("boolean") {}
 };
 
-inline TypeCSP real() { return std::make_shared<RealType>(); }
+inline const TypeCSP& real() { return TypeTable::instance().real(); }
 
-inline TypeCSP integer() { return std::make_shared<IntegerType>(); }
+inline const TypeCSP& integer() { return TypeTable::instance().integer(); }
 
-inline TypeCSP boolean() { return std::make_shared<BooleanType>(); }
+inline const TypeCSP& boolean() { return TypeTable::instance().boolean(); }
 
 }  // namespace types
 
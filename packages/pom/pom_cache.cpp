@@ -0,0 +1,686 @@
+
+#include <pom_cache.h>
+
+#include <fmt/format.h>
+
+#include <pom_basictypes.h>
+#include <pom_functiontype.h>
+#include <pom_listtype.h>
+#include <pom_ops.h>
+
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace pom {
+
+namespace cache {
+
+namespace {
+
+/// Layout, all integers little endian and arrays 8 byte aligned, so the columns can be read
+/// straight out of the mapping:
+///   Header, with the build and the size and hash of the payload that follows it
+///   symbols:  count, then each as length and bytes
+///   types:    count, then each as kind, child count and child type indices, children first
+///   units:    kind, recursive flag, signature, and for functions the rows of the body
+struct Header
+{
+    char     m_magic[8];
+    uint32_t m_version;
+    uint32_t m_units;
+    uint64_t m_build;
+    uint64_t m_source_hash;
+    uint64_t m_source_size;
+    uint64_t m_payload_hash;
+    uint64_t m_payload_size;
+};
+
+constexpr char k_magic[8] = {'c', 'o', 'n', 'f', 'l', 'a', 'k', 'e'};
+
+enum class TypeKind : uint8_t
+{
+    k_real,
+    k_integer,
+    k_boolean,
+    k_list,
+    k_function,
+};
+
+constexpr uint32_t k_no_type = ~0u;
+
+/// Fingerprint of what rows mean to this build: the builtins they index, the layout of their
+/// columns and the compiler. Files of another build could resolve to other builtins.
+uint64_t buildFingerprint()
+{
+    static const uint64_t fingerprint = [] {
+        auto text = fmt::format("{0} {1} {2}", sizeof(ast::ExprKind),
+                                uint32_t(ast::ExprKind::k_call), sizeof(ops::BuiltinOp));
+#ifdef __VERSION__
+        text += " " __VERSION__;
+#endif
+        for (size_t i = 1; i < ops::k_builtin_count; i++) {
+            auto& info = ops::builtinInfo(ops::BuiltinOp(i));
+            text += std::visit([](auto& op) { return fmt::format("\n{0}", op); }, info.m_op);
+            for (auto& arg : info.m_args) {
+                text += " " + arg->description();
+            }
+            text += " -> " + info.m_ret_type->description();
+        }
+        return hashSource(text);
+    }();
+    return fingerprint;
+}
+
+class Writer
+{
+   public:
+    template <class T>
+    void put(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <class T>
+    void putArray(const T* data, size_t size)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        align();
+        m_bytes.append(reinterpret_cast<const char*>(data), sizeof(T) * size);
+        align();
+    }
+
+    void align() { m_bytes.resize((m_bytes.size() + 7) & ~size_t(7)); }
+
+    uint32_t symbol(Symbol sym)
+    {
+        auto [it, inserted] = m_symbols.try_emplace(sym, uint32_t(m_symbol_list.size()));
+        if (inserted) {
+            m_symbol_list.push_back(sym);
+        }
+        return it->second;
+    }
+
+    tl::expected<uint32_t, Err> type(const TypeCSP& ty);
+
+    std::string& bytes() { return m_bytes; }
+
+    /// Symbol and type tables, written ahead of the units that refer to them.
+    std::string tables();
+
+   private:
+    std::string                               m_bytes;
+    std::unordered_map<Symbol, uint32_t>      m_symbols;
+    std::vector<Symbol>                       m_symbol_list;
+    std::unordered_map<const Type*, uint32_t> m_types;
+    std::string                               m_type_bytes;
+    uint32_t                                  m_type_count = 0;
+};
+
+tl::expected<uint32_t, Err> Writer::type(const TypeCSP& ty)
+{
+    if (!ty) {
+        return k_no_type;
+    }
+    auto fo = m_types.find(ty.get());
+    if (fo != m_types.end()) {
+        return fo->second;
+    }
+
+    TypeKind             kind;
+    std::vector<TypeCSP> children;
+    if (dynamic_cast<const types::RealType*>(ty.get())) {
+        kind = TypeKind::k_real;
+    } else if (dynamic_cast<const types::IntegerType*>(ty.get())) {
+        kind = TypeKind::k_integer;
+    } else if (dynamic_cast<const types::BooleanType*>(ty.get())) {
+        kind = TypeKind::k_boolean;
+    } else if (auto list = dynamic_cast<const types::List*>(ty.get())) {
+        kind     = TypeKind::k_list;
+        children = {list->m_contained_type};
+    } else if (auto fun = dynamic_cast<const types::Function*>(ty.get())) {
+        kind     = TypeKind::k_function;
+        children = fun->m_arg_types;
+        children.push_back(fun->m_ret_type);
+    } else {
+        return tl::make_unexpected(Err{fmt::format("Cannot cache type {0}", ty->description())});
+    }
+
+    std::vector<uint32_t> child_indices;
+    for (auto& child : children) {
+        auto index = type(child);
+        if (!index) {
+            return index;
+        }
+        child_indices.push_back(*index);
+    }
+
+    auto append = [&](auto value) {
+        m_type_bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    append(uint32_t(kind));
+    append(uint32_t(child_indices.size()));
+    for (auto index : child_indices) {
+        append(index);
+    }
+    m_types.emplace(ty.get(), m_type_count);
+    return m_type_count++;
+}
+
+std::string Writer::tables()
+{
+    Writer tables;
+    tables.put(uint32_t(m_symbol_list.size()));
+    for (auto sym : m_symbol_list) {
+        auto text = sym.str();
+        tables.put(uint32_t(text.size()));
+        tables.m_bytes.append(text);
+    }
+    tables.align();
+    tables.put(uint32_t(m_type_count));
+    tables.m_bytes.append(m_type_bytes);
+    tables.align();
+    return std::move(tables.m_bytes);
+}
+
+/// Bounds checked cursor over the mapped file.
+class Reader
+{
+   public:
+    Reader(std::string_view bytes) : m_bytes(bytes) {}
+
+    template <class T>
+    tl::expected<T, Err> get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (sizeof(T) > remaining()) {
+            return truncated();
+        }
+        T value;
+        std::memcpy(&value, m_bytes.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return value;
+    }
+
+    template <class T>
+    tl::expected<const T*, Err> getArray(size_t size)
+    {
+        align();
+        if (size > remaining() / sizeof(T)) {
+            return truncated();
+        }
+        auto data = reinterpret_cast<const T*>(m_bytes.data() + m_pos);
+        m_pos += sizeof(T) * size;
+        align();
+        return data;
+    }
+
+    tl::expected<std::string_view, Err> getText(size_t size)
+    {
+        if (size > remaining()) {
+            return truncated();
+        }
+        auto text = m_bytes.substr(m_pos, size);
+        m_pos += size;
+        return text;
+    }
+
+    void align() { m_pos = (m_pos + 7) & ~size_t(7); }
+
+    /// Bytes left after the cursor.
+    size_t remaining() const { return m_pos < m_bytes.size() ? m_bytes.size() - m_pos : 0; }
+
+   private:
+    static tl::unexpected<Err> truncated()
+    {
+        return tl::make_unexpected(Err{"Cache file is truncated"});
+    }
+
+    std::string_view m_bytes;
+    size_t           m_pos = 0;
+};
+
+tl::expected<void, Err> writeSignature(Writer& writer, const semantic::Signature& sig)
+{
+    auto ret = writer.type(sig.m_return_type);
+    if (!ret) {
+        return tl::make_unexpected(ret.error());
+    }
+    writer.put(writer.symbol(sig.m_name));
+    writer.put(*ret);
+    writer.put(uint32_t(sig.m_args.size()));
+    for (auto& [arg_type, arg_name] : sig.m_args) {
+        auto ty = writer.type(arg_type);
+        if (!ty) {
+            return tl::make_unexpected(ty.error());
+        }
+        writer.put(*ty);
+        writer.put(writer.symbol(arg_name));
+    }
+    return {};
+}
+
+tl::expected<void, Err> writeFunction(Writer& writer, const semantic::Function& fn)
+{
+    auto& flat = fn.m_flat;
+    auto  rows = flat.size();
+
+    std::vector<uint32_t> names(rows), types(rows);
+    std::vector<uint8_t>  literal_kinds(rows);
+    std::vector<uint64_t> literal_bits(rows);
+    for (uint32_t row = 0; row < rows; row++) {
+        names[row] = writer.symbol(flat.m_names[row]);
+        auto ty    = writer.type(fn.m_types[row]);
+        if (!ty) {
+            return tl::make_unexpected(ty.error());
+        }
+        types[row]         = *ty;
+        auto& literal      = flat.m_literals[row];
+        literal_kinds[row] = uint8_t(literal.index());
+        std::visit([&](auto& v) { std::memcpy(&literal_bits[row], &v.m_val, sizeof(v.m_val)); },
+                   literal);
+    }
+
+    writer.put(int64_t(flat.m_first));
+    writer.put(uint32_t(rows));
+    writer.put(uint32_t(flat.m_children.size()));
+    writer.putArray(flat.m_kinds.begin(), rows);
+    writer.putArray(flat.m_ops.begin(), rows);
+    writer.putArray(flat.m_child_begin.begin(), rows + 1);
+    writer.putArray(flat.m_children.begin(), flat.m_children.size());
+    writer.putArray(names.data(), rows);
+    writer.putArray(literal_kinds.data(), rows);
+    writer.putArray(literal_bits.data(), rows);
+    writer.putArray(types.data(), rows);
+    writer.putArray(fn.m_builtins.data(), rows);
+    return {};
+}
+
+/// What the units refer to by index.
+struct Tables
+{
+    std::vector<Symbol>  m_symbols;
+    std::vector<TypeCSP> m_types;
+};
+
+tl::expected<Tables, Err> readTables(Reader& reader)
+{
+    Tables tables;
+    auto   symbols = reader.get<uint32_t>();
+    if (!symbols) {
+        return tl::make_unexpected(symbols.error());
+    }
+    for (uint32_t i = 0; i < *symbols; i++) {
+        auto size = reader.get<uint32_t>();
+        if (!size) {
+            return tl::make_unexpected(size.error());
+        }
+        auto text = reader.getText(*size);
+        if (!text) {
+            return tl::make_unexpected(text.error());
+        }
+        tables.m_symbols.push_back(Symbol(*text));
+    }
+    reader.align();
+
+    auto types = reader.get<uint32_t>();
+    if (!types) {
+        return tl::make_unexpected(types.error());
+    }
+    auto bad_type = tl::make_unexpected(Err{"Cache file has a bad type"});
+    for (uint32_t i = 0; i < *types; i++) {
+        auto kind  = reader.get<uint32_t>();
+        auto count = reader.get<uint32_t>();
+        if (!kind || !count) {
+            return tl::make_unexpected(Err{"Cache file is truncated"});
+        }
+        std::vector<TypeCSP> children;
+        for (uint32_t c = 0; c < *count; c++) {
+            auto index = reader.get<uint32_t>();
+            if (!index || *index >= i) {
+                return bad_type;
+            }
+            children.push_back(tables.m_types[*index]);
+        }
+        switch (TypeKind(*kind)) {
+            case TypeKind::k_real:
+                tables.m_types.push_back(types::real());
+                break;
+            case TypeKind::k_integer:
+                tables.m_types.push_back(types::integer());
+                break;
+            case TypeKind::k_boolean:
+                tables.m_types.push_back(types::boolean());
+                break;
+            case TypeKind::k_list:
+                if (children.size() != 1) {
+                    return bad_type;
+                }
+                tables.m_types.push_back(types::list(children[0]));
+                break;
+            case TypeKind::k_function: {
+                if (children.empty()) {
+                    return bad_type;
+                }
+                auto ret_type = children.back();
+                children.pop_back();
+                tables.m_types.push_back(types::function(children, ret_type));
+                break;
+            }
+            default:
+                return bad_type;
+        }
+    }
+    reader.align();
+    return tables;
+}
+
+tl::expected<Symbol, Err> symbolAt(const Tables& tables, uint32_t index)
+{
+    if (index >= tables.m_symbols.size()) {
+        return tl::make_unexpected(Err{"Cache file has a bad symbol"});
+    }
+    return tables.m_symbols[index];
+}
+
+tl::expected<TypeCSP, Err> typeAt(const Tables& tables, uint32_t index)
+{
+    if (index == k_no_type) {
+        return nullptr;
+    }
+    if (index >= tables.m_types.size()) {
+        return tl::make_unexpected(Err{"Cache file has a bad type"});
+    }
+    return tables.m_types[index];
+}
+
+tl::expected<semantic::Signature, Err> readSignature(Reader& reader, const Tables& tables)
+{
+    semantic::Signature sig;
+    auto                name = reader.get<uint32_t>();
+    auto                ret  = reader.get<uint32_t>();
+    auto                args = reader.get<uint32_t>();
+    if (!name || !ret || !args) {
+        return tl::make_unexpected(Err{"Cache file is truncated"});
+    }
+    auto sym = symbolAt(tables, *name);
+    auto ty  = typeAt(tables, *ret);
+    if (!sym || !ty || !*ty) {
+        return tl::make_unexpected(Err{"Cache file has a bad signature"});
+    }
+    sig.m_name        = *sym;
+    sig.m_return_type = *ty;
+    for (uint32_t i = 0; i < *args; i++) {
+        auto arg_type = reader.get<uint32_t>();
+        auto arg_name = reader.get<uint32_t>();
+        if (!arg_type || !arg_name) {
+            return tl::make_unexpected(Err{"Cache file is truncated"});
+        }
+        auto arg_ty  = typeAt(tables, *arg_type);
+        auto arg_sym = symbolAt(tables, *arg_name);
+        if (!arg_ty || !*arg_ty || !arg_sym) {
+            return tl::make_unexpected(Err{"Cache file has a bad signature"});
+        }
+        sig.m_args.push_back({*arg_ty, *arg_sym});
+    }
+    return sig;
+}
+
+tl::expected<void, Err> readFunction(Reader&             reader,
+                                     const Tables&       tables,
+                                     ast::AstArena&      arena,
+                                     semantic::Function& fn)
+{
+    auto first    = reader.get<int64_t>();
+    auto rows     = reader.get<uint32_t>();
+    auto children = reader.get<uint32_t>();
+    if (!first || !rows || !children) {
+        return tl::make_unexpected(Err{"Cache file is truncated"});
+    }
+    // Each row takes a kind, op, child offset, name, literal kind and bits, type and builtin.
+    constexpr size_t k_row_bytes = sizeof(ast::ExprKind) + sizeof(char) + sizeof(uint32_t) * 3 +
+                                   sizeof(uint8_t) + sizeof(uint64_t) + sizeof(ops::BuiltinOp);
+    if (size_t(*rows) > reader.remaining() / k_row_bytes) {
+        return tl::make_unexpected(Err{"Cache file is truncated"});
+    }
+    auto kinds         = reader.getArray<ast::ExprKind>(*rows);
+    auto ops           = reader.getArray<char>(*rows);
+    auto child_begin   = reader.getArray<uint32_t>(size_t(*rows) + 1);
+    auto child_rows    = reader.getArray<uint32_t>(*children);
+    auto names         = reader.getArray<uint32_t>(*rows);
+    auto literal_kinds = reader.getArray<uint8_t>(*rows);
+    auto literal_bits  = reader.getArray<uint64_t>(*rows);
+    auto types         = reader.getArray<uint32_t>(*rows);
+    auto builtins      = reader.getArray<ops::BuiltinOp>(*rows);
+    if (!kinds || !ops || !child_begin || !child_rows || !names || !literal_kinds ||
+        !literal_bits || !types || !builtins) {
+        return tl::make_unexpected(Err{"Cache file is truncated"});
+    }
+
+    // Children come before their parents, anything else would make the scans read garbage.
+    auto bad_rows = tl::make_unexpected(Err{"Cache file has bad rows"});
+    if ((*child_begin)[0] != 0 || (*child_begin)[*rows] != *children) {
+        return bad_rows;
+    }
+    for (uint32_t row = 0; row < *rows; row++) {
+        auto kind  = (*kinds)[row];
+        auto count = (*child_begin)[row + 1] - (*child_begin)[row];
+        if ((*child_begin)[row] > (*child_begin)[row + 1] ||
+            uint8_t(kind) > uint8_t(ast::ExprKind::k_call) ||
+            size_t((*builtins)[row]) >= ops::k_builtin_count) {
+            return bad_rows;
+        }
+        // Shapes the expansion into nodes relies on.
+        if ((kind == ast::ExprKind::k_binary && count != 2) ||
+            ((kind == ast::ExprKind::k_literal || kind == ast::ExprKind::k_var ||
+              kind == ast::ExprKind::k_subscript) &&
+             count != 0) ||
+            (kind == ast::ExprKind::k_subscript && (*literal_kinds)[row] != 1)) {
+            return bad_rows;
+        }
+        for (auto c = (*child_begin)[row]; c < (*child_begin)[row + 1]; c++) {
+            if ((*child_rows)[c] >= row) {
+                return bad_rows;
+            }
+        }
+    }
+
+    std::vector<Symbol>       row_names(*rows);
+    std::vector<ast::Literal> literals(*rows);
+    fn.m_types.resize(*rows);
+    for (uint32_t row = 0; row < *rows; row++) {
+        auto name = symbolAt(tables, (*names)[row]);
+        auto ty   = typeAt(tables, (*types)[row]);
+        if (!name || !ty || !*ty) {
+            return bad_rows;
+        }
+        row_names[row]  = *name;
+        fn.m_types[row] = *ty;
+
+        auto bits = (*literal_bits)[row];
+        switch ((*literal_kinds)[row]) {
+            case 0:
+                literals[row] = literals::Boolean{bits != 0};
+                break;
+            case 1:
+                literals[row] = literals::Integer{int64_t(bits)};
+                break;
+            case 2: {
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                literals[row] = literals::Real{value};
+                break;
+            }
+            default:
+                return bad_rows;
+        }
+    }
+
+    // Columns stored as they are used stay in the mapping, which the arena keeps.
+    auto& flat         = fn.m_flat;
+    flat.m_first       = *first;
+    flat.m_kinds       = ast::ArenaArray<ast::ExprKind>(*kinds, *rows);
+    flat.m_ops         = ast::ArenaArray<char>(*ops, *rows);
+    flat.m_child_begin = ast::ArenaArray<uint32_t>(*child_begin, size_t(*rows) + 1);
+    flat.m_children    = ast::ArenaArray<uint32_t>(*child_rows, *children);
+    flat.m_names       = arena.copy(row_names);
+    flat.m_literals    = arena.copy(literals);
+    fn.m_code          = ast::expandFlat(flat, arena);
+    fn.m_builtins.assign(*builtins, *builtins + *rows);
+    return {};
+}
+
+}  // namespace
+
+uint64_t hashSource(std::string_view text)
+{
+    // Eight bytes at a time, multiply and fold.
+    constexpr uint64_t k_mul = 0x9e3779b97f4a7c15ull;
+    uint64_t           h     = text.size() * k_mul;
+    size_t             i     = 0;
+    for (; i + 8 <= text.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, text.data() + i, 8);
+        h = (h ^ word) * k_mul;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, text.data() + i, text.size() - i);
+    h = (h ^ tail) * k_mul;
+    return h ^ (h >> 32);
+}
+
+std::filesystem::path cachePath(const std::filesystem::path& dir, const Source& source)
+{
+    return dir / fmt::format("{0:016x}.cfc", hashSource(source.text()));
+}
+
+tl::expected<void, Err> save(const std::filesystem::path& path,
+                             const Source&                source,
+                             const semantic::TopLevel&    top_level)
+{
+    Writer units;
+    for (auto& unit : top_level) {
+        auto fn = std::get_if<semantic::Function>(&unit);
+        units.put(uint8_t(fn ? 1 : 0));
+        // Whether the function could call itself, its context is rebuilt from it.
+        units.put(uint8_t(fn && fn->m_context.m_variables.count(fn->m_sig.m_name)));
+        auto& sig     = fn ? fn->m_sig : std::get<semantic::Signature>(unit);
+        auto  written = writeSignature(units, sig);
+        if (written && fn) {
+            written = writeFunction(units, *fn);
+        }
+        if (!written) {
+            return written;
+        }
+        units.align();
+    }
+
+    Header header;
+    std::memcpy(header.m_magic, k_magic, sizeof(k_magic));
+    header.m_version     = k_version;
+    header.m_units       = uint32_t(top_level.size());
+    header.m_build       = buildFingerprint();
+    header.m_source_hash = hashSource(source.text());
+    header.m_source_size = source.size();
+
+    auto payload          = units.tables() + units.bytes();
+    header.m_payload_hash = hashSource(payload);
+    header.m_payload_size = payload.size();
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    auto          temp = path.string() + ".tmp";
+    std::ofstream ost(temp, std::ios::binary);
+    ost.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ost.write(payload.data(), payload.size());
+    ost.close();
+    if (!ost) {
+        return tl::make_unexpected(Err{fmt::format("Could not write {0}", temp)});
+    }
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        return tl::make_unexpected(Err{fmt::format("Could not write {0}: {1}", path.string(),
+                                                   ec.message())});
+    }
+    return {};
+}
+
+tl::expected<semantic::TopLevel, Err> load(const std::filesystem::path& path,
+                                           const Source&                source,
+                                           ast::AstArena&               arena)
+{
+    auto mapped = Source::map(path);
+    if (!mapped) {
+        return tl::make_unexpected(Err{mapped.error().m_desc});
+    }
+    auto   text = (*mapped)->text();
+    Reader reader(text);
+
+    auto header = reader.get<Header>();
+    if (!header) {
+        return tl::make_unexpected(header.error());
+    }
+    if (std::memcmp(header->m_magic, k_magic, sizeof(k_magic)) != 0) {
+        return tl::make_unexpected(Err{"Not a cache file"});
+    }
+    if (header->m_version != k_version) {
+        return tl::make_unexpected(Err{
+            fmt::format("Cache file version {0}, expected {1}", header->m_version, k_version)});
+    }
+    if (header->m_build != buildFingerprint()) {
+        return tl::make_unexpected(Err{"Cache file is of another build"});
+    }
+    if (header->m_source_size != source.size() ||
+        header->m_source_hash != hashSource(source.text())) {
+        return tl::make_unexpected(Err{"Cache file is of another source"});
+    }
+    auto payload = text.substr(sizeof(Header));
+    if (payload.size() < header->m_payload_size) {
+        return tl::make_unexpected(Err{"Cache file is truncated"});
+    }
+    if (payload.size() != header->m_payload_size ||
+        hashSource(payload) != header->m_payload_hash) {
+        return tl::make_unexpected(Err{"Cache file is corrupted"});
+    }
+
+    auto tables = readTables(reader);
+    if (!tables) {
+        return tl::make_unexpected(tables.error());
+    }
+
+    semantic::Analyzer globals;
+    semantic::TopLevel top_level;
+    for (uint32_t i = 0; i < header->m_units; i++) {
+        auto is_function = reader.get<uint8_t>();
+        auto recursive   = reader.get<uint8_t>();
+        if (!is_function || !recursive) {
+            return tl::make_unexpected(Err{"Cache file is truncated"});
+        }
+        auto sig = readSignature(reader, *tables);
+        if (!sig) {
+            return tl::make_unexpected(sig.error());
+        }
+        if (!*is_function) {
+            top_level.push_back(std::move(*sig));
+        } else {
+            semantic::Function fn;
+            fn.m_context = semantic::functionContext(globals.globals(), *sig, *recursive);
+            fn.m_sig     = std::move(*sig);
+            auto read    = readFunction(reader, *tables, arena, fn);
+            if (!read) {
+                return tl::make_unexpected(read.error());
+            }
+            top_level.push_back(std::move(fn));
+        }
+        globals.declare(top_level.back());
+        reader.align();
+    }
+    arena.keep(std::move(*mapped));
+    return top_level;
+}
+
+}  // namespace cache
+
+}  // namespace pom
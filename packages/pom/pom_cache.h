@@ -0,0 +1,45 @@
+#pragma once
+
+#include <pom_astarena.h>
+#include <pom_semantic.h>
+#include <pom_source.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <tl/expected.hpp>
+
+namespace pom {
+
+namespace cache {
+
+struct Err
+{
+    std::string m_desc;
+};
+
+/// Bumped whenever the layout of cache files changes, files of other versions are not loaded.
+constexpr uint32_t k_version = 4;
+
+uint64_t hashSource(std::string_view text);
+
+/// File in dir holding the cache of source, named after its hash.
+std::filesystem::path cachePath(const std::filesystem::path& dir, const Source& source);
+
+/// Writes the analyzed units of source. The file is written aside and renamed into place, so
+/// readers never see half of it.
+tl::expected<void, Err> save(const std::filesystem::path& path,
+                             const Source&                source,
+                             const semantic::TopLevel&    top_level);
+
+/// Maps a file written by save and rebuilds the units, their nodes go to arena, which keeps the
+/// mapping for the columns used in place. Nothing is typed again. Fails if the file is missing,
+/// of another version, build or source, or corrupted, callers then compile as usual.
+tl::expected<semantic::TopLevel, Err> load(const std::filesystem::path& path,
+                                           const Source&                source,
+                                           ast::AstArena&               arena);
+
+}  // namespace cache
+
+}  // namespace pom
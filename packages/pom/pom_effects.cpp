@@ -0,0 +1,131 @@
+
+#include <pom_effects.h>
+
+#include <pom_basictypes.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace pom {
+
+namespace effects {
+
+namespace {
+
+bool isScalar(const TypeCSP& ty)
+{
+    return ty == types::real() || ty == types::integer() || ty == types::boolean();
+}
+
+Effects analyzeExtern(const semantic::Signature& sig)
+{
+    Effects effects;
+    effects.m_pure = isPureExtern(sig.m_name) && isScalar(sig.m_return_type) &&
+                     std::all_of(sig.m_args.begin(), sig.m_args.end(),
+                                 [](auto& arg) { return isScalar(arg.first); });
+    effects.m_closed     = effects.m_pure;
+    effects.m_terminates = effects.m_pure;
+    return effects;
+}
+
+}  // namespace
+
+bool isPureExtern(Symbol name)
+{
+    static const std::unordered_set<Symbol> pure = {
+        "acos",  "asin",  "atan",  "atan2", "cbrt",  "ceil",  "cos",   "cosh",  "erf",
+        "erfc",  "exp",   "exp2",  "expm1", "fabs",  "fdim",  "floor", "fma",   "fmax",
+        "fmin",  "fmod",  "hypot", "log",   "log10", "log1p", "log2",  "pow",   "round",
+        "sin",   "sinh",  "sqrt",  "tan",   "tanh",  "trunc",
+    };
+    return pure.count(name) != 0;
+}
+
+Effects Analyzer::analyze(const semantic::TopLevelUnit& unit)
+{
+    auto fn = std::get_if<semantic::Function>(&unit);
+    if (!fn) {
+        auto& sig = std::get<semantic::Signature>(unit);
+        return m_functions[sig.m_name] = analyzeExtern(sig);
+    }
+
+    auto& sig    = fn->m_sig;
+    auto  is_arg = [&](Symbol name) {
+        return std::any_of(sig.m_args.begin(), sig.m_args.end(),
+                           [&](auto& arg) { return arg.second == name; });
+    };
+
+    // Recursion is assumed pure and closed, the rest of the body decides.
+    Effects effects;
+    effects.m_pure       = true;
+    effects.m_closed     = true;
+    effects.m_terminates = true;
+    auto& flat           = fn->m_flat;
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        auto name = flat.m_names[row];
+        switch (flat.m_kinds[row]) {
+            case ast::ExprKind::k_list:
+                effects.m_pure = false;
+                break;
+            case ast::ExprKind::k_subscript:
+                effects.m_reads_lists = true;
+                break;
+            case ast::ExprKind::k_call:
+                if (fn->m_builtins[row] != ops::BuiltinOp::k_none) {
+                    break;
+                }
+                if (is_arg(name)) {
+                    effects = Effects{false, effects.m_recursive};
+                } else if (name == sig.m_name && fn->m_context.m_variables.count(name)) {
+                    effects.m_recursive = true;
+                } else {
+                    auto callee = m_functions.find(name);
+                    if (callee == m_functions.end()) {
+                        effects = Effects{false, effects.m_recursive};
+                        break;
+                    }
+                    effects.m_pure       = effects.m_pure && callee->second.m_pure;
+                    effects.m_closed     = effects.m_closed && callee->second.m_closed;
+                    effects.m_terminates = effects.m_terminates && callee->second.m_terminates;
+                    effects.m_reads_lists = effects.m_reads_lists || callee->second.m_reads_lists;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    effects.m_terminates = effects.m_terminates && effects.m_closed && !effects.m_recursive;
+
+    // The value is the last row, a list there is allocated by this call.
+    auto last = flat.size() - 1;
+    if (flat.m_kinds[last] == ast::ExprKind::k_list) {
+        effects.m_fresh_result = true;
+    } else if (flat.m_kinds[last] == ast::ExprKind::k_call &&
+               fn->m_builtins[last] == ops::BuiltinOp::k_none && flat.m_names[last] != sig.m_name &&
+               !is_arg(flat.m_names[last])) {
+        auto callee            = m_functions.find(flat.m_names[last]);
+        effects.m_fresh_result = callee != m_functions.end() && callee->second.m_fresh_result;
+    }
+    m_functions[sig.m_name] = effects;
+    return effects;
+}
+
+void Analyzer::forget(Symbol name) { m_functions.erase(name); }
+
+void Analyzer::markImpure(Symbol name)
+{
+    auto fo = m_functions.find(name);
+    if (fo != m_functions.end()) {
+        fo->second.m_pure = false;
+    }
+}
+
+const Effects* Analyzer::find(Symbol name) const
+{
+    auto fo = m_functions.find(name);
+    return fo == m_functions.end() ? nullptr : &fo->second;
+}
+
+}  // namespace effects
+
+}  // namespace pom
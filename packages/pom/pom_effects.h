@@ -0,0 +1,61 @@
+#pragma once
+
+#include <pom_semantic.h>
+
+#include <unordered_map>
+
+namespace pom {
+
+namespace effects {
+
+/// What a function does besides computing its value from its arguments.
+struct Effects
+{
+    /// Allocates nothing and calls only pure functions and known pure externs, so calls with
+    /// equal arguments return equal values and can share one.
+    bool m_pure = false;
+
+    /// Calls itself.
+    bool m_recursive = false;
+
+    /// Calls only closed functions and known externs, none passed as arguments, so it neither
+    /// unwinds nor frees memory.
+    bool m_closed = false;
+
+    /// Closed and no call below it recurses, so it returns.
+    bool m_terminates = false;
+
+    /// Returns a list it allocated, which nothing else points to.
+    bool m_fresh_result = false;
+
+    /// Reads items of the lists it is given, or has a callee read them. A pure function then
+    /// returns equal values only while the lists stay the same.
+    bool m_reads_lists = false;
+};
+
+/// Externs known to be pure, closed and terminating, the functions of libm.
+bool isPureExtern(Symbol name);
+
+/// Effects of units analyzed one after the other, calls refer to the units seen before.
+class Analyzer
+{
+   public:
+    Effects analyze(const semantic::TopLevelUnit& unit);
+
+    /// Drops what is known of name, calls of it are impure until it is analyzed again.
+    void forget(Symbol name);
+
+    /// Calls of name have effects after all, as those of a memoized function write its table.
+    /// Units analyzed from now on see it, until name is analyzed again.
+    void markImpure(Symbol name);
+
+    /// Effects of name as last analyzed, nullptr if unknown.
+    const Effects* find(Symbol name) const;
+
+   private:
+    std::unordered_map<Symbol, Effects> m_functions;
+};
+
+}  // namespace effects
+
+}  // namespace pom
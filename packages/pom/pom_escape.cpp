@@ -0,0 +1,170 @@
+
+#include <pom_escape.h>
+
+#include <pom_listtype.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace pom {
+
+namespace escape {
+
+namespace {
+
+int32_t argIndex(const semantic::Signature& sig, Symbol name)
+{
+    for (size_t i = 0; i < sig.m_args.size(); i++) {
+        if (sig.m_args[i].second == name) {
+            return int32_t(i);
+        }
+    }
+    return -1;
+}
+
+bool isList(const TypeCSP& ty) { return dynamic_cast<const types::List*>(ty.get()) != nullptr; }
+
+/// Whether row lets the value of its operand at position pos escape. self is what fn does with its
+/// own arguments, for its recursive calls.
+bool letsEscape(const std::unordered_map<Symbol, Summary>& functions,
+                const semantic::Function&                  fn,
+                uint32_t                                   row,
+                size_t                                     pos,
+                const Summary&                             self)
+{
+    auto& flat = fn.m_flat;
+    switch (flat.m_kinds[row]) {
+        case ast::ExprKind::k_list:
+            return true;
+        case ast::ExprKind::k_call: {
+            if (fn.m_builtins[row] != ops::BuiltinOp::k_none) {
+                return false;
+            }
+            auto name = flat.m_names[row];
+            if (argIndex(fn.m_sig, name) >= 0) {
+                return true;
+            }
+            const Summary* callee = nullptr;
+            if (name == fn.m_sig.m_name && fn.m_context.m_variables.count(name)) {
+                callee = &self;
+            } else if (auto fo = functions.find(name); fo != functions.end()) {
+                callee = &fo->second;
+            }
+            return !callee || pos >= callee->m_escapes.size() || callee->m_escapes[pos];
+        }
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+const Summary& Analyzer::analyze(const semantic::TopLevelUnit& unit)
+{
+    auto fn = std::get_if<semantic::Function>(&unit);
+    if (!fn) {
+        auto& sig     = std::get<semantic::Signature>(unit);
+        auto& summary = m_functions[sig.m_name];
+        summary.m_escapes.assign(sig.m_args.size(), true);
+        summary.m_subscripts.assign(sig.m_args.size(), 0);
+        return summary;
+    }
+
+    auto& sig  = fn->m_sig;
+    auto& flat = fn->m_flat;
+    auto  args = sig.m_args.size();
+
+    Summary summary;
+    summary.m_escapes.assign(args, false);
+    summary.m_subscripts.assign(args, 0);
+    std::vector<bool> subscripted_only(args, true);
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        auto kind = flat.m_kinds[row];
+        auto arg  = argIndex(sig, flat.m_names[row]);
+        if (arg < 0 || (kind != ast::ExprKind::k_var && kind != ast::ExprKind::k_subscript)) {
+            continue;
+        }
+        if (kind == ast::ExprKind::k_subscript) {
+            auto index = std::get<literals::Integer>(flat.m_literals[row]).m_val;
+            if (index >= 0 && index < std::numeric_limits<int32_t>::max()) {
+                summary.m_subscripts[arg] = std::max(summary.m_subscripts[arg],
+                                                     uint32_t(index + 1));
+                continue;
+            }
+        }
+        subscripted_only[arg] = false;
+    }
+    for (size_t i = 0; i < args; i++) {
+        if (!subscripted_only[i] || !isList(sig.m_args[i].first)) {
+            summary.m_subscripts[i] = 0;
+        }
+    }
+
+    // Recursive calls hand the lists on to the arguments of the next call, which only escape
+    // once some other use shows they do.
+    auto escape = [&](uint32_t row) {
+        if (flat.m_kinds[row] != ast::ExprKind::k_var) {
+            return false;
+        }
+        auto arg = argIndex(sig, flat.m_names[row]);
+        if (arg < 0 || !isList(sig.m_args[arg].first) || summary.m_escapes[arg]) {
+            return false;
+        }
+        summary.m_escapes[arg] = true;
+        return true;
+    };
+    if (flat.size() != 0) {
+        escape(flat.size() - 1);
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t row = 0; row < flat.size(); row++) {
+            auto children = flat.children(row);
+            for (size_t pos = 0; pos < children.size(); pos++) {
+                if (letsEscape(m_functions, *fn, row, pos, summary)) {
+                    changed = escape(children[pos]) || changed;
+                }
+            }
+        }
+    }
+    return m_functions[sig.m_name] = std::move(summary);
+}
+
+void Analyzer::forget(Symbol name) { m_functions.erase(name); }
+
+const Summary* Analyzer::find(Symbol name) const
+{
+    auto fo = m_functions.find(name);
+    return fo == m_functions.end() ? nullptr : &fo->second;
+}
+
+std::vector<bool> Analyzer::localLists(const semantic::Function& fn) const
+{
+    auto&             flat = fn.m_flat;
+    std::vector<bool> local(flat.size());
+    auto              self = find(fn.m_sig.m_name);
+    if (!self || flat.size() == 0) {
+        return local;
+    }
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        local[row] = flat.m_kinds[row] == ast::ExprKind::k_list;
+    }
+    // The value of the function outlives it.
+    local.back() = false;
+
+    auto tail_calls = fn.selfTailCalls();
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        auto children = flat.children(row);
+        for (size_t pos = 0; pos < children.size(); pos++) {
+            if (local[children[pos]] &&
+                (tail_calls[row] || letsEscape(m_functions, fn, row, pos, *self))) {
+                local[children[pos]] = false;
+            }
+        }
+    }
+    return local;
+}
+
+}  // namespace escape
+
+}  // namespace pom
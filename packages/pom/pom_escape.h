@@ -0,0 +1,46 @@
+#pragma once
+
+#include <pom_semantic.h>
+
+#include <unordered_map>
+
+namespace pom {
+
+namespace escape {
+
+/// What a function does with the lists it is given, by argument position.
+struct Summary
+{
+    /// The list may outlive the call: it is returned, put in a list or given to a function that
+    /// lets it escape, is passed as an argument or is an extern.
+    std::vector<bool> m_escapes;
+
+    /// When the list is only read at constant indices, one more than the highest, 0 otherwise.
+    /// A caller may then pass that many items instead of the list.
+    std::vector<uint32_t> m_subscripts;
+};
+
+/// Lists of units analyzed one after the other, calls refer to the units seen before.
+class Analyzer
+{
+   public:
+    const Summary& analyze(const semantic::TopLevelUnit& unit);
+
+    /// Drops what is known of name, lists given to it escape until it is analyzed again.
+    void forget(Symbol name);
+
+    /// Summary of name as last analyzed, nullptr if unknown.
+    const Summary* find(Symbol name) const;
+
+    /// Marks the list rows of fn whose lists die with its frame: they are neither returned nor
+    /// given to a function that lets them escape, nor to fn itself in tail position, as that call
+    /// reuses the frame. fn must be analyzed already.
+    std::vector<bool> localLists(const semantic::Function& fn) const;
+
+   private:
+    std::unordered_map<Symbol, Summary> m_functions;
+};
+
+}  // namespace escape
+
+}  // namespace pom
@@ -6,25 +6,36 @@ namespace pom {
 
 namespace types {
 
-std::string Function::description() const
+namespace {
+
+std::string mangle(const std::vector<TypeCSP>& arg_types, const TypeCSP& ret_type)
 {
     std::ostringstream oss;
-    oss << "(";
-    for (auto& arg : m_arg_types) {
-        oss << arg->description() << ",";
+    oss << "__function__";
+    for (auto& arg : arg_types) {
+        oss << arg->mangled() << "_";
     }
-    oss << ") -> " << m_ret_type->description();
+    oss << "__" << ret_type->mangled();
     return oss.str();
 }
 
-std::string Function::mangled() const
+}  // namespace
+
+Function::Function(std::vector<TypeCSP> arg_types, TypeCSP ret_type)
+    : Type(mangle(arg_types, ret_type)),
+      m_arg_types(std::move(arg_types)),
+      m_ret_type(std::move(ret_type))
+{
+}
+
+std::string Function::description() const
 {
     std::ostringstream oss;
-    oss << "__function__";
+    oss << "(";
     for (auto& arg : m_arg_types) {
-        oss << arg->mangled() << "_";
+        oss << arg->description() << ",";
     }
-    oss << "__" << m_ret_type->mangled();
+    oss << ") -> " << m_ret_type->description();
     return oss.str();
 }
 
@@ -41,7 +52,7 @@ std::vector<std::shared_ptr<const Type>> Function::templateArgs() const
 tl::expected<TypeCSP, TypeError> Function::callable(const std::vector<TypeCSP>& arg_types) const
 {
     auto is_callable = std::equal(arg_types.begin(), arg_types.end(), m_arg_types.begin(),
-                                  [](auto& a, auto& b) { return *a == *b; });
+                                  m_arg_types.end(), [](auto& a, auto& b) { return a == b; });
     if (!is_callable) {
         return tl::make_unexpected(TypeError{"Mismatching argument types."});
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <pom_type.h>
+#include <pom_typetable.h>
 #include <string>
 #include <vector>
 
@@ -13,8 +14,6 @@ class Function : public Type
    public:
     std::string description() const final;
 
-    std::string mangled() const final;
-
     std::vector<std::shared_ptr<const Type>> templateArgs() const final;
 
     std::shared_ptr<const Type> returnType() const final { return m_ret_type; }
@@ -23,8 +22,18 @@ class Function : public Type
 
     std::vector<TypeCSP> m_arg_types;
     TypeCSP              m_ret_type;
+
+   private:
+    friend class pom::TypeTable;
+
+    Function(std::vector<TypeCSP> arg_types, TypeCSP ret_type);
 };
 
+inline TypeCSP function(const std::vector<TypeCSP>& arg_types, const TypeCSP& ret_type)
+{
+    return TypeTable::instance().function(arg_types, ret_type);
+}
+
 }  // namespace types
 
 }  // namespace pom
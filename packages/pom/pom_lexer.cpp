@@ -1,123 +1,530 @@
 
 #include <pom_lexer.h>
 
+#include <pom_scan.h>
+
 #include <fmt/format.h>
 #include <algorithm>
+#include <cassert>
 #include <charconv>
-#include <fstream>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 namespace pom {
 
 namespace lexer {
 
-inline tl::expected<Token, Err> nexttok(std::istream& ist, char& lastChar)
+namespace {
+
+/// Scans the text of a Source, never copying it.
+struct Cursor
 {
-    auto nextch = [&ist]() -> char { return char(ist.get()); };
+    const char* m_begin;
+    const char* m_pos;
+    const char* m_end;
 
-    // Skip any whitespace.
-    while (std::isspace(lastChar)) {
-        lastChar = nextch();
+    uint32_t offset(const char* p) const { return uint32_t(p - m_begin); }
+};
+
+double parseReal(std::string_view num_str)
+{
+    // strtod needs a terminated string, the mapped text is not.
+    char buffer[64];
+    if (num_str.size() < sizeof(buffer)) {
+        std::copy(num_str.begin(), num_str.end(), buffer);
+        buffer[num_str.size()] = '\0';
+        return strtod(buffer, nullptr);
     }
+    return strtod(std::string(num_str).c_str(), nullptr);
+}
 
-    if (std::isalpha(lastChar)) {  // identifier: [a-zA-Z][a-zA-Z0-9]*
-        std::string identifier;
-        identifier = lastChar;
-        while (std::isalnum((lastChar = nextch()))) {
-            identifier += lastChar;
+}  // namespace
+
+/// Caches the identifiers seen by a lexer, so that only new names go to the global symbol table.
+/// Keys view the text kept by the symbol table, they outlive the text being lexed.
+struct SymbolIndex
+{
+    SymbolId intern(std::string_view name)
+    {
+        auto fo = m_index.find(name);
+        if (fo != m_index.end()) {
+            return fo->second;
         }
+        auto sym = Symbol(name);
+        m_index.emplace(sym.str(), sym.id());
+        return sym.id();
+    }
+
+    std::unordered_map<std::string_view, SymbolId> m_index;
+};
+
+inline tl::expected<PackedToken, Err> nexttok(Cursor&      cur,
+                                              Tokens&      tokens,
+                                              SymbolIndex& symbols,
+                                              const char*& tok_begin)
+{
+    // Skip any whitespace.
+    cur.m_pos = scan::skipSpace(cur.m_pos, cur.m_end);
+    tok_begin = cur.m_pos;
+
+    // Check for end of file.
+    if (cur.m_pos == cur.m_end) {
+        return PackedToken{TokenKind::k_eof, 0, 0};
+    }
 
+    char first = *cur.m_pos;
+    if (scan::isAlpha(first)) {  // identifier: [a-zA-Z][a-zA-Z0-9]*
+        cur.m_pos = scan::skipAlnum(cur.m_pos + 1, cur.m_end);
+
+        std::string_view identifier(tok_begin, size_t(cur.m_pos - tok_begin));
         if (identifier == "def") {
-            return Keyword::k_def;
+            return PackedToken{TokenKind::k_keyword, 0, uint32_t(Keyword::k_def)};
         } else if (identifier == "extern") {
-            return Keyword::k_extern;
+            return PackedToken{TokenKind::k_keyword, 0, uint32_t(Keyword::k_extern)};
         } else if (identifier == "True") {
-            return literals::Boolean{true};
+            return PackedToken{TokenKind::k_boolean, 0, 1};
         } else if (identifier == "False") {
-            return literals::Boolean{false};
+            return PackedToken{TokenKind::k_boolean, 0, 0};
         }
-        return Identifier{identifier};
+        return PackedToken{TokenKind::k_identifier, 0, symbols.intern(identifier)};
     }
 
-    if (std::isdigit(lastChar) || lastChar == '.') {  // Number: [0-9.]+
-        std::string numStr;
-        do {
-            numStr += lastChar;
-            lastChar = nextch();
-        } while (std::isdigit(lastChar) || lastChar == '.');
+    if (scan::isDigit(first) || first == '.') {  // Number: [0-9.]+
+        cur.m_pos = scan::skipNumber(cur.m_pos + 1, cur.m_end);
 
-        if (lastChar == 'i') {
-            lastChar = nextch();
-            if (std::count(numStr.begin(), numStr.end(), '.') > 0) {
+        std::string_view num_str(tok_begin, size_t(cur.m_pos - tok_begin));
+        if (cur.m_pos != cur.m_end && *cur.m_pos == 'i') {
+            ++cur.m_pos;
+            if (num_str.find('.') != std::string_view::npos) {
                 return tl::make_unexpected(
-                    Err{fmt::format("Integer can't have period: {0}i", numStr)});
+                    Err{fmt::format("Integer can't have period: {0}i", num_str)});
             }
             int64_t val;
-            auto [p, ec] = std::from_chars(numStr.data(), numStr.data() + numStr.size(), val);
+            auto [p, ec] = std::from_chars(num_str.data(), num_str.data() + num_str.size(), val);
             if (ec != std::errc()) {
-                return tl::make_unexpected(Err{fmt::format("Error parsing number: {0}i", numStr)});
+                return tl::make_unexpected(Err{fmt::format("Error parsing number: {0}i", num_str)});
             }
 
-            return literals::Integer{val};
+            tokens.m_integers.push_back(val);
+            return PackedToken{TokenKind::k_integer, 0, uint32_t(tokens.m_integers.size() - 1)};
         }
 
-        double dval = strtod(numStr.c_str(), nullptr);
-        return literals::Real{dval};
+        tokens.m_reals.push_back(parseReal(num_str));
+        return PackedToken{TokenKind::k_real, 0, uint32_t(tokens.m_reals.size() - 1)};
     }
 
-    if (lastChar == '#') {
+    if (first == '#') {
         // Comment until end of line.
-        do {
-            lastChar = nextch();
-        } while (lastChar != '\0' && lastChar != '\n' && lastChar != '\r');
-
-        return Comment{};
-    }
+        cur.m_pos = scan::skipToEol(cur.m_pos + 1, cur.m_end);
 
-    // Check for end of file.  Don't eat the EOF.
-    if (lastChar == std::istream::traits_type::eof()) {
-        return Eof{};
+        return PackedToken{TokenKind::k_comment, 0, 0};
     }
 
-    auto tok = Operator{lastChar};
-    lastChar = nextch();
-    return tok;
+    ++cur.m_pos;
+    return PackedToken{TokenKind::k_operator, first, 0};
 }
 
-tl::expected<std::vector<Token>, Err> lex(std::istream& ist)
+namespace {
+
+/// Chunks are cut at the first line end after this many bytes.
+constexpr size_t k_chunk_size = 4 << 10;
+
+/// Lexes the text of a chunk, appending its tokens and their spans from its start to tokens. The
+/// Eof at its end is kept for the last chunk only.
+tl::expected<void, Err> lexChunk(std::string_view text,
+                                 bool             last,
+                                 SymbolIndex&     symbols,
+                                 Tokens&          tokens)
 {
-    std::vector<Token> tokens;
-    char               lastChar = ' ';
+    Cursor cur{text.data(), text.data(), text.data() + text.size()};
     while (1) {
-        auto tok = nexttok(ist, lastChar);
+        const char* tok_begin = nullptr;
+        auto        tok       = nexttok(cur, tokens, symbols, tok_begin);
         if (!tok) {
             return tl::make_unexpected(Err{tok.error()});
         }
 
-        if (std::holds_alternative<Comment>(*tok)) {
+        if (tok->m_kind == TokenKind::k_comment) {
             continue;
         }
-        tokens.push_back(*tok);
-        if (std::holds_alternative<Eof>(*tok)) {
-            break;
+        if (tok->m_kind == TokenKind::k_eof && !last) {
+            return {};
         }
+        tokens.m_tokens.push_back(*tok);
+        tokens.m_spans.push_back(Span{cur.offset(tok_begin), uint32_t(cur.m_pos - tok_begin)});
+        if (tok->m_kind == TokenKind::k_eof) {
+            return {};
+        }
+    }
+}
+
+/// Cuts text, starting at offset in the whole text, into chunks and lexes them. Text holding the
+/// end of the whole text always gets a chunk, for its Eof.
+tl::expected<void, Err> lexChunks(std::string_view                          text,
+                                  const std::shared_ptr<const std::string>& owned,
+                                  uint32_t                                  offset,
+                                  bool                                      last,
+                                  SymbolIndex&                              symbols,
+                                  Tokens&                                   tokens)
+{
+    if (text.empty() && !last) {
+        return {};
+    }
+    size_t begin = 0;
+    do {
+        auto end = text.size();
+        if (end - begin > k_chunk_size) {
+            auto eol = text.find('\n', begin + k_chunk_size - 1);
+            end      = eol == std::string_view::npos ? text.size() : eol + 1;
+        }
+        auto chunk_text = text.substr(begin, end - begin);
+        tokens.m_chunks.push_back(Chunk{chunk_text, owned, offset + uint32_t(begin),
+                                        uint32_t(tokens.m_tokens.size())});
+        auto lexed = lexChunk(chunk_text, last && end == text.size(), symbols, tokens);
+        if (!lexed) {
+            return lexed;
+        }
+        begin = end;
+    } while (begin < text.size());
+    return {};
+}
+
+}  // namespace
+
+tl::expected<Tokens, Err> lex(std::shared_ptr<const Source> source)
+{
+    Tokens tokens;
+    auto   text = source->text();
+    if (text.size() > std::numeric_limits<uint32_t>::max()) {
+        return tl::make_unexpected(Err{"Source too large"});
     }
 
+    SymbolIndex symbols;
+    auto        lexed = lexChunks(text, nullptr, 0, true, symbols, tokens);
+    if (!lexed) {
+        return tl::make_unexpected(lexed.error());
+    }
+    tokens.m_source = std::move(source);
     return tokens;
 }
 
-tl::expected<std::vector<Token>, Err> lex(const std::filesystem::path& path)
+tl::expected<Tokens, Err> lex(std::istream& ist) { return lex(Source::fromStream(ist)); }
+
+tl::expected<Tokens, Err> lex(const std::filesystem::path& path)
+{
+    auto source = Source::map(path);
+    if (!source) {
+        return tl::make_unexpected(Err{source.error().m_desc});
+    }
+    return lex(std::move(*source));
+}
+
+Lexer::Lexer(std::shared_ptr<const Source> source)
+    : m_source(std::move(source)), m_symbols(std::make_unique<SymbolIndex>())
+{
+    m_tokens.m_source = m_source;
+    if (m_source->size() > std::numeric_limits<uint32_t>::max()) {
+        m_error = Err{"Source too large"};
+        m_done  = true;
+        m_tokens.m_tokens.push_back(PackedToken{TokenKind::k_eof, 0, 0});
+        m_tokens.m_spans.push_back(Span{0, 0});
+    }
+}
+
+Lexer::Lexer(std::istream& stream)
+    : m_stream(&stream), m_symbols(std::make_unique<SymbolIndex>())
+{
+}
+
+Lexer::~Lexer() = default;
+
+bool Lexer::refill()
+{
+    std::string line;
+    if (m_error || !std::getline(*m_stream, line)) {
+        return false;
+    }
+    m_buffer.erase(0, m_pos);
+    m_text_offset += m_pos;
+    m_pos = 0;
+
+    // Tokens never span lines, so with the line ending kept only whitespace runs into the end
+    // of the buffer.
+    m_buffer.append(line);
+    if (!m_stream->eof()) {
+        m_buffer.push_back('\n');
+    }
+    if (m_text_offset + m_buffer.size() > std::numeric_limits<uint32_t>::max()) {
+        m_error = Err{"Source too large"};
+        m_buffer.clear();
+    }
+    return true;
+}
+
+PackedToken Lexer::lexUntil(size_t index)
+{
+    auto& tokens = m_tokens.m_tokens;
+    auto& spans  = m_tokens.m_spans;
+    while (index >= tokens.size() && !m_done) {
+        auto   text = m_source ? m_source->text() : std::string_view(m_buffer);
+        Cursor cur{text.data(), text.data() + m_pos, text.data() + text.size()};
+
+        auto        reals     = m_tokens.m_reals.size();
+        auto        integers  = m_tokens.m_integers.size();
+        const char* tok_begin = nullptr;
+        auto        tok       = nexttok(cur, m_tokens, *m_symbols, tok_begin);
+        if (m_stream && cur.m_pos == cur.m_end && refill()) {
+            // The token might go on in the text not read yet, lex it again.
+            m_tokens.m_reals.resize(reals);
+            m_tokens.m_integers.resize(integers);
+            continue;
+        }
+
+        auto offset = uint32_t(m_text_offset + cur.offset(tok_begin));
+        if (!tok && !m_error) {
+            m_error = tok.error();
+        }
+        if (m_error) {
+            m_done  = true;
+            tokens.push_back(PackedToken{TokenKind::k_eof, 0, 0});
+            spans.push_back(Span{offset, 0});
+            break;
+        }
+
+        m_pos = size_t(cur.m_pos - cur.m_begin);
+        if (tok->m_kind == TokenKind::k_comment) {
+            continue;
+        }
+        tokens.push_back(*tok);
+        spans.push_back(Span{offset, uint32_t(cur.m_pos - tok_begin)});
+        m_done = tok->m_kind == TokenKind::k_eof;
+    }
+    return index < tokens.size() ? tokens[index] : PackedToken{TokenKind::k_eof, 0, 0};
+}
+
+void Lexer::discard(size_t count)
+{
+    auto& tokens = m_tokens.m_tokens;
+    count        = std::min(count, tokens.size());
+    tokens.erase(tokens.begin(), tokens.begin() + count);
+    m_tokens.m_spans.erase(m_tokens.m_spans.begin(), m_tokens.m_spans.begin() + count);
+
+    // Pool indices grow with the token index, so the pools compact in place.
+    size_t reals    = 0;
+    size_t integers = 0;
+    for (auto& tok : tokens) {
+        if (tok.m_kind == TokenKind::k_real) {
+            m_tokens.m_reals[reals] = m_tokens.m_reals[tok.m_payload];
+            tok.m_payload           = uint32_t(reals++);
+        } else if (tok.m_kind == TokenKind::k_integer) {
+            m_tokens.m_integers[integers] = m_tokens.m_integers[tok.m_payload];
+            tok.m_payload                 = uint32_t(integers++);
+        }
+    }
+    m_tokens.m_reals.resize(reals);
+    m_tokens.m_integers.resize(integers);
+}
+
+namespace {
+
+/// Same token, literals by value as each stream has its pools.
+bool sameToken(const Tokens& a, PackedToken x, const Tokens& b, PackedToken y)
+{
+    if (x.m_kind != y.m_kind || x.m_op != y.m_op) {
+        return false;
+    }
+    switch (x.m_kind) {
+        case TokenKind::k_real:
+            return a.real(x) == b.real(y);
+        case TokenKind::k_integer:
+            return a.integer(x) == b.integer(y);
+        default:
+            return x.m_payload == y.m_payload;
+    }
+}
+
+bool isLiteral(PackedToken tok)
+{
+    return tok.m_kind == TokenKind::k_real || tok.m_kind == TokenKind::k_integer;
+}
+
+/// Offsets in the whole text of the tokens of chunks [first, last).
+std::vector<uint32_t> tokenStarts(const Tokens& tokens, size_t first, size_t last)
+{
+    std::vector<uint32_t> starts;
+    auto&                 chunks = tokens.m_chunks;
+    for (auto c = first; c < last; c++) {
+        auto end = c + 1 < chunks.size() ? chunks[c + 1].m_first_token : tokens.m_tokens.size();
+        for (auto i = chunks[c].m_first_token; i < end; i++) {
+            starts.push_back(chunks[c].m_offset + tokens.m_spans[i].m_offset);
+        }
+    }
+    return starts;
+}
+
+/// Replaces count_before elements at index with room for count, moving what follows once.
+template <class T>
+void splice(std::vector<T>& elems, size_t index, size_t count_before, size_t count)
+{
+    if (count > count_before) {
+        elems.insert(elems.begin() + index + count_before, count - count_before, T());
+    } else {
+        elems.erase(elems.begin() + index + count, elems.begin() + index + count_before);
+    }
+}
+
+/// Drops the literals no token refers to.
+void compactLiterals(Tokens& tokens)
+{
+    std::vector<double>  reals;
+    std::vector<int64_t> integers;
+    for (auto& tok : tokens.m_tokens) {
+        if (tok.m_kind == TokenKind::k_real) {
+            reals.push_back(tokens.m_reals[tok.m_payload]);
+            tok.m_payload = uint32_t(reals.size() - 1);
+        } else if (tok.m_kind == TokenKind::k_integer) {
+            integers.push_back(tokens.m_integers[tok.m_payload]);
+            tok.m_payload = uint32_t(integers.size() - 1);
+        }
+    }
+    tokens.m_reals    = std::move(reals);
+    tokens.m_integers = std::move(integers);
+}
+
+}  // namespace
+
+tl::expected<Relexed, Err> relex(Tokens& tokens, const Edit& edit)
+{
+    auto& chunks = tokens.m_chunks;
+    if (chunks.empty()) {
+        return tl::make_unexpected(Err{"No text to edit"});
+    }
+    auto size = size_t(chunks.back().m_offset) + chunks.back().m_text.size();
+    if (edit.m_offset > size || edit.m_length > size - edit.m_offset) {
+        return tl::make_unexpected(Err{"Edit out of range"});
+    }
+    if (size - edit.m_length + edit.m_text.size() > std::numeric_limits<uint32_t>::max()) {
+        return tl::make_unexpected(Err{"Source too large"});
+    }
+
+    // From the chunk of the first byte edited to the one of the byte after the edit, so a line
+    // the edit joins to the one before it is lexed with it.
+    auto chunk_at = [&](size_t offset) {
+        auto next = std::upper_bound(
+            chunks.begin(), chunks.end(), offset,
+            [](size_t o, const Chunk& chunk) { return o < chunk.m_offset; });
+        return size_t(next - chunks.begin()) - 1;
+    };
+    auto edit_end    = size_t(edit.m_offset) + edit.m_length;
+    auto first_chunk = chunk_at(edit.m_offset);
+    auto last_chunk  = chunk_at(edit_end);
+    bool last        = last_chunk + 1 == chunks.size();
+    auto base        = chunks[first_chunk].m_offset;
+
+    std::string text;
+    text.append(chunks[first_chunk].m_text.substr(0, edit.m_offset - base));
+    text.append(edit.m_text);
+    text.append(chunks[last_chunk].m_text.substr(edit_end - chunks[last_chunk].m_offset));
+    auto owned = std::make_shared<const std::string>(std::move(text));
+
+    // Lexed aside, tokens stay as they are if this fails.
+    Tokens      fresh;
+    SymbolIndex symbols;
+    auto        lexed = lexChunks(*owned, owned, base, last, symbols, fresh);
+    if (!lexed) {
+        return tl::make_unexpected(lexed.error());
+    }
+
+    auto first      = size_t(chunks[first_chunk].m_first_token);
+    auto end        = last ? tokens.m_tokens.size() : size_t(chunks[last_chunk + 1].m_first_token);
+    auto count      = fresh.m_tokens.size();
+    auto count_was  = end - first;
+    auto delta      = int64_t(edit.m_text.size()) - int64_t(edit.m_length);
+    auto old_starts = tokenStarts(tokens, first_chunk, last_chunk + 1);
+    auto new_starts = tokenStarts(fresh, 0, fresh.m_chunks.size());
+    auto same_at    = [&](size_t old_index, size_t new_index, int64_t shift) {
+        return sameToken(tokens, tokens.m_tokens[first + old_index], fresh,
+                         fresh.m_tokens[new_index]) &&
+               int64_t(old_starts[old_index]) + shift == int64_t(new_starts[new_index]) &&
+               tokens.m_spans[first + old_index].m_length == fresh.m_spans[new_index].m_length;
+    };
+
+    // Tokens lexed the same as before, in the same place or past the edit, are not reported
+    // and keep their literals.
+    size_t prefix = 0;
+    while (prefix < std::min(count, count_was) && same_at(prefix, prefix, 0)) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (prefix + suffix < std::min(count, count_was) &&
+           same_at(count_was - 1 - suffix, count - 1 - suffix, delta)) {
+        suffix++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        auto& tok = fresh.m_tokens[i];
+        if (!isLiteral(tok)) {
+            continue;
+        }
+        if (i < prefix || i >= count - suffix) {
+            auto old      = i < prefix ? i : i + count_was - count;
+            tok.m_payload = tokens.m_tokens[first + old].m_payload;
+        } else if (tok.m_kind == TokenKind::k_real) {
+            tokens.m_reals.push_back(fresh.real(tok));
+            tok.m_payload = uint32_t(tokens.m_reals.size() - 1);
+        } else {
+            tokens.m_integers.push_back(fresh.integer(tok));
+            tok.m_payload = uint32_t(tokens.m_integers.size() - 1);
+        }
+    }
+
+    splice(tokens.m_tokens, first, count_was, count);
+    splice(tokens.m_spans, first, count_was, count);
+    std::copy(fresh.m_tokens.begin(), fresh.m_tokens.end(), tokens.m_tokens.begin() + first);
+    std::copy(fresh.m_spans.begin(), fresh.m_spans.end(), tokens.m_spans.begin() + first);
+
+    auto chunk_count = fresh.m_chunks.size();
+    splice(chunks, first_chunk, last_chunk + 1 - first_chunk, chunk_count);
+    for (size_t c = 0; c < chunk_count; c++) {
+        chunks[first_chunk + c] = fresh.m_chunks[c];
+        chunks[first_chunk + c].m_first_token += uint32_t(first);
+    }
+    for (auto c = first_chunk + chunk_count; c < chunks.size(); c++) {
+        chunks[c].m_offset      = uint32_t(chunks[c].m_offset + delta);
+        chunks[c].m_first_token = uint32_t(chunks[c].m_first_token + count - count_was);
+    }
+
+    // Literals of replaced tokens stay in the pools until they outnumber the tokens.
+    if (tokens.m_reals.size() + tokens.m_integers.size() > 2 * tokens.m_tokens.size()) {
+        compactLiterals(tokens);
+    }
+    return Relexed{first + prefix, end - suffix, first + count - suffix};
+}
+
+Span Tokens::span(size_t index) const
+{
+    auto span = m_spans[index];
+    if (!m_chunks.empty()) {
+        auto next = std::upper_bound(
+            m_chunks.begin(), m_chunks.end(), index,
+            [](size_t i, const Chunk& chunk) { return i < chunk.m_first_token; });
+        span.m_offset += std::prev(next)->m_offset;
+    }
+    return span;
+}
+
+std::string Tokens::text() const
 {
-    std::ifstream fs(path, std::ios_base::in);
-    if (!fs.good()) {
-        return tl::make_unexpected(Err{"Error opening file"});
+    std::string text;
+    for (auto& chunk : m_chunks) {
+        text.append(chunk.m_text);
     }
-    return lex(fs);
+    return text;
 }
 
 struct Printer
@@ -153,6 +560,40 @@ struct Printer
     }
 };
 
+Token Tokens::decode(PackedToken tok) const
+{
+    switch (tok.m_kind) {
+        case TokenKind::k_keyword:
+            return Keyword(tok.m_payload);
+        case TokenKind::k_operator:
+            return Operator{tok.m_op};
+        case TokenKind::k_comment:
+            return Comment{};
+        case TokenKind::k_eof:
+            return Eof{};
+        case TokenKind::k_identifier:
+            return Identifier{identifier(tok)};
+        case TokenKind::k_real:
+            return literals::Real{real(tok)};
+        case TokenKind::k_integer:
+            return literals::Integer{integer(tok)};
+        case TokenKind::k_boolean:
+            return literals::Boolean{tok.m_payload != 0};
+    }
+    assert(0);
+    return Eof{};
+}
+
+std::vector<Token> Tokens::decoded() const
+{
+    std::vector<Token> decoded;
+    decoded.reserve(m_tokens.size());
+    for (auto tok : m_tokens) {
+        decoded.push_back(decode(tok));
+    }
+    return decoded;
+}
+
 std::string toString(const Token& token)
 {
     Printer pr;
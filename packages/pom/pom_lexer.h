@@ -2,7 +2,13 @@
 #pragma once
 
 #include <pom_literals.h>
+#include <pom_source.h>
+#include <pom_symbol.h>
 #include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string_view>
 #include <tl/expected.hpp>
 #include <variant>
 #include <vector>
@@ -41,7 +47,7 @@ struct Eof
 
 struct Identifier
 {
-    std::string m_name;
+    Symbol m_name;
 
     bool operator==(const Identifier& other) const { return other.m_name == m_name; }
 };
@@ -55,26 +61,191 @@ using Token = std::variant<Keyword,
                            literals::Integer,
                            literals::Boolean>;
 
-inline bool isOp(const Token& tok, char op)
+/// Byte range of a token, from the start of its chunk in Tokens, from the start of the input in
+/// the window of a Lexer.
+struct Span
 {
-    return std::holds_alternative<Operator>(tok) && std::get<Operator>(tok).m_op == op;
+    uint32_t m_offset;
+    uint32_t m_length;
+
+    bool operator==(const Span& other) const
+    {
+        return m_offset == other.m_offset && m_length == other.m_length;
+    }
+};
+
+enum class TokenKind : uint8_t
+{
+    k_keyword,
+    k_operator,
+    k_comment,
+    k_eof,
+    k_identifier,
+    k_real,
+    k_integer,
+    k_boolean,
+};
+
+/// Token as stored by the lexer: a kind and a payload. Identifiers keep their SymbolId in the
+/// payload, literals an index into the pools of Tokens. Keywords and booleans keep their value in
+/// the payload, operators their character in m_op.
+struct PackedToken
+{
+    TokenKind m_kind;
+    char      m_op;
+    uint32_t  m_payload;
+};
+
+static_assert(sizeof(PackedToken) == 8);
+
+/// Run of whole lines of the text of Tokens. Tokens never span lines, so an edit relexes only the
+/// chunks it touches, and spans from the start of a chunk stay put when the text before it moves.
+struct Chunk
+{
+    /// Text of the chunk, viewing the Source or, once edited, m_owned.
+    std::string_view                   m_text;
+    std::shared_ptr<const std::string> m_owned;
+
+    /// Offset of the chunk in the whole text and index of its first token.
+    uint32_t m_offset;
+    uint32_t m_first_token;
+};
+
+/// Result of lexing, with the Source the spans refer to.
+struct Tokens
+{
+    /// Source lexed, which the chunks not edited since view.
+    std::shared_ptr<const Source> m_source;
+    std::vector<PackedToken>      m_tokens;
+    std::vector<Span>             m_spans;
+
+    /// The text in order, none in the window of a Lexer.
+    std::vector<Chunk> m_chunks;
+
+    /// Literal pools.
+    std::vector<double>  m_reals;
+    std::vector<int64_t> m_integers;
+
+    /// Span of a token from the start of the text.
+    Span span(size_t index) const;
+
+    /// The text of the chunks, joined.
+    std::string text() const;
+
+    Symbol identifier(PackedToken tok) const { return Symbol::fromId(tok.m_payload); }
+
+    double real(PackedToken tok) const { return m_reals[tok.m_payload]; }
+
+    int64_t integer(PackedToken tok) const { return m_integers[tok.m_payload]; }
+
+    /// Expands a packed token, for printing and diagnostics.
+    Token decode(PackedToken tok) const;
+
+    std::vector<Token> decoded() const;
+};
+
+inline bool isOp(PackedToken tok, char op)
+{
+    return tok.m_kind == TokenKind::k_operator && tok.m_op == op;
 }
 
-inline bool isOpenParen(const Token& tok) { return isOp(tok, '('); }
+inline bool isOpenParen(PackedToken tok) { return isOp(tok, '('); }
 
-inline bool isCloseParen(const Token& tok) { return isOp(tok, ')'); }
+inline bool isCloseParen(PackedToken tok) { return isOp(tok, ')'); }
 
-inline bool isOpenBracket(const Token& tok) { return isOp(tok, '['); }
+inline bool isOpenBracket(PackedToken tok) { return isOp(tok, '['); }
 
-inline bool isCloseBracket(const Token& tok) { return isOp(tok, ']'); }
+inline bool isCloseBracket(PackedToken tok) { return isOp(tok, ']'); }
 
-inline bool isOpenAngled(const Token& tok) { return isOp(tok, '<'); }
+inline bool isOpenAngled(PackedToken tok) { return isOp(tok, '<'); }
 
-inline bool isCloseAngled(const Token& tok) { return isOp(tok, '>'); }
+inline bool isCloseAngled(PackedToken tok) { return isOp(tok, '>'); }
 
-tl::expected<std::vector<Token>, Err> lex(std::istream& stream);
+inline bool isKeyword(PackedToken tok, Keyword kw)
+{
+    return tok.m_kind == TokenKind::k_keyword && tok.m_payload == uint32_t(kw);
+}
+
+tl::expected<Tokens, Err> lex(std::shared_ptr<const Source> source);
+
+tl::expected<Tokens, Err> lex(std::istream& stream);
+
+/// Memory maps the file and lexes it in place.
+tl::expected<Tokens, Err> lex(const std::filesystem::path& path);
+
+struct SymbolIndex;
+
+/// Lexes on demand into a window of tokens. Tokens are read by index, reading past the end of
+/// the window lexes more input, and discard() drops the tokens the reader is done with, so memory
+/// stays bounded by what is still in the window. Spans count from the start of the input.
+class Lexer
+{
+   public:
+    /// Lexes a source in place.
+    explicit Lexer(std::shared_ptr<const Source> source);
+
+    /// Reads the stream a line at a time as tokens are needed, for pipes and stdin.
+    explicit Lexer(std::istream& stream);
+
+    ~Lexer();
+
+    /// Token at index of the window. Past the end of the input this is Eof, also when lexing
+    /// failed, in which case error() is set.
+    PackedToken at(size_t index)
+    {
+        return index < m_tokens.m_tokens.size() ? m_tokens.m_tokens[index] : lexUntil(index);
+    }
+
+    /// The window. Literal pools only hold the literals of tokens in it.
+    const Tokens& tokens() const { return m_tokens; }
+
+    /// Drops the first count tokens of the window, indices shift down by count.
+    void discard(size_t count);
+
+    const std::optional<Err>& error() const { return m_error; }
+
+   private:
+    PackedToken lexUntil(size_t index);
+
+    bool refill();
+
+    std::shared_ptr<const Source> m_source;
+    std::istream*                 m_stream = nullptr;
+
+    /// Text not consumed yet when reading a stream, starting at m_text_offset of the input.
+    std::string m_buffer;
+    uint64_t    m_text_offset = 0;
+    size_t      m_pos         = 0;
+
+    Tokens                       m_tokens;
+    std::unique_ptr<SymbolIndex> m_symbols;
+    bool                         m_done = false;
+    std::optional<Err>           m_error;
+};
+
+/// Replaces m_length bytes at m_offset with m_text.
+struct Edit
+{
+    uint32_t    m_offset;
+    uint32_t    m_length;
+    std::string m_text;
+};
+
+struct Relexed
+{
+    /// Tokens [m_first, m_old_end) of the previous stream were replaced by
+    /// [m_first, m_new_end) of the new one. Tokens after them are shifted but unchanged.
+    size_t m_first;
+    size_t m_old_end;
+    size_t m_new_end;
+};
 
-tl::expected<std::vector<Token>, Err> lex(const std::filesystem::path& path);
+/// Applies an edit to lexed tokens in place. Only the chunks the edit touches are copied and
+/// lexed again. Spans after them stay as they are, only the offsets of the chunks after move, so
+/// the work depends on the size of the edit and the number of chunks, plus one move of the
+/// tokens after the edit when their number changes. Literal pools are compacted once they
+/// outgrow the tokens. Tokens are unchanged if relexing fails.
+tl::expected<Relexed, Err> relex(Tokens& tokens, const Edit& edit);
 
 std::string toString(const Token& token);
 
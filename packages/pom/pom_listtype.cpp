@@ -7,13 +7,16 @@ namespace pom {
 
 namespace types {
 
+List::List(TypeCSP ty)
+    : Type(fmt::format("__list_{0}", ty ? ty->mangled() : "")), m_contained_type(std::move(ty))
+{
+}
+
 std::string List::description() const
 {
     return fmt::format("list<{0}>", m_contained_type->description());
 }
 
-std::string List::mangled() const { return fmt::format("__list_{0}", m_contained_type->mangled()); }
-
 }  // namespace types
 
 }  // namespace pom
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <pom_type.h>
+#include <pom_typetable.h>
 #include <string>
 #include <vector>
 
@@ -11,14 +12,10 @@ namespace types {
 class List : public Type
 {
    public:
-    List(TypeCSP ty) : m_contained_type(std::move(ty)) {}
-
     virtual ~List() {}
 
     std::string description() const final;
 
-    std::string mangled() const final;
-
     std::vector<std::shared_ptr<const Type>> templateArgs() const final
     {
         return {m_contained_type};
@@ -27,9 +24,14 @@ class List : public Type
     std::shared_ptr<const Type> subscriptedType(int64_t) const final { return m_contained_type; }
 
     TypeCSP m_contained_type;
+
+   private:
+    friend class pom::TypeTable;
+
+    List(TypeCSP ty);
 };
 
-inline TypeCSP list(TypeCSP tp) { return std::make_shared<List>(std::move(tp)); }
+inline TypeCSP list(const TypeCSP& tp) { return TypeTable::instance().list(tp); }
 
 }  // namespace types
 
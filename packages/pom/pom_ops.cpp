@@ -2,8 +2,8 @@
 
 #include <pom_basictypes.h>
 
+#include <cassert>
 #include <fmt/format.h>
-#include <map>
 #include <sstream>
 
 namespace pom {
@@ -12,49 +12,50 @@ namespace ops {
 
 namespace {
 
+/// Indexed by BuiltinOp.
 std::vector<OpInfo> makeOps()
 {
     auto real    = types::real();
     auto boolean = types::boolean();
     auto integer = types::integer();
 
+    using Op = BuiltinOp;
     // clang-format off
     std::vector<OpInfo> ops = {
-        {'+', {real, real}, real},
-        {'+', {integer, integer}, integer},
-        {'-', {real, real}, real},
-        {'-', {integer, integer}, integer},
-        {'*', {real, real}, real},
-        {'*', {integer, integer}, integer},
-
-        {'<', {integer, integer}, boolean},
-        {'>', {integer, integer}, boolean},
-        {'<', {real, real}, boolean},
-        {'>', {real, real}, boolean},
-
-        {"or", {boolean, boolean}, boolean},
-        {"and", {boolean, boolean}, boolean},
-
-        {"if", {boolean, real, real}, real},
-        {"if", {boolean, integer, integer}, integer},
+        {Op::k_none, '\0', {}, nullptr},
+
+        {Op::k_add_real, '+', {real, real}, real},
+        {Op::k_add_integer, '+', {integer, integer}, integer},
+        {Op::k_sub_real, '-', {real, real}, real},
+        {Op::k_sub_integer, '-', {integer, integer}, integer},
+        {Op::k_mul_real, '*', {real, real}, real},
+        {Op::k_mul_integer, '*', {integer, integer}, integer},
+
+        {Op::k_lt_integer, '<', {integer, integer}, boolean},
+        {Op::k_gt_integer, '>', {integer, integer}, boolean},
+        {Op::k_lt_real, '<', {real, real}, boolean},
+        {Op::k_gt_real, '>', {real, real}, boolean},
+
+        {Op::k_or, Symbol("or"), {boolean, boolean}, boolean},
+        {Op::k_and, Symbol("and"), {boolean, boolean}, boolean},
+
+        {Op::k_if_real, Symbol("if"), {boolean, real, real}, real},
+        {Op::k_if_integer, Symbol("if"), {boolean, integer, integer}, integer},
     };
     // clang-format on
     return ops;
-};  // namespace ops
+}
 
-std::multimap<OpKey, OpInfo> byKeyOps(const std::vector<OpInfo>& ops)
+const std::vector<OpInfo>& allOps()
 {
-    std::multimap<OpKey, OpInfo> byk;
-    for (auto& op : ops) {
-        byk.insert({op.m_op, op});
-    }
-    return byk;
+    static const std::vector<OpInfo> ops = makeOps();
+    return ops;
 }
 
 bool matches(const OpInfo& func, const std::vector<TypeCSP>& args)
 {
-    return std::equal(args.begin(), args.end(), func.m_args.begin(),
-                      [](auto& x, auto& y) { return *x == *y; });
+    return std::equal(args.begin(), args.end(), func.m_args.begin(), func.m_args.end(),
+                      [](auto& x, auto& y) { return x.get() == y.get(); });
 }
 
 std::string toStr(const OpKey& key)
@@ -64,20 +65,34 @@ std::string toStr(const OpKey& key)
 
 }  // namespace
 
-tl::expected<OpInfo, Err> getBuiltin(OpKey op_key, const std::vector<TypeCSP>& operands)
+BuiltinOp findBuiltin(const OpKey& op, const std::vector<TypeCSP>& operands)
 {
-    static std::vector<OpInfo>          ops   = makeOps();
-    static std::multimap<OpKey, OpInfo> byKey = byKeyOps(ops);
+    // A handful of overloads, comparing keys and interned types is cheaper than any index.
+    auto& ops = allOps();
+    for (size_t i = 1; i < ops.size(); i++) {
+        if (ops[i].m_op == op && matches(ops[i], operands)) {
+            return BuiltinOp(i);
+        }
+    }
+    return BuiltinOp::k_none;
+}
 
-    auto fo = byKey.find(op_key);
-    if (fo == byKey.end()) {
-        return tl::make_unexpected(Err{fmt::format("Op not found: {0}", toStr(op_key))});
+const OpInfo& builtinInfo(BuiltinOp op)
+{
+    assert(op != BuiltinOp::k_none && size_t(op) < k_builtin_count);
+    return allOps()[size_t(op)];
+}
+
+tl::expected<BuiltinOp, Err> getBuiltin(const OpKey& op_key, const std::vector<TypeCSP>& operands)
+{
+    auto op = findBuiltin(op_key, operands);
+    if (op != BuiltinOp::k_none) {
+        return op;
     }
 
-    for (; fo != byKey.end() && fo->first == op_key; ++fo) {
-        if (matches(fo->second, operands)) {
-            return fo->second;
-        }
+    auto& ops = allOps();
+    if (std::none_of(ops.begin(), ops.end(), [&](auto& info) { return info.m_op == op_key; })) {
+        return tl::make_unexpected(Err{fmt::format("Op not found: {0}", toStr(op_key))});
     }
 
     std::ostringstream operands_str;
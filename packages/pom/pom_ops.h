@@ -1,5 +1,6 @@
 #pragma once
 
+#include <pom_symbol.h>
 #include <pom_type.h>
 #include <tl/expected.hpp>
 #include <vector>
@@ -13,16 +14,47 @@ struct Err
     std::string m_desc;
 };
 
-using OpKey = std::variant<char, std::string>;
+using OpKey = std::variant<char, Symbol>;
+
+/// Builtin operators, one per overload. Semantic analysis resolves each operator and builtin call
+/// to one, later phases dispatch on it.
+enum class BuiltinOp : uint8_t
+{
+    k_none,
+    k_add_real,
+    k_add_integer,
+    k_sub_real,
+    k_sub_integer,
+    k_mul_real,
+    k_mul_integer,
+    k_lt_integer,
+    k_gt_integer,
+    k_lt_real,
+    k_gt_real,
+    k_or,
+    k_and,
+    k_if_real,
+    k_if_integer,
+};
+
+constexpr size_t k_builtin_count = size_t(BuiltinOp::k_if_integer) + 1;
 
 struct OpInfo
 {
+    BuiltinOp            m_id;
     OpKey                m_op;
     std::vector<TypeCSP> m_args;
     TypeCSP              m_ret_type;
 };
 
-tl::expected<OpInfo, Err> getBuiltin(OpKey op, const std::vector<TypeCSP>& ty);
+/// Overload of op for operands, k_none if there is none.
+BuiltinOp findBuiltin(const OpKey& op, const std::vector<TypeCSP>& operands);
+
+/// The builtin, which must not be k_none.
+const OpInfo& builtinInfo(BuiltinOp op);
+
+/// Like findBuiltin, saying why there is no overload.
+tl::expected<BuiltinOp, Err> getBuiltin(const OpKey& op, const std::vector<TypeCSP>& operands);
 
 }  // namespace ops
 
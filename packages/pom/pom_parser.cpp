@@ -1,9 +1,16 @@
 ﻿
 #include <pom_parser.h>
 
+#include <pom_threadpool.h>
+
 #include <fmt/format.h>
+#include <array>
+#include <cassert>
 #include <iostream>
-#include <map>
+#include <cstring>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace pom {
 
@@ -12,239 +19,481 @@ namespace parser {
 template <class RetT>
 using expected = tl::expected<RetT, Err>;
 
-using TokIt = std::vector<lexer::Token>::const_iterator;
-
 namespace {
 
-int tokPrecedence(const lexer::Token& tok)
+/// Walks the tokens of a lexed source, or of a lexer window, lexing on demand. Reading past the
+/// end, or past the end of the range being parsed, gives Eof.
+class TokIt
 {
-    static std::map<char, int> binopPrecedence;
-    if (binopPrecedence.empty()) {
-        // Install standard binary operators.
-        // 1 is lowest precedence.
-        binopPrecedence['<'] = 10;
-        binopPrecedence['>'] = 10;
-        binopPrecedence['+'] = 20;
-        binopPrecedence['-'] = 20;
-        binopPrecedence['*'] = 40;  // highest.
-    }
-    auto op = std::get_if<lexer::Operator>(&tok);
-    if (!op) {
-        return -1;
+   public:
+    TokIt(const lexer::Tokens& tokens, lexer::Lexer* lexer)
+        : m_tokens(tokens), m_lexer(lexer), m_end(tokens.m_tokens.size()), m_tok(load(0))
+    {
     }
-    auto fo = binopPrecedence.find(op->m_op);
-    if (fo == binopPrecedence.end()) {
-        return -1;
+
+    TokIt(const lexer::Tokens& tokens, size_t begin, size_t end)
+        : m_tokens(tokens), m_lexer(nullptr), m_index(begin), m_end(end), m_tok(load(begin))
+    {
     }
-    return fo->second;
-}
 
-struct ParserContext
-{
-    ast::ExprId m_current_id = 0;
+    lexer::PackedToken        operator*() const { return m_tok; }
+    const lexer::PackedToken* operator->() const { return &m_tok; }
 
-    ast::ExprId nextId() { return m_current_id++; }
-};
+    TokIt& operator++()
+    {
+        m_tok = load(++m_index);
+        return *this;
+    }
+
+    size_t index() const { return m_index; }
+
+   private:
+    lexer::PackedToken load(size_t index) const
+    {
+        if (m_lexer) {
+            return m_lexer->at(index);
+        }
+        return index < m_end ? m_tokens.m_tokens[index]
+                             : lexer::PackedToken{lexer::TokenKind::k_eof, 0, 0};
+    }
 
-expected<ast::ExprP> parseExpression(TokIt& tok_it, ParserContext& ctx);
+    const lexer::Tokens& m_tokens;
+    lexer::Lexer*        m_lexer;
+    size_t               m_index = 0;
+    size_t               m_end;
+    lexer::PackedToken   m_tok;
+};
 
-/// parenexpr ::= '(' expression ')'
-expected<ast::ExprP> parseParenExpr(TokIt& tok_it, ParserContext& ctx)
+constexpr std::array<int8_t, 256> makeBinopPrecedence()
 {
-    ++tok_it;  // eat (.
-    auto v = parseExpression(tok_it, ctx);
-    if (!v) {
-        return nullptr;
+    std::array<int8_t, 256> binop_precedence{};
+    for (auto& prec : binop_precedence) {
+        prec = -1;
     }
+    // Install standard binary operators.
+    // 1 is lowest precedence.
+    binop_precedence['<'] = 10;
+    binop_precedence['>'] = 10;
+    binop_precedence['+'] = 20;
+    binop_precedence['-'] = 20;
+    binop_precedence['*'] = 40;  // highest.
+    return binop_precedence;
+}
+
+int opPrecedence(char op)
+{
+    static constexpr auto binop_precedence = makeBinopPrecedence();
+    return binop_precedence[static_cast<unsigned char>(op)];
+}
 
-    if (!isCloseParen(*tok_it)) {
-        return tl::make_unexpected(Err{"expected ')'"});
+int tokPrecedence(lexer::PackedToken tok)
+{
+    if (tok.m_kind != lexer::TokenKind::k_operator) {
+        return -1;
     }
-    ++tok_it;  // eat ).
-    return v;
+    return opPrecedence(tok.m_op);
 }
 
-expected<ast::ExprP> parseListExpr(TokIt& tok_it, ParserContext& ctx)
+/// A paren, call or list whose expressions are being parsed, or the expression itself.
+struct OpenExpr
 {
-    ++tok_it;  // eat [.
+    enum Kind : uint8_t
+    {
+        k_top,
+        k_paren,
+        k_call,
+        k_list,
+    };
+
+    Kind   m_kind;
+    Symbol m_function;
+
+    /// Where the arguments or items start in m_children, and its operators in m_operators.
+    size_t m_first_child;
+    size_t m_first_operator;
+};
+
+/// Structure of a node without calls or lists below it, for hash-consing. Children are compared
+/// by identity, they are shared already.
+struct NodeKey
+{
+    uint32_t   m_scope;
+    uint8_t    m_kind;
+    uint8_t    m_literal_kind = 0;
+    char       m_op           = 0;
+    bool       m_subscripted  = false;
+    Symbol     m_name;
+    uint64_t   m_bits = 0;
+    ast::ExprP m_lhs  = nullptr;
+    ast::ExprP m_rhs  = nullptr;
+
+    bool operator==(const NodeKey& other) const
+    {
+        return m_scope == other.m_scope && m_kind == other.m_kind &&
+               m_literal_kind == other.m_literal_kind && m_op == other.m_op &&
+               m_subscripted == other.m_subscripted && m_name == other.m_name &&
+               m_bits == other.m_bits && m_lhs == other.m_lhs && m_rhs == other.m_rhs;
+    }
+};
 
-    ast::ListExpr li;
-    while (!lexer::isCloseBracket(*tok_it)) {
-        auto v = parseExpression(tok_it, ctx);
-        if (!v) {
-            return nullptr;
+struct NodeKeyHash
+{
+    size_t operator()(const NodeKey& key) const
+    {
+        size_t h = key.m_scope;
+        for (size_t v : {size_t(key.m_kind) << 16 | size_t(key.m_literal_kind) << 8 |
+                             size_t(uint8_t(key.m_op)) << 1 | size_t(key.m_subscripted),
+                         size_t(key.m_name.id()), size_t(key.m_bits),
+                         reinterpret_cast<size_t>(key.m_lhs),
+                         reinterpret_cast<size_t>(key.m_rhs)}) {
+            h = (h ^ v) * 0x100000001b3ull;
         }
-        li.m_expressions.push_back(std::move(*v));
+        return h;
     }
-    ++tok_it;  // eat ].
-    return std::make_shared<ast::Expr>(std::move(li), ctx.nextId());
-}
+};
 
-/// identifierexpr
-///   ::= identifier
-///   ::= identifier '(' expression* ')'
-expected<ast::ExprP> parseIdentifierExpr(TokIt& tok_it, ParserContext& ctx)
+struct ParserContext
 {
-    std::vector<ast::ExprP> args;
+    ParserContext(const lexer::Tokens& tokens,
+                  ast::AstArena&       arena,
+                  ast::ExprId          first_id,
+                  const Options&       options)
+        : m_tokens(tokens), m_arena(arena), m_current_id(first_id), m_options(options)
+    {
+    }
 
-    auto ident = std::get_if<lexer::Identifier>(&(*tok_it));
-    if (!ident) {
-        return tl::make_unexpected(Err{"expected identifier"});
+    const lexer::Tokens& m_tokens;
+    ast::AstArena&       m_arena;
+    ast::ExprId          m_current_id;
+    Options              m_options;
+
+    /// Children of the calls and lists being parsed, innermost last. Each node copies its own
+    /// children into the arena and pops them.
+    std::vector<ast::ExprP> m_children;
+
+    ast::ArenaArray<ast::ExprP> popChildren(size_t first)
+    {
+        auto children = m_arena.copy(m_children.data() + first,
+                                     m_children.data() + m_children.size());
+        m_children.resize(first);
+        return children;
     }
-    ++tok_it;
 
-    if (!lexer::isOpenParen(*tok_it)) {
-        if (lexer::isOpenBracket(*tok_it)) {
-            // a[1]
-            ++tok_it;
-            if (!std::holds_alternative<literals::Real>(*tok_it)) {
-                return tl::make_unexpected(Err{"expected a number inside []"});
-            }
-            int64_t subscript = int64_t(std::get<literals::Real>(*tok_it).m_val);
-            ++tok_it;
-            if (!lexer::isCloseBracket(*tok_it)) {
-                return tl::make_unexpected(Err{"expected closing brackets"});
-            }
-            ++tok_it;
-            return std::make_shared<ast::Expr>(ast::Var{ident->m_name, subscript}, ctx.nextId());
-        } else {
-            // Simple variable ref.
-            return std::make_shared<ast::Expr>(ast::Var{ident->m_name, std::nullopt}, ctx.nextId());
+    /// Stacks of parseExpression.
+    std::vector<OpenExpr>   m_open;
+    std::vector<ast::ExprP> m_operands;
+    std::vector<char>       m_operators;
+
+    void open(OpenExpr::Kind kind, Symbol function = {})
+    {
+        m_open.push_back(OpenExpr{kind, function, m_children.size(), m_operators.size()});
+    }
+
+    ast::ExprP popOperand()
+    {
+        auto operand = m_operands.back();
+        m_operands.pop_back();
+        return operand;
+    }
+
+    /// Builds the pending operators of the innermost open expression that bind at least prec.
+    void reduceOperators(int prec)
+    {
+        auto first = m_open.back().m_first_operator;
+        while (m_operators.size() > first && opPrecedence(m_operators.back()) >= prec) {
+            auto rhs = popOperand();
+            auto lhs = popOperand();
+            m_operands.push_back(add(ast::BinaryExpr{m_operators.back(), lhs, rhs}));
+            m_operators.pop_back();
         }
     }
 
-    // Call.
-    ++tok_it;  // eat (
-    if (!isCloseParen(*tok_it)) {
-        while (true) {
-            auto arg = parseExpression(tok_it, ctx);
-            if (!arg) {
-                return arg;
-            }
-            args.push_back(std::move(*arg));
+    /// Rows of the function being parsed.
+    ast::FlatExprsBuilder m_flat;
 
-            if (isCloseParen(*tok_it)) {
-                break;
-            }
+    ast::ExprId nextId() { return m_current_id++; }
 
-            if (!isOp(*tok_it, ',')) {
-                return tl::make_unexpected(Err{"Expected ')' or ',' in argument list"});
+    /// Canonical nodes of the function being parsed, when hash-consing.
+    std::unordered_map<NodeKey, ast::ExprP, NodeKeyHash> m_shared;
+    std::unordered_set<ast::ExprP>                       m_canonical;
+
+    /// Nodes only match nodes of the same scope. Arguments after the first of a call get a scope
+    /// of their own: they may be lowered conditionally, like the arms of an if, so nothing outside
+    /// may use their nodes and they may only use their own.
+    std::vector<uint32_t> m_scopes;
+    uint32_t              m_next_scope = 0;
+
+    void pushScope() { m_scopes.push_back(m_next_scope++); }
+
+    std::optional<NodeKey> key(const ast::Literal& lit) const
+    {
+        NodeKey key{m_scopes.back(), 0};
+        key.m_literal_kind = uint8_t(lit.index());
+        std::visit(
+            [&](auto& v) {
+                static_assert(sizeof(v.m_val) <= sizeof(key.m_bits));
+                std::memcpy(&key.m_bits, &v.m_val, sizeof(v.m_val));
+            },
+            lit);
+        return key;
+    }
+
+    std::optional<NodeKey> key(const ast::Var& var) const
+    {
+        NodeKey key{m_scopes.back(), 1};
+        key.m_name        = var.m_name;
+        key.m_subscripted = bool(var.m_subscript);
+        key.m_bits        = uint64_t(var.m_subscript.value_or(0));
+        return key;
+    }
+
+    std::optional<NodeKey> key(const ast::BinaryExpr& e) const
+    {
+        if (!m_canonical.count(e.m_lhs) || !m_canonical.count(e.m_rhs)) {
+            return std::nullopt;
+        }
+        NodeKey key{m_scopes.back(), 2};
+        key.m_op  = e.m_op;
+        key.m_lhs = e.m_lhs;
+        key.m_rhs = e.m_rhs;
+        return key;
+    }
+
+    /// Calls may have side effects and lists allocate, they are never shared.
+    std::optional<NodeKey> key(const ast::Call&) const { return std::nullopt; }
+
+    std::optional<NodeKey> key(const ast::ListExpr&) const { return std::nullopt; }
+
+    /// Creates a node with the next id, after its children. When hash-consing, returns the node
+    /// of the same structure instead if there is one.
+    template <class T>
+    ast::ExprP add(T&& val)
+    {
+        std::optional<NodeKey> node_key;
+        if (m_options.m_hash_cons) {
+            node_key = key(val);
+            if (node_key) {
+                auto fo = m_shared.find(*node_key);
+                if (fo != m_shared.end()) {
+                    return fo->second;
+                }
             }
-            ++tok_it;
         }
+        auto expr = m_arena.make<ast::Expr>(std::forward<T>(val), nextId());
+        m_flat.append(*expr);
+        if (node_key) {
+            m_shared.emplace(*node_key, expr);
+            m_canonical.insert(expr);
+        }
+        return expr;
     }
 
-    // Eat the ')'.
-    ++tok_it;
+    /// Rows of the function parsed so far, the next function starts over.
+    ast::FlatExprs finishFunction()
+    {
+        m_shared.clear();
+        m_canonical.clear();
+        return m_flat.finish(m_arena);
+    }
 
-    return std::make_shared<ast::Expr>(ast::Call{ident->m_name, std::move(args)}, ctx.nextId());
+    std::string toString(lexer::PackedToken tok) const
+    {
+        return lexer::toString(m_tokens.decode(tok));
+    }
+};
+
+/// identifierexpr
+///   ::= identifier
+///   ::= identifier '[' number ']'
+/// The call form, identifier '(' expression* ')', is opened by parseOperand.
+expected<ast::ExprP> parseIdentifierExpr(Symbol name, TokIt& tok_it, ParserContext& ctx)
+{
+    if (lexer::isOpenBracket(*tok_it)) {
+        // a[1]
+        ++tok_it;
+        if (tok_it->m_kind != lexer::TokenKind::k_real) {
+            return tl::make_unexpected(Err{"expected a number inside []"});
+        }
+        int64_t subscript = int64_t(ctx.m_tokens.real(*tok_it));
+        ++tok_it;
+        if (!lexer::isCloseBracket(*tok_it)) {
+            return tl::make_unexpected(Err{"expected closing brackets"});
+        }
+        ++tok_it;
+        return ctx.add(ast::Var{name, subscript});
+    }
+    // Simple variable ref.
+    return ctx.add(ast::Var{name, std::nullopt});
 }
 
 /// primary
 ///   ::= identifierexpr
 ///   ::= numberexpr
-///   ::= parenexpr
-expected<ast::ExprP> parsePrimary(TokIt& tok_it, ParserContext& ctx)
+///   ::= parenexpr   ::= '(' expression ')'
+///   ::= listexpr    ::= '[' expression* ']'
+///   ::= callexpr    ::= identifier '(' expression (',' expression)* ')'
+/// Returns nullptr when the primary opened a paren, a list or a call, its expressions come next.
+expected<ast::ExprP> parseOperand(TokIt& tok_it, ParserContext& ctx)
 {
     if (lexer::isOpenParen(*tok_it)) {
-        return parseParenExpr(tok_it, ctx);
+        ++tok_it;  // eat (.
+        ctx.open(OpenExpr::k_paren);
+        return nullptr;
     } else if (lexer::isOpenBracket(*tok_it)) {
-        return parseListExpr(tok_it, ctx);
-    } else if (std::holds_alternative<lexer::Identifier>(*tok_it)) {
-        return parseIdentifierExpr(tok_it, ctx);
-    } else if (std::holds_alternative<literals::Real>(*tok_it)) {
-        auto expr = ast::Literal{std::get<literals::Real>(*tok_it)};
+        ++tok_it;  // eat [.
+        if (lexer::isCloseBracket(*tok_it)) {
+            ++tok_it;  // eat ].
+            return ctx.add(ast::ListExpr{});
+        }
+        ctx.open(OpenExpr::k_list);
+        return nullptr;
+    } else if (tok_it->m_kind == lexer::TokenKind::k_identifier) {
+        auto name = ctx.m_tokens.identifier(*tok_it);
         ++tok_it;
-        return std::make_unique<ast::Expr>(expr, ctx.nextId());
-    } else if (std::holds_alternative<literals::Integer>(*tok_it)) {
-        auto expr = ast::Literal{std::get<literals::Integer>(*tok_it)};
+        if (!lexer::isOpenParen(*tok_it)) {
+            return parseIdentifierExpr(name, tok_it, ctx);
+        }
+        ++tok_it;  // eat (.
+        if (isCloseParen(*tok_it)) {
+            ++tok_it;  // eat ).
+            return ctx.add(ast::Call{name, {}});
+        }
+        ctx.open(OpenExpr::k_call, name);
+        return nullptr;
+    } else if (tok_it->m_kind == lexer::TokenKind::k_real) {
+        auto expr = ast::Literal{literals::Real{ctx.m_tokens.real(*tok_it)}};
+        ++tok_it;
+        return ctx.add(expr);
+    } else if (tok_it->m_kind == lexer::TokenKind::k_integer) {
+        auto expr = ast::Literal{literals::Integer{ctx.m_tokens.integer(*tok_it)}};
         ++tok_it;
-        return std::make_unique<ast::Expr>(expr, ctx.nextId());
-    } else if (std::holds_alternative<literals::Boolean>(*tok_it)) {
-        auto expr = ast::Literal{std::get<literals::Boolean>(*tok_it)};
+        return ctx.add(expr);
+    } else if (tok_it->m_kind == lexer::TokenKind::k_boolean) {
+        auto expr = ast::Literal{literals::Boolean{tok_it->m_payload != 0}};
         ++tok_it;
-        return std::make_unique<ast::Expr>(expr, ctx.nextId());
+        return ctx.add(expr);
     }
     return tl::make_unexpected(Err{
-        fmt::format("unknown token when expecting an expression: {0}", lexer::toString(*tok_it))});
+        fmt::format("unknown token when expecting an expression: {0}", ctx.toString(*tok_it))});
 }
 
-/// binoprhs
-///   ::= ('+' primary)*
-expected<ast::ExprP> parseBinOpRHS(int exprPrec, ast::ExprP lhs, TokIt& tok_it, ParserContext& ctx)
+/// Ends the innermost open expression, whose value is on top of m_operands. Returns true when
+/// an operand comes next: an argument after ',' or the next item of a list.
+expected<bool> closeExpr(TokIt& tok_it, ParserContext& ctx)
 {
-    // If this is a binop, find its precedence.
-    while (true) {
-        int tokPrec = tokPrecedence(*tok_it);
-
-        // If this is a binop that binds at least as tightly as the current binop,
-        // consume it, otherwise we are done.
-        if (tokPrec < exprPrec) {
-            return lhs;
-        }
-
-        // Okay, we know this is a binop.
-        auto op = std::get_if<lexer::Operator>(&(*tok_it));
-        if (!op) {
-            return tl::make_unexpected(Err{"expected binop"});
-        }
-        ++tok_it;  // eat binop
-
-        // Parse the primary expression after the binary operator.
-        auto rhs = parsePrimary(tok_it, ctx);
-        if (!rhs) {
-            return rhs;
-        }
-
-        // If BinOp binds less tightly with RHS than the operator after RHS, let
-        // the pending operator take RHS as its LHS.
-        int nextPrec = tokPrecedence(*tok_it);
-        if (tokPrec < nextPrec) {
-            rhs = parseBinOpRHS(tokPrec + 1, std::move(*rhs), tok_it, ctx);
-            if (!rhs) {
-                return rhs;
+    auto& open = ctx.m_open.back();
+    switch (open.m_kind) {
+        case OpenExpr::k_top:
+            return false;
+        case OpenExpr::k_paren:
+            if (!isCloseParen(*tok_it)) {
+                return tl::make_unexpected(Err{"expected ')'"});
             }
-        }
-
-        // Merge LHS/RHS.
-        lhs = std::make_unique<ast::Expr>(
-            ast::BinaryExpr{op->m_op, std::move(lhs), std::move(*rhs)}, ctx.nextId());
+            ++tok_it;  // eat ).
+            ctx.m_open.pop_back();
+            return false;
+        case OpenExpr::k_call:
+            if (ctx.m_children.size() > open.m_first_child) {
+                ctx.m_scopes.pop_back();
+            }
+            ctx.m_children.push_back(ctx.popOperand());
+            if (isOp(*tok_it, ',')) {
+                ++tok_it;
+                ctx.pushScope();
+                return true;
+            }
+            if (!isCloseParen(*tok_it)) {
+                return tl::make_unexpected(Err{"Expected ')' or ',' in argument list"});
+            }
+            ++tok_it;  // eat ).
+            ctx.m_operands.push_back(
+                ctx.add(ast::Call{open.m_function, ctx.popChildren(open.m_first_child)}));
+            ctx.m_open.pop_back();
+            return false;
+        case OpenExpr::k_list:
+            ctx.m_children.push_back(ctx.popOperand());
+            if (!lexer::isCloseBracket(*tok_it)) {
+                return true;
+            }
+            ++tok_it;  // eat ].
+            ctx.m_operands.push_back(ctx.add(ast::ListExpr{ctx.popChildren(open.m_first_child)}));
+            ctx.m_open.pop_back();
+            return false;
     }
+    return false;
 }
 
 /// expression
-///   ::= primary binoprhs
+///   ::= primary (binop primary)*
 ///
+/// Parsed with explicit stacks instead of recursion, so long operator chains and deep nesting
+/// cost heap and not native stack. An operator waits on m_operators until one that binds at most
+/// as tightly follows it, parens, calls and lists push an OpenExpr until they are closed.
 expected<ast::ExprP> parseExpression(TokIt& tok_it, ParserContext& ctx)
 {
-    auto lhs = parsePrimary(tok_it, ctx);
-    if (!lhs) {
-        return lhs;
-    }
+    ctx.m_open.clear();
+    ctx.m_operands.clear();
+    ctx.m_operators.clear();
+    ctx.m_scopes.clear();
+    ctx.pushScope();
+    ctx.open(OpenExpr::k_top);
+
+    while (true) {
+        auto operand = parseOperand(tok_it, ctx);
+        if (!operand) {
+            return operand;
+        }
+        if (!*operand) {
+            continue;
+        }
+        ctx.m_operands.push_back(*operand);
+
+        // Operators and closing brackets, until the next operand.
+        while (true) {
+            int prec = tokPrecedence(*tok_it);
+            if (prec >= 0) {
+                ctx.reduceOperators(prec);
+                ctx.m_operators.push_back(tok_it->m_op);
+                ++tok_it;  // eat binop
+                break;
+            }
 
-    return parseBinOpRHS(0, std::move(*lhs), tok_it, ctx);
+            ctx.reduceOperators(0);
+            if (ctx.m_open.size() == 1) {
+                ctx.m_open.pop_back();
+                return ctx.popOperand();
+            }
+            auto next_operand = closeExpr(tok_it, ctx);
+            if (!next_operand) {
+                return tl::unexpected(next_operand.error());
+            }
+            if (*next_operand) {
+                break;
+            }
+        }
+    }
 }
 
-expected<ast::TypeDescCSP> parseType(TokIt& tok_it)
+expected<ast::TypeDescP> parseType(TokIt& tok_it, ParserContext& ctx)
 {
-    auto type_ident = std::get_if<lexer::Identifier>(&(*tok_it));
-    if (!type_ident) {
+    if (tok_it->m_kind != lexer::TokenKind::k_identifier) {
         return tl::make_unexpected(
-            Err{fmt::format("Unexpected token in type: {0}", lexer::toString(*tok_it))});
+            Err{fmt::format("Unexpected token in type: {0}", ctx.toString(*tok_it))});
     }
+    auto type_name = ctx.m_tokens.identifier(*tok_it);
     ++tok_it;
 
-    std::vector<ast::TypeDescCSP> template_args;
+    std::vector<ast::TypeDescP> template_args;
     if (lexer::isOpenAngled(*tok_it)) {
         ++tok_it;
 
         while (1) {
             // template parameter
-            auto tt = parseType(tok_it);
+            auto tt = parseType(tok_it, ctx);
             if (!tt) {
                 return tt;
             }
-            template_args.push_back(std::move(*tt));
+            template_args.push_back(*tt);
 
             if (lexer::isCloseAngled(*tok_it)) {
                 ++tok_it;
@@ -253,27 +502,50 @@ expected<ast::TypeDescCSP> parseType(TokIt& tok_it)
 
             if (!lexer::isOp(*tok_it, ',')) {
                 return tl::make_unexpected(Err{
-                    fmt::format("Unexpected token in template: {0}", lexer::toString(*tok_it))});
+                    fmt::format("Unexpected token in template: {0}", ctx.toString(*tok_it))});
             }
             ++tok_it;
         }
     }
 
-    return std::make_shared<ast::TypeDesc>(
-        ast::TypeDesc{type_ident->m_name, std::move(template_args)});
+    return ctx.m_arena.make<ast::TypeDesc>(
+        ast::TypeDesc{type_name, ctx.m_arena.copy(template_args)});
 }
 
 /// prototype
-///   ::= id '(' id* ')'
-expected<ast::Signature> parsePrototype(TokIt& tok_it)
+///   ::= id ('<' id (',' id)* '>')? '(' id* ')'
+expected<ast::Signature> parsePrototype(TokIt& tok_it, ParserContext& ctx)
 {
-    if (!std::holds_alternative<lexer::Identifier>(*tok_it)) {
+    if (tok_it->m_kind != lexer::TokenKind::k_identifier) {
         return tl::make_unexpected(Err{"Expected function name in prototype"});
     }
 
-    std::string fn_name = std::get<lexer::Identifier>(*tok_it).m_name;
+    auto fn_name = ctx.m_tokens.identifier(*tok_it);
     ++tok_it;
 
+    std::vector<Symbol> type_params;
+    if (lexer::isOpenAngled(*tok_it)) {
+        ++tok_it;
+        while (1) {
+            if (tok_it->m_kind != lexer::TokenKind::k_identifier) {
+                return tl::make_unexpected(Err{fmt::format(
+                    "Unexpected token in type parameters: {0}", ctx.toString(*tok_it))});
+            }
+            type_params.push_back(ctx.m_tokens.identifier(*tok_it));
+            ++tok_it;
+
+            if (lexer::isCloseAngled(*tok_it)) {
+                ++tok_it;
+                break;
+            }
+            if (!isOp(*tok_it, ',')) {
+                return tl::make_unexpected(Err{fmt::format(
+                    "Unexpected token in type parameters: {0}", ctx.toString(*tok_it))});
+            }
+            ++tok_it;
+        }
+    }
+
     if (!isOpenParen(*tok_it)) {
         return tl::make_unexpected(Err{"Expected '(' in prototype"});
     }
@@ -288,45 +560,45 @@ expected<ast::Signature> parsePrototype(TokIt& tok_it)
         if (!args.empty()) {
             if (!isOp(*tok_it, ',')) {
                 return tl::make_unexpected(Err{fmt::format(
-                    "Expected comma in prototype but found: {0}", lexer::toString(*tok_it))});
+                    "Expected comma in prototype but found: {0}", ctx.toString(*tok_it))});
             }
             ++tok_it;
         }
 
-        auto type = parseType(tok_it);
+        auto type = parseType(tok_it, ctx);
         if (!type) {
             return tl::make_unexpected(type.error());
         }
 
-        auto name_ident = std::get_if<lexer::Identifier>(&(*tok_it));
-        if (!name_ident) {
+        if (tok_it->m_kind != lexer::TokenKind::k_identifier) {
             return tl::make_unexpected(
-                Err{fmt::format("Unexpected token in prototype: {0}", lexer::toString(*tok_it))});
+                Err{fmt::format("Unexpected token in prototype: {0}", ctx.toString(*tok_it))});
         }
+        auto arg_name = ctx.m_tokens.identifier(*tok_it);
         ++tok_it;
-        args.push_back(ast::Arg{std::move(*type), name_ident->m_name});
+        args.push_back(ast::Arg{*type, arg_name});
     }
 
-    ast::TypeDescCSP opt_ret_type;
+    ast::TypeDescP opt_ret_type = nullptr;
     if (isOp(*tok_it, ':')) {
         ++tok_it;
 
-        auto ret_type = parseType(tok_it);
+        auto ret_type = parseType(tok_it, ctx);
         if (!ret_type) {
             return tl::make_unexpected(
-                Err{fmt::format("Unexpected token in prototype: {0}", lexer::toString(*tok_it))});
+                Err{fmt::format("Unexpected token in prototype: {0}", ctx.toString(*tok_it))});
         }
-        opt_ret_type = std::move(*ret_type);
+        opt_ret_type = *ret_type;
     }
 
-    return ast::Signature{fn_name, std::move(args), std::move(opt_ret_type)};
+    return ast::Signature{fn_name, std::move(args), opt_ret_type, std::move(type_params)};
 }
 
 /// definition ::= 'def' prototype expression
 expected<ast::Function> parseDefinition(TokIt& tok_it, ParserContext& ctx)
 {
     ++tok_it;  // eat def.
-    auto proto = parsePrototype(tok_it);
+    auto proto = parsePrototype(tok_it, ctx);
     if (!proto) {
         return tl::unexpected(proto.error());
     }
@@ -335,7 +607,7 @@ expected<ast::Function> parseDefinition(TokIt& tok_it, ParserContext& ctx)
     if (!exp) {
         return tl::unexpected(exp.error());
     }
-    return ast::Function{std::move(*proto), std::move(*exp)};
+    return ast::Function{std::move(*proto), *exp, ctx.finishFunction()};
 }
 
 /// toplevelexpr ::= expression
@@ -347,57 +619,264 @@ expected<ast::Function> parseTopLevelExpr(TokIt& tok_it, ParserContext& ctx)
     }
 
     // Make an anonymous proto.
-    auto sig = ast::Signature{"__anon_expr", {}, {}};
-    return ast::Function{std::move(sig), std::move(*exp)};
+    auto sig = ast::Signature{"__anon_expr", {}, nullptr};
+    return ast::Function{std::move(sig), *exp, ctx.finishFunction()};
 }
 
 /// external ::= 'extern' prototype
-expected<ast::Signature> parseExtern(TokIt& tok_it, ParserContext&)
+expected<ast::Signature> parseExtern(TokIt& tok_it, ParserContext& ctx)
 {
     ++tok_it;  // eat extern.
-    return parsePrototype(tok_it);
+    return parsePrototype(tok_it, ctx);
 }
 
-}  // namespace
-
 /// top ::= definition | external | expression | ';'
-expected<TopLevel> parse(const std::vector<lexer::Token>& tokens)
+expected<std::optional<TopLevelUnit>> parseTopLevelUnit(TokIt& tok_it, ParserContext& ctx)
 {
-    ParserContext parser_context;
+    while (isOp(*tok_it, ';')) {
+        ++tok_it;
+    }
+    if (tok_it->m_kind == lexer::TokenKind::k_eof) {
+        return std::nullopt;
+    } else if (lexer::isKeyword(*tok_it, lexer::Keyword::k_def)) {
+        auto def = parseDefinition(tok_it, ctx);
+        if (!def) {
+            return tl::unexpected(def.error());
+        }
+        return std::move(*def);
+    } else if (lexer::isKeyword(*tok_it, lexer::Keyword::k_extern)) {
+        auto ext = parseExtern(tok_it, ctx);
+        if (!ext) {
+            return tl::unexpected(ext.error());
+        }
+        return std::move(*ext);
+    }
+    auto expr = parseTopLevelExpr(tok_it, ctx);
+    if (!expr) {
+        return tl::unexpected(expr.error());
+    }
+    return std::move(*expr);
+}
+
+/// Tokens [m_begin, m_end) of a source.
+struct TokenRange
+{
+    size_t m_begin;
+    size_t m_end;
+};
+
+/// Ranges worth handing to a thread of their own.
+constexpr size_t k_min_range_tokens = 4096;
+
+/// Cuts the tokens into ranges that parse on their own. A range starts at a def or an extern, or
+/// after a ';' outside of brackets, and holds at least min_tokens tokens unless it is the last.
+std::vector<TokenRange> splitUnits(const lexer::Tokens& tokens, size_t min_tokens)
+{
+    std::vector<TokenRange> ranges;
+
+    auto&  toks  = tokens.m_tokens;
+    size_t begin = 0;
+    int    depth = 0;
+    for (size_t i = 0; i < toks.size(); i++) {
+        auto tok = toks[i];
+        if (i - begin >= min_tokens && depth == 0 &&
+            (lexer::isKeyword(tok, lexer::Keyword::k_def) ||
+             lexer::isKeyword(tok, lexer::Keyword::k_extern) || isOp(toks[i - 1], ';'))) {
+            ranges.push_back({begin, i});
+            begin = i;
+        }
+        if (lexer::isOpenParen(tok) || lexer::isOpenBracket(tok)) {
+            depth++;
+        } else if ((lexer::isCloseParen(tok) || lexer::isCloseBracket(tok)) && depth > 0) {
+            depth--;
+        }
+    }
+    ranges.push_back({begin, toks.size()});
+    return ranges;
+}
+
+/// Every node takes at least one token, so ids counted from the index of the first token of the
+/// range don't run into the ones of the next range.
+expected<TopLevel> parseRange(const lexer::Tokens& tokens,
+                              TokenRange           range,
+                              ast::AstArena&       arena,
+                              const Options&       options)
+{
+    ParserContext parser_context(tokens, arena, ast::ExprId(range.m_begin), options);
     TopLevel      top_level;
-    auto          tok_it = tokens.begin();
-    while (tok_it != tokens.end()) {
-        if (std::holds_alternative<lexer::Eof>(*tok_it)) {
+    TokIt         tok_it(tokens, range.m_begin, range.m_end);
+    while (1) {
+        auto unit = parseTopLevelUnit(tok_it, parser_context);
+        if (!unit) {
+            return tl::unexpected(unit.error());
+        }
+        if (!*unit) {
             break;
-        } else if (std::holds_alternative<lexer::Keyword>(*tok_it)) {
-            auto kw = std::get<lexer::Keyword>(*tok_it);
-            if (kw == lexer::Keyword::k_def) {
-                auto def = parseDefinition(tok_it, parser_context);
-                if (!def) {
-                    return tl::unexpected(def.error());
-                }
-                top_level.push_back(std::move(*def));
-            } else if (kw == lexer::Keyword::k_extern) {
-                auto ext = parseExtern(tok_it, parser_context);
-                if (!ext) {
-                    return tl::unexpected(ext.error());
-                }
-                top_level.push_back(std::move(*ext));
-            }
-        } else if (isOp(*tok_it, ';')) {
-            ++tok_it;
-            continue;
-        } else {
-            auto expr = parseTopLevelExpr(tok_it, parser_context);
-            if (!expr) {
-                return tl::unexpected(expr.error());
-            }
-            top_level.push_back(std::move(*expr));
         }
+        top_level.push_back(std::move(**unit));
     }
+    assert(parser_context.m_current_id <= ast::ExprId(range.m_end));
     return top_level;
 }
 
+}  // namespace
+
+expected<TopLevel> parse(const lexer::Tokens& tokens, ast::AstArena& arena, const Options& options)
+{
+    auto ranges = splitUnits(tokens, k_min_range_tokens);
+    if (ranges.size() == 1) {
+        return parseRange(tokens, ranges.front(), arena, options);
+    }
+
+    std::vector<ast::AstArena>      arenas(ranges.size());
+    std::vector<expected<TopLevel>> parsed(ranges.size());
+    ThreadPool::shared().parallelFor(ranges.size(), [&](size_t i) {
+        parsed[i] = parseRange(tokens, ranges[i], arenas[i], options);
+    });
+
+    // The first error in the source is the one a sequential parse would have stopped at.
+    TopLevel top_level;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if (!parsed[i]) {
+            return tl::unexpected(parsed[i].error());
+        }
+        std::move(parsed[i]->begin(), parsed[i]->end(), std::back_inserter(top_level));
+        arena.adopt(std::move(arenas[i]));
+    }
+    return top_level;
+}
+
+Parser::Parser(lexer::Lexer& lexer, ast::AstArena& arena, const Options& options)
+    : m_lexer(lexer), m_arena(arena), m_options(options)
+{
+}
+
+expected<std::optional<TopLevelUnit>> Parser::next()
+{
+    ParserContext parser_context(m_lexer.tokens(), m_arena, m_next_id, m_options);
+    TokIt         tok_it(m_lexer.tokens(), &m_lexer);
+    auto          unit = parseTopLevelUnit(tok_it, parser_context);
+
+    // A lexer error ends the window early, it explains whatever the parser made of that.
+    if (m_lexer.error()) {
+        return tl::make_unexpected(Err{m_lexer.error()->m_desc});
+    }
+    m_lexer.discard(tok_it.index());
+    m_next_id = parser_context.m_current_id;
+    return unit;
+}
+
+Sharing sharing(const TopLevelUnit& unit)
+{
+    auto function = std::get_if<ast::Function>(&unit);
+    if (!function || function->m_flat.size() == 0) {
+        return {};
+    }
+    // Nodes of the tree below each row, shared subtrees counting once per use.
+    auto&               flat = function->m_flat;
+    std::vector<size_t> tree_nodes(flat.size());
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        tree_nodes[row] = 1;
+        for (auto child : flat.children(row)) {
+            tree_nodes[row] += tree_nodes[child];
+        }
+    }
+    return Sharing{tree_nodes.back(), flat.size()};
+}
+
+Sharing sharing(const TopLevel& top_level)
+{
+    Sharing total;
+    for (auto& unit : top_level) {
+        auto unit_sharing = sharing(unit);
+        total.m_nodes += unit_sharing.m_nodes;
+        total.m_unique += unit_sharing.m_unique;
+    }
+    return total;
+}
+
+std::ostream& operator<<(std::ostream& ost, const Sharing& sharing)
+{
+    ost << fmt::format("sharing: {0} unique nodes for {1} tree nodes", sharing.m_unique,
+                       sharing.m_nodes);
+    return ost;
+}
+
+namespace {
+
+struct Hasher
+{
+    void add(uint64_t value)
+    {
+        m_hash = (m_hash ^ value) * 0x100000001b3ull;
+        m_hash ^= m_hash >> 31;
+    }
+
+    void addType(const ast::TypeDesc* type)
+    {
+        if (!type) {
+            add(0);
+            return;
+        }
+        add(type->m_name.id());
+        add(type->m_template_args.size());
+        for (auto arg : type->m_template_args) {
+            addType(arg);
+        }
+    }
+
+    void addSignature(const ast::Signature& sig)
+    {
+        add(sig.m_name.id());
+        add(sig.m_args.size());
+        for (auto& arg : sig.m_args) {
+            addType(arg.m_type);
+            add(arg.m_name.id());
+        }
+        addType(sig.m_ret_type);
+        add(sig.m_type_params.size());
+        for (auto param : sig.m_type_params) {
+            add(param.id());
+        }
+    }
+
+    uint64_t m_hash = 0xcbf29ce484222325ull;
+};
+
+}  // namespace
+
+uint64_t contentHash(const TopLevelUnit& unit)
+{
+    Hasher hasher;
+    if (auto extrn = std::get_if<ast::Signature>(&unit)) {
+        hasher.addSignature(*extrn);
+        return hasher.m_hash;
+    }
+    auto& function = std::get<ast::Function>(unit);
+    auto& flat     = function.m_flat;
+    hasher.add(1);
+    hasher.addSignature(function.m_sig);
+    hasher.add(flat.size());
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        hasher.add(uint64_t(flat.m_kinds[row]) << 8 | uint8_t(flat.m_ops[row]));
+        hasher.add(flat.m_names[row].id());
+        auto& literal = flat.m_literals[row];
+        std::visit(
+            [&](auto& v) {
+                uint64_t bits = 0;
+                std::memcpy(&bits, &v.m_val, sizeof(v.m_val));
+                hasher.add(literal.index());
+                hasher.add(bits);
+            },
+            literal);
+        hasher.add(flat.m_child_begin[row + 1] - flat.m_child_begin[row]);
+        for (auto child : flat.children(row)) {
+            hasher.add(child);
+        }
+    }
+    return hasher.m_hash;
+}
+
 std::ostream& print(std::ostream& ost, const TopLevelUnit& u)
 {
     std::visit(
@@ -2,9 +2,11 @@
 #pragma once
 
 #include <pom_ast.h>
+#include <pom_astarena.h>
 #include <pom_lexer.h>
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <tl/expected.hpp>
 #include <variant>
@@ -22,7 +24,56 @@ struct Err
 using TopLevelUnit = std::variant<ast::Signature, ast::Function>;
 using TopLevel     = std::vector<TopLevelUnit>;
 
-tl::expected<TopLevel, Err> parse(const std::vector<lexer::Token>& tokens);
+struct Options
+{
+    /// Hash-cons the nodes of each function: structurally equal subtrees without calls or lists
+    /// share one node and one ExprId, so later phases handle them once.
+    bool m_hash_cons = false;
+};
+
+/// Nodes are allocated in arena, which must outlive the result and everything built from it.
+/// Large sources are cut between top level units and the pieces parsed on the shared ThreadPool.
+/// Each piece numbers its ExprIds from the index of its first token, so ids are unique and the
+/// same whatever the number of threads.
+tl::expected<TopLevel, Err> parse(const lexer::Tokens& tokens,
+                                  ast::AstArena&       arena,
+                                  const Options&       options = {});
+
+/// Parses one top level unit at a time, pulling tokens from the lexer as it goes. The tokens of
+/// a unit are discarded once it is parsed, ExprIds keep counting across units. The caller may
+/// reset the arena once it is done with a unit.
+class Parser
+{
+   public:
+    Parser(lexer::Lexer& lexer, ast::AstArena& arena, const Options& options = {});
+
+    /// Next unit, or nullopt at the end of the input.
+    tl::expected<std::optional<TopLevelUnit>, Err> next();
+
+   private:
+    lexer::Lexer&  m_lexer;
+    ast::AstArena& m_arena;
+    Options        m_options;
+    ast::ExprId    m_next_id = 0;
+};
+
+/// Nodes of the trees, counting shared subtrees once per use, against the unique nodes.
+struct Sharing
+{
+    size_t m_nodes  = 0;
+    size_t m_unique = 0;
+};
+
+Sharing sharing(const TopLevelUnit& unit);
+
+Sharing sharing(const TopLevel& top_level);
+
+std::ostream& operator<<(std::ostream& ost, const Sharing& sharing);
+
+/// Hash of what a unit says: its signature and its rows, not where it is, so moving or editing
+/// other units leaves it unchanged. Symbols are hashed by id, hashes are only comparable within
+/// one process.
+uint64_t contentHash(const TopLevelUnit& unit);
 
 std::ostream& print(std::ostream& ost, const TopLevelUnit& u);
 
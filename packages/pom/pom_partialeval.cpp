@@ -0,0 +1,731 @@
+
+#include <pom_partialeval.h>
+
+#include <pom_basictypes.h>
+#include <pom_escape.h>
+
+#include <fmt/format.h>
+
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+
+namespace pom {
+
+namespace partialeval {
+
+namespace {
+
+using Value = ast::Literal;
+using Op    = ops::BuiltinOp;
+
+TypeCSP valueType(const Value& value)
+{
+    switch (value.index()) {
+        case 0:
+            return types::boolean();
+        case 1:
+            return types::integer();
+        default:
+            return types::real();
+    }
+}
+
+/// Equal values, reals by their bits so that 0.0 and -0.0 differ.
+bool same(const std::optional<Value>& x, const std::optional<Value>& y)
+{
+    if (!x || !y || x->index() != y->index()) {
+        return !x && !y;
+    }
+    if (auto real = std::get_if<literals::Real>(&*x)) {
+        return std::memcmp(&real->m_val, &std::get<literals::Real>(*y).m_val, sizeof(double)) == 0;
+    }
+    return *x == *y;
+}
+
+/// Applies a builtin other than an if the way pol lowers it: integers wrap and compare unsigned,
+/// comparisons of reals are unordered.
+Value applyBuiltin(Op op, const Value* vs)
+{
+    auto real    = [&](size_t i) { return std::get<literals::Real>(vs[i]).m_val; };
+    auto integer = [&](size_t i) { return uint64_t(std::get<literals::Integer>(vs[i]).m_val); };
+    auto boolean = [&](size_t i) { return std::get<literals::Boolean>(vs[i]).m_val; };
+    switch (op) {
+        case Op::k_add_real:
+            return literals::Real{real(0) + real(1)};
+        case Op::k_add_integer:
+            return literals::Integer{int64_t(integer(0) + integer(1))};
+        case Op::k_sub_real:
+            return literals::Real{real(0) - real(1)};
+        case Op::k_sub_integer:
+            return literals::Integer{int64_t(integer(0) - integer(1))};
+        case Op::k_mul_real:
+            return literals::Real{real(0) * real(1)};
+        case Op::k_mul_integer:
+            return literals::Integer{int64_t(integer(0) * integer(1))};
+        case Op::k_lt_integer:
+            return literals::Boolean{integer(0) < integer(1)};
+        case Op::k_gt_integer:
+            return literals::Boolean{integer(0) > integer(1)};
+        case Op::k_lt_real:
+            return literals::Boolean{!(real(0) >= real(1))};
+        case Op::k_gt_real:
+            return literals::Boolean{!(real(0) <= real(1))};
+        case Op::k_or:
+            return literals::Boolean{boolean(0) || boolean(1)};
+        case Op::k_and:
+            return literals::Boolean{boolean(0) && boolean(1)};
+        case Op::k_none:
+        case Op::k_if_real:
+        case Op::k_if_integer:
+            break;
+    }
+    assert(0);
+    return Value();
+}
+
+bool isIf(Op op) { return op == Op::k_if_real || op == Op::k_if_integer; }
+
+/// Argument of a clone standing for an item of a list argument, has a dot like clones.
+Symbol itemName(Symbol list, uint32_t item) { return Symbol(fmt::format("{0}.{1}", list, item)); }
+
+/// A function as the evaluator and the folder see it, with its calls resolved to the functions
+/// visible where it is defined.
+struct Info
+{
+    const semantic::Function* m_fn = nullptr;
+
+    /// Position of the argument a var row reads, -1 for other rows.
+    std::vector<int32_t> m_arg;
+
+    /// Function a call row calls or a var row names, null for builtins, externs and arguments.
+    std::vector<const Info*> m_callee;
+
+    /// First row of the subtree of each row.
+    std::vector<uint32_t> m_subtree_begin;
+
+    /// Last row of the arm of an if starting at a row, 0 where none starts.
+    std::vector<uint32_t> m_region_end;
+
+    /// Made only of rows the evaluator runs.
+    bool m_evaluable = true;
+
+    /// What the function does with the lists it is given.
+    escape::Summary m_lists;
+};
+
+/// What a clone binds an argument to, a constant or a global function, neither for the arguments
+/// it still takes. A list only read at constant indices is bound to its items instead, which the
+/// clone takes in its place.
+struct Binding
+{
+    std::optional<Value> m_value;
+    const Info*          m_function = nullptr;
+    uint32_t             m_items    = 0;
+
+    explicit operator bool() const { return m_value || m_function || m_items; }
+};
+
+/// Bound arguments of a clone, by position.
+using Bound = std::vector<Binding>;
+
+bool same(const Binding& x, const Binding& y)
+{
+    return x.m_function == y.m_function && x.m_items == y.m_items && same(x.m_value, y.m_value);
+}
+
+/// Runs calls of evaluable functions with constant arguments, row by row as pol would lower them.
+class Evaluator
+{
+   public:
+    Evaluator(size_t fuel, size_t max_depth) : m_fuel(fuel), m_max_depth(max_depth) {}
+
+    /// Value returned, nullopt when a function is not evaluable or fuel or depth run out.
+    std::optional<Value> call(const Info& info, const std::vector<Value>& args)
+    {
+        if (!info.m_evaluable || m_depth == m_max_depth) {
+            return std::nullopt;
+        }
+        std::vector<Value> values(info.m_fn->m_flat.size());
+        m_depth++;
+        bool done = run(info, args, values);
+        m_depth--;
+        return done ? std::optional<Value>(values.back()) : std::nullopt;
+    }
+
+   private:
+    /// An if whose chosen arm is running, after which the scan resumes past its row in the range
+    /// [m_first, m_last] it is in.
+    struct PendingIf
+    {
+        uint32_t m_row;
+        uint32_t m_first;
+        uint32_t m_last;
+    };
+
+    bool run(const Info& info, const std::vector<Value>& args, std::vector<Value>& values)
+    {
+        // The chosen arm of an if is scanned in place of its row rather than run by a recursive
+        // call, so nesting costs a pending if each and no stack.
+        auto&                  fn = *info.m_fn;
+        std::vector<PendingIf> pending;
+        uint32_t               first = 0;
+        uint32_t               last  = uint32_t(values.size() - 1);
+        uint32_t               row   = first;
+        while (1) {
+            if (row > last) {
+                if (pending.empty()) {
+                    return true;
+                }
+                auto& top         = pending.back();
+                values[top.m_row] = values[last];
+                row               = top.m_row + 1;
+                first             = top.m_first;
+                last              = top.m_last;
+                pending.pop_back();
+                continue;
+            }
+            if (row != first && info.m_region_end[row]) {
+                row = info.m_region_end[row] + 1;
+                continue;
+            }
+            if (m_fuel == 0) {
+                return false;
+            }
+            m_fuel--;
+
+            auto children = fn.m_flat.children(row);
+            auto op       = fn.m_builtins[row];
+            if (fn.m_flat.m_kinds[row] == ast::ExprKind::k_literal) {
+                values[row] = fn.m_flat.m_literals[row];
+            } else if (fn.m_flat.m_kinds[row] == ast::ExprKind::k_var) {
+                values[row] = args[info.m_arg[row]];
+            } else if (isIf(op)) {
+                auto cond = std::get<literals::Boolean>(values[children[0]]).m_val;
+                pending.push_back(PendingIf{row, first, last});
+                last  = children[cond ? 1 : 2];
+                first = row = info.m_subtree_begin[last];
+                continue;
+            } else if (op != Op::k_none) {
+                Value operands[2];
+                for (size_t i = 0; i < children.size(); i++) {
+                    operands[i] = values[children[i]];
+                }
+                values[row] = applyBuiltin(op, operands);
+            } else {
+                std::vector<Value> call_args;
+                for (auto child : children) {
+                    call_args.push_back(values[child]);
+                }
+                auto value = call(*info.m_callee[row], call_args);
+                if (!value) {
+                    return false;
+                }
+                values[row] = *value;
+            }
+            row++;
+        }
+    }
+
+    size_t m_fuel;
+    size_t m_depth = 0;
+    size_t m_max_depth;
+};
+
+/// Rows of a function being built.
+struct FlatBuilder
+{
+    std::vector<ast::ExprKind>  m_kinds;
+    std::vector<uint32_t>       m_child_begin{0};
+    std::vector<uint32_t>       m_children;
+    std::vector<char>           m_ops;
+    std::vector<Symbol>         m_names;
+    std::vector<ast::Literal>   m_literals;
+    std::vector<TypeCSP>        m_types;
+    std::vector<ops::BuiltinOp> m_builtins;
+
+    uint32_t add(ast::ExprKind kind, char op, Symbol name, ast::Literal literal, TypeCSP type,
+                 ops::BuiltinOp builtin)
+    {
+        m_kinds.push_back(kind);
+        m_child_begin.push_back(uint32_t(m_children.size()));
+        m_ops.push_back(op);
+        m_names.push_back(name);
+        m_literals.push_back(literal);
+        m_types.push_back(std::move(type));
+        m_builtins.push_back(builtin);
+        return uint32_t(m_kinds.size() - 1);
+    }
+
+    uint32_t addLiteral(const Value& value)
+    {
+        return add(ast::ExprKind::k_literal, 0, Symbol(), value, valueType(value), Op::k_none);
+    }
+};
+
+struct Specialization
+{
+    const Info* m_callee;
+    Bound       m_bound;
+    Symbol      m_name;
+    bool        m_done = false;
+
+    /// Globals seen by the caller, which the functions bound are among.
+    size_t m_visible_globals = 0;
+};
+
+class Pass
+{
+   public:
+    Pass(ast::AstArena& arena, const Options& options) : m_arena(arena), m_options(options) {}
+
+    Result run(const semantic::TopLevel& top_level);
+
+   private:
+    const Info& addInfo(const semantic::Function& fn);
+
+    semantic::Function fold(const Info&                info,
+                            const Bound&               bound,
+                            const semantic::Signature& sig,
+                            const Specialization*      current);
+
+    /// Name of the clone of callee for bound, called from a function seeing visible_globals, if
+    /// there is or may be one.
+    std::optional<Symbol> specialize(const Info&           callee,
+                                     const Bound&          bound,
+                                     size_t                visible_globals,
+                                     const Specialization* current);
+
+    /// The names info refers to still are the functions they were where it was defined.
+    bool unchangedSince(const Info& info) const;
+
+    /// The name of function is still function, so rows can refer to it by name.
+    bool isVisible(const Info* function) const;
+
+    ast::AstArena&                          m_arena;
+    const Options&                          m_options;
+    escape::Analyzer                        m_escapes;
+    std::deque<Info>                        m_infos;
+    std::unordered_map<Symbol, const Info*> m_functions;
+    std::deque<Specialization>              m_specializations;
+    size_t                                  m_cloned_rows = 0;
+    Result                                  m_result;
+};
+
+const Info& Pass::addInfo(const semantic::Function& fn)
+{
+    auto& info   = m_infos.emplace_back();
+    auto& flat   = fn.m_flat;
+    auto  rows   = flat.size();
+    info.m_fn    = &fn;
+    info.m_lists = *m_escapes.find(fn.m_sig.m_name);
+    info.m_arg.assign(rows, -1);
+    info.m_callee.assign(rows, nullptr);
+    info.m_subtree_begin.resize(rows);
+    info.m_region_end.assign(rows, 0);
+
+    // The function itself when it may recurse, else the functions defined before it.
+    auto resolve = [&](Symbol name) -> const Info* {
+        if (name == fn.m_sig.m_name && fn.m_context.m_variables.count(name)) {
+            return &info;
+        }
+        auto fo = m_functions.find(name);
+        return fo != m_functions.end() ? fo->second : nullptr;
+    };
+    auto scalar = [](const TypeCSP& ty) {
+        return ty == types::real() || ty == types::integer() || ty == types::boolean();
+    };
+
+    info.m_evaluable = scalar(fn.m_sig.m_return_type);
+    for (auto& arg : fn.m_sig.m_args) {
+        info.m_evaluable = info.m_evaluable && scalar(arg.first);
+    }
+    for (uint32_t row = 0; row < rows; row++) {
+        auto children = flat.children(row);
+
+        info.m_subtree_begin[row] = row;
+        for (auto child : children) {
+            info.m_subtree_begin[row] = std::min(info.m_subtree_begin[row],
+                                                 info.m_subtree_begin[child]);
+        }
+
+        auto name   = flat.m_names[row];
+        auto is_arg = [&](Symbol arg) {
+            auto& args = fn.m_sig.m_args;
+            for (size_t i = 0; i < args.size(); i++) {
+                if (args[i].second == arg) {
+                    return int32_t(i);
+                }
+            }
+            return int32_t(-1);
+        };
+        switch (flat.m_kinds[row]) {
+            case ast::ExprKind::k_literal:
+                break;
+            case ast::ExprKind::k_var:
+                info.m_arg[row] = is_arg(name);
+                if (info.m_arg[row] < 0) {
+                    info.m_callee[row] = resolve(name);
+                    info.m_evaluable   = false;
+                }
+                break;
+            case ast::ExprKind::k_subscript:
+            case ast::ExprKind::k_list:
+                info.m_evaluable = false;
+                break;
+            case ast::ExprKind::k_binary:
+            case ast::ExprKind::k_call:
+                if (isIf(fn.m_builtins[row])) {
+                    for (size_t i = 1; i < children.size(); i++) {
+                        info.m_region_end[info.m_subtree_begin[children[i]]] = children[i];
+                    }
+                } else if (fn.m_builtins[row] == Op::k_none) {
+                    info.m_callee[row] = is_arg(name) < 0 ? resolve(name) : nullptr;
+                    info.m_evaluable   = info.m_evaluable && info.m_callee[row];
+                }
+                break;
+        }
+    }
+    return info;
+}
+
+bool Pass::unchangedSince(const Info& info) const
+{
+    auto& flat = info.m_fn->m_flat;
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        auto kind = flat.m_kinds[row];
+        bool global =
+            (kind == ast::ExprKind::k_var && info.m_arg[row] < 0) ||
+            (kind == ast::ExprKind::k_call && info.m_fn->m_builtins[row] == Op::k_none &&
+             (info.m_callee[row] || !info.m_fn->m_context.m_variables.count(flat.m_names[row])));
+        if (!global) {
+            continue;
+        }
+        auto fo  = m_functions.find(flat.m_names[row]);
+        auto now = fo != m_functions.end() ? fo->second : nullptr;
+        if (now != info.m_callee[row]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Pass::isVisible(const Info* function) const
+{
+    if (!function) {
+        return false;
+    }
+    auto fo = m_functions.find(function->m_fn->m_sig.m_name);
+    return fo != m_functions.end() && fo->second == function;
+}
+
+std::optional<Symbol> Pass::specialize(const Info&           callee,
+                                       const Bound&          bound,
+                                       size_t                visible_globals,
+                                       const Specialization* current)
+{
+    auto same_binding = [](const Binding& x, const Binding& y) { return same(x, y); };
+    for (auto& spec : m_specializations) {
+        if (spec.m_callee == &callee && std::equal(bound.begin(), bound.end(),
+                                                   spec.m_bound.begin(), spec.m_bound.end(),
+                                                   same_binding)) {
+            // One being folded can only call itself, the others come after it.
+            if (spec.m_done || &spec == current) {
+                return spec.m_name;
+            }
+            return std::nullopt;
+        }
+    }
+
+    // The clone is lowered where the caller is, it must call what the callee did.
+    auto& fn = *callee.m_fn;
+    if (m_specializations.size() >= m_options.m_max_specializations ||
+        fn.m_flat.size() > m_options.m_max_specialized_rows ||
+        m_cloned_rows + fn.m_flat.size() > m_options.m_max_cloned_rows || !unchangedSince(callee)) {
+        return std::nullopt;
+    }
+
+    auto& spec             = m_specializations.emplace_back();
+    spec.m_callee          = &callee;
+    spec.m_bound           = bound;
+    spec.m_visible_globals = std::max(visible_globals, fn.m_context.m_visible_globals);
+    spec.m_name            = Symbol(
+        fmt::format("{0}.{1}", fn.m_sig.m_name, m_specializations.size()));
+    m_cloned_rows += fn.m_flat.size();
+
+    semantic::Signature sig{spec.m_name, {}, fn.m_sig.m_return_type};
+    for (size_t i = 0; i < bound.size(); i++) {
+        auto& [type, name] = fn.m_sig.m_args[i];
+        if (!bound[i]) {
+            sig.m_args.push_back(fn.m_sig.m_args[i]);
+        }
+        for (uint32_t item = 0; item < bound[i].m_items; item++) {
+            sig.m_args.push_back({type->templateArgs()[0], itemName(name, item)});
+        }
+    }
+    auto clone  = fold(callee, bound, sig, &spec);
+    spec.m_done = true;
+    m_result.m_top_level.push_back(std::move(clone));
+    m_result.m_specializations++;
+    return spec.m_name;
+}
+
+semantic::Function Pass::fold(const Info&                info,
+                              const Bound&               bound,
+                              const semantic::Signature& sig,
+                              const Specialization*      current)
+{
+    auto& fn   = *info.m_fn;
+    auto& flat = fn.m_flat;
+    auto  rows = flat.size();
+
+    auto arg_index = [&](Symbol name) {
+        auto& args = fn.m_sig.m_args;
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i].second == name) {
+                return int32_t(i);
+            }
+        }
+        return int32_t(-1);
+    };
+
+    // Constant rows, rows naming a global function and rows standing for another one, an if on a
+    // constant for its arm. Calls through an argument bound to a function call it.
+    std::vector<std::optional<Value>> value(rows);
+    std::vector<const Info*>          function(rows);
+    std::vector<const Info*>          callee(info.m_callee);
+    std::vector<uint32_t>             forward(rows);
+    std::vector<Value>                operands;
+    for (uint32_t row = 0; row < rows; row++) {
+        forward[row]  = row;
+        auto children = flat.children(row);
+        auto op       = fn.m_builtins[row];
+        auto known    = std::all_of(children.begin(), children.end(),
+                                    [&](auto child) { return bool(value[child]); });
+        operands.clear();
+        for (auto child : children) {
+            operands.push_back(value[child] ? *value[child] : Value());
+        }
+
+        switch (flat.m_kinds[row]) {
+            case ast::ExprKind::k_literal:
+                value[row] = flat.m_literals[row];
+                break;
+            case ast::ExprKind::k_var:
+                if (info.m_arg[row] >= 0) {
+                    value[row]    = bound[info.m_arg[row]].m_value;
+                    function[row] = bound[info.m_arg[row]].m_function;
+                } else if (isVisible(info.m_callee[row])) {
+                    function[row] = info.m_callee[row];
+                }
+                break;
+            case ast::ExprKind::k_subscript:
+            case ast::ExprKind::k_list:
+                break;
+            case ast::ExprKind::k_binary:
+            case ast::ExprKind::k_call:
+                if (isIf(op)) {
+                    if (value[children[0]]) {
+                        auto arm = children[std::get<literals::Boolean>(operands[0]).m_val ? 1 : 2];
+                        value[row]    = value[arm];
+                        function[row] = function[arm];
+                        forward[row]  = forward[arm];
+                    }
+                } else if (op != Op::k_none) {
+                    if (known) {
+                        value[row] = applyBuiltin(op, operands.data());
+                    }
+                } else {
+                    auto arg = arg_index(flat.m_names[row]);
+                    if (arg >= 0) {
+                        callee[row] = bound[arg].m_function;
+                    }
+                    if (known && callee[row]) {
+                        Evaluator evaluator(m_options.m_fuel, m_options.m_max_depth);
+                        value[row] = evaluator.call(*callee[row], operands);
+                        m_result.m_evaluated_calls += value[row] ? 1 : 0;
+                    }
+                }
+                break;
+        }
+    }
+
+    // Rows the result still depends on, constants aside.
+    auto              root = rows - 1;
+    std::vector<bool> live(rows);
+    live[forward[root]] = !value[root];
+    for (auto row = int64_t(root); row >= 0; row--) {
+        if (live[row]) {
+            for (auto child : flat.children(uint32_t(row))) {
+                if (!value[child]) {
+                    live[forward[child]] = true;
+                }
+            }
+        }
+    }
+
+    // Calls with constant or function arguments call a clone of their callee taking the others,
+    // which calls the functions bound directly. Rows naming the bound functions go. Lists only
+    // given to the call, which only reads them at constant indices, go too, the clone takes their
+    // items and reads those of its arguments.
+    auto                       visible = current ? current->m_visible_globals
+                                                 : fn.m_context.m_visible_globals;
+    std::vector<Symbol>        names(flat.m_names.begin(), flat.m_names.end());
+    std::vector<ast::ExprKind> kinds(flat.m_kinds.begin(), flat.m_kinds.end());
+    std::vector<Bound>         call_bound(rows);
+    std::vector<uint32_t>      uses(rows);
+    for (uint32_t row = 0; row < rows; row++) {
+        for (auto child : flat.children(row)) {
+            uses[child]++;
+        }
+    }
+    for (uint32_t row = 0; row < rows; row++) {
+        auto kind = flat.m_kinds[row];
+        if (kind == ast::ExprKind::k_var && function[row]) {
+            names[row] = function[row]->m_fn->m_sig.m_name;
+        }
+        if (kind == ast::ExprKind::k_subscript) {
+            auto arg = arg_index(flat.m_names[row]);
+            if (arg >= 0 && bound[arg].m_items) {
+                auto index = std::get<literals::Integer>(flat.m_literals[row]).m_val;
+                kinds[row] = ast::ExprKind::k_var;
+                names[row] = itemName(flat.m_names[row], uint32_t(index));
+            }
+        }
+        if (!live[row] || kind != ast::ExprKind::k_call || fn.m_builtins[row] != Op::k_none ||
+            !callee[row]) {
+            continue;
+        }
+        names[row]    = callee[row]->m_fn->m_sig.m_name;
+        auto children = flat.children(row);
+        if (!m_options.m_max_specializations) {
+            continue;
+        }
+        auto& subscripts = callee[row]->m_lists.m_subscripts;
+        Bound bound_args;
+        for (size_t i = 0; i < children.size(); i++) {
+            auto child = children[i];
+            auto items = flat.m_kinds[child] == ast::ExprKind::k_list
+                             ? flat.children(child).size()
+                             : 0;
+            bool scalar = uses[child] == 1 && i < subscripts.size() && subscripts[i] &&
+                          subscripts[i] <= items;
+            bound_args.push_back(
+                Binding{value[child], function[child], scalar ? uint32_t(items) : 0});
+        }
+        // Calls with only constant arguments are the evaluator's.
+        auto some      = std::count_if(bound_args.begin(), bound_args.end(),
+                                       [](auto& b) { return bool(b); });
+        auto functions = std::any_of(bound_args.begin(), bound_args.end(),
+                                     [](auto& b) { return b.m_function || b.m_items; });
+        auto spec      = some && (size_t(some) < bound_args.size() || functions)
+                             ? specialize(*callee[row], bound_args, visible, current)
+                             : std::nullopt;
+        if (!spec) {
+            continue;
+        }
+        names[row] = *spec;
+        for (size_t i = 0; i < children.size(); i++) {
+            if (bound_args[i].m_function) {
+                live[forward[children[i]]] = false;
+            }
+            if (bound_args[i].m_items) {
+                live[children[i]] = false;
+                m_result.m_scalarized_lists++;
+            }
+        }
+        call_bound[row] = std::move(bound_args);
+    }
+
+    // Live rows in their order. Constants are literal rows right before the row using them, so
+    // the rows of each subtree stay a run.
+    FlatBuilder           out;
+    std::vector<uint32_t> new_row(rows);
+    for (uint32_t row = 0; row < rows; row++) {
+        if (!live[row]) {
+            continue;
+        }
+        auto  children   = flat.children(row);
+        auto& bound_args = call_bound[row];
+
+        std::vector<uint32_t> mapped;
+        for (size_t i = 0; i < children.size(); i++) {
+            auto child = children[i];
+            if (!bound_args.empty() && bound_args[i]) {
+                if (bound_args[i].m_items) {
+                    for (auto item : flat.children(child)) {
+                        mapped.push_back(value[item] ? out.addLiteral(*value[item])
+                                                     : new_row[forward[item]]);
+                    }
+                }
+                continue;
+            }
+            mapped.push_back(value[child] ? out.addLiteral(*value[child])
+                                          : new_row[forward[child]]);
+        }
+        new_row[row] = out.add(kinds[row], flat.m_ops[row], names[row],
+                               flat.m_literals[row], fn.m_types[row], fn.m_builtins[row]);
+        out.m_children.insert(out.m_children.end(), mapped.begin(), mapped.end());
+        out.m_child_begin.back() = uint32_t(out.m_children.size());
+    }
+    if (value[root]) {
+        out.addLiteral(*value[root]);
+        out.m_child_begin.back() = uint32_t(out.m_children.size());
+    }
+
+    m_result.m_folded_rows += rows > out.m_kinds.size() ? rows - out.m_kinds.size() : 0;
+
+    semantic::Function folded;
+    folded.m_sig                = sig;
+    folded.m_flat.m_first       = flat.m_first;
+    folded.m_flat.m_kinds       = m_arena.copy(out.m_kinds);
+    folded.m_flat.m_child_begin = m_arena.copy(out.m_child_begin);
+    folded.m_flat.m_children    = m_arena.copy(out.m_children);
+    folded.m_flat.m_ops         = m_arena.copy(out.m_ops);
+    folded.m_flat.m_names       = m_arena.copy(out.m_names);
+    folded.m_flat.m_literals    = m_arena.copy(out.m_literals);
+    folded.m_code               = ast::expandFlat(folded.m_flat, m_arena);
+    folded.m_types              = std::move(out.m_types);
+    folded.m_builtins           = std::move(out.m_builtins);
+    if (current) {
+        semantic::Context outer{{}, fn.m_context.m_globals, current->m_visible_globals};
+        folded.m_context = semantic::functionContext(outer, sig, false);
+    } else {
+        folded.m_context = fn.m_context;
+    }
+    return folded;
+}
+
+Result Pass::run(const semantic::TopLevel& top_level)
+{
+    for (auto& unit : top_level) {
+        auto fn = std::get_if<semantic::Function>(&unit);
+        if (!fn) {
+            // An extern hides the function of its name.
+            m_functions.erase(std::get<semantic::Signature>(unit).m_name);
+            m_escapes.analyze(unit);
+            m_result.m_top_level.push_back(unit);
+            continue;
+        }
+        m_escapes.analyze(unit);
+        auto& info = addInfo(*fn);
+        auto  folded = fold(info, Bound(fn->m_sig.m_args.size()), fn->m_sig, nullptr);
+        m_result.m_top_level.push_back(std::move(folded));
+        m_functions[fn->m_sig.m_name] = &info;
+    }
+    return std::move(m_result);
+}
+
+}  // namespace
+
+bool isClone(Symbol name) { return name.str().find('.') != std::string_view::npos; }
+
+Result evaluate(const semantic::TopLevel& top_level, ast::AstArena& arena, const Options& options)
+{
+    return Pass(arena, options).run(top_level);
+}
+
+}  // namespace partialeval
+
+}  // namespace pom
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <pom_astarena.h>
+#include <pom_semantic.h>
+
+namespace pom {
+
+namespace partialeval {
+
+struct Options
+{
+    /// Rows the evaluator may run for one call with constant arguments before it gives up and
+    /// leaves the call to run time.
+    size_t m_fuel = 100000;
+
+    /// Deepest nesting of calls the evaluator follows.
+    size_t m_max_depth = 256;
+
+    /// Most clones of functions specialized for constant arguments, 0 disables them.
+    size_t m_max_specializations = 64;
+
+    /// Functions with more rows are not specialized.
+    size_t m_max_specialized_rows = 256;
+
+    /// Rows of the functions specialized, over all clones.
+    size_t m_max_cloned_rows = 4096;
+};
+
+struct Result
+{
+    semantic::TopLevel m_top_level;
+
+    /// Rows removed over all functions.
+    size_t m_folded_rows = 0;
+
+    /// Calls replaced by the value they return.
+    size_t m_evaluated_calls = 0;
+
+    /// Clones added, named after the function they specialize and a number.
+    size_t m_specializations = 0;
+
+    /// Lists no longer allocated, their items are given to a clone instead.
+    size_t m_scalarized_lists = 0;
+};
+
+/// Folds operators and ifs on constants. Calls of functions with constant arguments are replaced
+/// by the value they return, calls with some constant arguments or global functions as arguments
+/// by calls of a clone of the callee specialized for them, which comes right before the caller.
+/// Clones call the functions they are given directly, and take the items of lists given to them
+/// when all they do is read them at constant indices. Only functions made of literals, their
+/// arguments, builtins and calls of such functions are evaluated, they are pure. Rows of the
+/// functions folded are allocated in arena.
+Result evaluate(const semantic::TopLevel& top_level,
+                ast::AstArena&            arena,
+                const Options&            options = Options());
+
+/// Clones are named after the function they specialize, a dot and a number, no name in the source
+/// has a dot. They are never entry points, even without arguments.
+bool isClone(Symbol name);
+
+}  // namespace partialeval
+
+}  // namespace pom
@@ -0,0 +1,319 @@
+
+#include <pom_scan.h>
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define POM_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace pom {
+
+namespace scan {
+
+namespace {
+
+/// Scalar fallback, also used for the tails shorter than a vector.
+
+template <uint8_t classes>
+const char* skipClassScalar(const char* pos, const char* end)
+{
+    while (pos != end && is(*pos, classes)) {
+        ++pos;
+    }
+    return pos;
+}
+
+template <uint8_t classes>
+const char* skipUntilClassScalar(const char* pos, const char* end)
+{
+    while (pos != end && !is(*pos, classes)) {
+        ++pos;
+    }
+    return pos;
+}
+
+const char* skipSpaceScalar(const char* pos, const char* end)
+{
+    return skipClassScalar<k_space>(pos, end);
+}
+
+const char* skipAlnumScalar(const char* pos, const char* end)
+{
+    return skipClassScalar<k_alpha | k_digit>(pos, end);
+}
+
+const char* skipNumberScalar(const char* pos, const char* end)
+{
+    return skipClassScalar<k_digit | k_period>(pos, end);
+}
+
+const char* skipToEolScalar(const char* pos, const char* end)
+{
+    return skipUntilClassScalar<k_eol>(pos, end);
+}
+
+#ifdef POM_SCAN_X86
+
+/// SSE4.2: pcmpestri compares 16 bytes against up to 8 character ranges in one instruction.
+
+constexpr int k_sse_run  = _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY;
+constexpr int k_sse_stop = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY;
+
+template <int mode>
+__attribute__((target("sse4.2"))) const char* scanSse42(const char* pos,
+                                                        const char* end,
+                                                        __m128i     set,
+                                                        int         set_len)
+{
+    while (end - pos >= 32) {
+        auto lo  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        auto hi  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos + 16));
+        int  idx = _mm_cmpestri(set, set_len, lo, 16, mode);
+        if (idx != 16) {
+            return pos + idx;
+        }
+        idx = _mm_cmpestri(set, set_len, hi, 16, mode);
+        if (idx != 16) {
+            return pos + 16 + idx;
+        }
+        pos += 32;
+    }
+    if (end - pos >= 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        int  idx   = _mm_cmpestri(set, set_len, chunk, 16, mode);
+        if (idx != 16) {
+            return pos + idx;
+        }
+        pos += 16;
+    }
+    return pos;
+}
+
+__attribute__((target("sse4.2"))) const char* skipSpaceSse42(const char* pos, const char* end)
+{
+    auto ranges = _mm_setr_epi8('\t', '\r', ' ', ' ', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return skipSpaceScalar(scanSse42<k_sse_run>(pos, end, ranges, 4), end);
+}
+
+__attribute__((target("sse4.2"))) const char* skipAlnumSse42(const char* pos, const char* end)
+{
+    auto ranges = _mm_setr_epi8('a', 'z', 'A', 'Z', '0', '9', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return skipAlnumScalar(scanSse42<k_sse_run>(pos, end, ranges, 6), end);
+}
+
+__attribute__((target("sse4.2"))) const char* skipNumberSse42(const char* pos, const char* end)
+{
+    auto ranges = _mm_setr_epi8('0', '9', '.', '.', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return skipNumberScalar(scanSse42<k_sse_run>(pos, end, ranges, 4), end);
+}
+
+__attribute__((target("sse4.2"))) const char* skipToEolSse42(const char* pos, const char* end)
+{
+    auto stops = _mm_setr_epi8('\0', '\n', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return skipToEolScalar(scanSse42<k_sse_stop>(pos, end, stops, 3), end);
+}
+
+/// AVX2: classify 32 bytes per compare, 64 per step, and find the first stop with a bit scan.
+
+/// Bytes with lo <= c <= hi, compared as unsigned.
+__attribute__((target("avx2"))) inline __m256i inRange(__m256i v, char lo, char hi)
+{
+    auto d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(char(hi - lo))), d);
+}
+
+__attribute__((target("avx2"))) inline __m256i equals(__m256i v, char c)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+struct SpaceClass
+{
+    __attribute__((target("avx2"))) static __m256i run(__m256i v)
+    {
+        return _mm256_or_si256(equals(v, ' '), inRange(v, '\t', '\r'));
+    }
+};
+
+struct AlnumClass
+{
+    __attribute__((target("avx2"))) static __m256i run(__m256i v)
+    {
+        auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        return _mm256_or_si256(inRange(lower, 'a', 'z'), inRange(v, '0', '9'));
+    }
+};
+
+struct NumberClass
+{
+    __attribute__((target("avx2"))) static __m256i run(__m256i v)
+    {
+        return _mm256_or_si256(inRange(v, '0', '9'), equals(v, '.'));
+    }
+};
+
+struct NotEolClass
+{
+    __attribute__((target("avx2"))) static __m256i run(__m256i v)
+    {
+        auto eol = _mm256_or_si256(_mm256_or_si256(equals(v, '\0'), equals(v, '\n')),
+                                   equals(v, '\r'));
+        return _mm256_xor_si256(eol, _mm256_set1_epi8(char(0xff)));
+    }
+};
+
+template <class Class>
+__attribute__((target("avx2,bmi"))) const char* scanAvx2(const char* pos, const char* end)
+{
+    while (end - pos >= 64) {
+        auto lo       = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+        auto hi       = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos + 32));
+        auto stops_lo = ~uint64_t(uint32_t(_mm256_movemask_epi8(Class::run(lo))));
+        auto stops_hi = ~uint64_t(uint32_t(_mm256_movemask_epi8(Class::run(hi))));
+        auto stops    = (stops_lo & 0xffffffffull) | (stops_hi << 32);
+        if (stops) {
+            return pos + _tzcnt_u64(stops);
+        }
+        pos += 64;
+    }
+    if (end - pos >= 32) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+        auto stops = ~uint32_t(_mm256_movemask_epi8(Class::run(chunk)));
+        if (stops) {
+            return pos + _tzcnt_u32(stops);
+        }
+        pos += 32;
+    }
+    return pos;
+}
+
+const char* skipSpaceAvx2(const char* pos, const char* end)
+{
+    return skipSpaceScalar(scanAvx2<SpaceClass>(pos, end), end);
+}
+
+const char* skipAlnumAvx2(const char* pos, const char* end)
+{
+    return skipAlnumScalar(scanAvx2<AlnumClass>(pos, end), end);
+}
+
+const char* skipNumberAvx2(const char* pos, const char* end)
+{
+    return skipNumberScalar(scanAvx2<NumberClass>(pos, end), end);
+}
+
+const char* skipToEolAvx2(const char* pos, const char* end)
+{
+    return skipToEolScalar(scanAvx2<NotEolClass>(pos, end), end);
+}
+
+#endif
+
+using ScanFn = const char* (*)(const char*, const char*);
+
+struct Scanners
+{
+    Isa    m_isa;
+    ScanFn m_space;
+    ScanFn m_alnum;
+    ScanFn m_number;
+    ScanFn m_to_eol;
+};
+
+// clang-format off
+constexpr Scanners k_scalar_scanners = {
+    Isa::k_scalar, skipSpaceScalar, skipAlnumScalar, skipNumberScalar, skipToEolScalar
+};
+#ifdef POM_SCAN_X86
+constexpr Scanners k_sse42_scanners = {
+    Isa::k_sse42, skipSpaceSse42, skipAlnumSse42, skipNumberSse42, skipToEolSse42
+};
+constexpr Scanners k_avx2_scanners = {
+    Isa::k_avx2, skipSpaceAvx2, skipAlnumAvx2, skipNumberAvx2, skipToEolAvx2
+};
+#endif
+// clang-format on
+
+const Scanners* scannersFor(Isa isa)
+{
+#ifdef POM_SCAN_X86
+    if (isa >= Isa::k_avx2 && detectIsa() >= Isa::k_avx2) {
+        return &k_avx2_scanners;
+    }
+    if (isa >= Isa::k_sse42 && detectIsa() >= Isa::k_sse42) {
+        return &k_sse42_scanners;
+    }
+#endif
+    return &k_scalar_scanners;
+}
+
+std::atomic<const Scanners*>& activeScanners()
+{
+    static std::atomic<const Scanners*> active{scannersFor(detectIsa())};
+    return active;
+}
+
+inline const Scanners& scanners() { return *activeScanners().load(std::memory_order_relaxed); }
+
+}  // namespace
+
+Isa detectIsa()
+{
+#ifdef POM_SCAN_X86
+    static const Isa detected = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")) {
+            return Isa::k_avx2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return Isa::k_sse42;
+        }
+        return Isa::k_scalar;
+    }();
+    return detected;
+#else
+    return Isa::k_scalar;
+#endif
+}
+
+Isa isa() { return scanners().m_isa; }
+
+Isa setIsa(Isa isa)
+{
+    auto selected = scannersFor(isa);
+    activeScanners().store(selected);
+    return selected->m_isa;
+}
+
+const char* toString(Isa isa)
+{
+    switch (isa) {
+        case Isa::k_scalar:
+            return "scalar";
+        case Isa::k_sse42:
+            return "sse4.2";
+        case Isa::k_avx2:
+            return "avx2";
+    }
+    return "<<unknown isa>>";
+}
+
+const char* skipSpaceRun(const char* pos, const char* end) { return scanners().m_space(pos, end); }
+
+const char* skipAlnumRun(const char* pos, const char* end) { return scanners().m_alnum(pos, end); }
+
+const char* skipNumberRun(const char* pos, const char* end)
+{
+    return scanners().m_number(pos, end);
+}
+
+const char* skipToEolRun(const char* pos, const char* end)
+{
+    return scanners().m_to_eol(pos, end);
+}
+
+}  // namespace scan
+
+}  // namespace pom
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace pom {
+
+namespace scan {
+
+/// Character classes used by the lexer. They are ASCII only and do not depend on the locale.
+enum CharClass : uint8_t
+{
+    k_space  = 1 << 0,  // ' ', \t, \n, \v, \f, \r
+    k_alpha  = 1 << 1,  // [a-zA-Z]
+    k_digit  = 1 << 2,  // [0-9]
+    k_period = 1 << 3,  // .
+    k_eol    = 1 << 4,  // \0, \n, \r
+};
+
+constexpr std::array<uint8_t, 256> makeClassTable()
+{
+    std::array<uint8_t, 256> table{};
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        table[c] |= k_space;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+        table[c] |= k_alpha;
+    }
+    for (int c = 'A'; c <= 'Z'; c++) {
+        table[c] |= k_alpha;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        table[c] |= k_digit;
+    }
+    table['.'] |= k_period;
+    for (int c : {'\0', '\n', '\r'}) {
+        table[c] |= k_eol;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint8_t, 256> k_class_table = makeClassTable();
+
+inline bool is(char c, uint8_t classes)
+{
+    return (k_class_table[static_cast<unsigned char>(c)] & classes) != 0;
+}
+
+inline bool isSpace(char c) { return is(c, k_space); }
+
+inline bool isAlpha(char c) { return is(c, k_alpha); }
+
+inline bool isDigit(char c) { return is(c, k_digit); }
+
+/// Instruction sets the run scanners can use, picked at runtime.
+enum class Isa
+{
+    k_scalar = 0,
+    k_sse42  = 1,
+    k_avx2   = 2,
+};
+
+/// Best instruction set supported by this cpu.
+Isa detectIsa();
+
+/// Instruction set currently in use. Defaults to detectIsa().
+Isa isa();
+
+/// Forces an instruction set, for tests and benchmarks. Falls back to the best supported one
+/// if the requested one is not available and returns what got selected.
+Isa setIsa(Isa isa);
+
+const char* toString(Isa isa);
+
+/// Vectorized run scanners, they pay off on runs longer than a few bytes.
+const char* skipSpaceRun(const char* pos, const char* end);
+const char* skipAlnumRun(const char* pos, const char* end);
+const char* skipNumberRun(const char* pos, const char* end);
+const char* skipToEolRun(const char* pos, const char* end);
+
+/// Most runs between tokens are a byte or two long. Probe that many inline before dispatching.
+constexpr int k_probe_length = 8;
+
+template <uint8_t classes, bool until>
+inline const char* probe(const char* pos, const char* end, bool& done)
+{
+    for (int i = 0; i < k_probe_length; i++, pos++) {
+        if (pos == end || is(*pos, classes) == until) {
+            done = true;
+            return pos;
+        }
+    }
+    done = false;
+    return pos;
+}
+
+/// Each of these returns the first position in [pos, end) that is not part of the run, or end.
+
+/// Whitespace: [ \t\n\v\f\r]*
+inline const char* skipSpace(const char* pos, const char* end)
+{
+    bool done;
+    pos = probe<k_space, false>(pos, end, done);
+    return done ? pos : skipSpaceRun(pos, end);
+}
+
+/// Rest of an identifier: [a-zA-Z0-9]*
+inline const char* skipAlnum(const char* pos, const char* end)
+{
+    bool done;
+    pos = probe<k_alpha | k_digit, false>(pos, end, done);
+    return done ? pos : skipAlnumRun(pos, end);
+}
+
+/// Rest of a number: [0-9.]*
+inline const char* skipNumber(const char* pos, const char* end)
+{
+    bool done;
+    pos = probe<k_digit | k_period, false>(pos, end, done);
+    return done ? pos : skipNumberRun(pos, end);
+}
+
+/// Rest of a comment, stops at \0, \n or \r.
+inline const char* skipToEol(const char* pos, const char* end) { return skipToEolRun(pos, end); }
+
+}  // namespace scan
+
+}  // namespace pom
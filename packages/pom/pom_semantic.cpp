@@ -3,6 +3,7 @@
 
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <fmt/ranges.h>
 #include <map>
 
 #include <pom_basictypes.h>
@@ -11,167 +12,270 @@
 #include <pom_ops.h>
 #include <pom_typebuilder.h>
 
+#include <algorithm>
 #include <cassert>
+#include <mutex>
+#include <optional>
 
 namespace pom {
 
 namespace semantic {
 
-namespace {
+struct Instance
+{
+    Function m_function;
 
-tl::expected<TypeCSP, Err> calculateType(const ast::Expr& expr, Context& context);
+    /// Instances the function calls, each after the instances it calls.
+    std::vector<const Instance*> m_needs;
 
-tl::expected<TypeCSP, Err> calculateType(const literals::Boolean&, Context&)
-{
-    return types::boolean();
-}
+    /// False while the function is analyzed, only the function itself may call it then.
+    bool m_done = false;
+};
 
-tl::expected<TypeCSP, Err> calculateType(const literals::Integer&, Context&)
+namespace {
+
+/// Type of the name of a generic def. The name is no value, each call instantiates the def for the
+/// types of its arguments. The body is only analyzed for the instances.
+class GenericFunction : public Type, public std::enable_shared_from_this<GenericFunction>
 {
-    return types::integer();
-}
+   public:
+    GenericFunction(const ast::Function& function, const Context& context);
 
-tl::expected<TypeCSP, Err> calculateType(const literals::Real&, Context&) { return types::real(); }
+    std::string description() const final
+    {
+        return fmt::format("generic function {0}", m_sig.m_name);
+    }
 
-tl::expected<TypeCSP, Err> calculateType(const ast::Literal& lit, Context& context)
-{
-    return std::visit([&](auto& x) { return calculateType(x, context); }, lit);
-}
+    /// The instance for the types of the arguments of a call, analyzed on first use.
+    tl::expected<const Instance*, Err> instantiate(const std::vector<TypeCSP>& arg_types) const;
 
-tl::expected<TypeCSP, Err> calculateType(const ast::Var& var, Context& context)
+   private:
+    /// The def is copied, the unit it was parsed from may go away before its last use.
+    std::shared_ptr<ast::AstArena> m_arena;
+    ast::Signature                 m_sig;
+    ast::FlatExprs                 m_flat;
+    Context                        m_context;
+
+    /// Instances by type arguments, in the order of the type parameters.
+    mutable std::map<std::vector<const Type*>, std::unique_ptr<Instance>> m_instances;
+};
+
+TypeCSP literalType(const ast::Literal& lit)
 {
-    auto found = context.m_variables.find(var.m_name);
-    if (found == context.m_variables.end()) {
-        return tl::make_unexpected(
-            Err{fmt::format("Variable {0} not found in this context", var.m_name)});
-    }
-    auto ty = found->second;
-    if (var.m_subscript) {
-        ty = ty->subscriptedType(*var.m_subscript);
-    }
-    return ty;
+    return std::visit(
+        [](auto& x) {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (std::is_same_v<T, literals::Boolean>) {
+                return types::boolean();
+            } else if constexpr (std::is_same_v<T, literals::Integer>) {
+                return types::integer();
+            } else {
+                return types::real();
+            }
+        },
+        lit);
 }
 
-tl::expected<TypeCSP, Err> calculateType(const ast::ListExpr& li, Context& context)
+struct RowTypes
+{
+    std::vector<TypeCSP>        m_types;
+    std::vector<ops::BuiltinOp> m_builtins;
+
+    /// Rows calling a generic function and the instance each calls.
+    std::vector<std::pair<uint32_t, Symbol>> m_instance_calls;
+
+    /// Instances called, each after the instances it calls.
+    std::vector<const Instance*> m_instances;
+};
+
+/// Type of one row, the types of its children are known already. Sets the builtin an operator or
+/// call resolves to, and records the calls of generic functions, in rows.
+tl::expected<TypeCSP, Err> calculateType(const ast::FlatExprs&       flat,
+                                         uint32_t                    row,
+                                         const std::vector<TypeCSP>& child_types,
+                                         const Context&              context,
+                                         RowTypes&                   rows)
 {
-    TypeCSP ty;
-    for (auto& expr : li.m_expressions) {
-        auto res = calculateType(*expr, context);
-        if (!res) {
-            return res;
+    auto& builtin = rows.m_builtins[row];
+    switch (flat.m_kinds[row]) {
+        case ast::ExprKind::k_literal:
+            return literalType(flat.m_literals[row]);
+
+        case ast::ExprKind::k_var:
+        case ast::ExprKind::k_subscript: {
+            auto name  = flat.m_names[row];
+            auto found = context.find(name);
+            if (!found) {
+                return tl::make_unexpected(
+                    Err{fmt::format("Variable {0} not found in this context", name)});
+            }
+            auto ty = *found;
+            if (dynamic_cast<const GenericFunction*>(ty.get())) {
+                return tl::make_unexpected(
+                    Err{fmt::format("Generic function {0} can only be called", name)});
+            }
+            if (flat.m_kinds[row] == ast::ExprKind::k_subscript) {
+                ty = ty->subscriptedType(std::get<literals::Integer>(flat.m_literals[row]).m_val);
+                if (!ty) {
+                    return tl::make_unexpected(
+                        Err{fmt::format("Variable {0} cannot be subscripted", name)});
+                }
+            }
+            return ty;
         }
-        assert(*res);
-        if (!ty) {
-            ty = *res;
+
+        case ast::ExprKind::k_list: {
+            TypeCSP ty;
+            for (auto& res : child_types) {
+                if (!ty) {
+                    ty = res;
+                }
+                if (*ty != *res) {
+                    return tl::make_unexpected(
+                        Err{fmt::format("Mismatching types in lists, found {0} and {1}",
+                                        ty->description(), res->description())});
+                }
+            }
+            return types::list(ty);
         }
 
-        if (*ty != **res) {
-            return tl::make_unexpected(
-                Err{fmt::format("Mismatching types in lists, found {0} and {1}", ty->description(),
-                                (*res)->description())});
+        case ast::ExprKind::k_binary: {
+            builtin = ops::findBuiltin(flat.m_ops[row], child_types);
+            if (builtin == ops::BuiltinOp::k_none) {
+                return tl::make_unexpected(
+                    Err{ops::getBuiltin(flat.m_ops[row], child_types).error().m_desc});
+            }
+            return ops::builtinInfo(builtin).m_ret_type;
         }
-        auto ins = context.m_expressions.insert({expr->m_id, ty});
-        if (!ins.second) {
-            assert(0);
-            return tl::make_unexpected(Err{"Duplicated expression id."});
+
+        case ast::ExprKind::k_call: {
+            auto name = flat.m_names[row];
+            builtin   = ops::findBuiltin(name, child_types);
+            if (builtin != ops::BuiltinOp::k_none) {
+                return ops::builtinInfo(builtin).m_ret_type;
+            }
+
+            auto found = context.find(name);
+            if (!found) {
+                return tl::make_unexpected(
+                    Err{fmt::format("Function {0} not found in this context", name)});
+            }
+            if (auto generic = dynamic_cast<const GenericFunction*>(found->get())) {
+                auto instance = generic->instantiate(child_types);
+                if (!instance) {
+                    return tl::make_unexpected(
+                        Err{fmt::format("Error calling {0}: {1}", name, instance.error().m_desc)});
+                }
+                auto& sig = (*instance)->m_function.m_sig;
+                if (!(*instance)->m_done) {
+                    // Recursion, which the declared return type allows.
+                    if (!context.m_variables.count(sig.m_name)) {
+                        return tl::make_unexpected(Err{fmt::format(
+                            "{0} can only call itself while it is instantiated", sig.m_name)});
+                    }
+                } else {
+                    auto& needs = (*instance)->m_needs;
+                    rows.m_instances.insert(rows.m_instances.end(), needs.begin(), needs.end());
+                    rows.m_instances.push_back(*instance);
+                }
+                rows.m_instance_calls.push_back({row, sig.m_name});
+                return sig.m_return_type;
+            }
+            auto ret_type = (*found)->callable(child_types);
+            if (!ret_type) {
+                return tl::make_unexpected(
+                    Err{fmt::format("Error calling {0}: {1}", name, ret_type.error().m_desc)});
+            }
+            return *ret_type;
         }
     }
-    return std::make_shared<types::List>(ty);
+    assert(0);
+    return tl::make_unexpected(Err{"Unknown expression kind"});
 }
 
-tl::expected<TypeCSP, Err> calculateType(const ast::BinaryExpr& expr, Context& context)
+/// Types every row of a function in one forward scan.
+tl::expected<RowTypes, Err> calculateTypes(const ast::FlatExprs& flat, const Context& context)
 {
-    auto lhs_type = calculateType(*expr.m_lhs, context);
-    if (!lhs_type) {
-        return lhs_type;
-    }
-    auto rhs_type = calculateType(*expr.m_rhs, context);
-    if (!rhs_type) {
-        return rhs_type;
-    }
-
-    auto ins_l = context.m_expressions.insert({expr.m_lhs->m_id, *lhs_type});
-    auto ins_r = context.m_expressions.insert({expr.m_rhs->m_id, *rhs_type});
-    if (!ins_l.second || !ins_r.second) {
-        assert(0);
-        return tl::make_unexpected(Err{"Duplicated expression id."});
-    }
-
-    auto op = ops::getBuiltin(expr.m_op, {*lhs_type, *rhs_type});
-    if (!op) {
-        return tl::make_unexpected(Err{op.error().m_desc});
+    RowTypes rows;
+    rows.m_types.resize(flat.size());
+    rows.m_builtins.resize(flat.size(), ops::BuiltinOp::k_none);
+    std::vector<TypeCSP> child_types;
+    for (uint32_t row = 0; row < flat.size(); row++) {
+        child_types.clear();
+        for (auto child : flat.children(row)) {
+            child_types.push_back(rows.m_types[child]);
+        }
+        auto ty = calculateType(flat, row, child_types, context, rows);
+        if (!ty) {
+            return tl::make_unexpected(ty.error());
+        }
+        assert(*ty);
+        rows.m_types[row] = std::move(*ty);
     }
-    return op->m_ret_type;
+    return rows;
 }
 
-tl::expected<TypeCSP, Err> calculateType(const ast::Call& call, Context& context)
+TypeCSP signatureType(const Signature& sig)
 {
-    std::vector<TypeCSP> arg_types;
-    for (auto& arg : call.m_args) {
-        auto arg_ty = calculateType(*arg, context);
-        if (!arg_ty) {
-            return arg_ty;
-        }
-        arg_types.push_back(*arg_ty);
+    std::vector<TypeCSP> arg_types(sig.m_args.size());
+    std::transform(sig.m_args.begin(), sig.m_args.end(), arg_types.begin(),
+                   [](auto& arg) { return arg.first; });
+    return types::function(arg_types, sig.m_return_type);
+}
 
-        auto ins = context.m_expressions.insert({arg->m_id, *arg_ty});
-        if (!ins.second) {
-            assert(0);
-            return tl::make_unexpected(Err{"Duplicated expression id."});
-        }
-    }
+}  // namespace
 
-    auto builtin = ops::getBuiltin(call.m_function, arg_types);
-    if (builtin) {
-        return builtin->m_ret_type;
-    }
+TypeCSP Function::type() const { return signatureType(m_sig); }
 
-    auto found = context.m_variables.find(call.m_function);
-    if (found == context.m_variables.end()) {
-        return tl::make_unexpected(
-            Err{fmt::format("Function {0} not found in this context", call.m_function)});
-    }
-    auto ret_type = found->second->callable(arg_types);
-    if (!ret_type) {
-        return tl::make_unexpected(
-            Err{fmt::format("Error calling {0}: {1}", call.m_function, ret_type.error().m_desc)});
-    }
+namespace {
 
-    return *ret_type;
+Symbol unitName(const parser::TopLevelUnit& unit)
+{
+    auto fn = std::get_if<ast::Function>(&unit);
+    return fn ? fn->m_sig.m_name : std::get<ast::Signature>(unit).m_name;
 }
 
-tl::expected<TypeCSP, Err> calculateType(const ast::Expr& expr, Context& context)
+Symbol unitName(const TopLevelUnit& unit)
 {
-    return std::visit([&](auto& x) { return calculateType(x, context); }, expr.m_val);
+    auto fn = std::get_if<Function>(&unit);
+    return fn ? fn->m_sig.m_name : std::get<Signature>(unit).m_name;
 }
 
-TypeCSP signatureType(const Signature& sig)
+TypeCSP unitType(const TopLevelUnit& unit)
 {
-    types::Function fun;
-    fun.m_arg_types.resize(sig.m_args.size());
-    std::transform(sig.m_args.begin(), sig.m_args.end(), fun.m_arg_types.begin(),
-                   [](auto& arg) { return arg.first; });
-    fun.m_ret_type = sig.m_return_type;
-    return std::make_shared<types::Function>(fun);
+    auto fn = std::get_if<Function>(&unit);
+    return fn ? fn->type() : signatureType(std::get<Signature>(unit));
 }
 
 }  // namespace
 
-TypeCSP Function::type() const { return signatureType(m_sig); }
+Context functionContext(const Context& outer, const Signature& sig, bool recursive)
+{
+    Context context{{}, outer.m_globals, outer.m_visible_globals};
+    for (auto& arg : sig.m_args) {
+        context.m_variables.insert({arg.second, arg.first});
+    }
+    if (recursive) {
+        context.m_variables.insert({sig.m_name, signatureType(sig)});
+    }
+    return context;
+}
 
-tl::expected<Signature, Err> analyze(const ast::Signature& sig, Context&)
+tl::expected<Signature, Err> analyze(const ast::Signature& sig,
+                                     const Context&,
+                                     const types::TypeArgs& type_args = {})
 {
     Signature sem_sig;
     sem_sig.m_name = sig.m_name;
     for (auto& arg : sig.m_args) {
-        auto typ = types::build(*arg.m_type);
+        auto typ = types::build(*arg.m_type, type_args);
         if (!typ) {
             return tl::make_unexpected(Err{typ.error().m_desc});
         }
         sem_sig.m_args.push_back({std::move(*typ), arg.m_name});
     }
     if (sig.m_ret_type) {
-        auto typ = types::build(*sig.m_ret_type);
+        auto typ = types::build(*sig.m_ret_type, type_args);
         if (!typ) {
             return tl::make_unexpected(Err{typ.error().m_desc});
         }
@@ -180,45 +284,187 @@ tl::expected<Signature, Err> analyze(const ast::Signature& sig, Context&)
     return sem_sig;
 }
 
-tl::expected<Function, Err> analyze(const ast::Function& function, Context& outer_context)
+namespace {
+
+/// Analyzes the rows of a function in the context of its body. Calls of generic functions are
+/// renamed to the instance they call in a copy of the names made in arena, or in an arena of its
+/// own when null, and the instances are appended to instances. Without code, the nodes are
+/// expanded from the rows into arena.
+tl::expected<Function, Err> analyzeBody(Signature                      sig,
+                                        const ast::FlatExprs&          flat,
+                                        ast::ExprP                     code,
+                                        Context                        context,
+                                        std::shared_ptr<ast::AstArena> arena,
+                                        std::vector<const Instance*>&  instances)
 {
-    auto sig = analyze(function.m_sig, outer_context);
-    if (!sig) {
-        return tl::make_unexpected(sig.error());
+    if (flat.size() == 0) {
+        return tl::make_unexpected(Err{fmt::format("Function {0} has no body", sig.m_name)});
+    }
+    auto rows = calculateTypes(flat, context);
+    if (!rows) {
+        return tl::make_unexpected(rows.error());
     }
 
-    auto context = outer_context;
-    for (auto& arg : sig->m_args) {
-        context.m_variables.insert({arg.second, arg.first});
+    auto ret_type = &rows->m_types.back();
+    assert(*ret_type);
+    if (sig.m_return_type) {
+        if (*sig.m_return_type != **ret_type) {
+            return tl::make_unexpected(
+                Err{fmt::format("Function declared return type {0} but evaluated to type {1}",
+                                sig.m_return_type->description(), (*ret_type)->description())});
+        }
+    } else {
+        sig.m_return_type = *ret_type;
     }
 
-    if (sig->m_return_type) {
-        // allow recursion
-        context.m_variables.insert({function.m_sig.m_name, signatureType(*sig)});
+    Function fn{std::move(sig),
+                code,
+                flat,
+                std::move(rows->m_types),
+                std::move(rows->m_builtins),
+                std::move(context),
+                std::move(arena)};
+    if (!rows->m_instance_calls.empty()) {
+        if (!fn.m_arena) {
+            fn.m_arena = std::make_shared<ast::AstArena>();
+        }
+        std::vector<Symbol> names(flat.m_names.begin(), flat.m_names.end());
+        for (auto& [row, name] : rows->m_instance_calls) {
+            names[row] = name;
+        }
+        fn.m_flat.m_names = fn.m_arena->copy(names);
+        fn.m_code         = nullptr;
     }
+    if (!fn.m_code) {
+        fn.m_code = ast::expandFlat(fn.m_flat, *fn.m_arena);
+    }
+    instances.insert(instances.end(), rows->m_instances.begin(), rows->m_instances.end());
+    return fn;
+}
 
-    auto ret_type = calculateType(*function.m_code, context);
-    if (!ret_type) {
-        return tl::make_unexpected(ret_type.error());
+ast::TypeDescP copyType(ast::TypeDescP type, ast::AstArena& arena)
+{
+    std::vector<ast::TypeDescP> args;
+    for (auto arg : type->m_template_args) {
+        args.push_back(copyType(arg, arena));
     }
+    return arena.make<ast::TypeDesc>(ast::TypeDesc{type->m_name, arena.copy(args)});
+}
 
-    assert(*ret_type);
-    if (sig->m_return_type) {
-        if (*sig->m_return_type != **ret_type) {
+/// Instances are analyzed one at a time, even when units are analyzed on several threads. The
+/// analysis of one may instantiate others, m_depth of them are under way.
+struct Instantiation
+{
+    std::recursive_mutex m_mutex;
+    size_t               m_depth = 0;
+};
+
+Instantiation& instantiation()
+{
+    static Instantiation state;
+    return state;
+}
+
+/// Deepest nesting of instantiations, generic functions calling themselves with ever new type
+/// arguments would never end.
+constexpr size_t k_max_instantiation_depth = 64;
+
+GenericFunction::GenericFunction(const ast::Function& function, const Context& context)
+    : Type(fmt::format("generic.{0}", function.m_sig.m_name)),
+      m_arena(std::make_shared<ast::AstArena>()),
+      m_sig(function.m_sig),
+      m_flat(ast::copyFlat(function.m_flat, *m_arena)),
+      m_context(context)
+{
+    for (auto& arg : m_sig.m_args) {
+        arg.m_type = copyType(arg.m_type, *m_arena);
+    }
+    if (m_sig.m_ret_type) {
+        m_sig.m_ret_type = copyType(m_sig.m_ret_type, *m_arena);
+    }
+}
+
+tl::expected<const Instance*, Err> GenericFunction::instantiate(
+    const std::vector<TypeCSP>& arg_types) const
+{
+    if (arg_types.size() != m_sig.m_args.size()) {
+        return tl::make_unexpected(Err{fmt::format("Expected {0} arguments but got {1}",
+                                                   m_sig.m_args.size(), arg_types.size())});
+    }
+    types::TypeArgs type_args;
+    for (size_t i = 0; i < arg_types.size(); i++) {
+        auto matched =
+            types::match(*m_sig.m_args[i].m_type, arg_types[i], m_sig.m_type_params, type_args);
+        if (!matched) {
+            return tl::make_unexpected(Err{matched.error().m_desc});
+        }
+    }
+    std::vector<const Type*> key;
+    std::vector<std::string> descriptions;
+    for (auto param : m_sig.m_type_params) {
+        auto fo = type_args.find(param);
+        if (fo == type_args.end()) {
             return tl::make_unexpected(
-                Err{fmt::format("Function declared return type {0} but evaluated to type {1}",
-                                sig->m_return_type->description(), (*ret_type)->description())});
+                Err{fmt::format("Cannot infer type parameter {0} from the arguments", param)});
         }
-    } else {
-        sig->m_return_type = *ret_type;
+        key.push_back(fo->second.get());
+        descriptions.push_back(fo->second->description());
     }
 
-    auto ins = context.m_expressions.insert({function.m_code->m_id, *ret_type});
-    if (!ins.second) {
-        assert(0);
-        return tl::make_unexpected(Err{"Duplicated expression id."});
+    auto&                                 state = instantiation();
+    std::lock_guard<std::recursive_mutex> lock(state.m_mutex);
+    if (auto fo = m_instances.find(key); fo != m_instances.end()) {
+        return fo->second.get();
+    }
+    if (state.m_depth == k_max_instantiation_depth) {
+        return tl::make_unexpected(
+            Err{fmt::format("Instantiations of {0} nested too deeply", m_sig.m_name)});
+    }
+
+    auto sig = analyze(m_sig, m_context, type_args);
+    if (!sig) {
+        return tl::make_unexpected(sig.error());
+    }
+    sig->m_name = Symbol(fmt::format("{0}<{1}>", m_sig.m_name, fmt::join(descriptions, ",")));
+
+    // A declared return type allows recursion, the calls of the generic function in the body
+    // find the instance unfinished.
+    auto context = functionContext(m_context, *sig, bool(sig->m_return_type));
+    if (sig->m_return_type) {
+        context.m_variables.insert({m_sig.m_name, shared_from_this()});
+    }
+    auto instance = m_instances.emplace(key, std::make_unique<Instance>()).first;
+    instance->second->m_function.m_sig = *sig;
+
+    state.m_depth++;
+    auto body = analyzeBody(*sig, m_flat, nullptr, std::move(context), m_arena,
+                            instance->second->m_needs);
+    state.m_depth--;
+    if (!body) {
+        m_instances.erase(instance);
+        return tl::make_unexpected(
+            Err{fmt::format("In {0}: {1}", sig->m_name, body.error().m_desc)});
     }
-    return Function{*sig, function.m_code, context};
+    instance->second->m_function = std::move(*body);
+    instance->second->m_done     = true;
+    return instance->second.get();
+}
+
+}  // namespace
+
+tl::expected<Function, Err> analyze(const ast::Function&          function,
+                                    Context&                      outer_context,
+                                    std::vector<const Instance*>& instances)
+{
+    auto sig = analyze(function.m_sig, outer_context);
+    if (!sig) {
+        return tl::make_unexpected(sig.error());
+    }
+
+    // A declared return type allows recursion.
+    auto context = functionContext(outer_context, *sig, bool(sig->m_return_type));
+    return analyzeBody(std::move(*sig), function.m_flat, function.m_code, std::move(context),
+                       nullptr, instances);
 }
 
 tl::expected<TopLevelUnit, Err> analyzeExtern(const ast::Signature& extrn, Context& context)
@@ -233,53 +479,280 @@ tl::expected<TopLevelUnit, Err> analyzeExtern(const ast::Signature& extrn, Conte
         return tl::make_unexpected(sig.error());
     }
     assert(sig->m_return_type);
-    context.m_variables.insert({extrn.m_name, signatureType(*sig)});
     return *sig;
 }
 
-tl::expected<TopLevel, Err> analyze(const parser::TopLevel& top_level)
+namespace {
+
+/// What a parsed unit declares and gives.
+struct Analyzed
+{
+    Symbol  m_name;
+    TypeCSP m_type;
+
+    /// None for a generic def.
+    std::optional<TopLevelUnit> m_unit;
+
+    /// Instances of generic functions the unit calls, each after the instances it calls.
+    std::vector<const Instance*> m_instances;
+};
+
+tl::expected<Analyzed, Err> analyzeUnit(const parser::TopLevelUnit& unit, Context& context)
+{
+    if (auto extrn = std::get_if<ast::Signature>(&unit)) {
+        if (!extrn->m_type_params.empty()) {
+            return tl::make_unexpected(
+                Err{fmt::format("extern function {0} cannot be generic", extrn->m_name)});
+        }
+        auto sig = analyzeExtern(*extrn, context);
+        if (!sig) {
+            return tl::make_unexpected(sig.error());
+        }
+        return Analyzed{unitName(*sig), unitType(*sig), std::move(*sig), {}};
+    }
+
+    auto& fn = std::get<ast::Function>(unit);
+    if (!fn.m_sig.m_type_params.empty()) {
+        return Analyzed{
+            fn.m_sig.m_name, std::make_shared<GenericFunction>(fn, context), std::nullopt, {}};
+    }
+    Analyzed analyzed;
+    auto     sem_fn = semantic::analyze(fn, context, analyzed.m_instances);
+    if (!sem_fn) {
+        return tl::make_unexpected(sem_fn.error());
+    }
+    analyzed.m_name = sem_fn->m_sig.m_name;
+    analyzed.m_type = sem_fn->type();
+    analyzed.m_unit = std::move(*sem_fn);
+    return analyzed;
+}
+
+/// Units after a redefinition are typed against the first definition of the name, as the global
+/// scope keeps its type, so a redefinition has to keep that type too.
+tl::expected<void, Err> checkRedefinition(const GlobalScope& globals, const Analyzed& analyzed)
 {
-    Context  context;
-    TopLevel semantic_top_level;
+    auto declared = globals.find(analyzed.m_name, globals.size());
+    if (declared && **declared != *analyzed.m_type) {
+        return tl::make_unexpected(Err{fmt::format("{0} redefined as {1}, it is {2}",
+                                                   analyzed.m_name, analyzed.m_type->description(),
+                                                   (*declared)->description())});
+    }
+    return {};
+}
 
-    for (auto& unit : top_level) {
-        if (std::holds_alternative<ast::Signature>(unit)) {
-            auto tlu = analyzeExtern(std::get<ast::Signature>(unit), context);
-            if (!tlu) {
-                return tl::make_unexpected(tlu.error());
-            }
-            semantic_top_level.push_back(*tlu);
-        } else if (std::holds_alternative<ast::Function>(unit)) {
-            auto sem_fn = analyze(std::get<ast::Function>(unit), context);
-            if (!sem_fn) {
-                return tl::make_unexpected(sem_fn.error());
+/// Appends the instances and then the unit of analyzed to top_level, instances only the first
+/// time.
+void emit(Analyzed&&                           analyzed,
+          std::unordered_set<const Instance*>& emitted,
+          TopLevel&                            top_level)
+{
+    for (auto instance : analyzed.m_instances) {
+        if (emitted.insert(instance).second) {
+            top_level.push_back(instance->m_function);
+        }
+    }
+    if (analyzed.m_unit) {
+        top_level.push_back(std::move(*analyzed.m_unit));
+    }
+}
+
+}  // namespace
+
+Analyzer::Analyzer() : m_globals(std::make_shared<GlobalScope>()) {}
+
+tl::expected<TopLevel, Err> Analyzer::analyze(const parser::TopLevelUnit& unit)
+{
+    auto context  = globals();
+    auto analyzed = analyzeUnit(unit, context);
+    if (!analyzed) {
+        return tl::make_unexpected(analyzed.error());
+    }
+    auto redefined = checkRedefinition(*m_globals, *analyzed);
+    if (!redefined) {
+        return tl::make_unexpected(redefined.error());
+    }
+    m_globals->declare(analyzed->m_name, analyzed->m_type);
+    TopLevel top_level;
+    emit(std::move(*analyzed), m_emitted, top_level);
+    return top_level;
+}
+
+void Analyzer::declare(const TopLevelUnit& unit)
+{
+    m_globals->declare(unitName(unit), unitType(unit));
+}
+
+tl::expected<TopLevel, Err> analyze(const parser::TopLevel& top_level, ThreadPool& pool)
+{
+    // Without workers the graph is only overhead.
+    if (pool.workers() == 0) {
+        Analyzer analyzer;
+        TopLevel semantic_top_level;
+        for (auto& unit : top_level) {
+            auto units = analyzer.analyze(unit);
+            if (!units) {
+                return tl::make_unexpected(units.error());
             }
+            std::move(units->begin(), units->end(), std::back_inserter(semantic_top_level));
+        }
+        return semantic_top_level;
+    }
 
-            semantic_top_level.push_back(*sem_fn);
+    // Every name is reserved in order first, so each unit sees the globals before it whichever
+    // order the units are analyzed in.
+    auto                               globals = std::make_shared<GlobalScope>();
+    std::vector<size_t>                visible(top_level.size());
+    std::vector<bool>                  declares(top_level.size());
+    std::unordered_map<Symbol, size_t> declared_by;
+    for (size_t i = 0; i < top_level.size(); i++) {
+        auto name   = std::visit([](auto& unit) { return unitName(unit); }, top_level[i]);
+        visible[i]  = globals->size();
+        declares[i] = globals->reserve(name);
+        if (declares[i]) {
+            declared_by[name] = i;
+        }
+    }
 
-            context.m_variables.insert({sem_fn->m_sig.m_name, sem_fn->type()});
+    // A function waits for the units declaring the globals it names. Its own name only refers
+    // to itself when it may recurse, otherwise to an earlier unit of the same name.
+    std::vector<std::vector<size_t>> dependencies(top_level.size());
+    std::vector<std::vector<size_t>> dependents(top_level.size());
+    for (size_t i = 0; i < top_level.size(); i++) {
+        auto fn = std::get_if<ast::Function>(&top_level[i]);
+        if (!fn) {
+            continue;
+        }
+        auto& deps = dependencies[i];
+        for (auto name : fn->m_flat.m_names) {
+            auto fo = declared_by.find(name);
+            if (fo != declared_by.end() && fo->second < i) {
+                deps.push_back(fo->second);
+            }
+        }
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+        for (auto dep : deps) {
+            dependents[dep].push_back(i);
         }
     }
 
+    std::vector<std::optional<tl::expected<Analyzed, Err>>> results(top_level.size());
+    pool.parallelGraph(dependents, [&](size_t i) {
+        // Units after a failed one are not reported, the first failure is.
+        for (auto dep : dependencies[i]) {
+            if (!results[dep] || !*results[dep]) {
+                return;
+            }
+        }
+        Context context{{}, globals, visible[i]};
+        results[i] = analyzeUnit(top_level[i], context);
+        if (*results[i] && declares[i]) {
+            globals->define((*results[i])->m_name, (*results[i])->m_type);
+        }
+    });
+
+    TopLevel                            semantic_top_level;
+    std::unordered_set<const Instance*> emitted;
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& result = results[i];
+        if (!result || !*result) {
+            assert(result);
+            return tl::make_unexpected(result->error());
+        }
+        if (!declares[i]) {
+            auto redefined = checkRedefinition(*globals, **result);
+            if (!redefined) {
+                return tl::make_unexpected(redefined.error());
+            }
+        }
+        emit(std::move(**result), emitted, semantic_top_level);
+    }
     return semantic_top_level;
 }
 
-tl::expected<TypeCSP, Err> Context::expressionType(ast::ExprId id) const
+tl::expected<TypeCSP, Err> Function::expressionType(ast::ExprId id) const
 {
-    auto fo = m_expressions.find(id);
-    if (fo == m_expressions.end()) {
+    auto row = m_flat.row(id);
+    if (id < m_flat.m_first || row >= m_types.size()) {
         return tl::make_unexpected(Err{fmt::format("Expression id not found: {0}", id)});
     }
-    return fo->second;
+    return m_types[row];
+}
+
+std::vector<bool> Function::selfTailCalls() const
+{
+    std::vector<bool> self(m_flat.size());
+    if (m_flat.size() == 0) {
+        return self;
+    }
+    // Arguments shadow the function.
+    bool recursive = m_context.m_variables.count(m_sig.m_name) &&
+                     std::none_of(m_sig.m_args.begin(), m_sig.m_args.end(),
+                                  [&](auto& arg) { return arg.second == m_sig.m_name; });
+
+    // Parents come after their children, so tail positions go down in one backward scan.
+    std::vector<bool> tail(m_flat.size());
+    tail.back() = true;
+    for (auto row = uint32_t(m_flat.size()); row-- > 0;) {
+        if (!tail[row]) {
+            continue;
+        }
+        auto builtin = m_builtins[row];
+        if (builtin == ops::BuiltinOp::k_if_real || builtin == ops::BuiltinOp::k_if_integer) {
+            auto children = m_flat.children(row);
+            for (size_t i = 1; i < children.size(); i++) {
+                tail[children[i]] = true;
+            }
+        }
+        self[row] = recursive && m_flat.m_kinds[row] == ast::ExprKind::k_call &&
+                    builtin == ops::BuiltinOp::k_none && m_flat.m_names[row] == m_sig.m_name;
+    }
+    return self;
+}
+
+void GlobalScope::declare(Symbol name, TypeCSP type)
+{
+    m_names.insert({name, Entry{std::move(type), m_names.size()}});
+}
+
+bool GlobalScope::reserve(Symbol name)
+{
+    return m_names.insert({name, Entry{nullptr, m_names.size()}}).second;
+}
+
+void GlobalScope::define(Symbol name, TypeCSP type)
+{
+    auto& entry = m_names.at(name);
+    assert(!entry.m_type);
+    entry.m_type = std::move(type);
+}
+
+const TypeCSP* GlobalScope::find(Symbol name, size_t visible) const
+{
+    // The index first, types of names not visible may be being defined.
+    auto fo = m_names.find(name);
+    if (fo == m_names.end() || fo->second.m_index >= visible || !fo->second.m_type) {
+        return nullptr;
+    }
+    return &fo->second.m_type;
+}
+
+const TypeCSP* Context::find(Symbol name) const
+{
+    auto fo = m_variables.find(name);
+    if (fo != m_variables.end()) {
+        return &fo->second;
+    }
+    return m_globals ? m_globals->find(name, m_visible_globals) : nullptr;
 }
 
-tl::expected<TypeCSP, Err> Context::variableType(std::string_view name) const
+tl::expected<TypeCSP, Err> Context::variableType(Symbol name) const
 {
-    auto fo = m_variables.find(std::string(name));
-    if (fo == m_variables.end()) {
+    auto found = find(name);
+    if (!found) {
         return tl::make_unexpected(Err{fmt::format("Variable not found: {0}", name)});
     }
-    return fo->second;
+    return *found;
 }
 
 std::ostream& operator<<(std::ostream& ost, const Signature& sig)
@@ -324,9 +797,10 @@ std::ostream& operator<<(std::ostream& ost, const Context& context)
     for (auto& v : context.m_variables) {
         ost << v.first << ": " << v.second->description() << std::endl;
     }
-    ost << "Expressions::" << std::endl;
-    for (auto& e : context.m_expressions) {
-        ost << e.first << ": " << e.second->description() << std::endl;
+    if (context.m_globals) {
+        context.m_globals->forEach(context.m_visible_globals, [&](Symbol name, const TypeCSP& ty) {
+            ost << name << ": " << ty->description() << std::endl;
+        });
     }
     ost << "===========---------==========" << std::endl;
     return ost;
@@ -1,10 +1,15 @@
 #pragma once
 
 #include <pom_ast.h>
+#include <pom_astarena.h>
+#include <pom_ops.h>
 #include <pom_parser.h>
+#include <pom_threadpool.h>
 #include <pom_type.h>
 
-#include <map>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <tl/expected.hpp>
 
 namespace pom {
@@ -16,36 +21,134 @@ struct Err
     std::string m_desc;
 };
 
+/// Names declared at the top level, in declaration order. Names are only ever added, so the
+/// contexts of functions analyzed earlier share it and still see the globals as they were.
+class GlobalScope
+{
+   public:
+    /// Declares name, unless it is declared already.
+    void declare(Symbol name, TypeCSP type);
+
+    /// Declares name without a type, returns false if it is declared already. Until define sets
+    /// its type the name is not found. Once every name is reserved, units can be defined from
+    /// several threads, as the scope does not change shape anymore.
+    bool reserve(Symbol name);
+
+    void define(Symbol name, TypeCSP type);
+
+    /// Type of name if it is among the first visible declarations, null otherwise.
+    const TypeCSP* find(Symbol name, size_t visible) const;
+
+    size_t size() const { return m_names.size(); }
+
+    template <class Fn>
+    void forEach(size_t visible, Fn&& fn) const
+    {
+        for (auto& [name, entry] : m_names) {
+            if (entry.m_index < visible && entry.m_type) {
+                fn(name, entry.m_type);
+            }
+        }
+    }
+
+   private:
+    struct Entry
+    {
+        TypeCSP m_type;
+        size_t  m_index;
+    };
+
+    std::unordered_map<Symbol, Entry> m_names;
+};
+
+/// Names visible in a scope: its own, then the first m_visible_globals of the global scope.
 struct Context
 {
-    std::map<std::string, TypeCSP> m_variables;
-    std::map<ast::ExprId, TypeCSP> m_expressions;
+    std::unordered_map<Symbol, TypeCSP> m_variables;
+    std::shared_ptr<const GlobalScope>  m_globals;
+    size_t                              m_visible_globals = 0;
 
-    tl::expected<TypeCSP, Err> expressionType(ast::ExprId id) const;
+    const TypeCSP* find(Symbol name) const;
 
-    tl::expected<TypeCSP, Err> variableType(std::string_view name) const;
+    tl::expected<TypeCSP, Err> variableType(Symbol name) const;
 };
 
 struct Signature
 {
-    std::string                                  m_name;
-    std::vector<std::pair<TypeCSP, std::string>> m_args;
-    TypeCSP                                      m_return_type;
+    Symbol                                  m_name;
+    std::vector<std::pair<TypeCSP, Symbol>> m_args;
+    TypeCSP                                 m_return_type;
 };
 
 struct Function
 {
-    Signature  m_sig;
-    ast::ExprP m_code;
-    Context    m_context;
+    Signature      m_sig;
+    ast::ExprP     m_code;
+    ast::FlatExprs m_flat;
+
+    /// Type of each row of m_flat.
+    std::vector<TypeCSP> m_types;
+
+    /// Builtin each row of m_flat resolves to, k_none for rows other than operators and calls
+    /// of builtins.
+    std::vector<ops::BuiltinOp> m_builtins;
+
+    Context m_context;
+
+    /// Rows analysis rewrote, like calls of generic functions renamed to the instance they call,
+    /// and the rows of instances. Null when m_flat is the parsed one.
+    std::shared_ptr<ast::AstArena> m_arena;
 
     TypeCSP type() const;
+
+    tl::expected<TypeCSP, Err> expressionType(ast::ExprId id) const;
+
+    /// Marks the rows calling the function itself in tail position: the last row and the arms of
+    /// ifs in tail position. Their value is the value of the function, so they can start it over
+    /// instead of calling it.
+    std::vector<bool> selfTailCalls() const;
 };
 
 using TopLevelUnit = std::variant<Signature, Function>;
 using TopLevel     = std::vector<TopLevelUnit>;
 
-tl::expected<TopLevel, Err> analyze(const parser::TopLevel& top_level);
+/// A generic def instantiated for some type arguments.
+struct Instance;
+
+/// Analyzes units on pool as soon as the globals they refer to are, results and errors are those
+/// of analyzing them in order. A generic def gives no unit, each of its instances is a function
+/// named after it and its type arguments, like sum<integer>, coming right before its first user.
+tl::expected<TopLevel, Err> analyze(const parser::TopLevel& top_level,
+                                    ThreadPool&             pool = ThreadPool::shared());
+
+/// Context of the body of a function: its arguments and, when it may recurse, itself, in front of
+/// the globals visible from outer.
+Context functionContext(const Context& outer, const Signature& sig, bool recursive);
+
+/// Analyzes one unit at a time, keeping only the global names seen so far. The units it returns
+/// share the global scope and can be dropped independently.
+class Analyzer
+{
+   public:
+    Analyzer();
+
+    /// The instances of generic functions unit is the first to call, then unit itself unless it
+    /// is a generic def.
+    tl::expected<TopLevel, Err> analyze(const parser::TopLevelUnit& unit);
+
+    /// Makes the name of a unit analyzed elsewhere, like one loaded from a cache, visible to the
+    /// units after it.
+    void declare(const TopLevelUnit& unit);
+
+    /// Context seeing the globals declared so far.
+    Context globals() const { return Context{{}, m_globals, m_globals->size()}; }
+
+   private:
+    std::shared_ptr<GlobalScope>        m_globals;
+    std::unordered_set<const Instance*> m_emitted;
+};
+
+std::ostream& print(std::ostream& ost, const TopLevelUnit& unit);
 
 std::ostream& print(std::ostream& ost, const TopLevel& top_level);
 
@@ -0,0 +1,70 @@
+
+#include <pom_source.h>
+
+#include <fmt/format.h>
+#include <iostream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pom {
+
+tl::expected<std::shared_ptr<const Source>, SourceError> Source::map(
+    const std::filesystem::path& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return tl::make_unexpected(SourceError{"Error opening file"});
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return tl::make_unexpected(SourceError{"Error reading file size"});
+    }
+
+    std::shared_ptr<Source> source(new Source());
+    if (st.st_size > 0) {
+        auto size    = size_t(st.st_size);
+        auto mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            return tl::make_unexpected(
+                SourceError{fmt::format("Error mapping file: {0}", path.string())});
+        }
+        // The whole file is going to be scanned front to back.
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        source->m_mapping      = mapping;
+        source->m_mapping_size = size;
+        source->m_text         = std::string_view(static_cast<const char*>(mapping), size);
+    }
+    // The mapping stays valid after closing the descriptor.
+    ::close(fd);
+    return source;
+}
+
+std::shared_ptr<const Source> Source::fromString(std::string text)
+{
+    std::shared_ptr<Source> source(new Source());
+    source->m_owned = std::move(text);
+    source->m_text  = source->m_owned;
+    return source;
+}
+
+std::shared_ptr<const Source> Source::fromStream(std::istream& stream)
+{
+    return fromString(
+        std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()));
+}
+
+Source::~Source()
+{
+    if (m_mapping) {
+        ::munmap(m_mapping, m_mapping_size);
+    }
+}
+
+}  // namespace pom
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tl/expected.hpp>
+
+namespace pom {
+
+struct SourceError
+{
+    std::string m_desc;
+};
+
+/// The text of a program. Files are memory mapped read-only, other inputs own their buffer.
+/// Tokens refer into the text, so whoever holds them keeps the Source alive.
+class Source
+{
+   public:
+    static tl::expected<std::shared_ptr<const Source>, SourceError> map(
+        const std::filesystem::path& path);
+
+    static std::shared_ptr<const Source> fromString(std::string text);
+
+    static std::shared_ptr<const Source> fromStream(std::istream& stream);
+
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    ~Source();
+
+    std::string_view text() const { return m_text; }
+
+    size_t size() const { return m_text.size(); }
+
+   private:
+    Source() = default;
+
+    std::string_view m_text;
+    std::string      m_owned;
+    void*            m_mapping      = nullptr;
+    size_t           m_mapping_size = 0ull;
+};
+
+}  // namespace pom
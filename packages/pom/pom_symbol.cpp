@@ -0,0 +1,70 @@
+
+#include <pom_symbol.h>
+
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace pom {
+
+namespace {
+
+class SymbolTable
+{
+   public:
+    SymbolTable() { intern(""); }
+
+    SymbolId intern(std::string_view name)
+    {
+        {
+            std::shared_lock lock(m_mutex);
+            auto             fo = m_ids.find(name);
+            if (fo != m_ids.end()) {
+                return fo->second;
+            }
+        }
+        std::unique_lock lock(m_mutex);
+        auto             fo = m_ids.find(name);
+        if (fo != m_ids.end()) {
+            return fo->second;
+        }
+        // Deque elements never move, so views of them stay valid as the table grows.
+        auto& stored = m_names.emplace_back(name);
+        auto  id     = SymbolId(m_names.size() - 1);
+        m_ids.emplace(stored, id);
+        return id;
+    }
+
+    std::string_view name(SymbolId id)
+    {
+        std::shared_lock lock(m_mutex);
+        return m_names[id];
+    }
+
+    static SymbolTable& instance()
+    {
+        static SymbolTable table;
+        return table;
+    }
+
+   private:
+    std::shared_mutex                              m_mutex;
+    std::deque<std::string>                        m_names;
+    std::unordered_map<std::string_view, SymbolId> m_ids;
+};
+
+}  // namespace
+
+SymbolId Symbol::intern(std::string_view name) { return SymbolTable::instance().intern(name); }
+
+std::string_view Symbol::str() const { return SymbolTable::instance().name(m_id); }
+
+std::ostream& operator<<(std::ostream& ost, const Symbol& sym)
+{
+    ost << sym.str();
+    return ost;
+}
+
+}  // namespace pom
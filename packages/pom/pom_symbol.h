@@ -0,0 +1,68 @@
+#pragma once
+
+#include <fmt/format.h>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+namespace pom {
+
+using SymbolId = uint32_t;
+
+/// An interned name. Names are interned once per process into a global table, so copying,
+/// hashing and comparing symbols is integer work. The text is only looked up for diagnostics
+/// and for naming llvm symbols.
+class Symbol
+{
+   public:
+    Symbol() = default;
+    Symbol(std::string_view name) : m_id(intern(name)) {}
+    Symbol(const char* name) : m_id(intern(name)) {}
+    Symbol(const std::string& name) : m_id(intern(name)) {}
+
+    static Symbol fromId(SymbolId id)
+    {
+        Symbol sym;
+        sym.m_id = id;
+        return sym;
+    }
+
+    SymbolId id() const { return m_id; }
+
+    bool empty() const { return m_id == 0; }
+
+    /// Text of the symbol, valid for the life of the process.
+    std::string_view str() const;
+
+    bool operator==(const Symbol& other) const { return m_id == other.m_id; }
+    bool operator!=(const Symbol& other) const { return m_id != other.m_id; }
+    bool operator<(const Symbol& other) const { return m_id < other.m_id; }
+
+   private:
+    static SymbolId intern(std::string_view name);
+
+    // 0 is the empty name.
+    SymbolId m_id = 0;
+};
+
+std::ostream& operator<<(std::ostream& ost, const Symbol& sym);
+
+}  // namespace pom
+
+template <>
+struct std::hash<pom::Symbol>
+{
+    size_t operator()(const pom::Symbol& sym) const { return sym.id(); }
+};
+
+template <>
+struct fmt::formatter<pom::Symbol> : fmt::formatter<std::string_view>
+{
+    template <class FormatContext>
+    auto format(const pom::Symbol& sym, FormatContext& ctx) const
+    {
+        return fmt::formatter<std::string_view>::format(sym.str(), ctx);
+    }
+};
@@ -0,0 +1,200 @@
+
+#include <pom_threadpool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace pom {
+
+ThreadPool::ThreadPool()
+    : ThreadPool(std::max<size_t>(std::thread::hardware_concurrency(), 1) - 1)
+{
+}
+
+ThreadPool::ThreadPool(size_t workers)
+{
+    for (size_t i = 0; i < workers; i++) {
+        m_threads.emplace_back([this] { run(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::run()
+{
+    while (1) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+    struct Loop
+    {
+        std::atomic<size_t>     m_next{0};
+        size_t                  m_done = 0;
+        std::mutex              m_mutex;
+        std::condition_variable m_finished;
+    };
+    auto loop = std::make_shared<Loop>();
+
+    // Runs indices until there are none left. Helpers that start late find nothing to do, so the
+    // caller never waits for a worker busy with something else.
+    auto drain = [loop, count, &fn] {
+        size_t ran = 0;
+        for (auto i = loop->m_next++; i < count; i = loop->m_next++) {
+            fn(i);
+            ran++;
+        }
+        if (ran) {
+            std::lock_guard lock(loop->m_mutex);
+            loop->m_done += ran;
+            if (loop->m_done == count) {
+                loop->m_finished.notify_all();
+            }
+        }
+    };
+
+    auto helpers = std::min(workers(), count > 0 ? count - 1 : 0);
+    if (helpers) {
+        {
+            std::lock_guard lock(m_mutex);
+            for (size_t i = 0; i < helpers; i++) {
+                m_tasks.push_back(drain);
+            }
+        }
+        m_wake.notify_all();
+    }
+    drain();
+
+    std::unique_lock lock(loop->m_mutex);
+    loop->m_finished.wait(lock, [&] { return loop->m_done == count; });
+}
+
+void ThreadPool::parallelGraph(const std::vector<std::vector<size_t>>& dependents,
+                               const std::function<void(size_t)>&      fn)
+{
+    struct Queue
+    {
+        std::mutex         m_mutex;
+        std::deque<size_t> m_tasks;
+    };
+
+    struct Graph
+    {
+        Graph(size_t tasks, size_t threads) : m_pending(tasks), m_queues(threads) {}
+
+        std::vector<std::atomic<size_t>> m_pending;
+        std::vector<Queue>               m_queues;
+        std::atomic<size_t>              m_ready{0};
+        std::atomic<size_t>              m_done{0};
+        std::mutex                       m_mutex;
+        std::condition_variable          m_changed;
+    };
+
+    auto count   = dependents.size();
+    auto helpers = std::min(workers(), count > 0 ? count - 1 : 0);
+    auto graph   = std::make_shared<Graph>(count, helpers + 1);
+    for (auto& waiting : dependents) {
+        for (auto task : waiting) {
+            graph->m_pending[task]++;
+        }
+    }
+
+    // Tasks ready from the start go to the caller, last first so it runs them in order.
+    for (size_t i = count; i-- > 0;) {
+        if (graph->m_pending[i] == 0) {
+            graph->m_queues[0].m_tasks.push_back(i);
+            graph->m_ready++;
+        }
+    }
+
+    auto take = [graph](size_t thread, size_t& task) {
+        auto& queues = graph->m_queues;
+        for (size_t i = 0; i < queues.size(); i++) {
+            auto&           queue = queues[(thread + i) % queues.size()];
+            std::lock_guard lock(queue.m_mutex);
+            if (!queue.m_tasks.empty()) {
+                if (i == 0) {
+                    task = queue.m_tasks.back();
+                    queue.m_tasks.pop_back();
+                } else {
+                    task = queue.m_tasks.front();
+                    queue.m_tasks.pop_front();
+                }
+                graph->m_ready--;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Helpers that start after the last task find it done and return, fn and dependents are only
+    // used while tasks remain.
+    auto work = [graph, take, count, &dependents, &fn](size_t thread) {
+        while (graph->m_done < count) {
+            size_t task;
+            if (!take(thread, task)) {
+                std::unique_lock lock(graph->m_mutex);
+                graph->m_changed.wait(
+                    lock, [&] { return graph->m_done == count || graph->m_ready > 0; });
+                continue;
+            }
+            fn(task);
+            size_t readied = 0;
+            for (auto next : dependents[task]) {
+                if (--graph->m_pending[next] == 0) {
+                    std::lock_guard lock(graph->m_queues[thread].m_mutex);
+                    graph->m_queues[thread].m_tasks.push_back(next);
+                    graph->m_ready++;
+                    readied++;
+                }
+            }
+            auto last = ++graph->m_done == count;
+            if (readied > 1 || last) {
+                std::lock_guard lock(graph->m_mutex);
+                graph->m_changed.notify_all();
+            }
+        }
+    };
+
+    if (helpers) {
+        {
+            std::lock_guard lock(m_mutex);
+            for (size_t i = 1; i <= helpers; i++) {
+                m_tasks.push_back([work, i] { work(i); });
+            }
+        }
+        m_wake.notify_all();
+    }
+    work(0);
+}
+
+}  // namespace pom
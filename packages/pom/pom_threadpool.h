@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pom {
+
+/// Fixed set of worker threads shared by the compiler phases that split their work.
+class ThreadPool
+{
+   public:
+    /// One worker less than the hardware threads, the caller of parallelFor is the last one.
+    ThreadPool();
+
+    explicit ThreadPool(size_t workers);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static ThreadPool& shared();
+
+    size_t workers() const { return m_threads.size(); }
+
+    /// Calls fn(i) for i in [0, count) on the workers and the calling thread, returns when all
+    /// calls returned. Indices are handed out in order, one at a time.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    /// Calls fn(i) for each task i once the tasks it depends on returned, dependents[i] lists the
+    /// tasks waiting for i and must not form a cycle. Each thread keeps a deque of the tasks it
+    /// made ready and runs the newest first, idle threads steal the oldest from the others.
+    /// Returns when all calls returned.
+    void parallelGraph(const std::vector<std::vector<size_t>>& dependents,
+                       const std::function<void(size_t)>&      fn);
+
+   private:
+    void run();
+
+    std::vector<std::thread>          m_threads;
+    std::mutex                        m_mutex;
+    std::condition_variable           m_wake;
+    std::deque<std::function<void()>> m_tasks;
+    bool                              m_stop = false;
+};
+
+}  // namespace pom
@@ -4,6 +4,7 @@
 #include <string>
 #include <tl/expected.hpp>
 #include <variant>
+#include <vector>
 
 namespace pom {
 
@@ -19,7 +20,8 @@ class Type
 
     virtual std::string description() const = 0;
 
-    virtual std::string mangled() const = 0;
+    /// Unique name of the type, built once.
+    const std::string& mangled() const { return m_mangled; }
 
     virtual std::vector<std::shared_ptr<const Type>> templateArgs() const { return {}; }
 
@@ -30,15 +32,17 @@ class Type
 
     virtual std::shared_ptr<const Type> subscriptedType(int64_t) const { return nullptr; }
 
-    bool operator==(const Type& other) const;
-    bool operator!=(const Type& other) const;
-};
+    /// Types are interned by the TypeTable, equal types are the same object.
+    bool operator==(const Type& other) const { return this == &other; }
+    bool operator!=(const Type& other) const { return this != &other; }
 
-using TypeCSP = std::shared_ptr<const Type>;
+   protected:
+    explicit Type(std::string mangled) : m_mangled(std::move(mangled)) {}
 
-/// Inline methods
+   private:
+    std::string m_mangled;
+};
 
-inline bool Type::operator==(const Type& other) const { return other.mangled() == mangled(); }
-inline bool Type::operator!=(const Type& other) const { return other.mangled() != mangled(); }
+using TypeCSP = std::shared_ptr<const Type>;
 
 }  // namespace pom
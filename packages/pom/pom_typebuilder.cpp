@@ -6,23 +6,53 @@
 #include <pom_listtype.h>
 
 #include <fmt/format.h>
+
+#include <algorithm>
 #include <map>
 
 namespace pom {
 
 namespace types {
 
-tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type)
+namespace {
+
+/// Name of the type constructor of a built type.
+std::string_view constructorName(const TypeCSP& type)
 {
+    if (dynamic_cast<const List*>(type.get())) {
+        return "list";
+    }
+    if (dynamic_cast<const Function*>(type.get())) {
+        return "fun";
+    }
+    return type->mangled();
+}
+
+}  // namespace
+
+tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type) { return build(type, {}); }
+
+tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type, const TypeArgs& args)
+{
+    auto arg = args.find(type.m_name);
+    if (arg != args.end()) {
+        if (!type.m_template_args.empty()) {
+            return tl::make_unexpected(TypeError{
+                fmt::format("Type parameter {0} takes no template args", type.m_name)});
+        }
+        return arg->second;
+    }
+
     struct NArgs
     {
         size_t m_min;
     };
 
-    static const std::map<std::string, std::variant<size_t, NArgs>> types_info{
+    static const std::map<std::string_view, std::variant<size_t, NArgs>> types_info{
         {"real", 0ull}, {"integer", 0ull}, {"boolean", 0ull}, {"list", 1ull}, {"fun", NArgs{1}}};
 
-    auto info = types_info.find(type.m_name);
+    auto name = type.m_name.str();
+    auto info = types_info.find(name);
     if (info == types_info.end()) {
         return tl::make_unexpected(TypeError{fmt::format("Unknown type: {0}", type.m_name)});
     }
@@ -43,28 +73,23 @@ tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type)
 
     std::vector<TypeCSP> template_types;
     for (auto& targ : type.m_template_args) {
-        auto btarg = build(*targ);
+        auto btarg = build(*targ, args);
         if (!btarg) {
             return btarg;
         }
         template_types.push_back(std::move(*btarg));
     }
 
-    if (type.m_name == "real") {
+    if (name == "real") {
         return real();
-    } else if (type.m_name == "integer") {
+    } else if (name == "integer") {
         return integer();
-    } else if (type.m_name == "boolean") {
+    } else if (name == "boolean") {
         return boolean();
-    } else if (type.m_name == "list") {
+    } else if (name == "list") {
         return list(template_types[0]);
-    } else if (type.m_name == "fun") {
-        Function function_type;
-        function_type.m_ret_type = template_types[0];
-        for (size_t i = 1ull; i < template_types.size(); i++) {
-            function_type.m_arg_types.push_back(template_types[i]);
-        }
-        return std::make_shared<Function>(std::move(function_type));
+    } else if (name == "fun") {
+        return function({template_types.begin() + 1, template_types.end()}, template_types[0]);
     }
 
     return tl::make_unexpected(
@@ -72,6 +97,36 @@ tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type)
     ;
 }
 
+tl::expected<void, TypeError> match(const ast::TypeDesc&       type,
+                                    const TypeCSP&             concrete,
+                                    const std::vector<Symbol>& params,
+                                    TypeArgs&                  args)
+{
+    if (std::find(params.begin(), params.end(), type.m_name) != params.end()) {
+        auto bound = args.insert({type.m_name, concrete}).first->second;
+        if (bound != concrete) {
+            return tl::make_unexpected(TypeError{
+                fmt::format("Type parameter {0} is both {1} and {2}", type.m_name,
+                            bound->description(), concrete->description())});
+        }
+        return {};
+    }
+
+    auto concrete_args = concrete->templateArgs();
+    if (type.m_name.str() != constructorName(concrete) ||
+        type.m_template_args.size() != concrete_args.size()) {
+        return tl::make_unexpected(TypeError{fmt::format(
+            "Type {0} does not match {1}", type.m_name, concrete->description())});
+    }
+    for (size_t i = 0; i < concrete_args.size(); i++) {
+        auto matched = match(*type.m_template_args[i], concrete_args[i], params, args);
+        if (!matched) {
+            return matched;
+        }
+    }
+    return {};
+}
+
 }  // namespace types
 
 }  // namespace pom
@@ -3,13 +3,28 @@
 #include <pom_type.h>
 #include <tl/expected.hpp>
 
+#include <unordered_map>
+
 namespace pom {
 
 namespace types {
 
+/// Types the type parameters of a generic def stand for.
+using TypeArgs = std::unordered_map<Symbol, TypeCSP>;
+
 /// Builds, from an ast's type description, a valid type or an error
 tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type);
 
+/// Builds type with its type parameters replaced by the types they stand for in args.
+tl::expected<TypeCSP, TypeError> build(const ast::TypeDesc& type, const TypeArgs& args);
+
+/// Binds in args the type parameters among params that type names, so that type describes
+/// concrete. Fails when type has another shape or a parameter is bound to another type already.
+tl::expected<void, TypeError> match(const ast::TypeDesc&       type,
+                                    const TypeCSP&             concrete,
+                                    const std::vector<Symbol>& params,
+                                    TypeArgs&                  args);
+
 }  // namespace types
 
 }  // namespace pom
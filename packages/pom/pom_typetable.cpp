@@ -0,0 +1,70 @@
+
+#include <pom_typetable.h>
+
+#include <pom_basictypes.h>
+#include <pom_functiontype.h>
+#include <pom_listtype.h>
+
+namespace pom {
+
+size_t TypeTable::KeyHash::operator()(const Key& key) const
+{
+    size_t h = size_t(key.m_kind);
+    for (auto part : key.m_parts) {
+        h = (h ^ std::hash<const Type*>()(part)) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+TypeTable::TypeTable()
+    : m_real(new types::RealType()),
+      m_integer(new types::IntegerType()),
+      m_boolean(new types::BooleanType())
+{
+}
+
+TypeTable& TypeTable::instance()
+{
+    static TypeTable table;
+    return table;
+}
+
+TypeCSP TypeTable::list(const TypeCSP& contained)
+{
+    std::lock_guard lock(m_mutex);
+    m_lookup.m_kind = Kind::k_list;
+    m_lookup.m_parts.assign(1, contained.get());
+    auto fo = m_types.find(m_lookup);
+    if (fo != m_types.end()) {
+        return fo->second;
+    }
+    TypeCSP ty(new types::List(contained));
+    m_types.emplace(m_lookup, ty);
+    return ty;
+}
+
+TypeCSP TypeTable::function(const std::vector<TypeCSP>& arg_types, const TypeCSP& ret_type)
+{
+    std::lock_guard lock(m_mutex);
+    m_lookup.m_kind = Kind::k_function;
+    m_lookup.m_parts.clear();
+    for (auto& arg : arg_types) {
+        m_lookup.m_parts.push_back(arg.get());
+    }
+    m_lookup.m_parts.push_back(ret_type.get());
+    auto fo = m_types.find(m_lookup);
+    if (fo != m_types.end()) {
+        return fo->second;
+    }
+    TypeCSP ty(new types::Function(arg_types, ret_type));
+    m_types.emplace(m_lookup, ty);
+    return ty;
+}
+
+size_t TypeTable::size() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_types.size();
+}
+
+}  // namespace pom
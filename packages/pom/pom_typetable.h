@@ -0,0 +1,67 @@
+#pragma once
+
+#include <pom_type.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pom {
+
+/// Owns every type. A type is built once per structure: lists and functions are keyed on their
+/// already interned parts, so equal types are the same object and compare by address. Types live
+/// as long as the program. Safe to use from several threads.
+class TypeTable
+{
+   public:
+    static TypeTable& instance();
+
+    const TypeCSP& real() const { return m_real; }
+
+    const TypeCSP& integer() const { return m_integer; }
+
+    const TypeCSP& boolean() const { return m_boolean; }
+
+    TypeCSP list(const TypeCSP& contained);
+
+    TypeCSP function(const std::vector<TypeCSP>& arg_types, const TypeCSP& ret_type);
+
+    /// Number of list and function types built so far.
+    size_t size() const;
+
+   private:
+    TypeTable();
+
+    enum class Kind : uint8_t
+    {
+        k_list,
+        k_function,
+    };
+
+    /// Structure of a type, its kind and its parts. The return type of a function goes last.
+    struct Key
+    {
+        Kind                     m_kind;
+        std::vector<const Type*> m_parts;
+
+        bool operator==(const Key& other) const
+        {
+            return m_kind == other.m_kind && m_parts == other.m_parts;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    TypeCSP m_real;
+    TypeCSP m_integer;
+    TypeCSP m_boolean;
+
+    mutable std::mutex                        m_mutex;
+    std::unordered_map<Key, TypeCSP, KeyHash> m_types;
+    Key                                       m_lookup;
+};
+
+}  // namespace pom
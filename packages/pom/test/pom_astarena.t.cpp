@@ -0,0 +1,45 @@
+#include <pom_astarena.h>
+#include <pom_astbuilder.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <numeric>
+
+TEST_CASE("Test ast arena", "[ast]")
+{
+    using namespace pom;
+    using namespace pom::ast::builder;
+
+    ast::AstArena arena;
+
+    // Enough nodes for several blocks, all of them stay put and aligned.
+    std::vector<ast::ExprP> nodes;
+    for (int i = 0; i < 10000; i++) {
+        nodes.push_back(i % 2 ? real(arena, i) : var(arena, "x"));
+    }
+    for (int i = 0; i < 10000; i++) {
+        REQUIRE(uintptr_t(nodes[i]) % alignof(ast::Expr) == 0);
+        if (i % 2) {
+            REQUIRE(*nodes[i] == *real(arena, i));
+        } else {
+            REQUIRE(*nodes[i] == *var(arena, "x"));
+        }
+    }
+
+    // Runs larger than a block.
+    std::vector<int64_t> big(100000);
+    std::iota(big.begin(), big.end(), 0);
+    auto copied = arena.copy(big);
+    REQUIRE(copied.size() == big.size());
+    REQUIRE(std::equal(copied.begin(), copied.end(), big.begin()));
+    REQUIRE(arena.copy(std::vector<int64_t>()).empty());
+
+    auto list_expr = list(arena, {real(arena, 1.0), var(arena, "y")});
+    REQUIRE(std::get<ast::ListExpr>(list_expr->m_val).m_expressions.size() == 2);
+
+    REQUIRE(arena.used() > 0);
+    arena.reset();
+    REQUIRE(arena.used() == 0);
+    REQUIRE(*call(arena, "foo", {integer(arena, 1)}) ==
+            *call(arena, "foo", {integer(arena, 1)}));
+}
@@ -0,0 +1,174 @@
+#include <pom_cache.h>
+#include <pom_lexer.h>
+#include <pom_parser.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+bool sameType(const pom::TypeCSP& a, const pom::TypeCSP& b)
+{
+    return a ? b && *a == *b : !b;
+}
+
+bool sameSignature(const pom::semantic::Signature& a, const pom::semantic::Signature& b)
+{
+    auto same_arg = [](auto& x, auto& y) {
+        return sameType(x.first, y.first) && x.second == y.second;
+    };
+    return a.m_name == b.m_name && sameType(a.m_return_type, b.m_return_type) &&
+           std::equal(a.m_args.begin(), a.m_args.end(), b.m_args.begin(), b.m_args.end(),
+                      same_arg);
+}
+
+bool sameContext(const pom::semantic::Context& a, const pom::semantic::Context& b)
+{
+    if (a.m_variables.size() != b.m_variables.size() ||
+        a.m_visible_globals != b.m_visible_globals) {
+        return false;
+    }
+    for (auto& [name, ty] : a.m_variables) {
+        auto fo = b.m_variables.find(name);
+        if (fo == b.m_variables.end() || !sameType(ty, fo->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sameFlat(const pom::ast::FlatExprs& a, const pom::ast::FlatExprs& b)
+{
+    return a.m_first == b.m_first &&
+           std::equal(a.m_kinds.begin(), a.m_kinds.end(), b.m_kinds.begin(), b.m_kinds.end()) &&
+           std::equal(a.m_ops.begin(), a.m_ops.end(), b.m_ops.begin(), b.m_ops.end()) &&
+           std::equal(a.m_child_begin.begin(), a.m_child_begin.end(), b.m_child_begin.begin(),
+                      b.m_child_begin.end()) &&
+           std::equal(a.m_children.begin(), a.m_children.end(), b.m_children.begin(),
+                      b.m_children.end()) &&
+           std::equal(a.m_names.begin(), a.m_names.end(), b.m_names.begin(), b.m_names.end()) &&
+           std::equal(a.m_literals.begin(), a.m_literals.end(), b.m_literals.begin(),
+                      b.m_literals.end());
+}
+
+}  // namespace
+
+TEST_CASE("Test analysis cache", "[cache]")
+{
+    using namespace pom;
+
+    auto dir = std::filesystem::temp_directory_path() / "pom_cache_test";
+    std::filesystem::remove_all(dir);
+
+    for (auto& entry : std::filesystem::directory_iterator(CONFLAKE_EXAMPLES)) {
+        if (entry.path().extension() != ".cfl") {
+            continue;
+        }
+        INFO(entry.path());
+        auto source = Source::map(entry.path());
+        REQUIRE(source);
+        auto tokens = lexer::lex(*source);
+        REQUIRE(tokens);
+        ast::AstArena arena;
+        auto          top_level = parser::parse(*tokens, arena);
+        REQUIRE(top_level);
+        auto analyzed = semantic::analyze(*top_level);
+        REQUIRE(analyzed);
+
+        auto path = cache::cachePath(dir, **source);
+        REQUIRE(path.parent_path() == dir);
+        REQUIRE(!cache::load(path, **source, arena));
+        REQUIRE(cache::save(path, **source, *analyzed));
+
+        ast::AstArena loaded_arena;
+        auto          loaded = cache::load(path, **source, loaded_arena);
+        REQUIRE(loaded);
+        REQUIRE(loaded->size() == analyzed->size());
+        for (size_t i = 0; i < analyzed->size(); i++) {
+            auto& unit        = (*analyzed)[i];
+            auto& loaded_unit = (*loaded)[i];
+            REQUIRE(unit.index() == loaded_unit.index());
+            if (auto sig = std::get_if<semantic::Signature>(&unit)) {
+                REQUIRE(sameSignature(*sig, std::get<semantic::Signature>(loaded_unit)));
+                continue;
+            }
+            auto& fn        = std::get<semantic::Function>(unit);
+            auto& loaded_fn = std::get<semantic::Function>(loaded_unit);
+            REQUIRE(sameSignature(fn.m_sig, loaded_fn.m_sig));
+            REQUIRE(sameFlat(fn.m_flat, loaded_fn.m_flat));
+            REQUIRE(*fn.m_code == *loaded_fn.m_code);
+            REQUIRE(sameContext(fn.m_context, loaded_fn.m_context));
+            REQUIRE(std::equal(fn.m_types.begin(), fn.m_types.end(), loaded_fn.m_types.begin(),
+                               loaded_fn.m_types.end(), sameType));
+        }
+    }
+
+    // Another source hashes to another file, and is rejected when pointed at this one.
+    auto source = Source::fromString("def f(real a) a * 2.0; f(1.0)");
+    auto tokens = lexer::lex(source);
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+    auto path = cache::cachePath(dir, *source);
+    REQUIRE(cache::save(path, *source, *analyzed));
+    REQUIRE(cache::load(path, *source, arena));
+
+    auto other = Source::fromString("def f(real a) a * 3.0; f(1.0)");
+    REQUIRE(cache::cachePath(dir, *other) != path);
+    REQUIRE(cache::load(path, *other, arena).error().m_desc == "Cache file is of another source");
+
+    // Files of other versions and truncated files are misses.
+    std::string bytes;
+    {
+        std::ifstream ist(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(ist), {});
+    }
+    auto rewrite = [&](const std::string& contents) {
+        std::ofstream ost(path, std::ios::binary | std::ios::trunc);
+        ost.write(contents.data(), contents.size());
+    };
+    auto old_version = bytes;
+    old_version[8]   = char(cache::k_version + 1);
+    rewrite(old_version);
+    REQUIRE(!cache::load(path, *source, arena));
+    rewrite(bytes.substr(0, bytes.size() - 8));
+    REQUIRE(cache::load(path, *source, arena).error().m_desc == "Cache file is truncated");
+
+    // So are files whose payload changed.
+    auto flipped = bytes;
+    flipped[bytes.size() / 2] ^= 1;
+    rewrite(flipped);
+    REQUIRE(cache::load(path, *source, arena).error().m_desc == "Cache file is corrupted");
+    rewrite(bytes);
+    REQUIRE(cache::load(path, *source, arena));
+
+    // Row counts are checked against what is left of the payload. f is the first unit, with 3
+    // rows and 2 children. The hash of the payload follows magic, version, unit count, build and
+    // source hash and size, the payload the header.
+    auto at = bytes.find(std::string("\3\0\0\0\2\0\0\0", 8), 56);
+    REQUIRE(at != std::string::npos);
+    auto huge = bytes;
+    for (int i = 0; i < 4; i++) {
+        huge[at + i] = char(0xff);
+    }
+    auto hash = cache::hashSource(std::string_view(huge).substr(56));
+    std::memcpy(huge.data() + 40, &hash, sizeof(hash));
+    rewrite(huge);
+    REQUIRE(cache::load(path, *source, arena).error().m_desc == "Cache file is truncated");
+
+    // Units are not typed again, files of another build, whose rows could mean other builtins,
+    // are misses.
+    auto other_build = bytes;
+    other_build[16] ^= 1;
+    rewrite(other_build);
+    REQUIRE(cache::load(path, *source, arena).error().m_desc == "Cache file is of another build");
+    REQUIRE(cache::save(path, *source, *analyzed));
+    REQUIRE(cache::load(path, *source, arena));
+
+    std::filesystem::remove_all(dir);
+}
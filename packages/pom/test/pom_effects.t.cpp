@@ -0,0 +1,89 @@
+#include <pom_effects.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <unordered_map>
+
+#include "pom_testing.h"
+
+namespace {
+
+/// Effects of the named units of text, analyzed in order.
+std::unordered_map<std::string, pom::effects::Effects> analyze(const std::string& text)
+{
+    pom::testing::Analyzed                                 analyzed(text);
+    pom::effects::Analyzer                                 analyzer;
+    std::unordered_map<std::string, pom::effects::Effects> effects;
+    for (auto& unit : analyzed.m_top_level) {
+        auto fn   = std::get_if<pom::semantic::Function>(&unit);
+        auto name = fn ? fn->m_sig.m_name : std::get<pom::semantic::Signature>(unit).m_name;
+        effects[std::string(name.str())] = analyzer.analyze(unit);
+    }
+    return effects;
+}
+
+}  // namespace
+
+TEST_CASE("Test effect analysis", "[effects]")
+{
+    using namespace pom;
+
+    REQUIRE(effects::isPureExtern("cos"));
+    REQUIRE(!effects::isPureExtern("printf"));
+
+    auto effects = analyze("extern cos(real x) : real;\n"
+                           "extern putchard(real x) : real;\n"
+                           "def fib(integer x) : integer if(x < 2i, x, fib(x - 1i) + fib(x - 2i))\n"
+                           "def wave(real x) cos(x) * 2.0\n"
+                           "def echo(real x) putchard(x)\n"
+                           "def twice(real x) echo(x) + wave(x)\n"
+                           "def pair(real x) [x x]\n"
+                           "def call(fun<real, real> f) f(2.0)\n"
+                           "def pairs(real x) pair(x)\n"
+                           "def second(list<real> l) l[1]\n"
+                           "def scaled(list<real> l, real a) second(l) * a\n");
+
+    REQUIRE(effects["cos"].m_pure);
+    REQUIRE(!effects["putchard"].m_pure);
+
+    REQUIRE(effects["fib"].m_pure);
+    REQUIRE(effects["fib"].m_recursive);
+    REQUIRE(effects["wave"].m_pure);
+    REQUIRE(!effects["wave"].m_recursive);
+
+    // Impurity goes up through the callers.
+    REQUIRE(!effects["echo"].m_pure);
+    REQUIRE(!effects["twice"].m_pure);
+
+    // Lists are allocated, arguments could be anything.
+    REQUIRE(!effects["pair"].m_pure);
+    REQUIRE(!effects["call"].m_pure);
+
+    // What the attributes of the functions come from.
+    REQUIRE(effects["cos"].m_terminates);
+    REQUIRE(!effects["putchard"].m_closed);
+    REQUIRE(effects["fib"].m_closed);
+    REQUIRE(!effects["fib"].m_terminates);
+    REQUIRE(effects["wave"].m_terminates);
+    REQUIRE(!effects["twice"].m_closed);
+    REQUIRE(effects["pair"].m_closed);
+    REQUIRE(effects["pair"].m_fresh_result);
+    REQUIRE(effects["pairs"].m_fresh_result);
+    REQUIRE(!effects["wave"].m_fresh_result);
+    REQUIRE(!effects["call"].m_closed);
+
+    // Reading the lists given keeps a function pure, only scalars are read by the rest.
+    REQUIRE(effects["second"].m_pure);
+    REQUIRE(effects["second"].m_reads_lists);
+    REQUIRE(effects["scaled"].m_pure);
+    REQUIRE(effects["scaled"].m_reads_lists);
+    REQUIRE(!effects["wave"].m_reads_lists);
+    REQUIRE(!effects["fib"].m_reads_lists);
+
+    // A forgotten callee is unknown.
+    effects::Analyzer analyzer;
+    testing::Analyzed analyzed("def sq(real x) x * x\ndef quad(real x) sq(sq(x))");
+    REQUIRE(analyzer.analyze(analyzed.m_top_level[0]).m_pure);
+    analyzer.forget("sq");
+    REQUIRE(!analyzer.analyze(analyzed.m_top_level[1]).m_pure);
+}
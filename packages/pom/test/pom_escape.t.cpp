@@ -0,0 +1,60 @@
+#include <pom_escape.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+
+#include "pom_testing.h"
+
+TEST_CASE("Test escape analysis", "[escape]")
+{
+    using namespace pom;
+
+    testing::Analyzed analyzed(
+        "extern sink(list<real> x) : real\n"
+        "def third(list<real> x) x[2]\n"
+        "def id(list<real> x, real a) x\n"
+        "def both(list<real> x, list<real> y) third(x) + x[0] + sink(y)\n"
+        "def loop(list<real> x, integer n) : real if(n < 1i, x[0], loop(x, n - 1i) + 1.0)\n"
+        "def tail(list<real> x, integer n) : real if(n < 1i, x[0], tail([x[1] x[0]], n - 1i))\n"
+        "def call(fun<real, list<real>> f, real a) f([a])\n"
+        "def f(real a) third([a a a]) + both([a], [a]) + third(id([a], a))\n"
+        "def g(real a) id([a a], a)\n");
+    escape::Analyzer analyzer;
+    for (auto& unit : analyzed.m_top_level) {
+        analyzer.analyze(unit);
+    }
+
+    using Flags = std::vector<bool>;
+    using Reads = std::vector<uint32_t>;
+    REQUIRE(analyzer.find("sink")->m_escapes == Flags{true});
+    REQUIRE(analyzer.find("third")->m_escapes == Flags{false});
+    REQUIRE(analyzer.find("third")->m_subscripts == Reads{3});
+    REQUIRE(analyzer.find("id")->m_escapes == Flags{true, false});
+    REQUIRE(analyzer.find("id")->m_subscripts == Reads{0, 0});
+
+    // Reads through callees are no constant reads, externs keep what they get.
+    REQUIRE(analyzer.find("both")->m_escapes == Flags{false, true});
+    REQUIRE(analyzer.find("both")->m_subscripts == Reads{0, 0});
+
+    // Recursion alone does not let a list escape.
+    REQUIRE(analyzer.find("loop")->m_escapes == Flags{false, false});
+    REQUIRE(analyzer.find("loop")->m_subscripts == Reads{0, 0});
+    REQUIRE(analyzer.find("tail")->m_escapes == Flags{false, false});
+    REQUIRE(analyzer.find("tail")->m_subscripts == Reads{2, 0});
+
+    // Lists given to self calls in tail position or to unknown functions leave the frame.
+    auto local_lists = [&](size_t unit) {
+        auto& fn    = std::get<semantic::Function>(analyzed.m_top_level[unit]);
+        auto  local = analyzer.localLists(fn);
+        return std::count(local.begin(), local.end(), true);
+    };
+    REQUIRE(local_lists(5) == 0);
+    REQUIRE(local_lists(6) == 0);
+    REQUIRE(local_lists(7) == 2);
+    REQUIRE(local_lists(8) == 0);
+
+    // A forgotten callee is unknown.
+    analyzer.forget("third");
+    REQUIRE(local_lists(7) == 1);
+}
@@ -3,11 +3,14 @@
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <fmt/format.h>
+
 #include <filesystem>
 
 #include <sstream>
 
 #include <iostream>
+#include <random>
 
 TEST_CASE("Test simple lexer cases", "[lexer][foo]")
 {
@@ -31,7 +34,7 @@ TEST_CASE("Test simple lexer cases", "[lexer][foo]")
         std::stringstream ss(str);
         auto              tokens = lex(ss);
         REQUIRE(tokens);
-        REQUIRE(expected == *tokens);
+        REQUIRE(expected == tokens->decoded());
     }
 }
 
@@ -76,6 +79,193 @@ TEST_CASE("Test lexer on files", "[lexer]")
     for (auto& [path, expected] : ppp) {
         auto tokens = lex(path);
         REQUIRE(tokens);
-        REQUIRE(expected == *tokens);
+        REQUIRE(expected == tokens->decoded());
+    }
+}
+
+TEST_CASE("Test lexer spans", "[lexer]")
+{
+    using namespace pom::lexer;
+    using namespace pom::literals;
+
+    auto source = pom::Source::fromString("def foo(real a) # comment\n  a*12.5");
+    auto tokens = lex(source);
+    REQUIRE(tokens);
+    REQUIRE(tokens->m_source == source);
+    REQUIRE(tokens->m_tokens.size() == tokens->m_spans.size());
+
+    // clang-format off
+    std::vector<Span> expected = {
+        {0, 3}, {4, 3}, {7, 1}, {8, 4}, {13, 1}, {14, 1}, {28, 1}, {29, 1}, {30, 4}, {34, 0}
+    };
+    // clang-format on
+    REQUIRE(expected == tokens->m_spans);
+
+    auto foo = tokens->identifier(tokens->m_tokens[1]);
+    REQUIRE(foo.str() == "foo");
+    REQUIRE(tokens->real(tokens->m_tokens[8]) == 12.5);
+}
+
+TEST_CASE("Test packed tokens", "[lexer]")
+{
+    using namespace pom::lexer;
+
+    std::stringstream ss("def foo(real a) foo(a) + a * 2i");
+    auto              tokens = lex(ss);
+    REQUIRE(tokens);
+
+    REQUIRE(tokens->m_integers == std::vector<int64_t>{2});
+    REQUIRE(tokens->m_reals.empty());
+
+    auto& toks = tokens->m_tokens;
+    REQUIRE(isKeyword(toks[0], Keyword::k_def));
+    REQUIRE(isOpenParen(toks[2]));
+    REQUIRE(toks[1].m_kind == TokenKind::k_identifier);
+    REQUIRE(tokens->identifier(toks[1]) == pom::Symbol("foo"));
+    REQUIRE(toks[1].m_payload == toks[6].m_payload);
+    REQUIRE(isOp(toks[10], '+'));
+    REQUIRE(tokens->integer(toks[13]) == 2);
+    REQUIRE(toks.back().m_kind == TokenKind::k_eof);
+}
+
+TEST_CASE("Test streaming lexer", "[lexer]")
+{
+    using namespace pom::lexer;
+
+    std::string text =
+        "extern cos(real x) : real;\n"
+        "# a comment\n"
+        "def foo(real a, int b) : real a * 2.5 + cos(a)\n"
+        "\n"
+        "   foo(1.0, 3i) ; [1, 2.0]";
+    auto expected = lex(pom::Source::fromString(text));
+    REQUIRE(expected);
+
+    // Read the window in steps, discarding what was read, from a stream and from a source.
+    for (size_t step : {1, 3, 1000}) {
+        std::istringstream ist(text);
+        Lexer              streamed(ist);
+        Lexer              mapped(pom::Source::fromString(text));
+        for (auto* lexer : {&streamed, &mapped}) {
+            std::vector<Token> tokens;
+            std::vector<Span>  spans;
+            while (tokens.empty() || !std::holds_alternative<Eof>(tokens.back())) {
+                for (size_t i = 0; i < step; i++) {
+                    auto tok = lexer->at(i);
+                    tokens.push_back(lexer->tokens().decode(tok));
+                    spans.push_back(lexer->tokens().m_spans[i]);
+                    if (tok.m_kind == TokenKind::k_eof) {
+                        break;
+                    }
+                }
+                lexer->discard(step);
+            }
+            REQUIRE(!lexer->error());
+            REQUIRE(tokens == expected->decoded());
+            REQUIRE(spans == expected->m_spans);
+            REQUIRE(lexer->tokens().m_reals.empty());
+        }
+    }
+
+    std::istringstream bad("foo 1.5i bar");
+    Lexer              lexer(bad);
+    REQUIRE(lexer.at(0).m_kind == TokenKind::k_identifier);
+    REQUIRE(lexer.at(1).m_kind == TokenKind::k_eof);
+    REQUIRE(lexer.error());
+}
+
+TEST_CASE("Test incremental relexing", "[lexer]")
+{
+    using namespace pom::lexer;
+
+    auto spans = [](const Tokens& tokens) {
+        std::vector<Span> spans;
+        for (size_t i = 0; i < tokens.m_tokens.size(); i++) {
+            spans.push_back(tokens.span(i));
+        }
+        return spans;
+    };
+    // Edits tokens in place, a failed relex leaves them as they were.
+    auto edit_lexed = [&](Tokens& tokens, const Edit& edit) {
+        auto text   = tokens.text();
+        auto edited = text;
+        edited.replace(edit.m_offset, edit.m_length, edit.m_text);
+        auto expected = lex(pom::Source::fromString(edited));
+        auto before   = tokens.decoded();
+        auto relexed  = relex(tokens, edit);
+        REQUIRE(bool(expected) == bool(relexed));
+        if (!expected) {
+            REQUIRE(tokens.text() == text);
+            REQUIRE(tokens.decoded() == before);
+            return Relexed{};
+        }
+        REQUIRE(tokens.text() == edited);
+        REQUIRE(tokens.decoded() == expected->decoded());
+        REQUIRE(spans(tokens) == spans(*expected));
+        return *relexed;
+    };
+    auto check = [&](const std::string& text, const Edit& edit) {
+        auto tokens = lex(pom::Source::fromString(text));
+        REQUIRE(tokens);
+        return edit_lexed(*tokens, edit);
+    };
+
+    std::string text = "def foo(real a) a * 2\n# a comment\nfoo(1) + foo(2) + foo(3)\n";
+
+    // Renaming the first foo only touches that token.
+    auto renamed = check(text, Edit{4, 3, "bar"});
+    REQUIRE(renamed.m_first == 1);
+    REQUIRE(renamed.m_old_end == 2);
+    REQUIRE(renamed.m_new_end == 2);
+
+    // Appending to an identifier merges with it.
+    auto appended = check(text, Edit{7, 0, "x"});
+    REQUIRE(appended.m_first == 1);
+    REQUIRE(appended.m_new_end == 2);
+
+    // Splitting a token and editing comments, at the start and at the end.
+    check(text, Edit{17, 1, " b *"});
+    check(text, Edit{23, 0, "\n"});
+    check(text, Edit{24, 2, ""});
+    check(text, Edit{22, 1, "#"});
+    check(text, Edit{0, 0, "1 + "});
+    check(text, Edit{uint32_t(text.size()), 0, "+ 4i"});
+    check(text, Edit{0, uint32_t(text.size()), ""});
+
+    // Random edits, checked against lexing from scratch.
+    std::mt19937 rng(4242);
+    std::string  alphabet = "ab1.i #\n+(";
+    for (int i = 0; i < 500; i++) {
+        auto        offset = uint32_t(rng() % (text.size() + 1));
+        auto        length = uint32_t(rng() % (text.size() - offset + 1) % 6);
+        std::string replacement;
+        for (auto n = rng() % 5; n > 0; n--) {
+            replacement += alphabet[rng() % alphabet.size()];
+        }
+        check(text, Edit{offset, length, replacement});
+    }
+
+    auto tokens = lex(pom::Source::fromString(text));
+    REQUIRE(!relex(*tokens, Edit{1000, 0, ""}));
+
+    // Edits in a row of a text of many chunks, whose literal pools stay bounded by the tokens.
+    std::string long_text;
+    for (int i = 0; long_text.size() < 64 << 10; i++) {
+        long_text += fmt::format("def f{0}(real a) a * {0}.5 + {0}i # {0}\n", i);
+    }
+    auto long_tokens = lex(pom::Source::fromString(long_text));
+    REQUIRE(long_tokens);
+    REQUIRE(long_tokens->m_chunks.size() > 10);
+    for (int i = 0; i < 300; i++) {
+        auto        size   = uint32_t(long_tokens->text().size());
+        auto        offset = uint32_t(rng() % (size + 1));
+        auto        length = uint32_t(rng() % (size - offset + 1) % (i % 10 ? 6 : 5000));
+        std::string replacement;
+        for (auto n = rng() % 8; n > 0; n--) {
+            replacement += alphabet[rng() % alphabet.size()];
+        }
+        edit_lexed(*long_tokens, Edit{offset, length, replacement});
+        REQUIRE(long_tokens->m_reals.size() + long_tokens->m_integers.size() <=
+                2 * long_tokens->m_tokens.size());
     }
 }
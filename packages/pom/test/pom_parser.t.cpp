@@ -6,8 +6,12 @@
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <fmt/format.h>
+
 #include <filesystem>
+#include <fstream>
 #include <numeric>
+#include <sstream>
 
 TEST_CASE("Test parser files", "[parser]")
 {
@@ -42,17 +46,228 @@ TEST_CASE("Test parser files", "[parser]")
         auto tokens = lex(path);
         REQUIRE(tokens);
 
-        auto res = pom::parser::parse(*tokens);
+        pom::ast::AstArena arena;
+        auto               res = pom::parser::parse(*tokens, arena);
         REQUIRE(res);
         REQUIRE(res->size() == expected_size);
     }
 }
 
+TEST_CASE("Test streaming parser", "[parser]")
+{
+    using namespace pom;
+
+    for (auto& entry : std::filesystem::directory_iterator(CONFLAKE_EXAMPLES)) {
+        auto tokens = lexer::lex(entry.path());
+        REQUIRE(tokens);
+        ast::AstArena arena;
+        auto          expected = parser::parse(*tokens, arena);
+        REQUIRE(expected);
+
+        std::ifstream  ist(entry.path());
+        lexer::Lexer   lexer(ist);
+        parser::Parser parser(lexer, arena);
+
+        parser::TopLevel top_level;
+        while (1) {
+            auto unit = parser.next();
+            REQUIRE(unit);
+            if (!*unit) {
+                break;
+            }
+            top_level.push_back(std::move(**unit));
+            // Only the lookahead is left in the window.
+            REQUIRE(lexer.tokens().m_tokens.size() <= 1);
+        }
+        REQUIRE(top_level == *expected);
+    }
+
+    std::istringstream bad("def foo(real a) a + 1.5i");
+    lexer::Lexer       lexer(bad);
+    ast::AstArena      arena;
+    parser::Parser     parser(lexer, arena);
+    auto               unit = parser.next();
+    REQUIRE(!unit);
+    REQUIRE(unit.error().m_desc == "Integer can't have period: 1.5i");
+}
+
+TEST_CASE("Test flat expressions", "[parser]")
+{
+    using namespace pom;
+    using Kind = ast::ExprKind;
+
+    auto tokens = lexer::lex(Source::fromString("def f(real a) g(a[1], 2.0) + a\nf(1.0)"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          top_level = parser::parse(*tokens, arena);
+    REQUIRE(top_level);
+    REQUIRE(top_level->size() == 2);
+
+    // Post-order, children before their parent.
+    auto& flat = std::get<ast::Function>((*top_level)[0]).m_flat;
+    REQUIRE(flat.m_first == 0);
+    REQUIRE(flat.size() == 5);
+    REQUIRE(flat.m_kinds[0] == Kind::k_subscript);
+    REQUIRE(flat.m_names[0] == Symbol("a"));
+    REQUIRE(flat.m_literals[0] == ast::Literal(literals::Integer{1}));
+    REQUIRE(flat.m_kinds[1] == Kind::k_literal);
+    REQUIRE(flat.m_kinds[2] == Kind::k_call);
+    REQUIRE(flat.m_names[2] == Symbol("g"));
+    REQUIRE(std::vector<uint32_t>(flat.children(2).begin(), flat.children(2).end()) ==
+            std::vector<uint32_t>{0, 1});
+    REQUIRE(flat.m_kinds[3] == Kind::k_var);
+    REQUIRE(flat.m_kinds[4] == Kind::k_binary);
+    REQUIRE(flat.m_ops[4] == '+');
+    REQUIRE(std::vector<uint32_t>(flat.children(4).begin(), flat.children(4).end()) ==
+            std::vector<uint32_t>{2, 3});
+    REQUIRE(flat.children(3).empty());
+
+    // Ids carry on across functions, rows start over.
+    auto& anon = std::get<ast::Function>((*top_level)[1]).m_flat;
+    REQUIRE(anon.m_first == 5);
+    REQUIRE(anon.size() == 2);
+    REQUIRE(anon.row(6) == 1);
+}
+
+TEST_CASE("Test parallel parser", "[parser]")
+{
+    using namespace pom;
+
+    std::string text;
+    for (int i = 0; i < 2000; i++) {
+        text += fmt::format("def f{0}(real a) a * {0}.5 + g(a, [a 1.0]); f{0}(2.0)\n", i);
+    }
+    auto tokens = lexer::lex(Source::fromString(text));
+    REQUIRE(tokens);
+
+    ast::AstArena arena;
+    auto          top_level = parser::parse(*tokens, arena);
+    REQUIRE(top_level);
+    REQUIRE(top_level->size() == 4000);
+
+    // Same units as parsing one at a time, with ids that only grow.
+    std::istringstream ist(text);
+    lexer::Lexer       lexer(ist);
+    ast::AstArena      seq_arena;
+    parser::Parser     parser(lexer, seq_arena);
+    ast::ExprId        next_id = 0;
+    for (auto& unit : *top_level) {
+        auto seq_unit = parser.next();
+        REQUIRE(seq_unit);
+        REQUIRE(*seq_unit);
+        REQUIRE(**seq_unit == unit);
+
+        auto& flat = std::get<ast::Function>(unit).m_flat;
+        REQUIRE(flat.m_first >= next_id);
+        next_id = flat.m_first + flat.size();
+    }
+
+    // The first error in the source is reported.
+    auto bad_tokens = lexer::lex(Source::fromString(text + "def h(real a) )\ndef k(real a) (a"));
+    REQUIRE(bad_tokens);
+    auto bad = parser::parse(*bad_tokens, arena);
+    REQUIRE(!bad);
+    REQUIRE(bad.error().m_desc == "unknown token when expecting an expression: op: )");
+}
+
+TEST_CASE("Test deep expressions", "[parser]")
+{
+    using namespace pom;
+
+    // Deep enough to overflow the stack if any phase recursed per node.
+    size_t      depth = 200000;
+    std::string text  = "def f(real a) " + std::string(depth, '(') + "a + [a 1.0]" +
+                       std::string(depth, ')') + " * a\n";
+    auto tokens = lexer::lex(Source::fromString(text));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          top_level = parser::parse(*tokens, arena);
+    REQUIRE(top_level);
+
+    auto& function = std::get<ast::Function>(top_level->front());
+    REQUIRE(function.m_flat.size() == 7);
+    std::ostringstream ost;
+    ost << *function.m_code;
+    REQUIRE(ost.str() == "(be: * (be: + v/a [v/a, d1, ]) v/a)");
+
+    std::string chain = "def g(real a) a";
+    for (size_t i = 0; i < depth; i++) {
+        chain += " + a";
+    }
+    auto chain_tokens = lexer::lex(Source::fromString(chain));
+    REQUIRE(chain_tokens);
+    auto chain_top_level = parser::parse(*chain_tokens, arena);
+    REQUIRE(chain_top_level);
+    REQUIRE(*chain_top_level == *chain_top_level);
+    size_t nodes = 0;
+    ast::visitExprTree(*std::get<ast::Function>(chain_top_level->front()).m_code,
+                       [&](const ast::Expr&) { return ++nodes; });
+    REQUIRE(nodes == 2 * depth + 1);
+
+    std::istringstream unclosed("def h(real a) ((a + 1.0)");
+    lexer::Lexer       lexer(unclosed);
+    parser::Parser     parser(lexer, arena);
+    auto               unit = parser.next();
+    REQUIRE(!unit);
+    REQUIRE(unit.error().m_desc == "expected ')'");
+}
+
+TEST_CASE("Test hash-consing", "[parser]")
+{
+    using namespace pom;
+    using Kind = ast::ExprKind;
+
+    auto tokens = lexer::lex(
+        Source::fromString("def f(real x) (1+2+x)*(x+(1+2))\n"
+                           "def g(real x) h(x * x, x * x) + x * x + [x] + [x] + g(x) + g(x)\n"
+                           "f(1)"));
+    REQUIRE(tokens);
+    ast::AstArena   arena;
+    parser::Options options;
+    options.m_hash_cons = true;
+    auto top_level      = parser::parse(*tokens, arena, options);
+    REQUIRE(top_level);
+
+    // The tree is the same, with 1, 2, x and 1+2 stored once.
+    ast::AstArena plain_arena;
+    auto          plain = parser::parse(*tokens, plain_arena);
+    REQUIRE(*top_level == *plain);
+
+    auto& f = std::get<ast::Function>((*top_level)[0]);
+    REQUIRE(f.m_flat.size() == 7);
+    auto& mul = std::get<ast::BinaryExpr>(f.m_code->m_val);
+    auto& lhs = std::get<ast::BinaryExpr>(mul.m_lhs->m_val);
+    auto& rhs = std::get<ast::BinaryExpr>(mul.m_rhs->m_val);
+    REQUIRE(lhs.m_lhs == rhs.m_rhs);
+    REQUIRE(lhs.m_rhs == rhs.m_lhs);
+    REQUIRE(lhs.m_lhs->m_id == rhs.m_rhs->m_id);
+
+    // x * x is shared by the first argument of h and by what is outside of the call, the second
+    // argument keeps its own. Lists and calls are never shared.
+    auto&  g     = std::get<ast::Function>((*top_level)[1]).m_flat;
+    size_t calls = 0, lists = 0, products = 0;
+    for (uint32_t row = 0; row < g.size(); row++) {
+        calls += g.m_kinds[row] == Kind::k_call;
+        lists += g.m_kinds[row] == Kind::k_list;
+        products += g.m_kinds[row] == Kind::k_binary && g.m_ops[row] == '*';
+    }
+    REQUIRE(calls == 3);
+    REQUIRE(lists == 2);
+    REQUIRE(products == 2);
+
+    auto stats = parser::sharing(*top_level);
+    REQUIRE(stats.m_nodes == parser::sharing(*plain).m_nodes);
+    REQUIRE(stats.m_unique < stats.m_nodes);
+    REQUIRE(stats.m_unique == f.m_flat.size() + g.size() + 2);
+}
+
 TEST_CASE("Test parser samples", "[parser]")
 {
     using namespace pom;
     using namespace pom::ast::builder;
 
+    ast::AstArena a;
+
     auto anonfun = [](ast::ExprP expr) {
         ast::Signature sig;
         sig.m_name = "__anon_expr";
@@ -64,13 +279,13 @@ TEST_CASE("Test parser samples", "[parser]")
         {
             "4+(5*3)",
             {
-                anonfun(bin_op('+', real(4.0), bin_op('*', real(5.0), real(3.0))))
+                anonfun(bin_op(a, '+', real(a, 4.0), bin_op(a, '*', real(a, 5.0), real(a, 3.0))))
             }
         },
         {
             "3i+1i",
             {
-                anonfun(bin_op('+', integer(3), integer(1)))
+                anonfun(bin_op(a, '+', integer(a, 3), integer(a, 1)))
             }
         }
     };
@@ -81,7 +296,7 @@ TEST_CASE("Test parser samples", "[parser]")
         auto               tokens = lexer::lex(iss);
         REQUIRE(tokens);
 
-        auto res = parser::parse(*tokens);
+        auto res = parser::parse(*tokens, a);
         REQUIRE(res);
 
         REQUIRE(res->size() == expected.size());
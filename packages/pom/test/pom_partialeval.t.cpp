@@ -0,0 +1,153 @@
+#include <pom_partialeval.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <sstream>
+
+#include "pom_testing.h"
+
+namespace {
+
+/// Units of text printed after partial evaluation.
+std::string evaluate(const std::string&               text,
+                     pom::partialeval::Result&        result,
+                     const pom::partialeval::Options& options = pom::partialeval::Options())
+{
+    pom::testing::Analyzed analyzed(text);
+    result = pom::partialeval::evaluate(analyzed.m_top_level, analyzed.m_arena, options);
+    std::ostringstream ost;
+    pom::semantic::print(ost, result.m_top_level);
+    return ost.str();
+}
+
+const char* k_fib = "def fib(integer x) : integer if(x < 2i, x, fib(x - 1i) + fib(x - 2i))\n";
+
+}  // namespace
+
+TEST_CASE("Test partial evaluation", "[partialeval]")
+{
+    using namespace pom;
+
+    partialeval::Result result;
+    REQUIRE(evaluate("4+5", result) == "func: __anon_expr <- ->real: d9\n");
+    REQUIRE(result.m_folded_rows == 2);
+
+    REQUIRE(evaluate(std::string(k_fib) + "fib(8i)", result) ==
+            "func: fib <- x, ->integer: [call if <- (be: < v/x i2), v/x, (be: + [call fib <- (be: "
+            "- v/x i1), ] [call fib <- (be: - v/x i2), ]), ]\n"
+            "func: __anon_expr <- ->integer: i21\n");
+    REQUIRE(result.m_evaluated_calls == 1);
+
+    // Out of fuel the call is left to run time.
+    partialeval::Options options;
+    options.m_fuel = 1000;
+    REQUIRE(evaluate(std::string(k_fib) + "fib(30i)", result, options).find(
+                "func: __anon_expr <- ->integer: [call fib <- i30, ]") != std::string::npos);
+    REQUIRE(result.m_evaluated_calls == 0);
+
+    // Ifs on constants become their arm, constant arms stay.
+    REQUIRE(evaluate("def f(real a) if(1.0 < 2.0, a * 2.0, a + 1.0)\n"
+                     "def g(real a) if(a < 2.0, 1.0 + 2.0, a)",
+                     result) ==
+            "func: f <- a, ->real: (be: * v/a d2)\n"
+            "func: g <- a, ->real: [call if <- (be: < v/a d2), d3, v/a, ]\n");
+
+    // Constant arguments go into clones, each placed before its first caller.
+    REQUIRE(evaluate("def p(real x, integer n) : real if(n < 1i, 1.0, x * p(x, n - 1i))\n"
+                     "def q(real y) p(y, 3i)",
+                     result) ==
+            "func: p <- x, n, ->real: [call if <- (be: < v/n i1), d1, (be: * v/x [call p <- v/x, "
+            "(be: - v/n i1), ]), ]\n"
+            "func: p.4 <- x, ->real: d1\n"
+            "func: p.3 <- x, ->real: (be: * v/x [call p.4 <- v/x, ])\n"
+            "func: p.2 <- x, ->real: (be: * v/x [call p.3 <- v/x, ])\n"
+            "func: p.1 <- x, ->real: (be: * v/x [call p.2 <- v/x, ])\n"
+            "func: q <- y, ->real: [call p.1 <- v/y, ]\n");
+    REQUIRE(result.m_specializations == 4);
+
+    options.m_max_specializations = 2;
+    REQUIRE(evaluate("def p(real x, integer n) : real if(n < 1i, 1.0, x * p(x, n - 1i))\n"
+                     "def q(real y) p(y, 3i)",
+                     result, options)
+                .find("func: p.2 <- x, ->real: (be: * v/x [call p <- v/x, i1, ])") !=
+            std::string::npos);
+    REQUIRE(result.m_specializations == 2);
+
+    // Externs are not evaluated, and functions calling them not either.
+    REQUIRE(evaluate("extern cos(real x) : real\ndef f(real x) cos(x) + cos(2.0 * 3.0)\nf(1.0)",
+                     result)
+                .find("func: f <- x, ->real: (be: + [call cos <- v/x, ] [call cos <- d6, ])\n"
+                      "func: __anon_expr <- ->real: [call f <- d1, ]\n") != std::string::npos);
+    REQUIRE(result.m_evaluated_calls == 0);
+
+    // Clones call what the callee did, not what was defined since.
+    REQUIRE(evaluate("def g(real x) x\n"
+                     "def f(real x, real y) g(x) * y\n"
+                     "def g(real x) x + 1.0\n"
+                     "def h(real y) f(2.0, y)",
+                     result)
+                .find("func: h <- y, ->real: [call f <- d2, v/y, ]") != std::string::npos);
+    REQUIRE(result.m_specializations == 0);
+}
+
+TEST_CASE("Test specialization for function arguments", "[partialeval]")
+{
+    using namespace pom;
+
+    // Clones call the functions they are given directly, one clone serves equal calls.
+    const char* text = "def sq(real x) x * x\n"
+                       "def twice(fun<real, real> f, real x) f(f(x))\n"
+                       "def g(real y) twice(sq, y) + twice(sq, y * 2.0)\n";
+
+    partialeval::Result result;
+    REQUIRE(evaluate(text, result) ==
+            "func: sq <- x, ->real: (be: * v/x v/x)\n"
+            "func: twice <- f, x, ->real: [call f <- [call f <- v/x, ], ]\n"
+            "func: twice.1 <- x, ->real: [call sq <- [call sq <- v/x, ], ]\n"
+            "func: g <- y, ->real: (be: + [call twice.1 <- v/y, ] [call twice.1 <- (be: * v/y "
+            "d2), ])\n");
+    REQUIRE(result.m_specializations == 1);
+
+    // Given only functions, the clone takes no arguments and its calls get evaluated.
+    REQUIRE(evaluate("def sq(real x) x * x\n"
+                     "def at2(fun<real, real> f) f(2.0)\n"
+                     "at2(sq)",
+                     result)
+                .find("func: at2.1 <- ->real: d4\n"
+                      "func: __anon_expr <- ->real: [call at2.1 <- ]\n") != std::string::npos);
+    REQUIRE(result.m_evaluated_calls == 1);
+
+    // Past the budget calls stay indirect.
+    partialeval::Options options;
+    options.m_max_cloned_rows = 2;
+    REQUIRE(evaluate(text, result, options).find("[call twice <- v/sq, v/y, ]") !=
+            std::string::npos);
+    REQUIRE(result.m_specializations == 0);
+}
+
+TEST_CASE("Test scalarized lists", "[partialeval]")
+{
+    using namespace pom;
+
+    // Lists only read at constant indices are passed as their items, constant ones included.
+    partialeval::Result result;
+    REQUIRE(evaluate("def third(list<real> x) x[2]\n"
+                     "def f(real a) third([a 1.0 a * 2.0])\n",
+                     result) ==
+            "func: third <- x, ->real: v/x[2]\n"
+            "func: third.1 <- x.0, x.1, x.2, ->real: v/x.2\n"
+            "func: f <- a, ->real: [call third.1 <- v/a, d1, (be: * v/a d2), ]\n");
+    REQUIRE(result.m_scalarized_lists == 1);
+    REQUIRE(result.m_specializations == 1);
+
+    // Lists read otherwise, too short for the reads or kept stay lists.
+    REQUIRE(evaluate("def third(list<real> x) x[2]\n"
+                     "def id(list<real> x) x\n"
+                     "def pass(list<real> x) third(x)\n"
+                     "def f(real a) third([a a]) + third(id([a a a])) + pass([a a a])\n",
+                     result)
+                .find("func: f <- a, ->real: (be: + (be: + [call third <- [v/a, v/a, ], ] [call "
+                      "third <- [call id <- [v/a, v/a, v/a, ], ], ]) [call pass <- [v/a, v/a, "
+                      "v/a, ], ])") != std::string::npos);
+    REQUIRE(result.m_scalarized_lists == 0);
+}
@@ -0,0 +1,51 @@
+
+#include <pom_scan.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+TEST_CASE("Test vectorized scanners against scalar", "[scan]")
+{
+    using namespace pom::scan;
+
+    using ScanFn                       = const char* (*)(const char*, const char*);
+    std::vector<ScanFn>      scanners  = {skipSpace, skipAlnum, skipNumber, skipToEol};
+    std::vector<std::string> alphabets = {" \t\n\v\f\r", "azAZ09xyQ", "0123456789.", "ab #;+\t"};
+
+    // Runs of every length around the vector widths, ended by every kind of stop character.
+    std::mt19937             rng(1337);
+    std::vector<std::string> inputs;
+    std::string              stops("\0\n\r x.9(;\xff", 11);
+    for (auto& alphabet : alphabets) {
+        for (size_t len = 0; len < 140; len++) {
+            for (char stop : stops) {
+                std::string input;
+                for (size_t i = 0; i < len; i++) {
+                    input += alphabet[rng() % alphabet.size()];
+                }
+                input += stop;
+                input += alphabet;
+                inputs.push_back(std::move(input));
+            }
+        }
+    }
+
+    auto best = detectIsa();
+    for (auto& input : inputs) {
+        auto begin = input.data();
+        auto end   = input.data() + input.size();
+        for (auto scanner : scanners) {
+            setIsa(Isa::k_scalar);
+            auto expected = scanner(begin, end);
+            for (auto isa : {Isa::k_sse42, Isa::k_avx2}) {
+                setIsa(isa);
+                REQUIRE(scanner(begin, end) == expected);
+                REQUIRE(scanner(end, end) == end);
+            }
+        }
+    }
+    REQUIRE(setIsa(best) == best);
+}
@@ -0,0 +1,252 @@
+#include <pom_basictypes.h>
+#include <pom_lexer.h>
+#include <pom_parser.h>
+#include <pom_semantic.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/format.h>
+
+#include <sstream>
+
+namespace {
+
+/// Printed units, or the first error, analyzing one unit after the other.
+std::string analyzeInOrder(const pom::parser::TopLevel& top_level)
+{
+    pom::semantic::Analyzer analyzer;
+    std::ostringstream      ost;
+    for (auto& unit : top_level) {
+        auto analyzed = analyzer.analyze(unit);
+        if (!analyzed) {
+            return analyzed.error().m_desc;
+        }
+        pom::semantic::print(ost, *analyzed);
+    }
+    return ost.str();
+}
+
+std::string analyzeOnPool(const pom::parser::TopLevel& top_level, pom::ThreadPool& pool)
+{
+    auto analyzed = pom::semantic::analyze(top_level, pool);
+    if (!analyzed) {
+        return analyzed.error().m_desc;
+    }
+    std::ostringstream ost;
+    pom::semantic::print(ost, *analyzed);
+    return ost.str();
+}
+
+}  // namespace
+
+TEST_CASE("Test semantic scopes", "[semantic]")
+{
+    using namespace pom;
+
+    auto tokens = lexer::lex(Source::fromString("def f(real a) a * 2.0\n"
+                                                "def g(real b, integer a) f(b)\n"
+                                                "def h(real c) : real if(c < 1.0, c, h(c - 1.0))\n"
+                                                "g(1.0, 2i)"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+    auto& f = std::get<semantic::Function>((*analyzed)[0]).m_context;
+    auto& g = std::get<semantic::Function>((*analyzed)[1]).m_context;
+    auto& h = std::get<semantic::Function>((*analyzed)[2]).m_context;
+
+    // Each function keeps its own names and shares the globals.
+    REQUIRE(f.m_variables.size() == 1);
+    REQUIRE(g.m_variables.size() == 2);
+    REQUIRE(h.m_variables.size() == 2);
+    REQUIRE(f.m_globals == g.m_globals);
+    REQUIRE(g.m_globals == h.m_globals);
+
+    // Arguments shadow globals, globals declared later are not visible.
+    REQUIRE(*f.variableType("a") == types::real());
+    REQUIRE(*g.variableType("a") == types::integer());
+    REQUIRE(!f.variableType("f"));
+    REQUIRE(!f.variableType("g"));
+    REQUIRE(g.variableType("f"));
+    REQUIRE(!g.variableType("g"));
+    REQUIRE(h.variableType("h"));
+    REQUIRE(h.variableType("g"));
+
+    // Later functions cannot see what was declared in a function body.
+    auto bad = lexer::lex(Source::fromString("def f(real a) a\ndef g(real b) a"));
+    REQUIRE(bad);
+    REQUIRE(semantic::analyze(*parser::parse(*bad, arena)).error().m_desc ==
+            "Variable a not found in this context");
+}
+
+TEST_CASE("Test builtin resolution", "[semantic]")
+{
+    using namespace pom;
+    using Op = ops::BuiltinOp;
+
+    auto tokens = lexer::lex(Source::fromString(
+        "def f(real a) a * 2.0\ndef g(integer b) if(b < 2i, f(1.5), 1.0 - f(2.5))"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+
+    // Rows are in post order, calls of functions resolve to no builtin.
+    auto& f = std::get<semantic::Function>((*analyzed)[0]);
+    auto& g = std::get<semantic::Function>((*analyzed)[1]);
+    REQUIRE(f.m_builtins == std::vector<Op>{Op::k_none, Op::k_none, Op::k_mul_real});
+    REQUIRE(g.m_builtins == std::vector<Op>{Op::k_none,
+                                            Op::k_none,
+                                            Op::k_lt_integer,
+                                            Op::k_none,
+                                            Op::k_none,
+                                            Op::k_none,
+                                            Op::k_none,
+                                            Op::k_none,
+                                            Op::k_sub_real,
+                                            Op::k_if_real});
+
+    REQUIRE(ops::findBuiltin('+', {types::integer(), types::integer()}) == Op::k_add_integer);
+    REQUIRE(ops::findBuiltin('+', {types::integer(), types::real()}) == Op::k_none);
+    REQUIRE(ops::findBuiltin(Symbol("and"), {types::boolean(), types::boolean()}) == Op::k_and);
+    REQUIRE(ops::findBuiltin(Symbol("f"), {types::real()}) == Op::k_none);
+    REQUIRE(ops::builtinInfo(Op::k_if_integer).m_ret_type == types::integer());
+    REQUIRE(ops::getBuiltin('*', {types::boolean(), types::boolean()}).error().m_desc ==
+            "Builtin not found: * with operands of type boolean,boolean,");
+}
+
+TEST_CASE("Test self tail calls", "[semantic]")
+{
+    using namespace pom;
+
+    auto tokens = lexer::lex(Source::fromString(
+        "def count(integer n, integer acc) : integer if(n < 1i, acc, count(n - 1i, acc + 1i))\n"
+        "def fib(integer x) : integer if(x < 2i, x, fib(x - 1i) + fib(x - 2i))\n"
+        "def spin(integer n) : integer spin(n)\n"
+        "def start(integer n) : integer count(n, 0i)"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+
+    auto tail_calls = [&](size_t unit) {
+        return std::get<semantic::Function>((*analyzed)[unit]).selfTailCalls();
+    };
+    auto count = std::vector<bool>(12);
+    count[10]  = true;
+    REQUIRE(tail_calls(0) == count);
+
+    // Calls under an operator are not in tail position, calls of others are no self calls.
+    REQUIRE(tail_calls(1) == std::vector<bool>(14));
+    REQUIRE(tail_calls(2) == std::vector<bool>{false, true});
+    REQUIRE(tail_calls(3) == std::vector<bool>(3));
+}
+
+TEST_CASE("Test parallel analysis", "[semantic]")
+{
+    using namespace pom;
+
+    // Chains of calls across units, redefinitions, recursion and externs. bad_at breaks a unit.
+    auto program = [](size_t bad_at) {
+        std::string text = "extern cos(real x) : real\n";
+        for (size_t i = 0; i < 200; i++) {
+            text += fmt::format("def f{0}(real a) a * 2.0 + cos(a)\n", i);
+            if (i == 0) {
+                text += "def g0(real a) a\n";
+            } else if (i == bad_at) {
+                text += fmt::format("def g{0}(real a) f{0}(a) + h{0}(a)\n", i);
+            } else {
+                text += fmt::format("def g{0}(real a) f{0}(a) + g{1}(a) * f{1}(a)\n", i, i - 1);
+            }
+            text += fmt::format("def f{0}(real a) a\n", i / 2);
+            text += fmt::format("def r{0}(integer n) : integer if(n < 1i, 0i, r{0}(n - 1i))\n", i);
+            text += fmt::format("def h{0}(real a) if(r{0}(2i) < 1i, g{0}(a), a)\n", i);
+        }
+        // Fails too, with nothing to wait for, but is not the first failure.
+        if (bad_at < 200) {
+            text += "def z(real a) a + 1i\n";
+        }
+        // Units after a redefinition are typed against the first definition, so it keeps the type.
+        if (bad_at == 2000) {
+            text += "def f7(integer a) a\n";
+        }
+        return text + "g199(1.0)";
+    };
+
+    ThreadPool pool(3);
+    for (size_t bad_at : {size_t(1000), size_t(150), size_t(20), size_t(2000)}) {
+        auto tokens = lexer::lex(Source::fromString(program(bad_at)));
+        REQUIRE(tokens);
+        ast::AstArena arena;
+        auto          top_level = parser::parse(*tokens, arena);
+        REQUIRE(top_level);
+
+        auto expected = analyzeInOrder(*top_level);
+        if (bad_at < 200) {
+            REQUIRE(expected == fmt::format("Function h{0} not found in this context", bad_at));
+        } else if (bad_at == 2000) {
+            REQUIRE(expected == "f7 redefined as (integer,) -> integer, it is (real,) -> real");
+        } else {
+            REQUIRE(expected.find("func: g199") != std::string::npos);
+        }
+        for (int run = 0; run < 10; run++) {
+            REQUIRE(analyzeOnPool(*top_level, pool) == expected);
+        }
+    }
+}
+
+TEST_CASE("Test generic functions", "[semantic]")
+{
+    using namespace pom;
+
+    auto analyze = [](const std::string& text) {
+        auto tokens = lexer::lex(Source::fromString(text));
+        REQUIRE(tokens);
+        ast::AstArena arena;
+        auto          top_level = parser::parse(*tokens, arena);
+        REQUIRE(top_level);
+        return analyzeInOrder(*top_level);
+    };
+
+    // Instances come right before their first user, once, after the instances they call.
+    auto text = "def sq<T>(T x) : T x * x\n"
+                "def pow<T>(T x, integer n) : T if(n < 1i, x, sq(pow(x, n - 1i)))\n"
+                "def f(real a) sq(a) + pow(a, 2i)\n"
+                "def g(integer a) sq(a) * sq(a + 1i)\n"
+                "def h(real a) sq(a) - 1.0\n";
+    auto tokens = lexer::lex(Source::fromString(text));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          top_level = parser::parse(*tokens, arena);
+    REQUIRE(top_level);
+    auto analyzed = semantic::analyze(*top_level);
+    REQUIRE(analyzed);
+    std::vector<std::string> names;
+    for (auto& unit : *analyzed) {
+        names.emplace_back(std::get<semantic::Function>(unit).m_sig.m_name.str());
+    }
+    REQUIRE(names == std::vector<std::string>{"sq<real>", "pow<real>", "f", "sq<integer>", "g",
+                                              "h"});
+
+    // Calls are renamed to the instances, which call themselves.
+    auto& pow = std::get<semantic::Function>((*analyzed)[1]);
+    auto& f   = std::get<semantic::Function>((*analyzed)[2]);
+    REQUIRE(pow.m_sig.m_return_type == types::real());
+    REQUIRE(pow.m_flat.m_names[pow.m_flat.size() - 3] == Symbol("pow<real>"));
+    REQUIRE(f.m_flat.m_names[1] == Symbol("sq<real>"));
+    REQUIRE(f.m_context.m_variables.size() == 1);
+
+    ThreadPool pool(3);
+    REQUIRE(analyzeOnPool(*top_level, pool) == analyzeInOrder(*top_level));
+
+    REQUIRE(analyze("def k<T>(T x) x\ndef u(real a) k") == "Generic function k can only be called");
+    REQUIRE(analyze("def z<T, U>(T x) x\nz(1.0)") ==
+            "Error calling z: Cannot infer type parameter U from the arguments");
+    REQUIRE(analyze("def p<T>(T x, T y) x\np(1.0, 2i)") ==
+            "Error calling p: Type parameter T is both real and integer");
+    REQUIRE(analyze("def l<T>(list<T> x) x\nl(1.0)") ==
+            "Error calling l: Type list does not match real");
+    REQUIRE(analyze("def b<T>(T x) x + 1.0\nb(1i)").rfind("Error calling b: In b<integer>: ", 0) ==
+            0);
+    REQUIRE(analyze("extern e<T>(T x) : T") == "extern function e cannot be generic");
+}
@@ -0,0 +1,53 @@
+
+#include <pom_symbol.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+TEST_CASE("Test symbol interning", "[symbol]")
+{
+    using pom::Symbol;
+
+    Symbol foo("foo");
+    Symbol foo_again(std::string("fo") + "o");
+    Symbol bar("bar");
+
+    REQUIRE(foo == foo_again);
+    REQUIRE(foo.id() == foo_again.id());
+    REQUIRE(foo != bar);
+    REQUIRE(foo.str() == "foo");
+    REQUIRE(Symbol::fromId(bar.id()).str() == "bar");
+    REQUIRE(Symbol().empty());
+    REQUIRE(Symbol("").empty());
+    REQUIRE(fmt::format("<{0}>", bar) == "<bar>");
+
+    std::unordered_map<Symbol, int> scope = {{foo, 1}, {bar, 2}};
+    REQUIRE(scope.at("foo") == 1);
+}
+
+TEST_CASE("Test symbol interning from several threads", "[symbol]")
+{
+    using pom::Symbol;
+
+    std::vector<std::vector<Symbol>> interned(4);
+    std::vector<std::thread>         threads;
+    for (auto& out : interned) {
+        threads.emplace_back([&out]() {
+            for (int i = 0; i < 1000; i++) {
+                out.push_back(Symbol(fmt::format("threaded{0}", i)));
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    for (auto& out : interned) {
+        REQUIRE(out == interned[0]);
+    }
+    REQUIRE(interned[0][999].str() == "threaded999");
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <pom_lexer.h>
+#include <pom_parser.h>
+#include <pom_semantic.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+
+namespace pom {
+
+namespace testing {
+
+/// Units of a text lexed, parsed and analyzed, along with the arena their rows live in. Units
+/// must not outlive it.
+struct Analyzed
+{
+    explicit Analyzed(const std::string& text)
+    {
+        auto tokens = lexer::lex(Source::fromString(text));
+        REQUIRE(tokens);
+        auto top_level = parser::parse(*tokens, m_arena);
+        REQUIRE(top_level);
+        auto analyzed = semantic::analyze(*top_level);
+        REQUIRE(analyzed);
+        m_top_level = std::move(*analyzed);
+    }
+
+    Analyzed(const Analyzed&)            = delete;
+    Analyzed& operator=(const Analyzed&) = delete;
+
+    ast::AstArena      m_arena;
+    semantic::TopLevel m_top_level;
+};
+
+}  // namespace testing
+
+}  // namespace pom
@@ -0,0 +1,72 @@
+#include <pom_threadpool.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+TEST_CASE("Test thread pool", "[threadpool]")
+{
+    pom::ThreadPool pool(3);
+    REQUIRE(pool.workers() == 3);
+
+    std::vector<std::atomic<int>> calls(1000);
+    pool.parallelFor(calls.size(), [&](size_t i) { calls[i]++; });
+    for (auto& c : calls) {
+        REQUIRE(c == 1);
+    }
+
+    int none = 0;
+    pool.parallelFor(0, [&](size_t) { none++; });
+    REQUIRE(none == 0);
+
+    // Without workers everything runs on the caller.
+    pom::ThreadPool     inline_pool(0);
+    std::vector<size_t> order;
+    inline_pool.parallelFor(4, [&](size_t i) { order.push_back(i); });
+    REQUIRE(order == std::vector<size_t>{0, 1, 2, 3});
+}
+
+TEST_CASE("Test thread pool task graphs", "[threadpool]")
+{
+    // Layers of tasks, each waiting for two of the layer before.
+    constexpr size_t                 k_width = 50, k_layers = 20;
+    std::vector<std::vector<size_t>> dependents(k_width * k_layers);
+    std::vector<std::vector<size_t>> dependencies(dependents.size());
+    for (size_t i = k_width; i < dependents.size(); i++) {
+        for (auto dep : {i - k_width, (i - k_width + 7) % k_width + (i / k_width - 1) * k_width}) {
+            dependents[dep].push_back(i);
+            dependencies[i].push_back(dep);
+        }
+    }
+
+    for (size_t workers : {0, 1, 3}) {
+        pom::ThreadPool                  pool(workers);
+        std::atomic<size_t>              clock{0};
+        std::vector<std::atomic<size_t>> finished(dependents.size());
+        std::vector<bool>                ready(dependents.size());
+        pool.parallelGraph(dependents, [&](size_t i) {
+            auto now = ++clock;
+            bool ok  = true;
+            for (auto dep : dependencies[i]) {
+                ok = ok && finished[dep] != 0 && finished[dep] < now;
+            }
+            ready[i]    = ok;
+            finished[i] = ++clock;
+        });
+        REQUIRE(clock == 2 * dependents.size());
+        REQUIRE(std::count(ready.begin(), ready.end(), true) == ready.size());
+    }
+
+    pom::ThreadPool pool(2);
+    int             none = 0;
+    pool.parallelGraph({}, [&](size_t) { none++; });
+    REQUIRE(none == 0);
+
+    // Without workers ready tasks run in order.
+    pom::ThreadPool     inline_pool(0);
+    std::vector<size_t> order;
+    inline_pool.parallelGraph({{}, {}, {}}, [&](size_t i) { order.push_back(i); });
+    REQUIRE(order == std::vector<size_t>{0, 1, 2});
+}
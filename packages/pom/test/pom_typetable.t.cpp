@@ -0,0 +1,53 @@
+#include <pom_basictypes.h>
+#include <pom_functiontype.h>
+#include <pom_lexer.h>
+#include <pom_listtype.h>
+#include <pom_parser.h>
+#include <pom_semantic.h>
+#include <pom_threadpool.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Test type table", "[types]")
+{
+    using namespace pom;
+
+    REQUIRE(types::real() == types::real());
+    REQUIRE(types::real() != types::integer());
+    REQUIRE(*types::boolean() == *types::boolean());
+
+    auto lists = types::list(types::list(types::real()));
+    REQUIRE(lists == types::list(types::list(types::real())));
+    REQUIRE(lists != types::list(types::list(types::integer())));
+    REQUIRE(lists->mangled() == "__list___list_real");
+    REQUIRE(lists->description() == "list<list<real>>");
+
+    auto fun = types::function({types::real(), lists}, types::integer());
+    REQUIRE(fun == types::function({types::real(), lists}, types::integer()));
+    REQUIRE(fun != types::function({lists, types::real()}, types::integer()));
+    REQUIRE(fun != types::function({types::real()}, types::integer()));
+    REQUIRE(fun->mangled() == "__function__real___list___list_real___integer");
+    REQUIRE(fun->callable({types::real(), types::list(types::list(types::real()))}));
+    REQUIRE(!fun->callable({types::real()}));
+
+    // Types spelled in signatures are the ones the table hands out.
+    auto tokens = lexer::lex(Source::fromString(
+        "def f(fun<integer, real, list<list<real>>> g, list<list<real>> xs) 1.0"));
+    REQUIRE(tokens);
+    ast::AstArena arena;
+    auto          analyzed = semantic::analyze(*parser::parse(*tokens, arena));
+    REQUIRE(analyzed);
+    auto& sig = std::get<semantic::Function>(analyzed->front()).m_sig;
+    REQUIRE(sig.m_args[0].first == fun);
+    REQUIRE(sig.m_args[1].first == lists);
+
+    // Built concurrently, still one object per type.
+    std::vector<TypeCSP> built(64);
+    ThreadPool           pool(3);
+    pool.parallelFor(built.size(), [&](size_t i) {
+        built[i] = types::function({types::list(types::integer())}, types::list(types::boolean()));
+    });
+    for (auto& ty : built) {
+        REQUIRE(ty == built.front());
+    }
+}